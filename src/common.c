@@ -184,11 +184,22 @@ int ptpmon_query_port_state_by_name(struct ptpmon *ptpmon, const char *iface,
 {
 	struct default_ds default_ds;
 	char real_ifname[IFNAMSIZ];
+	struct port_identity portid;
 	char **tried_ports, *dup;
 	int portnum, num_ports;
 	int tries = 0;
 	int rc;
 
+	/* ptp4l doesn't renumber its ports while running, so once the port
+	 * has been found, only its state needs to be queried (or taken from
+	 * the notification cache).
+	 */
+	if (ptpmon_lookup_port_name(ptpmon, iface, &portid)) {
+		rc = ptpmon_get_port_state(ptpmon, &portid, port_state);
+		if (!rc)
+			return 0;
+	}
+
 	rc = vlan_resolve_real_dev(rtnl, iface, real_ifname);
 	if (rc)
 		return rc;
@@ -212,7 +223,6 @@ int ptpmon_query_port_state_by_name(struct ptpmon *ptpmon, const char *iface,
 		__u8 buf[sizeof(struct port_properties_np) + MAX_IFACE_LEN] = {0};
 		struct port_properties_np *port_properties_np;
 		char real_port_ifname[IFNAMSIZ];
-		struct port_identity portid;
 
 		portid_set(&portid, &default_ds.clock_identity, portnum);
 
@@ -246,6 +256,7 @@ int ptpmon_query_port_state_by_name(struct ptpmon *ptpmon, const char *iface,
 		}
 
 		*port_state = port_properties_np->port_state;
+		ptpmon_cache_port_name(ptpmon, iface, &portid, *port_state);
 		rc = 0;
 		goto out;
 	}
@@ -235,12 +235,6 @@ static inline __s64 utc_to_tai(__s64 utc, __s64 offset)
 	return utc + offset * NSEC_PER_SEC;
 }
 
-static inline __s64
-master_offset_from_current_ds(const struct current_ds *current_ds)
-{
-	return (__s64 )(__be64_to_cpu(current_ds->offset_from_master)) >> 16;
-}
-
 int ptpmon_query_port_state_by_name(struct ptpmon *ptpmon, const char *iface,
 				    struct mnl_socket *rtnl,
 				    enum port_state *port_state);
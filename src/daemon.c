@@ -4,12 +4,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/limits.h>
-#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "argparser.h"
 #include "common.h"
@@ -21,16 +24,65 @@
 #include "sk.h"
 #include "sysmon.h"
 
+#define ISOCHRON_DAEMON_BACKLOG		8
+/* Output queued for a client, beyond which it is disconnected. A client
+ * which waits for each response before the next request never gets near.
+ */
+#define ISOCHRON_DAEMON_TXQ_LIMIT	(1 << 20)
+
+enum isochron_daemon_fd_type {
+	ISOCHRON_DAEMON_FD_LISTEN,
+	ISOCHRON_DAEMON_FD_CLIENT,
+	ISOCHRON_DAEMON_FD_SAMPLER,
+	ISOCHRON_DAEMON_FD_TEST_STATE,
+};
+
+/* What an epoll event refers to. Only client sockets have a client. */
+struct isochron_daemon_fd {
+	enum isochron_daemon_fd_type type;
+	struct isochron_daemon_client *client;
+};
+
+/* A management connection. Each has its own error table for GET_ERROR,
+ * and its own event subscription.
+ */
+struct isochron_daemon_client {
+	struct sk *sock;
+	struct isochron_mgmt_handler *mgmt_handler;
+	struct isochron_notifier *notifier;
+	struct isochron_daemon_fd sock_fd;
+	/* Waiting for the socket to become writable */
+	bool tx_pending;
+	/* Still referenced by the epoll events being processed */
+	bool closed;
+	LIST_ENTRY(isochron_daemon_client) list;
+};
+
 struct isochron_daemon {
 	struct ip_address stats_addr;
 	long stats_port;
 	char pid_filename[PATH_MAX];
 	char log_filename[PATH_MAX];
-	struct isochron_mgmt_handler *mgmt_handler;
+	bool keep_sender;
 	struct sk *mgmt_listen_sock;
-	struct sk *mgmt_sock;
-	bool have_client;
+	struct isochron_daemon_fd listen_fd;
+	/* Samples the node state for all event subscribers */
+	struct isochron_event_sampler *sampler;
+	struct isochron_daemon_fd sampler_fd;
+	/* Written to by the sender threads when they stop */
+	int test_state_fd;
+	struct isochron_daemon_fd test_state_fd_ev;
+	int epoll_fd;
+	LIST_HEAD(client_head, isochron_daemon_client) clients;
+	struct client_head closed_clients;
+	/* The client which instantiated the sender role. While it is
+	 * connected, all others are read-only observers.
+	 */
+	struct isochron_daemon_client *controller;
+	/* The client whose request is being processed */
+	struct isochron_daemon_client *client;
 	struct isochron_send *send;
+	struct isochron_log_subscription log_sub;
 	struct mnl_socket *rtnl;
 	bool session_active;
 };
@@ -95,6 +147,7 @@ static int prog_prepare_send_session(struct isochron_daemon *prog)
 	if (rc)
 		goto err_start_threads;
 
+	prog->log_sub.next = 0;
 	prog->session_active = true;
 
 	return 0;
@@ -137,22 +190,13 @@ static void isochron_teardown_sender(struct isochron_daemon *prog)
 	prog->send = NULL;
 }
 
-static void prog_close_client_stats_session(struct isochron_daemon *prog)
-{
-	isochron_teardown_sender(prog);
-	sk_close(prog->mgmt_sock);
-	prog->have_client = false;
-}
-
-static int prog_client_connect_event(struct isochron_daemon *prog)
+/* The log is consumed by reading it, which only the controller may do */
+static int prog_check_log_consumer(struct isochron_daemon *prog, char *extack)
 {
-	int rc;
-
-	rc = sk_accept(prog->mgmt_listen_sock, &prog->mgmt_sock);
-	if (rc)
-		return rc;
-
-	prog->have_client = true;
+	if (prog->controller && prog->client != prog->controller) {
+		mgmt_extack(extack, "Log can only be retrieved by the controller");
+		return -EPERM;
+	}
 
 	return 0;
 }
@@ -177,10 +221,13 @@ static int prog_update_role(void *priv, void *ptr, char *extack)
 	}
 
 	isochron_send_prepare_default_args(send);
+	send->state_event_fd = prog->test_state_fd;
 
 	isochron_teardown_sender(prog);
 
 	prog->send = send;
+	prog->controller = prog->client;
+	prog->log_sub.chunk_size = 0;
 
 	return 0;
 }
@@ -746,6 +793,49 @@ static int prog_update_cpu_mask(void *priv, void *ptr, char *extack)
 	return 0;
 }
 
+static enum test_state prog_test_state(struct isochron_daemon *prog)
+{
+	struct isochron_send *send = prog->send;
+
+	if (!prog->session_active)
+		return ISOCHRON_TEST_STATE_IDLE;
+
+	/* Without timestamping, there is no tx timestamp thread to wait for */
+	if (!__atomic_load_n(&send->send_tid_stopped, __ATOMIC_ACQUIRE) ||
+	    (send->do_ts &&
+	     !__atomic_load_n(&send->tx_tstamp_tid_stopped, __ATOMIC_ACQUIRE)))
+		return ISOCHRON_TEST_STATE_RUNNING;
+
+	if (send->tx_timestamp_tid_rc || send->send_tid_rc)
+		return ISOCHRON_TEST_STATE_FAILED;
+
+	return ISOCHRON_TEST_STATE_IDLE;
+}
+
+/* Let subscribers know right away that a session started or stopped,
+ * rather than at their next sampling interval
+ */
+static void prog_notify_test_state(struct isochron_daemon *prog)
+{
+	enum test_state test_state = prog_test_state(prog);
+	struct isochron_daemon_client *client;
+
+	LIST_FOREACH(client, &prog->clients, list)
+		isochron_notifier_test_state(client->notifier, test_state);
+}
+
+/* The sender threads stopped, which may have ended the session */
+static void prog_test_state_event(struct isochron_daemon *prog)
+{
+	eventfd_t count;
+
+	if (eventfd_read(prog->test_state_fd, &count) < 0)
+		return;
+
+	if (prog->send)
+		prog_notify_test_state(prog);
+}
+
 static int prog_update_test_state(void *priv, void *ptr, char *extack)
 {
 	struct isochron_daemon *prog = priv;
@@ -779,6 +869,8 @@ static int prog_update_test_state(void *priv, void *ptr, char *extack)
 			return rc;
 	}
 
+	prog_notify_test_state(prog);
+
 	return 0;
 }
 
@@ -798,6 +890,13 @@ static int prog_update_sync_monitor_enabled(void *priv, void *ptr,
 	return 0;
 }
 
+static int prog_update_event_subscribe(void *priv, void *ptr, char *extack)
+{
+	struct isochron_daemon *prog = priv;
+
+	return isochron_notifier_subscribe(prog->client->notifier, ptr, extack);
+}
+
 static int prog_forward_isochron_log(void *priv, char *extack)
 {
 	struct isochron_daemon *prog = priv;
@@ -814,18 +913,62 @@ static int prog_forward_isochron_log(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	rc = isochron_send_tlv(prog->mgmt_sock, ISOCHRON_RESPONSE,
+	rc = prog_check_log_consumer(prog, extack);
+	if (rc)
+		return rc;
+
+	rc = isochron_send_tlv(prog->client->sock, ISOCHRON_RESPONSE,
 			       ISOCHRON_MID_LOG,
 			       isochron_log_buf_tlv_size(&send->log));
 	if (rc)
 		return rc;
 
-	isochron_log_xmit(&send->log, prog->mgmt_sock);
+	isochron_log_xmit(&send->log, prog->client->sock);
 	isochron_log_teardown(&send->log);
+	prog->log_sub.next = 0;
 	return isochron_log_init(&send->log, send->iterations *
 				 sizeof(struct isochron_send_pkt_data));
 }
 
+static int prog_update_log_subscribe(void *priv, void *ptr, char *extack)
+{
+	struct isochron_daemon *prog = priv;
+	struct isochron_log_subscribe *sub = ptr;
+
+	prog->log_sub.chunk_size = __be32_to_cpu(sub->chunk_size);
+	prog->log_sub.next = 0;
+
+	return 0;
+}
+
+static int prog_forward_log_chunk(void *priv, char *extack)
+{
+	struct isochron_daemon *prog = priv;
+	struct isochron_send *send = prog->send;
+	__u32 horizon;
+	int rc;
+
+	if (!send) {
+		mgmt_extack(extack, "Sender role not instantiated");
+		return -EINVAL;
+	}
+
+	if (!prog->session_active) {
+		mgmt_extack(extack, "Log exists only while session is active");
+		return -EINVAL;
+	}
+
+	rc = prog_check_log_consumer(prog, extack);
+	if (rc)
+		return rc;
+
+	horizon = isochron_send_log_horizon(send, prog->log_sub.next);
+
+	return isochron_forward_log_chunk(prog->client->sock, &send->log,
+					  sizeof(struct isochron_send_pkt_data),
+					  &prog->log_sub, horizon, extack);
+}
+
 static int prog_forward_sysmon_offset(void *priv, char *extack)
 {
 	struct isochron_daemon *prog = priv;
@@ -841,7 +984,7 @@ static int prog_forward_sysmon_offset(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	return isochron_forward_sysmon_offset(prog->mgmt_sock,
+	return isochron_forward_sysmon_offset(prog->client->sock,
 					      send->sysmon, extack);
 }
 
@@ -860,7 +1003,7 @@ static int prog_forward_ptpmon_offset(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	return isochron_forward_ptpmon_offset(prog->mgmt_sock,
+	return isochron_forward_ptpmon_offset(prog->client->sock,
 					      send->ptpmon, extack);
 }
 
@@ -880,7 +1023,7 @@ static int prog_forward_utc_offset(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	rc = isochron_forward_utc_offset(prog->mgmt_sock, send->ptpmon,
+	rc = isochron_forward_utc_offset(prog->client->sock, send->ptpmon,
 					 &utc_offset, extack);
 	if (rc)
 		return rc;
@@ -911,7 +1054,7 @@ static int prog_forward_port_state(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	return isochron_forward_port_state(prog->mgmt_sock, send->ptpmon,
+	return isochron_forward_port_state(prog->client->sock, send->ptpmon,
 					   send->if_name, prog->rtnl, extack);
 }
 
@@ -925,7 +1068,7 @@ static int prog_forward_port_link_state(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	return isochron_forward_port_link_state(prog->mgmt_sock, send->if_name,
+	return isochron_forward_port_link_state(prog->client->sock, send->if_name,
 						prog->rtnl, extack);
 }
 
@@ -944,7 +1087,7 @@ static int prog_forward_gm_clock_identity(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	return isochron_forward_gm_clock_identity(prog->mgmt_sock,
+	return isochron_forward_gm_clock_identity(prog->client->sock,
 						  send->ptpmon, extack);
 }
 
@@ -959,32 +1102,22 @@ static int prog_forward_test_state(void *priv, char *extack)
 		return -EINVAL;
 	}
 
-	if (!prog->session_active) {
-		test_state = ISOCHRON_TEST_STATE_IDLE;
-	} else if (send->tx_tstamp_tid_stopped) {
-		test_state = ISOCHRON_TEST_STATE_IDLE;
-
-		if (send->tx_timestamp_tid_rc) {
+	test_state = prog_test_state(prog);
+	if (test_state == ISOCHRON_TEST_STATE_FAILED) {
+		if (send->tx_timestamp_tid_rc)
 			mgmt_extack(extack, "TX timestamping thread failed");
-			test_state = ISOCHRON_TEST_STATE_FAILED;
-		}
-
-		if (send->send_tid_rc) {
+		if (send->send_tid_rc)
 			mgmt_extack(extack, "Sender thread failed");
-			test_state = ISOCHRON_TEST_STATE_FAILED;
-		}
-	} else {
-		test_state = ISOCHRON_TEST_STATE_RUNNING;
 	}
 
-	return isochron_forward_test_state(prog->mgmt_sock, test_state, extack);
+	return isochron_forward_test_state(prog->client->sock, test_state, extack);
 }
 
 static int prog_forward_current_clock_tai(void *priv, char *extack)
 {
 	struct isochron_daemon *prog = priv;
 
-	return isochron_forward_current_clock_tai(prog->mgmt_sock, extack);
+	return isochron_forward_current_clock_tai(prog->client->sock, extack);
 }
 
 static int prog_forward_oper_base_time(void *priv, char *extack)
@@ -1001,12 +1134,12 @@ static int prog_forward_oper_base_time(void *priv, char *extack)
 
 	t.time = __cpu_to_be64(send->oper_base_time);
 
-	rc = isochron_send_tlv(prog->mgmt_sock, ISOCHRON_RESPONSE,
+	rc = isochron_send_tlv(prog->client->sock, ISOCHRON_RESPONSE,
 			       ISOCHRON_MID_OPER_BASE_TIME, sizeof(t));
 	if (rc)
 		return rc;
 
-	sk_send(prog->mgmt_sock, &t, sizeof(t));
+	sk_send(prog->client->sock, &t, sizeof(t));
 
 	return 0;
 }
@@ -1046,6 +1179,13 @@ static const struct isochron_mgmt_ops daemon_mgmt_ops[__ISOCHRON_MID_MAX] = {
 	[ISOCHRON_MID_OPER_BASE_TIME] = {
 		.get = prog_forward_oper_base_time,
 	},
+	[ISOCHRON_MID_LOG_SUBSCRIBE] = {
+		.set = prog_update_log_subscribe,
+		.struct_size = sizeof(struct isochron_log_subscribe),
+	},
+	[ISOCHRON_MID_LOG_CHUNK] = {
+		.get = prog_forward_log_chunk,
+	},
 	[ISOCHRON_MID_NODE_ROLE] = {
 		.set = prog_update_role,
 		.struct_size = sizeof(struct isochron_node_role),
@@ -1186,85 +1326,334 @@ static const struct isochron_mgmt_ops daemon_mgmt_ops[__ISOCHRON_MID_MAX] = {
 		.set = prog_update_sync_monitor_enabled,
 		.struct_size = sizeof(struct isochron_feature_enabled),
 	},
+	[ISOCHRON_MID_EVENT_SUBSCRIBE] = {
+		.set = prog_update_event_subscribe,
+		.struct_size = sizeof(struct isochron_event_subscribe),
+		.per_connection = true,
+	},
 };
 
-static int prog_mgmt_loop(struct isochron_daemon *prog)
+static int prog_client_connect_event(struct isochron_daemon *prog)
 {
-	struct pollfd pfd[1] = {
-		[0] = {
-			/* .fd to be filled in dynamically */
-			.events = POLLIN | POLLERR | POLLPRI,
-		},
+	struct isochron_daemon_client *client;
+	struct epoll_event ev = {
+		.events = EPOLLIN,
 	};
+	int rc;
+
+	client = calloc(1, sizeof(*client));
+	if (!client)
+		return -ENOMEM;
+
+	client->sock_fd.type = ISOCHRON_DAEMON_FD_CLIENT;
+	client->sock_fd.client = client;
+
+	client->mgmt_handler = isochron_mgmt_handler_create(daemon_mgmt_ops);
+	if (!client->mgmt_handler) {
+		rc = -ENOMEM;
+		goto err_handler;
+	}
+
+	rc = sk_accept(prog->mgmt_listen_sock, &client->sock);
+	if (rc)
+		goto err_accept;
+
+	/* Requests are reassembled across events and responses are queued,
+	 * one client sending a partial message or not reading must not
+	 * block the others
+	 */
+	rc = sk_set_nonblock(client->sock, ISOCHRON_DAEMON_TXQ_LIMIT);
+	if (rc)
+		goto err_notifier;
+
+	client->notifier = isochron_notifier_create(prog->sampler,
+						    client->sock);
+	if (!client->notifier) {
+		rc = -ENOMEM;
+		goto err_notifier;
+	}
+
+	ev.data.ptr = &client->sock_fd;
+	if (epoll_ctl(prog->epoll_fd, EPOLL_CTL_ADD, sk_fd(client->sock),
+		      &ev) < 0) {
+		perror("epoll_ctl");
+		rc = -errno;
+		goto err_epoll_sock;
+	}
+
+	LIST_INSERT_HEAD(&prog->clients, client, list);
+
+	return 0;
+
+err_epoll_sock:
+	isochron_notifier_destroy(client->notifier);
+err_notifier:
+	sk_close(client->sock);
+err_accept:
+	isochron_mgmt_handler_destroy(client->mgmt_handler);
+err_handler:
+	free(client);
+	return rc;
+}
+
+static void prog_close_client(struct isochron_daemon *prog,
+			      struct isochron_daemon_client *client)
+{
+	if (client == prog->controller) {
+		if (!prog->keep_sender)
+			isochron_teardown_sender(prog);
+		prog->controller = NULL;
+		prog->log_sub.chunk_size = 0;
+	}
+
+	epoll_ctl(prog->epoll_fd, EPOLL_CTL_DEL, sk_fd(client->sock), NULL);
+	isochron_notifier_destroy(client->notifier);
+	sk_close(client->sock);
+	isochron_mgmt_handler_destroy(client->mgmt_handler);
+
+	/* Its socket may have more events in the batch being processed */
+	client->closed = true;
+	LIST_REMOVE(client, list);
+	LIST_INSERT_HEAD(&prog->closed_clients, client, list);
+}
+
+static void prog_free_closed_clients(struct isochron_daemon *prog)
+{
+	struct isochron_daemon_client *client;
+
+	while ((client = LIST_FIRST(&prog->closed_clients)) != NULL) {
+		LIST_REMOVE(client, list);
+		free(client);
+	}
+}
+
+static void prog_client_event(struct isochron_daemon *prog,
+			      struct isochron_daemon_client *client)
+{
+	bool read_only = prog->controller && client != prog->controller;
+	int rc;
+
+	isochron_mgmt_handler_set_read_only(client->mgmt_handler, read_only);
+
+	prog->client = client;
+	rc = isochron_mgmt_event(client->sock, client->mgmt_handler, prog);
+	prog->client = NULL;
+
+	/* A broken connection only affects its own client */
+	if (rc || sk_closed(client->sock))
+		prog_close_client(prog, client);
+}
+
+static void prog_client_writable_event(struct isochron_daemon *prog,
+				       struct isochron_daemon_client *client)
+{
+	if (sk_tx_drain(client->sock))
+		prog_close_client(prog, client);
+}
+
+/* Watch for the client sockets becoming writable only while they have
+ * output queued
+ */
+static void prog_update_client_events(struct isochron_daemon *prog)
+{
+	struct isochron_daemon_client *client;
+	struct epoll_event ev;
+	bool tx_pending;
+
+	LIST_FOREACH(client, &prog->clients, list) {
+		tx_pending = sk_tx_queued(client->sock);
+		if (tx_pending == client->tx_pending)
+			continue;
+
+		ev.events = tx_pending ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		ev.data.ptr = &client->sock_fd;
+
+		if (epoll_ctl(prog->epoll_fd, EPOLL_CTL_MOD,
+			      sk_fd(client->sock), &ev) < 0) {
+			perror("epoll_ctl");
+			continue;
+		}
+
+		client->tx_pending = tx_pending;
+	}
+}
+
+/* Time to sample the node state for the subscribers which are due */
+static void prog_sampler_event(struct isochron_daemon *prog)
+{
+	struct isochron_node_status status = {};
+	struct isochron_send *send = prog->send;
+	int rc;
+
+	if (send) {
+		status.ptpmon = send->ptpmon;
+		status.sysmon = send->sysmon;
+		status.if_name = strlen(send->if_name) ? send->if_name : NULL;
+		status.rtnl = prog->rtnl;
+		status.have_test_state = true;
+		status.test_state = prog_test_state(prog);
+	}
+
+	rc = isochron_event_sampler_event(prog->sampler, &status);
+	if (rc)
+		pr_err(rc, "Failed to sample the node state: %m\n");
+
+	if (status.have_utc_offset) {
+		isochron_fixup_kernel_utc_offset(status.utc_offset);
+		send->utc_tai_offset = status.utc_offset;
+	}
+}
+
+static int prog_mgmt_loop(struct isochron_daemon *prog)
+{
+	struct epoll_event events[16];
+	int i, cnt, err;
 	int rc = 0;
-	int cnt;
 
 	do {
-		if (prog->have_client)
-			pfd[0].fd = sk_fd(prog->mgmt_sock);
-		else
-			pfd[0].fd = sk_fd(prog->mgmt_listen_sock);
-
-		cnt = poll(pfd, ARRAY_SIZE(pfd), -1);
+		cnt = epoll_wait(prog->epoll_fd, events, ARRAY_SIZE(events),
+				 -1);
 		if (cnt < 0) {
 			if (errno == EINTR) {
 				break;
 			} else {
-				perror("poll failed");
+				perror("epoll_wait failed");
 				rc = -errno;
 				break;
 			}
-		} else if (!cnt) {
-			printf("poll returned 0\n");
-			break;
 		}
 
-		if (pfd[0].revents & (POLLIN | POLLERR | POLLPRI)) {
-			if (prog->have_client) {
-				rc = isochron_mgmt_event(prog->mgmt_sock,
-							 prog->mgmt_handler,
-							 prog);
-				if (sk_closed(prog->mgmt_sock))
-					prog_close_client_stats_session(prog);
-				else if (rc)
-					break;
-			} else {
-				rc = prog_client_connect_event(prog);
-				if (rc)
-					break;
+		for (i = 0; i < cnt; i++) {
+			struct isochron_daemon_fd *fd = events[i].data.ptr;
+
+			switch (fd->type) {
+			case ISOCHRON_DAEMON_FD_LISTEN:
+				/* Failing to accept a client (EMFILE,
+				 * ECONNABORTED, ENOMEM) only affects that
+				 * client
+				 */
+				err = prog_client_connect_event(prog);
+				if (err)
+					fprintf(stderr,
+						"Failed to accept client: %s\n",
+						strerror(-err));
+				break;
+			case ISOCHRON_DAEMON_FD_CLIENT:
+				if (!fd->client->closed &&
+				    events[i].events & EPOLLOUT)
+					prog_client_writable_event(prog,
+								   fd->client);
+				if (!fd->client->closed &&
+				    events[i].events & ~EPOLLOUT)
+					prog_client_event(prog, fd->client);
+				break;
+			case ISOCHRON_DAEMON_FD_SAMPLER:
+				prog_sampler_event(prog);
+				break;
+			case ISOCHRON_DAEMON_FD_TEST_STATE:
+				prog_test_state_event(prog);
+				break;
 			}
 		}
 
-		if (signal_received)
-			break;
-	} while (1);
+		prog_update_client_events(prog);
+		prog_free_closed_clients(prog);
+	} while (!signal_received);
 
-	if (prog->have_client)
-		prog_close_client_stats_session(prog);
+	while (!LIST_EMPTY(&prog->clients))
+		prog_close_client(prog, LIST_FIRST(&prog->clients));
+
+	prog_free_closed_clients(prog);
+
+	isochron_teardown_sender(prog);
 
 	return rc;
 }
 
+static int prog_epoll_add(struct isochron_daemon *prog, int fd,
+			  struct isochron_daemon_fd *daemon_fd)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = daemon_fd,
+	};
+
+	if (epoll_ctl(prog->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
+		return -errno;
+	}
+
+	return 0;
+}
+
 static int prog_init_mgmt_listen_sock(struct isochron_daemon *prog)
 {
 	int rc;
 
-	prog->mgmt_handler = isochron_mgmt_handler_create(daemon_mgmt_ops);
-	if (!prog->mgmt_handler)
-		return -ENOMEM;
+	LIST_INIT(&prog->clients);
+	LIST_INIT(&prog->closed_clients);
+	prog->listen_fd.type = ISOCHRON_DAEMON_FD_LISTEN;
+	prog->sampler_fd.type = ISOCHRON_DAEMON_FD_SAMPLER;
+	prog->test_state_fd_ev.type = ISOCHRON_DAEMON_FD_TEST_STATE;
+
+	prog->epoll_fd = epoll_create1(0);
+	if (prog->epoll_fd < 0) {
+		perror("epoll_create1");
+		return -errno;
+	}
+
+	prog->sampler = isochron_event_sampler_create();
+	if (!prog->sampler) {
+		rc = -ENOMEM;
+		goto err_sampler;
+	}
 
-	rc = sk_listen_tcp(&prog->stats_addr, prog->stats_port, 1,
-			   &prog->mgmt_listen_sock);
+	prog->test_state_fd = eventfd(0, EFD_NONBLOCK);
+	if (prog->test_state_fd < 0) {
+		perror("eventfd");
+		rc = -errno;
+		goto err_eventfd;
+	}
+
+	rc = sk_listen_tcp(&prog->stats_addr, prog->stats_port,
+			   ISOCHRON_DAEMON_BACKLOG, &prog->mgmt_listen_sock);
 	if (rc)
-		isochron_mgmt_handler_destroy(prog->mgmt_handler);
+		goto err_listen;
 
+	rc = prog_epoll_add(prog, sk_fd(prog->mgmt_listen_sock),
+			    &prog->listen_fd);
+	if (rc)
+		goto err_epoll;
+
+	rc = prog_epoll_add(prog, isochron_event_sampler_fd(prog->sampler),
+			    &prog->sampler_fd);
+	if (rc)
+		goto err_epoll;
+
+	rc = prog_epoll_add(prog, prog->test_state_fd,
+			    &prog->test_state_fd_ev);
+	if (rc)
+		goto err_epoll;
+
+	return 0;
+
+err_epoll:
+	sk_close(prog->mgmt_listen_sock);
+err_listen:
+	close(prog->test_state_fd);
+err_eventfd:
+	isochron_event_sampler_destroy(prog->sampler);
+err_sampler:
+	close(prog->epoll_fd);
 	return rc;
 }
 
 static void prog_teardown_mgmt_listen_sock(struct isochron_daemon *prog)
 {
 	sk_close(prog->mgmt_listen_sock);
-	isochron_mgmt_handler_destroy(prog->mgmt_handler);
+	close(prog->test_state_fd);
+	isochron_event_sampler_destroy(prog->sampler);
+	close(prog->epoll_fd);
 }
 
 static int prog_rtnl_open(struct isochron_daemon *prog)
@@ -1465,6 +1854,14 @@ static int prog_parse_args(int argc, char **argv, struct isochron_daemon *prog)
 			        .ptr = &prog->stats_addr,
 			},
 			.optional = true,
+		}, {
+			.short_opt = "-k",
+			.long_opt = "--keep-sender",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->keep_sender,
+			},
+			.optional = true,
 		},
 	};
 	int rc;
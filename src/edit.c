@@ -0,0 +1,665 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Copyright 2021 NXP */
+#include <errno.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "argparser.h"
+#include "common.h"
+#include "isochron.h"
+#include "log.h"
+
+#define ISOCHRON_EDIT_CHUNK_SIZE	4096 /* packets */
+#define ISOCHRON_EDIT_MAX_INPUTS	64
+#define ISOCHRON_EDIT_OP_BUFSIZ		32
+
+enum isochron_edit_op {
+	ISOCHRON_EDIT_SLICE,
+	ISOCHRON_EDIT_CONCAT,
+	ISOCHRON_EDIT_MERGE,
+};
+
+struct isochron_edit_buf {
+	struct isochron_send_pkt_data send_pkts[ISOCHRON_EDIT_CHUNK_SIZE];
+	struct isochron_rcv_pkt_data rcv_pkts[ISOCHRON_EDIT_CHUNK_SIZE];
+};
+
+/* A range of packets from one input, processed as a unit by one thread.
+ * The chunks are ordered by input and then by sequence number, so the
+ * output position of a chunk is the sum of the packets selected from all
+ * chunks before it.
+ */
+struct isochron_edit_chunk {
+	int input;
+	__u32 first;
+	__u32 count;
+	__u32 num_selected;
+	__u32 out_start;
+};
+
+struct isochron_edit_cursor {
+	struct isochron_edit_buf *buf;
+	__u32 next;
+	__u32 base;
+	__u32 pos;
+	__u32 count;
+	bool done;
+};
+
+struct isochron_edit_input {
+	struct isochron_log_file file;
+	const char *path;
+};
+
+struct isochron_edit {
+	char operation[ISOCHRON_EDIT_OP_BUFSIZ];
+	char input_files[BUFSIZ];
+	char output_file[PATH_MAX];
+	enum isochron_edit_op op;
+	unsigned long start;
+	unsigned long stop;
+	__s64 start_time;
+	__s64 stop_time;
+	long session;
+	long num_threads;
+	struct isochron_edit_input inputs[ISOCHRON_EDIT_MAX_INPUTS];
+	int num_inputs;
+	struct isochron_edit_chunk *chunks;
+	size_t num_chunks;
+	size_t next_chunk;
+	bool write_pass;
+	struct isochron_log_file output;
+	int rc;
+};
+
+static bool prog_pkt_selected(const struct isochron_edit *prog,
+			      const struct isochron_send_pkt_data *send_pkt,
+			      __u32 index)
+{
+	__s64 scheduled = (__s64 )__be64_to_cpu(send_pkt->scheduled);
+	__u32 seqid = __be32_to_cpu(send_pkt->seqid);
+
+	/* Packet was never logged */
+	if (seqid != index + 1)
+		return false;
+
+	if (seqid < prog->start || (prog->stop && seqid > prog->stop))
+		return false;
+
+	if (scheduled < prog->start_time ||
+	    (prog->stop_time && scheduled > prog->stop_time))
+		return false;
+
+	return true;
+}
+
+/* The report expects the sequence numbers to be contiguous and to start
+ * from 1, so renumber the packets as they are placed in the output.
+ */
+static void prog_copy_pkt(struct isochron_edit_buf *out, __u32 n,
+			  const struct isochron_edit_buf *in, __u32 i,
+			  __u32 seqid)
+{
+	const struct isochron_send_pkt_data *send_pkt = &in->send_pkts[i];
+	const struct isochron_rcv_pkt_data *rcv_pkt = &in->rcv_pkts[i];
+
+	out->send_pkts[n] = *send_pkt;
+	out->send_pkts[n].seqid = __cpu_to_be32(seqid);
+
+	if (rcv_pkt->seqid == send_pkt->seqid) {
+		out->rcv_pkts[n] = *rcv_pkt;
+		out->rcv_pkts[n].seqid = __cpu_to_be32(seqid);
+	} else {
+		memset(&out->rcv_pkts[n], 0, sizeof(out->rcv_pkts[n]));
+	}
+}
+
+static int prog_process_chunk(struct isochron_edit *prog,
+			      struct isochron_edit_chunk *chunk,
+			      struct isochron_edit_buf *in,
+			      struct isochron_edit_buf *out)
+{
+	const struct isochron_log_file *f = &prog->inputs[chunk->input].file;
+	__u32 i, n = 0;
+	int rc;
+
+	rc = isochron_log_file_read(f, in->send_pkts, in->rcv_pkts,
+				    chunk->first, chunk->count);
+	if (rc) {
+		pr_err(rc, "Failed to read from %s: %m\n",
+		       prog->inputs[chunk->input].path);
+		return rc;
+	}
+
+	for (i = 0; i < chunk->count; i++) {
+		if (!prog_pkt_selected(prog, &in->send_pkts[i],
+				       chunk->first + i))
+			continue;
+
+		if (prog->write_pass)
+			prog_copy_pkt(out, n, in, i, chunk->out_start + n + 1);
+		n++;
+	}
+
+	if (!prog->write_pass) {
+		chunk->num_selected = n;
+		return 0;
+	}
+
+	rc = isochron_log_file_write(&prog->output, out->send_pkts,
+				     out->rcv_pkts, chunk->out_start, n);
+	if (rc)
+		pr_err(rc, "Failed to write to %s: %m\n", prog->output_file);
+
+	return rc;
+}
+
+static void *prog_worker_thread(void *arg)
+{
+	struct isochron_edit *prog = arg;
+	struct isochron_edit_buf *in, *out;
+	size_t i;
+	int rc;
+
+	in = malloc(sizeof(*in));
+	out = malloc(sizeof(*out));
+	if (!in || !out) {
+		__atomic_store_n(&prog->rc, -ENOMEM, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	while (!__atomic_load_n(&prog->rc, __ATOMIC_RELAXED)) {
+		i = __atomic_fetch_add(&prog->next_chunk, 1, __ATOMIC_RELAXED);
+		if (i >= prog->num_chunks)
+			break;
+
+		rc = prog_process_chunk(prog, &prog->chunks[i], in, out);
+		if (rc) {
+			__atomic_store_n(&prog->rc, rc, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+out:
+	free(out);
+	free(in);
+
+	return NULL;
+}
+
+static int prog_run_workers(struct isochron_edit *prog)
+{
+	long i, num_threads = prog->num_threads;
+	pthread_t *tids;
+	int rc;
+
+	if ((size_t)num_threads > prog->num_chunks)
+		num_threads = prog->num_chunks;
+	if (!num_threads)
+		return 0;
+
+	tids = calloc(num_threads, sizeof(*tids));
+	if (!tids)
+		return -ENOMEM;
+
+	prog->next_chunk = 0;
+	prog->rc = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		rc = pthread_create(&tids[i], NULL, prog_worker_thread, prog);
+		if (rc) {
+			pr_err(-rc, "failed to create worker thread: %m\n");
+			__atomic_store_n(&prog->rc, -rc, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	while (i--)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+
+	return prog->rc;
+}
+
+/* Returns the total number of packets that go to the output */
+static __u32 prog_assign_output_offsets(struct isochron_edit *prog)
+{
+	__u32 out_start = 0;
+	size_t i;
+
+	for (i = 0; i < prog->num_chunks; i++) {
+		prog->chunks[i].out_start = out_start;
+		out_start += prog->chunks[i].num_selected;
+	}
+
+	return out_start;
+}
+
+static int prog_cursor_advance(struct isochron_edit *prog, int input,
+			       struct isochron_edit_cursor *cursor)
+{
+	const struct isochron_log_file *f = &prog->inputs[input].file;
+	int rc;
+
+	while (true) {
+		if (cursor->pos == cursor->count) {
+			if (cursor->next >= f->num_send_pkts) {
+				cursor->done = true;
+				return 0;
+			}
+
+			cursor->base = cursor->next;
+			cursor->count = min((__u32)ISOCHRON_EDIT_CHUNK_SIZE,
+					    f->num_send_pkts - cursor->base);
+			cursor->next += cursor->count;
+			cursor->pos = 0;
+
+			rc = isochron_log_file_read(f, cursor->buf->send_pkts,
+						    cursor->buf->rcv_pkts,
+						    cursor->base,
+						    cursor->count);
+			if (rc) {
+				pr_err(rc, "Failed to read from %s: %m\n",
+				       prog->inputs[input].path);
+				return rc;
+			}
+		}
+
+		if (prog_pkt_selected(prog,
+				      &cursor->buf->send_pkts[cursor->pos],
+				      cursor->base + cursor->pos))
+			return 0;
+
+		cursor->pos++;
+	}
+}
+
+static __s64 prog_cursor_scheduled(const struct isochron_edit_cursor *cursor)
+{
+	return __be64_to_cpu(cursor->buf->send_pkts[cursor->pos].scheduled);
+}
+
+/* Interleave the selected packets of all inputs in the order of their
+ * scheduled TX time. Each input is already sorted, so this is a k-way
+ * merge which only needs to keep one chunk per input in memory.
+ */
+static int prog_merge(struct isochron_edit *prog)
+{
+	struct isochron_edit_cursor *cursors;
+	struct isochron_edit_buf *out;
+	__u32 n = 0, out_start = 0;
+	int i, best;
+	int rc = 0;
+
+	cursors = calloc(prog->num_inputs, sizeof(*cursors));
+	out = malloc(sizeof(*out));
+	if (!cursors || !out) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < prog->num_inputs; i++) {
+		cursors[i].buf = malloc(sizeof(*cursors[i].buf));
+		if (!cursors[i].buf) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		rc = prog_cursor_advance(prog, i, &cursors[i]);
+		if (rc)
+			goto out;
+	}
+
+	while (true) {
+		best = -1;
+
+		for (i = 0; i < prog->num_inputs; i++) {
+			if (cursors[i].done)
+				continue;
+
+			if (best < 0 || prog_cursor_scheduled(&cursors[i]) <
+					prog_cursor_scheduled(&cursors[best]))
+				best = i;
+		}
+
+		if (best < 0 || n == ISOCHRON_EDIT_CHUNK_SIZE) {
+			rc = isochron_log_file_write(&prog->output,
+						     out->send_pkts,
+						     out->rcv_pkts,
+						     out_start, n);
+			if (rc) {
+				pr_err(rc, "Failed to write to %s: %m\n",
+				       prog->output_file);
+				goto out;
+			}
+
+			out_start += n;
+			n = 0;
+		}
+
+		if (best < 0)
+			break;
+
+		prog_copy_pkt(out, n, cursors[best].buf, cursors[best].pos,
+			      out_start + n + 1);
+		n++;
+
+		cursors[best].pos++;
+		rc = prog_cursor_advance(prog, best, &cursors[best]);
+		if (rc)
+			goto out;
+	}
+
+out:
+	if (cursors)
+		for (i = 0; i < prog->num_inputs; i++)
+			free(cursors[i].buf);
+	free(cursors);
+	free(out);
+
+	return rc;
+}
+
+static int prog_init_chunks(struct isochron_edit *prog)
+{
+	size_t num_chunks = 0;
+	__u32 first;
+	int i;
+
+	for (i = 0; i < prog->num_inputs; i++)
+		num_chunks += (prog->inputs[i].file.num_send_pkts +
+			       ISOCHRON_EDIT_CHUNK_SIZE - 1) /
+			      ISOCHRON_EDIT_CHUNK_SIZE;
+
+	prog->chunks = calloc(num_chunks, sizeof(*prog->chunks));
+	if (num_chunks && !prog->chunks)
+		return -ENOMEM;
+
+	for (i = 0; i < prog->num_inputs; i++) {
+		__u32 num_pkts = prog->inputs[i].file.num_send_pkts;
+
+		for (first = 0; first < num_pkts;
+		     first += ISOCHRON_EDIT_CHUNK_SIZE) {
+			struct isochron_edit_chunk *chunk;
+
+			chunk = &prog->chunks[prog->num_chunks++];
+			chunk->input = i;
+			chunk->first = first;
+			chunk->count = min((__u32)ISOCHRON_EDIT_CHUNK_SIZE,
+					   num_pkts - first);
+		}
+	}
+
+	return 0;
+}
+
+static void prog_close_inputs(struct isochron_edit *prog)
+{
+	int i;
+
+	for (i = 0; i < prog->num_inputs; i++)
+		isochron_log_file_close(&prog->inputs[i].file);
+
+	prog->num_inputs = 0;
+}
+
+static int prog_open_inputs(struct isochron_edit *prog)
+{
+	struct stat out_st, in_st;
+	char *saveptr, *path;
+	bool out_exists;
+	int rc;
+
+	out_exists = !stat(prog->output_file, &out_st);
+
+	for (path = strtok_r(prog->input_files, ",", &saveptr); path;
+	     path = strtok_r(NULL, ",", &saveptr)) {
+		struct isochron_edit_input *input;
+
+		if (prog->num_inputs == ISOCHRON_EDIT_MAX_INPUTS) {
+			fprintf(stderr, "Too many input files, maximum is %d\n",
+				ISOCHRON_EDIT_MAX_INPUTS);
+			rc = -EINVAL;
+			goto err;
+		}
+
+		input = &prog->inputs[prog->num_inputs];
+		input->path = path;
+
+		rc = isochron_log_file_open(&input->file, path, prog->session);
+		if (rc)
+			goto err;
+
+		prog->num_inputs++;
+
+		/* The output file is truncated before the inputs are read */
+		if (out_exists && !fstat(input->file.fd, &in_st) &&
+		    in_st.st_dev == out_st.st_dev &&
+		    in_st.st_ino == out_st.st_ino) {
+			fprintf(stderr,
+				"Output file %s cannot also be an input file\n",
+				prog->output_file);
+			rc = -EINVAL;
+			goto err;
+		}
+
+		if (!isochron_log_file_params_match(&prog->inputs[0].file,
+						    &input->file))
+			fprintf(stderr,
+				"Warning: %s was recorded with different test parameters than %s, keeping those of the latter\n",
+				path, prog->inputs[0].path);
+	}
+
+	if (!prog->num_inputs) {
+		fprintf(stderr, "No input file specified\n");
+		return -EINVAL;
+	}
+
+	if (prog->op == ISOCHRON_EDIT_SLICE && prog->num_inputs != 1) {
+		fprintf(stderr, "Slicing requires a single input file\n");
+		rc = -EINVAL;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	prog_close_inputs(prog);
+	return rc;
+}
+
+static int prog_parse_args(int argc, char **argv, struct isochron_edit *prog)
+{
+	bool help = false;
+	struct prog_arg args[] = {
+		{
+			.short_opt = "-h",
+			.long_opt = "--help",
+			.type = PROG_ARG_HELP,
+			.help_ptr = {
+			        .ptr = &help,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-o",
+			.long_opt = "--operation",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->operation,
+				.size = ISOCHRON_EDIT_OP_BUFSIZ - 1,
+			},
+		}, {
+			.short_opt = "-F",
+			.long_opt = "--input-files",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->input_files,
+				.size = BUFSIZ - 1,
+			},
+		}, {
+			.short_opt = "-O",
+			.long_opt = "--output-file",
+			.type = PROG_ARG_FILEPATH,
+			.filepath = {
+				.buf = prog->output_file,
+				.size = PATH_MAX - 1,
+			},
+		}, {
+			.short_opt = "-i",
+			.long_opt = "--session",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->session,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-s",
+			.long_opt = "--start",
+			.type = PROG_ARG_UNSIGNED,
+			.unsigned_ptr = {
+				.ptr = &prog->start,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-S",
+			.long_opt = "--stop",
+			.type = PROG_ARG_UNSIGNED,
+			.unsigned_ptr = {
+				.ptr = &prog->stop,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-b",
+			.long_opt = "--start-time",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->start_time,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-e",
+			.long_opt = "--stop-time",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->stop_time,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-j",
+			.long_opt = "--num-threads",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->num_threads,
+			},
+			.optional = true,
+		},
+	};
+	int rc;
+
+	rc = prog_parse_np_args(argc, argv, args, ARRAY_SIZE(args));
+
+	/* Non-positional arguments left unconsumed */
+	if (rc < 0) {
+		pr_err(rc, "argument parsing failed: %m\n");
+		return rc;
+	} else if (rc < argc) {
+		fprintf(stderr, "%d unconsumed arguments. First: %s\n",
+			argc - rc, argv[rc]);
+		prog_usage("isochron-edit", args, ARRAY_SIZE(args));
+		return -1;
+	}
+
+	if (help) {
+		prog_usage("isochron-edit", args, ARRAY_SIZE(args));
+		return -1;
+	}
+
+	if (!strcmp(prog->operation, "slice")) {
+		prog->op = ISOCHRON_EDIT_SLICE;
+	} else if (!strcmp(prog->operation, "concat")) {
+		prog->op = ISOCHRON_EDIT_CONCAT;
+	} else if (!strcmp(prog->operation, "merge")) {
+		prog->op = ISOCHRON_EDIT_MERGE;
+	} else {
+		fprintf(stderr,
+			"Unknown operation \"%s\", expected slice, concat or merge\n",
+			prog->operation);
+		return -EINVAL;
+	}
+
+	if (prog->session < 0) {
+		fprintf(stderr, "Session index cannot be negative\n");
+		return -EINVAL;
+	}
+
+	if (!prog->num_threads)
+		prog->num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (prog->num_threads < 1) {
+		fprintf(stderr, "Number of threads must be positive\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int isochron_edit_main(int argc, char *argv[])
+{
+	struct isochron_edit prog = {0};
+	__u32 packet_count;
+	int rc;
+
+	rc = prog_parse_args(argc, argv, &prog);
+	if (rc)
+		return rc;
+
+	rc = prog_open_inputs(&prog);
+	if (rc)
+		return rc;
+
+	rc = prog_init_chunks(&prog);
+	if (rc)
+		goto out_close_inputs;
+
+	/* First pass: count the packets selected from each chunk */
+	rc = prog_run_workers(&prog);
+	if (rc)
+		goto out_free_chunks;
+
+	packet_count = prog_assign_output_offsets(&prog);
+
+	rc = isochron_log_file_create(&prog.output, prog.output_file,
+				      &prog.inputs[0].file, packet_count);
+	if (rc)
+		goto out_free_chunks;
+
+	/* Second pass: place the selected packets in the output */
+	if (prog.op == ISOCHRON_EDIT_MERGE) {
+		rc = prog_merge(&prog);
+	} else {
+		prog.write_pass = true;
+		rc = prog_run_workers(&prog);
+	}
+
+	isochron_log_file_close(&prog.output);
+
+	if (rc)
+		unlink(prog.output_file);
+	else
+		printf("Wrote %u packets to %s\n", packet_count,
+		       prog.output_file);
+
+out_free_chunks:
+	free(prog.chunks);
+out_close_inputs:
+	prog_close_inputs(&prog);
+
+	return rc;
+}
@@ -0,0 +1,602 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Copyright 2021 NXP */
+/* Compiler for the integer expressions over the log variables that
+ * isochron-report accepts in place of a printf argument or as a
+ * user-defined metric. The expression is parsed by recursive descent, with
+ * C precedence rules, into instructions for a stack machine, so that
+ * evaluating it once per packet does not involve any parsing.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+
+#define ISOCHRON_EXPR_MAX_NESTING	64
+
+struct isochron_expr_parser {
+	struct isochron_expr *expr;
+	const char *str;
+	const char *pos;
+	const char *end;
+	isochron_expr_var_cb_t *var_cb;
+	void *priv;
+	int capacity;
+	/* Stack depth after the last emitted instruction */
+	int depth;
+	int nesting;
+};
+
+static int isochron_expr_error(struct isochron_expr_parser *p,
+			       const char *msg)
+{
+	fprintf(stderr, "%s at position %ld of expression \"%.*s\"\n",
+		msg, (long)(p->pos - p->str), (int)(p->end - p->str), p->str);
+
+	return -EINVAL;
+}
+
+static void isochron_expr_skip_spaces(struct isochron_expr_parser *p)
+{
+	while (p->pos < p->end && isspace((unsigned char)*p->pos))
+		p->pos++;
+}
+
+/* Consume @tok if it comes next, but not if it is just the start of a
+ * longer operator (for example "<" in front of "<=").
+ */
+static bool isochron_expr_accept(struct isochron_expr_parser *p,
+				 const char *tok)
+{
+	size_t len = strlen(tok);
+
+	isochron_expr_skip_spaces(p);
+
+	if ((size_t)(p->end - p->pos) < len || memcmp(p->pos, tok, len))
+		return false;
+
+	if (len == 1 && p->pos + 1 < p->end && p->pos[1] == '=' &&
+	    strchr("<>=!", tok[0]))
+		return false;
+
+	if (len == 1 && p->pos + 1 < p->end && p->pos[1] == tok[0] &&
+	    strchr("&|", tok[0]))
+		return false;
+
+	p->pos += len;
+
+	return true;
+}
+
+static int isochron_expr_expect(struct isochron_expr_parser *p,
+				const char *tok)
+{
+	char msg[64];
+
+	if (isochron_expr_accept(p, tok))
+		return 0;
+
+	snprintf(msg, sizeof(msg), "Expected '%s'", tok);
+
+	return isochron_expr_error(p, msg);
+}
+
+/* Effect of each instruction on the depth of the stack */
+static int isochron_expr_stack_effect(enum isochron_expr_opcode opcode)
+{
+	switch (opcode) {
+	case ISOCHRON_EXPR_CONST:
+	case ISOCHRON_EXPR_LOAD_S64:
+	case ISOCHRON_EXPR_LOAD_U32:
+		return 1;
+	case ISOCHRON_EXPR_NEG:
+	case ISOCHRON_EXPR_NOT:
+	case ISOCHRON_EXPR_BOOL:
+	case ISOCHRON_EXPR_ABS:
+	case ISOCHRON_EXPR_JMP:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Returns the index of the emitted instruction, or a negative error code */
+static int isochron_expr_emit(struct isochron_expr_parser *p,
+			      enum isochron_expr_opcode opcode, __s64 arg)
+{
+	struct isochron_expr *expr = p->expr;
+	struct isochron_expr_insn *insns;
+
+	if (expr->num_insns == p->capacity) {
+		if (p->capacity == ISOCHRON_EXPR_MAX_INSNS)
+			return isochron_expr_error(p, "Expression too long");
+
+		p->capacity = p->capacity ? 2 * p->capacity : 16;
+		insns = realloc(expr->insns, p->capacity * sizeof(*insns));
+		if (!insns)
+			return -ENOMEM;
+
+		expr->insns = insns;
+	}
+
+	p->depth += isochron_expr_stack_effect(opcode);
+	if (p->depth > ISOCHRON_EXPR_MAX_DEPTH)
+		return isochron_expr_error(p, "Expression too complex");
+
+	expr->insns[expr->num_insns].opcode = opcode;
+	expr->insns[expr->num_insns].arg = arg;
+
+	return expr->num_insns++;
+}
+
+/* Point a previously emitted jump to the next instruction */
+static void isochron_expr_patch(struct isochron_expr_parser *p, int insn)
+{
+	p->expr->insns[insn].arg = p->expr->num_insns;
+}
+
+static int isochron_expr_ternary(struct isochron_expr_parser *p);
+
+static int isochron_expr_number(struct isochron_expr_parser *p)
+{
+	__s64 val = 0;
+	int digit;
+
+	while (p->pos < p->end && isdigit((unsigned char)*p->pos)) {
+		digit = *p->pos - '0';
+		/* Check before multiplying, so that the value cannot wrap */
+		if (val > (LLONG_MAX - digit) / 10)
+			return isochron_expr_error(p, "Integer out of range");
+		val = val * 10 + digit;
+		p->pos++;
+	}
+
+	return isochron_expr_emit(p, ISOCHRON_EXPR_CONST, val);
+}
+
+static int isochron_expr_variable(struct isochron_expr_parser *p, char code)
+{
+	size_t offset, size;
+	int rc;
+
+	rc = p->var_cb(p->priv, code, &offset, &size);
+	if (rc) {
+		p->pos--;
+		return isochron_expr_error(p, "Unknown variable");
+	}
+
+	if (size == sizeof(__s64))
+		return isochron_expr_emit(p, ISOCHRON_EXPR_LOAD_S64, offset);
+	if (size == sizeof(__u32))
+		return isochron_expr_emit(p, ISOCHRON_EXPR_LOAD_U32, offset);
+
+	return isochron_expr_error(p, "Unsupported variable size");
+}
+
+/* abs(x), min(x, y) and max(x, y) */
+static int isochron_expr_function(struct isochron_expr_parser *p,
+				  const char *name, size_t len)
+{
+	enum isochron_expr_opcode opcode;
+	int num_args, rc, i;
+
+	if (len == 3 && !memcmp(name, "abs", 3)) {
+		opcode = ISOCHRON_EXPR_ABS;
+		num_args = 1;
+	} else if (len == 3 && !memcmp(name, "min", 3)) {
+		opcode = ISOCHRON_EXPR_MIN;
+		num_args = 2;
+	} else if (len == 3 && !memcmp(name, "max", 3)) {
+		opcode = ISOCHRON_EXPR_MAX;
+		num_args = 2;
+	} else {
+		p->pos = name;
+		return isochron_expr_error(p, "Unknown function");
+	}
+
+	rc = isochron_expr_expect(p, "(");
+	if (rc)
+		return rc;
+
+	for (i = 0; i < num_args; i++) {
+		if (i) {
+			rc = isochron_expr_expect(p, ",");
+			if (rc)
+				return rc;
+		}
+
+		rc = isochron_expr_ternary(p);
+		if (rc < 0)
+			return rc;
+	}
+
+	rc = isochron_expr_expect(p, ")");
+	if (rc)
+		return rc;
+
+	return isochron_expr_emit(p, opcode, 0);
+}
+
+static int isochron_expr_primary(struct isochron_expr_parser *p)
+{
+	const char *name;
+	int rc;
+
+	isochron_expr_skip_spaces(p);
+
+	if (p->pos == p->end)
+		return isochron_expr_error(p, "Unexpected end");
+
+	if (isdigit((unsigned char)*p->pos))
+		return isochron_expr_number(p);
+
+	if (isalpha((unsigned char)*p->pos)) {
+		name = p->pos;
+		while (p->pos < p->end && isalpha((unsigned char)*p->pos))
+			p->pos++;
+
+		/* Variables have single-letter names, functions don't */
+		if (p->pos - name == 1)
+			return isochron_expr_variable(p, *name);
+
+		return isochron_expr_function(p, name, p->pos - name);
+	}
+
+	if (isochron_expr_accept(p, "(")) {
+		rc = isochron_expr_ternary(p);
+		if (rc < 0)
+			return rc;
+
+		return isochron_expr_expect(p, ")");
+	}
+
+	return isochron_expr_error(p, "Unexpected character");
+}
+
+static int isochron_expr_unary(struct isochron_expr_parser *p)
+{
+	enum isochron_expr_opcode opcode;
+	int rc;
+
+	if (isochron_expr_accept(p, "-"))
+		opcode = ISOCHRON_EXPR_NEG;
+	else if (isochron_expr_accept(p, "!"))
+		opcode = ISOCHRON_EXPR_NOT;
+	else if (isochron_expr_accept(p, "+"))
+		return isochron_expr_unary(p);
+	else
+		return isochron_expr_primary(p);
+
+	rc = isochron_expr_unary(p);
+	if (rc < 0)
+		return rc;
+
+	return isochron_expr_emit(p, opcode, 0);
+}
+
+struct isochron_expr_binop {
+	const char *tok;
+	enum isochron_expr_opcode opcode;
+};
+
+static const struct isochron_expr_binop isochron_expr_mul_ops[] = {
+	{ "*", ISOCHRON_EXPR_MUL },
+	{ "/", ISOCHRON_EXPR_DIV },
+	{ "%", ISOCHRON_EXPR_MOD },
+	{ NULL },
+};
+
+static const struct isochron_expr_binop isochron_expr_add_ops[] = {
+	{ "+", ISOCHRON_EXPR_ADD },
+	{ "-", ISOCHRON_EXPR_SUB },
+	{ NULL },
+};
+
+static const struct isochron_expr_binop isochron_expr_cmp_ops[] = {
+	{ "==", ISOCHRON_EXPR_EQ },
+	{ "!=", ISOCHRON_EXPR_NE },
+	{ "<=", ISOCHRON_EXPR_LE },
+	{ ">=", ISOCHRON_EXPR_GE },
+	{ "<", ISOCHRON_EXPR_LT },
+	{ ">", ISOCHRON_EXPR_GT },
+	{ NULL },
+};
+
+/* Left-associative chain of binary operators of the same precedence */
+static int isochron_expr_binary(struct isochron_expr_parser *p,
+				const struct isochron_expr_binop *ops,
+				int (*operand)(struct isochron_expr_parser *p))
+{
+	const struct isochron_expr_binop *op;
+	int rc;
+
+	rc = operand(p);
+	if (rc < 0)
+		return rc;
+
+	while (true) {
+		for (op = ops; op->tok; op++)
+			if (isochron_expr_accept(p, op->tok))
+				break;
+		if (!op->tok)
+			return 0;
+
+		rc = operand(p);
+		if (rc < 0)
+			return rc;
+
+		rc = isochron_expr_emit(p, op->opcode, 0);
+		if (rc < 0)
+			return rc;
+	}
+}
+
+static int isochron_expr_mul(struct isochron_expr_parser *p)
+{
+	return isochron_expr_binary(p, isochron_expr_mul_ops,
+				    isochron_expr_unary);
+}
+
+static int isochron_expr_add(struct isochron_expr_parser *p)
+{
+	return isochron_expr_binary(p, isochron_expr_add_ops,
+				    isochron_expr_mul);
+}
+
+static int isochron_expr_cmp(struct isochron_expr_parser *p)
+{
+	return isochron_expr_binary(p, isochron_expr_cmp_ops,
+				    isochron_expr_add);
+}
+
+/* Short-circuit "a && b" is "a ? !!b : 0", and "a || b" is "a ? 1 : !!b" */
+static int isochron_expr_logical(struct isochron_expr_parser *p,
+				 const char *tok,
+				 int (*operand)(struct isochron_expr_parser *p))
+{
+	bool is_and = !strcmp(tok, "&&");
+	int jump, end, depth, rc;
+
+	rc = operand(p);
+	if (rc < 0)
+		return rc;
+
+	while (isochron_expr_accept(p, tok)) {
+		jump = isochron_expr_emit(p, is_and ? ISOCHRON_EXPR_JZ :
+					  ISOCHRON_EXPR_JNZ, 0);
+		if (jump < 0)
+			return jump;
+
+		depth = p->depth;
+
+		rc = operand(p);
+		if (rc < 0)
+			return rc;
+
+		rc = isochron_expr_emit(p, ISOCHRON_EXPR_BOOL, 0);
+		if (rc < 0)
+			return rc;
+
+		end = isochron_expr_emit(p, ISOCHRON_EXPR_JMP, 0);
+		if (end < 0)
+			return end;
+
+		isochron_expr_patch(p, jump);
+		p->depth = depth;
+
+		rc = isochron_expr_emit(p, ISOCHRON_EXPR_CONST, !is_and);
+		if (rc < 0)
+			return rc;
+
+		isochron_expr_patch(p, end);
+	}
+
+	return 0;
+}
+
+static int isochron_expr_and(struct isochron_expr_parser *p)
+{
+	return isochron_expr_logical(p, "&&", isochron_expr_cmp);
+}
+
+static int isochron_expr_or(struct isochron_expr_parser *p)
+{
+	return isochron_expr_logical(p, "||", isochron_expr_and);
+}
+
+static int isochron_expr_ternary(struct isochron_expr_parser *p)
+{
+	int jump, end, depth, rc;
+
+	if (++p->nesting > ISOCHRON_EXPR_MAX_NESTING)
+		return isochron_expr_error(p, "Expression nested too deeply");
+
+	rc = isochron_expr_or(p);
+	if (rc < 0)
+		return rc;
+
+	if (isochron_expr_accept(p, "?")) {
+		jump = isochron_expr_emit(p, ISOCHRON_EXPR_JZ, 0);
+		if (jump < 0)
+			return jump;
+
+		depth = p->depth;
+
+		rc = isochron_expr_ternary(p);
+		if (rc < 0)
+			return rc;
+
+		rc = isochron_expr_expect(p, ":");
+		if (rc)
+			return rc;
+
+		end = isochron_expr_emit(p, ISOCHRON_EXPR_JMP, 0);
+		if (end < 0)
+			return end;
+
+		isochron_expr_patch(p, jump);
+		p->depth = depth;
+
+		rc = isochron_expr_ternary(p);
+		if (rc < 0)
+			return rc;
+
+		isochron_expr_patch(p, end);
+	}
+
+	p->nesting--;
+
+	return 0;
+}
+
+/* Compile the first @len characters of @str */
+int isochron_expr_compile(struct isochron_expr *expr, const char *str,
+			  size_t len, isochron_expr_var_cb_t var_cb,
+			  void *priv)
+{
+	struct isochron_expr_parser p = {
+		.expr = expr,
+		.str = str,
+		.pos = str,
+		.end = str + len,
+		.var_cb = var_cb,
+		.priv = priv,
+	};
+	int rc;
+
+	expr->insns = NULL;
+	expr->num_insns = 0;
+
+	rc = isochron_expr_ternary(&p);
+	if (rc < 0)
+		goto err;
+
+	isochron_expr_skip_spaces(&p);
+	if (p.pos != p.end) {
+		rc = isochron_expr_error(&p, "Unexpected character");
+		goto err;
+	}
+
+	return 0;
+
+err:
+	isochron_expr_free(expr);
+	return rc;
+}
+
+/* Arithmetic wraps around like on unsigned integers, and division by zero
+ * gives zero, so that no value of the variables is undefined behavior.
+ */
+__s64 isochron_expr_eval(const struct isochron_expr *expr, const void *vars)
+{
+	const struct isochron_expr_insn *insn = expr->insns;
+	const struct isochron_expr_insn *end = insn + expr->num_insns;
+	__s64 stack[ISOCHRON_EXPR_MAX_DEPTH];
+	__s64 *sp = stack - 1;
+	__s64 b;
+
+	while (insn != end) {
+		switch (insn->opcode) {
+		case ISOCHRON_EXPR_CONST:
+			*++sp = insn->arg;
+			break;
+		case ISOCHRON_EXPR_LOAD_S64:
+			*++sp = *(const __s64 *)((const char *)vars + insn->arg);
+			break;
+		case ISOCHRON_EXPR_LOAD_U32:
+			*++sp = *(const __u32 *)((const char *)vars + insn->arg);
+			break;
+		case ISOCHRON_EXPR_NEG:
+			*sp = -(__u64)*sp;
+			break;
+		case ISOCHRON_EXPR_NOT:
+			*sp = !*sp;
+			break;
+		case ISOCHRON_EXPR_BOOL:
+			*sp = !!*sp;
+			break;
+		case ISOCHRON_EXPR_ABS:
+			if (*sp < 0)
+				*sp = -(__u64)*sp;
+			break;
+		case ISOCHRON_EXPR_JMP:
+			insn = expr->insns + insn->arg;
+			continue;
+		case ISOCHRON_EXPR_JZ:
+			if (!*sp--) {
+				insn = expr->insns + insn->arg;
+				continue;
+			}
+			break;
+		case ISOCHRON_EXPR_JNZ:
+			if (*sp--) {
+				insn = expr->insns + insn->arg;
+				continue;
+			}
+			break;
+		default:
+			b = *sp--;
+
+			switch (insn->opcode) {
+			case ISOCHRON_EXPR_ADD:
+				*sp = (__u64)*sp + (__u64)b;
+				break;
+			case ISOCHRON_EXPR_SUB:
+				*sp = (__u64)*sp - (__u64)b;
+				break;
+			case ISOCHRON_EXPR_MUL:
+				*sp = (__u64)*sp * (__u64)b;
+				break;
+			case ISOCHRON_EXPR_DIV:
+				if (b == -1)
+					*sp = -(__u64)*sp;
+				else
+					*sp = b ? *sp / b : 0;
+				break;
+			case ISOCHRON_EXPR_MOD:
+				*sp = (b && b != -1) ? *sp % b : 0;
+				break;
+			case ISOCHRON_EXPR_MIN:
+				*sp = *sp < b ? *sp : b;
+				break;
+			case ISOCHRON_EXPR_MAX:
+				*sp = *sp > b ? *sp : b;
+				break;
+			case ISOCHRON_EXPR_EQ:
+				*sp = *sp == b;
+				break;
+			case ISOCHRON_EXPR_NE:
+				*sp = *sp != b;
+				break;
+			case ISOCHRON_EXPR_LT:
+				*sp = *sp < b;
+				break;
+			case ISOCHRON_EXPR_LE:
+				*sp = *sp <= b;
+				break;
+			case ISOCHRON_EXPR_GT:
+				*sp = *sp > b;
+				break;
+			case ISOCHRON_EXPR_GE:
+				*sp = *sp >= b;
+				break;
+			default:
+				break;
+			}
+		}
+
+		insn++;
+	}
+
+	return *sp;
+}
+
+void isochron_expr_free(struct isochron_expr *expr)
+{
+	free(expr->insns);
+	expr->insns = NULL;
+	expr->num_insns = 0;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright 2021 NXP */
+#ifndef _ISOCHRON_EXPR_H
+#define _ISOCHRON_EXPR_H
+
+#include <linux/types.h>
+#include <stddef.h>
+
+#define ISOCHRON_EXPR_MAX_INSNS		1024
+#define ISOCHRON_EXPR_MAX_DEPTH		32
+
+enum isochron_expr_opcode {
+	ISOCHRON_EXPR_CONST,
+	ISOCHRON_EXPR_LOAD_S64,
+	ISOCHRON_EXPR_LOAD_U32,
+	ISOCHRON_EXPR_NEG,
+	ISOCHRON_EXPR_NOT,
+	ISOCHRON_EXPR_BOOL,
+	ISOCHRON_EXPR_ABS,
+	ISOCHRON_EXPR_ADD,
+	ISOCHRON_EXPR_SUB,
+	ISOCHRON_EXPR_MUL,
+	ISOCHRON_EXPR_DIV,
+	ISOCHRON_EXPR_MOD,
+	ISOCHRON_EXPR_MIN,
+	ISOCHRON_EXPR_MAX,
+	ISOCHRON_EXPR_EQ,
+	ISOCHRON_EXPR_NE,
+	ISOCHRON_EXPR_LT,
+	ISOCHRON_EXPR_LE,
+	ISOCHRON_EXPR_GT,
+	ISOCHRON_EXPR_GE,
+	/* Jumps take the index of the target instruction as argument */
+	ISOCHRON_EXPR_JMP,
+	ISOCHRON_EXPR_JZ,
+	ISOCHRON_EXPR_JNZ,
+};
+
+struct isochron_expr_insn {
+	enum isochron_expr_opcode opcode;
+	/* Constant, variable offset or jump target */
+	__s64 arg;
+};
+
+/* An integer expression compiled to instructions for a stack machine */
+struct isochron_expr {
+	struct isochron_expr_insn *insns;
+	int num_insns;
+};
+
+/* Resolve a single-letter variable to its offset and size (sizeof(__s64)
+ * or sizeof(__u32)) within the structure later passed to
+ * isochron_expr_eval(). Returns a negative error code for unknown
+ * variables.
+ */
+typedef int isochron_expr_var_cb_t(void *priv, char code, size_t *offset,
+				   size_t *size);
+
+int isochron_expr_compile(struct isochron_expr *expr, const char *str,
+			  size_t len, isochron_expr_var_cb_t var_cb,
+			  void *priv);
+__s64 isochron_expr_eval(const struct isochron_expr *expr, const void *vars);
+void isochron_expr_free(struct isochron_expr *expr);
+
+#endif
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Copyright 2021 NXP */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include "fft.h"
+
+/* Iterative radix-2 decimation in time FFT of @n complex points, with the
+ * twiddle factors precomputed for the largest stage and strided for the
+ * smaller ones.
+ */
+static int fft_complex(double complex *buf, size_t n)
+{
+	double complex *twiddles;
+	size_t i, j, k, m;
+
+	if (n < 2)
+		return 0;
+
+	twiddles = malloc(n / 2 * sizeof(*twiddles));
+	if (!twiddles)
+		return -ENOMEM;
+
+	for (i = 0; i < n / 2; i++)
+		twiddles[i] = cexp(-2 * M_PI * I * i / n);
+
+	/* Bit-reversal permutation */
+	for (i = 1, j = 0; i < n; i++) {
+		size_t bit = n >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+
+		if (i < j) {
+			double complex tmp = buf[i];
+
+			buf[i] = buf[j];
+			buf[j] = tmp;
+		}
+	}
+
+	for (m = 2; m <= n; m <<= 1) {
+		size_t half = m / 2, stride = n / m;
+
+		for (k = 0; k < n; k += m) {
+			for (j = 0; j < half; j++) {
+				double complex t, u;
+
+				t = twiddles[j * stride] * buf[k + j + half];
+				u = buf[k + j];
+				buf[k + j] = u + t;
+				buf[k + j + half] = u - t;
+			}
+		}
+	}
+
+	free(twiddles);
+
+	return 0;
+}
+
+/* The real samples are treated as n / 2 complex ones, with the even samples
+ * as the real parts and the odd samples as the imaginary parts. The spectra
+ * of the even and odd samples are then separated from the result and
+ * combined into the spectrum of the real signal.
+ */
+int fft_real(double complex *buf, size_t n)
+{
+	size_t half = n / 2, k;
+	double complex z0;
+	int rc;
+
+	if (n < 2 || (n & (n - 1)))
+		return -EINVAL;
+
+	rc = fft_complex(buf, half);
+	if (rc)
+		return rc;
+
+	z0 = buf[0];
+	buf[0] = creal(z0) + cimag(z0);
+	buf[half] = creal(z0) - cimag(z0);
+
+	for (k = 1; k <= half / 2; k++) {
+		double complex zk = buf[k], zn = conj(buf[half - k]);
+		double complex w = cexp(-2 * M_PI * I * k / n);
+		double complex even, odd;
+
+		even = (zk + zn) / 2;
+		odd = (zk - zn) / (2 * I);
+		buf[k] = even + w * odd;
+		/* Bin n / 2 - k, from the conjugate pair of the same values */
+		buf[half - k] = conj(even - w * odd);
+	}
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright 2021 NXP */
+#ifndef _ISOCHRON_FFT_H
+#define _ISOCHRON_FFT_H
+
+#include <complex.h>
+#include <stddef.h>
+
+/* Spectrum of @n real samples, where @n is a power of 2. On input, @buf
+ * holds the samples as the first @n doubles of an array of n / 2 + 1
+ * complex numbers. On output, it holds the spectrum bins 0 to n / 2, the
+ * other half being the complex conjugate of these.
+ */
+int fft_real(double complex *buf, size_t n);
+
+#endif
@@ -30,6 +30,10 @@ static const struct isochron_prog progs[] = {
 		.prog_name = "isochron-report",
 		.prog_func = "report",
 		.main = isochron_report_main,
+	}, {
+		.prog_name = "isochron-edit",
+		.prog_func = "edit",
+		.main = isochron_edit_main,
 	},
 };
 
@@ -18,6 +18,7 @@ int isochron_orchestrate_main(int argc, char *argv[]);
 int isochron_send_main(int argc, char *argv[]);
 int isochron_rcv_main(int argc, char *argv[]);
 int isochron_report_main(int argc, char *argv[]);
+int isochron_edit_main(int argc, char *argv[]);
 
 int isochron_parse_args(int *argc, char ***argv,
 			const struct isochron_prog **prog);
@@ -1,21 +1,36 @@
 // SPDX-License-Identifier: GPL-2.0
 /* Copyright 2019-2021 NXP */
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "common.h"
 #include "endian.h"
+#include "expr.h"
+#include "fft.h"
+#include "isochron.h"
 #include "log.h"
 
-#define ISOCHRON_LOG_VERSION	4
+/* Version of the log file format. Files without an annotation section are
+ * saved as version 4, which they are identical to, so that older readers
+ * can still open them.
+ */
+#define ISOCHRON_LOG_VERSION		5
+#define ISOCHRON_LOG_VERSION_NO_ANNOTATIONS	4
+/* Version of the log transferred over the management socket, which is
+ * independent of the file format
+ */
+#define ISOCHRON_LOG_WIRE_VERSION	4
 
 #define FILEMODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP) /*0660*/
 
@@ -24,59 +39,105 @@
 #define ISOCHRON_FLAG_TAPRIO		BIT(2)
 #define ISOCHRON_FLAG_TXTIME		BIT(3)
 #define ISOCHRON_FLAG_DEADLINE		BIT(4)
+/* Set while a memory-mapped log is being filled in, cleared on completion */
+#define ISOCHRON_FLAG_INCOMPLETE	BIT(5)
+
+#define ISOCHRON_LOG_LOAD_RANGE_SIZE	(16 * 1024 * 1024) /* bytes */
+#define ISOCHRON_LOG_LOAD_MAX_THREADS	64
+
+#define ISOCHRON_CONTAINER_VERSION	1
+#define ISOCHRON_SESSION_DIR_SIZE	64
 
 static const char *isochron_magic = "ISOCHRON";
+static const char *isochron_container_magic = "ISOCHSES";
 
-struct isochron_log_file_header {
+/* A multi-session container starts with this header, followed by a chain of
+ * session directory blocks. Each session is laid out exactly like a
+ * single-session log file (header, send log, receive log), with the log
+ * offsets relative to the start of the session.
+ */
+struct isochron_container_header {
 	char		magic[8];
 	__be32		version;
-	__be32		packet_count;
-	__be16		frame_size;
-	__be16		flags;
-	__be32		reserved;
-	__be64		base_time;
-	__be64		advance_time;
-	__be64		shift_time;
-	__be64		cycle_time;
-	__be64		window_size;
-	__be64		send_log_start;
-	__be64		rcv_log_start;
-	__be32		send_log_size;
-	__be32		rcv_log_size;
-	__be64		reserved2;
+	__be32		num_sessions;
+	__be64		first_dir;
+	__be64		last_dir;
+	__be64		reserved;
 } __attribute((packed));
 
-struct isochron_packet_metrics {
-	LIST_ENTRY(isochron_packet_metrics) list;
-	__s64 wakeup_to_hw_ts;
-	__s64 hw_rx_deadline_delta;
-	__s64 latency_budget;
-	__s64 path_delay;
-	__s64 wakeup_latency;
-	__s64 sender_latency;
-	__s64 driver_latency;
-	__s64 arrival_latency;
-	__u32 seqid;
-};
+struct isochron_session_entry {
+	__be64		start;
+	__be64		size;
+} __attribute((packed));
 
-struct isochron_stats {
-	LIST_HEAD(stats_head, isochron_packet_metrics) entries;
-	int frame_count;
-	int hw_tx_deadline_misses;
-	double tx_sync_offset_mean;
-	double rx_sync_offset_mean;
-	double path_delay_mean;
-};
+struct isochron_session_dir {
+	__be64		next;
+	__be32		num_entries;
+	__be32		reserved;
+	struct isochron_session_entry entries[ISOCHRON_SESSION_DIR_SIZE];
+} __attribute((packed));
 
+/* Running statistics of a metric, updated packet by packet using Welford's
+ * algorithm, so that no per-packet state needs to be kept.
+ */
 struct isochron_metric_stats {
 	int seqid_of_min;
 	int seqid_of_max;
 	__s64 min;
 	__s64 max;
 	double mean;
+	double m2;
 	double stddev;
 };
 
+/* Log-linear histogram with a relative bucket width of at most
+ * 1 / ISOCHRON_HIST_SUB_BUCKETS, used for approximating percentiles of
+ * logs too large to keep every value of a metric in memory. Negative
+ * values are kept separately, by magnitude.
+ */
+#define ISOCHRON_HIST_SUB_BITS		7
+#define ISOCHRON_HIST_SUB_BUCKETS	(1 << ISOCHRON_HIST_SUB_BITS)
+#define ISOCHRON_HIST_NUM_BUCKETS	\
+	(ISOCHRON_HIST_SUB_BUCKETS * (65 - ISOCHRON_HIST_SUB_BITS))
+
+struct isochron_metric_hist {
+	__u64 pos[ISOCHRON_HIST_NUM_BUCKETS];
+	__u64 neg[ISOCHRON_HIST_NUM_BUCKETS];
+};
+
+/* Number of packets whose statistics are computed as one unit */
+#define ISOCHRON_REPORT_BLOCK_SIZE	8192
+
+#define ISOCHRON_MAX_USER_METRICS	16
+#define ISOCHRON_USER_METRIC_NAME_LEN	64
+#define ISOCHRON_STATS_MAX_METRICS	\
+	(__ISOCHRON_METRIC_MAX + ISOCHRON_MAX_USER_METRICS)
+
+/* Metric defined on the command line as an expression over the printf
+ * variables, kept in the statistics after the built-in ones.
+ */
+struct isochron_user_metric {
+	char name[ISOCHRON_USER_METRIC_NAME_LEN];
+	struct isochron_expr expr;
+};
+
+struct isochron_stats {
+	struct isochron_metric_stats metrics[ISOCHRON_STATS_MAX_METRICS];
+	/* Per-packet values, only kept for exact percentiles */
+	__s64 *columns[ISOCHRON_STATS_MAX_METRICS];
+	struct isochron_metric_hist *hists;
+	const struct isochron_user_metric *user_metrics;
+	int num_user_metrics;
+	int frame_count;
+	int hw_tx_deadline_misses;
+	__u64 not_tx_timestamped;
+	__u64 not_received;
+	__u64 sync_lost;
+	double tx_sync_offset_mean;
+	double rx_sync_offset_mean;
+	double path_delay_mean;
+};
+
 #define ISOCHRON_FMT_TIME		BIT(0)
 #define ISOCHRON_FMT_SIGNED		BIT(1)
 #define ISOCHRON_FMT_UNSIGNED		BIT(2)
@@ -100,6 +161,7 @@ struct isochron_printf_variables {
 };
 
 struct isochron_variable_code {
+	const char *name;
 	size_t offset;
 	size_t size;
 	unsigned long valid_formats;
@@ -107,6 +169,7 @@ struct isochron_variable_code {
 
 static const struct isochron_variable_code variable_codes[256] = {
 	['A'] = {
+		.name = "advance_time",
 		.offset = offsetof(struct isochron_printf_variables,
 				   advance_time),
 		.size = sizeof(__s64),
@@ -116,6 +179,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['B'] = {
+		.name = "base_time",
 		.offset = offsetof(struct isochron_printf_variables,
 				   base_time),
 		.size = sizeof(__s64),
@@ -125,6 +189,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['C'] = {
+		.name = "cycle_time",
 		.offset = offsetof(struct isochron_printf_variables,
 				   cycle_time),
 		.size = sizeof(__s64),
@@ -134,6 +199,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['H'] = {
+		.name = "shift_time",
 		.offset = offsetof(struct isochron_printf_variables,
 				   shift_time),
 		.size = sizeof(__s64),
@@ -143,6 +209,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['W'] = {
+		.name = "window_size",
 		.offset = offsetof(struct isochron_printf_variables,
 				   window_size),
 		.size = sizeof(__s64),
@@ -152,6 +219,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['S'] = {
+		.name = "tx_scheduled",
 		.offset = offsetof(struct isochron_printf_variables,
 				   tx_scheduled),
 		.size = sizeof(__s64),
@@ -161,6 +229,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['w'] = {
+		.name = "tx_wakeup",
 		.offset = offsetof(struct isochron_printf_variables,
 				   tx_wakeup),
 		.size = sizeof(__s64),
@@ -170,6 +239,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['T'] = {
+		.name = "tx_hwts",
 		.offset = offsetof(struct isochron_printf_variables,
 				   tx_hwts),
 		.size = sizeof(__s64),
@@ -179,6 +249,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['t'] = {
+		.name = "tx_swts",
 		.offset = offsetof(struct isochron_printf_variables,
 				   tx_swts),
 		.size = sizeof(__s64),
@@ -188,6 +259,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['s'] = {
+		.name = "tx_sched",
 		.offset = offsetof(struct isochron_printf_variables,
 				   tx_sched),
 		.size = sizeof(__s64),
@@ -197,6 +269,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['q'] = {
+		.name = "seqid",
 		.offset = offsetof(struct isochron_printf_variables,
 				   seqid),
 		.size = sizeof(__u32),
@@ -204,6 +277,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['a'] = {
+		.name = "arrival",
 		.offset = offsetof(struct isochron_printf_variables,
 				   arrival),
 		.size = sizeof(__s64),
@@ -213,6 +287,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['R'] = {
+		.name = "rx_hwts",
 		.offset = offsetof(struct isochron_printf_variables,
 				   rx_hwts),
 		.size = sizeof(__s64),
@@ -222,6 +297,7 @@ static const struct isochron_variable_code variable_codes[256] = {
 				 ISOCHRON_FMT_HEX,
 	},
 	['r'] = {
+		.name = "rx_swts",
 		.offset = offsetof(struct isochron_printf_variables,
 				   rx_swts),
 		.size = sizeof(__s64),
@@ -285,30 +361,359 @@ int isochron_log_rcv_pkt(struct isochron_log *log,
 	return 0;
 }
 
-int isochron_log_xmit(struct isochron_log *log, struct sk *sock)
+/* The sync log is a ring, where the oldest samples are overwritten once
+ * it fills up.
+ */
+void isochron_log_sync_sample(struct isochron_log *log, unsigned long index,
+			      const struct isochron_sync_sample *sample)
 {
-	__be32 log_version = __cpu_to_be32(ISOCHRON_LOG_VERSION);
-	__be32 buf_len = __cpu_to_be32(log->size);
-	int rc;
+	size_t num_samples = log->size / sizeof(*sample);
+	struct isochron_sync_sample *dest;
 
-	rc = sk_send(sock, &log_version, sizeof(log_version));
-	if (rc) {
-		sk_err(sock, rc, "Failed to write log version to socket: %m\n");
-		return -errno;
+	if (!num_samples)
+		return;
+
+	dest = isochron_log_get_entry(log, sizeof(*sample),
+				      index % num_samples);
+	memcpy(dest, sample, sizeof(*sample));
+}
+
+/* Rotate the ring after @count samples were logged, so that the samples are
+ * in chronological order and the unused entries (zeroes) are at the end.
+ */
+int isochron_log_sync_finish(struct isochron_log *log, unsigned long count)
+{
+	size_t num_samples = log->size / sizeof(struct isochron_sync_sample);
+	size_t len = num_samples * sizeof(struct isochron_sync_sample);
+	size_t head;
+	char *tmp;
+
+	if (count <= num_samples)
+		return 0;
+
+	head = (count % num_samples) * sizeof(struct isochron_sync_sample);
+	if (!head)
+		return 0;
+
+	tmp = malloc(head);
+	if (!tmp)
+		return -ENOMEM;
+
+	memcpy(tmp, log->buf, head);
+	memmove(log->buf, log->buf + head, len - head);
+	memcpy(log->buf + len - head, tmp, head);
+	free(tmp);
+
+	return 0;
+}
+
+static size_t isochron_sync_log_num_samples(const struct isochron_log *sync_log)
+{
+	const struct isochron_sync_sample *samples = (const void *)sync_log->buf;
+	size_t i, num_samples = sync_log->size / sizeof(*samples);
+
+	for (i = 0; i < num_samples; i++)
+		if (!samples[i].ts)
+			break;
+
+	return i;
+}
+
+/* Offset between the system clock and the PHC at time @t, linearly
+ * interpolated between the two closest samples.
+ */
+static __s64 isochron_sync_log_offset(const struct isochron_sync_sample *samples,
+				      size_t num_samples, __s64 t)
+{
+	size_t lo = 0, hi = num_samples - 1, mid;
+	__s64 t0, t1, o0, o1;
+
+	if (t <= (__s64)__be64_to_cpu(samples[lo].ts))
+		return (__s64)__be64_to_cpu(samples[lo].offset);
+	if (t >= (__s64)__be64_to_cpu(samples[hi].ts))
+		return (__s64)__be64_to_cpu(samples[hi].offset);
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if ((__s64)__be64_to_cpu(samples[mid].ts) <= t)
+			lo = mid;
+		else
+			hi = mid;
 	}
 
-	rc = sk_send(sock, &buf_len, sizeof(buf_len));
-	if (rc) {
-		sk_err(sock, rc, "Failed to write log length to socket: %m\n");
-		return -errno;
+	t0 = __be64_to_cpu(samples[lo].ts);
+	t1 = __be64_to_cpu(samples[hi].ts);
+	o0 = __be64_to_cpu(samples[lo].offset);
+	o1 = __be64_to_cpu(samples[hi].offset);
+
+	if (t1 == t0)
+		return o0;
+
+	return o0 + (o1 - o0) * (t - t0) / (t1 - t0);
+}
+
+static void isochron_print_sync_excursion(unsigned long first,
+					  unsigned long last, __s64 max_offset)
+{
+	printf("Sync excursion during packets %lu-%lu, max offset %lld ns\n",
+	       first, last, max_offset);
+}
+
+/* Use the sync samples to move the software timestamps of the sender (taken
+ * with the system clock) into the time base of its PHC, and/or to report
+ * the packets sent while the two clocks were more than @excursion apart.
+ * The scheduled TX time, which the wakeup was computed from, is moved as
+ * well, so that intervals measured with the system clock alone, like the
+ * wakeup latency, are left unchanged by the correction.
+ */
+int isochron_log_sync_correct(struct isochron_log *send_log,
+			      const struct isochron_log *sync_log,
+			      unsigned long start, unsigned long stop,
+			      bool correct, __s64 excursion)
+{
+	size_t num_pkts = send_log->size / sizeof(struct isochron_send_pkt_data);
+	const struct isochron_sync_sample *samples = (const void *)sync_log->buf;
+	size_t num_samples = isochron_sync_log_num_samples(sync_log);
+	unsigned long seqid, first = 0, num_excursions = 0;
+	__s64 offset, max_offset = 0;
+
+	if (!num_samples) {
+		fprintf(stderr,
+			"Log has no sync samples, was --sync-sample-interval used?\n");
+		return 0;
 	}
 
-	if (log->size) {
-		rc = sk_send(sock, log->buf, log->size);
-		if (rc) {
-			sk_err(sock, rc, "Failed to write log to socket: %m\n");
-			return -errno;
+	for (seqid = start; seqid <= stop && seqid <= num_pkts; seqid++) {
+		struct isochron_send_pkt_data *send_pkt;
+		__s64 wakeup;
+
+		send_pkt = isochron_log_get_entry(send_log, sizeof(*send_pkt),
+						  seqid - 1);
+		wakeup = __be64_to_cpu(send_pkt->wakeup);
+		if (!wakeup)
+			continue;
+
+		offset = isochron_sync_log_offset(samples, num_samples, wakeup);
+
+		if (excursion && llabs(offset) > excursion) {
+			if (!first) {
+				first = seqid;
+				max_offset = 0;
+			}
+			if (llabs(offset) > llabs(max_offset))
+				max_offset = offset;
+			num_excursions++;
+		} else if (first) {
+			isochron_print_sync_excursion(first, seqid - 1,
+						      max_offset);
+			first = 0;
+		}
+
+		if (!correct)
+			continue;
+
+		send_pkt->wakeup = __cpu_to_be64(wakeup - offset);
+		send_pkt->scheduled = __cpu_to_be64(__be64_to_cpu(send_pkt->scheduled) -
+						    offset);
+		if (send_pkt->swts)
+			send_pkt->swts = __cpu_to_be64(__be64_to_cpu(send_pkt->swts) -
+						       offset);
+		if (send_pkt->sched_ts)
+			send_pkt->sched_ts = __cpu_to_be64(__be64_to_cpu(send_pkt->sched_ts) -
+							   offset);
+	}
+
+	if (first)
+		isochron_print_sync_excursion(first, seqid - 1, max_offset);
+
+	if (excursion)
+		printf("%lu packets sent during sync excursions larger than %lld ns\n",
+		       num_excursions, excursion);
+
+	return 0;
+}
+
+/* Record an interval in the first unused annotation slot. Once the log is
+ * full, the last annotation is extended to also cover the new interval.
+ */
+int isochron_log_annotate(struct isochron_log *log,
+			  enum isochron_annotation_type type,
+			  __s64 start, __s64 stop)
+{
+	struct isochron_annotation *annotations = (void *)log->buf;
+	size_t i, num = log->size / sizeof(*annotations);
+
+	if (!num)
+		return -ENOSPC;
+
+	for (i = 0; i < num; i++)
+		if (!annotations[i].type)
+			break;
+
+	if (i == num) {
+		annotations[num - 1].stop = __cpu_to_be64(stop);
+		return 0;
+	}
+
+	annotations[i].start = __cpu_to_be64(start);
+	annotations[i].stop = __cpu_to_be64(stop);
+	annotations[i].type = __cpu_to_be32(type);
+
+	return 0;
+}
+
+struct isochron_sync_loss {
+	__s64 start;
+	__s64 stop;
+	unsigned long first;
+	unsigned long last;
+};
+
+static int isochron_sync_loss_cmp(const void *a, const void *b)
+{
+	const struct isochron_sync_loss *la = *(const void **)a;
+	const struct isochron_sync_loss *lb = *(const void **)b;
+
+	return la->start < lb->start ? -1 : la->start > lb->start;
+}
+
+/* Report the packets scheduled for transmission during an annotated sync
+ * loss, and if @exclude is set, mark them so that they are left out of the
+ * statistics. The packets are scheduled in increasing order, so they are
+ * matched in a single pass against the intervals sorted by their start,
+ * keeping track of the ones which may still contain the next packet.
+ */
+int isochron_log_sync_loss(struct isochron_log *send_log,
+			   const struct isochron_log *annotation_log,
+			   unsigned long start, unsigned long stop,
+			   bool exclude)
+{
+	size_t num_pkts = send_log->size / sizeof(struct isochron_send_pkt_data);
+	const struct isochron_annotation *annotations = (const void *)annotation_log->buf;
+	size_t i, j, num = annotation_log->size / sizeof(*annotations);
+	struct isochron_sync_loss *losses, **sorted, **active;
+	size_t num_losses = 0, num_active = 0, next = 0;
+	unsigned long seqid, total = 0;
+
+	for (i = 0; i < num; i++)
+		if (__be32_to_cpu(annotations[i].type) == ISOCHRON_ANNOTATION_SYNC_LOSS)
+			num_losses++;
+
+	if (!num_losses)
+		return 0;
+
+	losses = calloc(num_losses, sizeof(*losses));
+	sorted = calloc(2 * num_losses, sizeof(*sorted));
+	if (!losses || !sorted) {
+		fprintf(stderr, "Failed to allocate memory for the sync loss intervals\n");
+		free(losses);
+		free(sorted);
+		return -ENOMEM;
+	}
+
+	active = sorted + num_losses;
+
+	for (i = 0, j = 0; i < num; i++) {
+		const struct isochron_annotation *a = &annotations[i];
+
+		if (__be32_to_cpu(a->type) != ISOCHRON_ANNOTATION_SYNC_LOSS)
+			continue;
+
+		losses[j].start = __be64_to_cpu(a->start);
+		losses[j].stop = __be64_to_cpu(a->stop);
+		sorted[j] = &losses[j];
+		j++;
+	}
+
+	qsort(sorted, num_losses, sizeof(*sorted), isochron_sync_loss_cmp);
+
+	for (seqid = start; seqid <= stop && seqid <= num_pkts; seqid++) {
+		struct isochron_send_pkt_data *send_pkt;
+		__s64 scheduled;
+
+		if (next == num_losses && !num_active)
+			break;
+
+		send_pkt = isochron_log_get_entry(send_log, sizeof(*send_pkt),
+						  seqid - 1);
+		scheduled = __be64_to_cpu(send_pkt->scheduled);
+
+		/* Retire the intervals which ended before this packet */
+		for (i = 0, j = 0; i < num_active; i++)
+			if (active[i]->stop >= scheduled)
+				active[j++] = active[i];
+		num_active = j;
+
+		for (; next < num_losses; next++) {
+			if (sorted[next]->start > scheduled)
+				break;
+			if (sorted[next]->stop >= scheduled)
+				active[num_active++] = sorted[next];
+		}
+
+		if (!num_active)
+			continue;
+
+		for (i = 0; i < num_active; i++) {
+			if (!active[i]->first)
+				active[i]->first = seqid;
+			active[i]->last = seqid;
 		}
+
+		if (exclude)
+			send_pkt->flags |= __cpu_to_be32(ISOCHRON_PKT_SYNC_LOST);
+
+		total++;
+	}
+
+	for (i = 0; i < num_losses; i++) {
+		const struct isochron_sync_loss *l = &losses[i];
+		char start_buf[TIMESPEC_BUFSIZ];
+		char stop_buf[TIMESPEC_BUFSIZ];
+
+		ns_sprintf(start_buf, l->start);
+		ns_sprintf(stop_buf, l->stop);
+
+		if (l->first)
+			printf("Sync lost from %s to %s, packets %lu-%lu\n",
+			       start_buf, stop_buf, l->first, l->last);
+		else
+			printf("Sync lost from %s to %s, no packets affected\n",
+			       start_buf, stop_buf);
+	}
+
+	if (total)
+		printf("%lu packets sent during sync loss%s\n", total,
+		       exclude ? ", excluded from the statistics" : "");
+
+	free(losses);
+	free(sorted);
+
+	return 0;
+}
+
+int isochron_log_xmit(struct isochron_log *log, struct sk *sock)
+{
+	__be32 log_version = __cpu_to_be32(ISOCHRON_LOG_WIRE_VERSION);
+	__be32 buf_len = __cpu_to_be32(log->size);
+	struct iovec iov[] = {
+		{
+			.iov_base = &log_version,
+			.iov_len = sizeof(log_version),
+		}, {
+			.iov_base = &buf_len,
+			.iov_len = sizeof(buf_len),
+		}, {
+			.iov_base = log->buf,
+			.iov_len = log->size,
+		},
+	};
+	int rc;
+
+	rc = sk_sendv(sock, iov, ARRAY_SIZE(iov));
+	if (rc) {
+		sk_err(sock, rc, "Failed to write log to socket: %m\n");
+		return rc;
 	}
 
 	return 0;
@@ -326,10 +731,10 @@ int isochron_log_recv(struct isochron_log *log, struct sk *sock)
 		return rc;
 	}
 
-	if (__be32_to_cpu(log_version) != ISOCHRON_LOG_VERSION) {
+	if (__be32_to_cpu(log_version) != ISOCHRON_LOG_WIRE_VERSION) {
 		fprintf(stderr,
 			"incompatible isochron log version %d, expected %d, exiting\n",
-			__be32_to_cpu(log_version), ISOCHRON_LOG_VERSION);
+			__be32_to_cpu(log_version), ISOCHRON_LOG_WIRE_VERSION);
 		return -EINVAL;
 	}
 
@@ -447,156 +852,131 @@ isochron_printf_vars_get(const struct isochron_send_pkt_data *send_pkt,
 	v->seqid = (__u32 )__be32_to_cpu(send_pkt->seqid);
 }
 
-static int
-isochron_printf_signed_int(char *buf, const char *buf_end_ptr,
-			   const struct isochron_variable_code *vc,
-			   const struct isochron_printf_variables *v)
-{
-	__s64 *var64 = (__s64 *)((char *)v + vc->offset);
-	__s32 *var32 = (__s32 *)((char *)v + vc->offset);
-	char tmp[30];
-	size_t size;
-
-	switch (vc->size) {
-	case sizeof(__s64):
-		sprintf(tmp, "%lld", *var64);
-		break;
-	case sizeof(__s32):
-		sprintf(tmp, "%d", *var32);
-		break;
-	default:
-		fprintf(stderr,
-			"Unrecognized variable size %zu for a signed int\n",
-			vc->size);
-		return -EINVAL;
-	}
-
-	size = strlen(tmp);
+/* Longest expansion of a single variable: "-9223372036854775808" */
+#define ISOCHRON_PRINTF_MAX_VAR_LEN	21
+#define ISOCHRON_PRINTF_MAX_NUM_OPS	(2 * ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS + 1)
 
-	if (buf + size >= buf_end_ptr) {
-		fprintf(stderr,
-			"Destination buffer not large enough to print signed int\n");
-		return -EINVAL;
-	}
+enum isochron_printf_op_type {
+	ISOCHRON_PRINTF_OP_LITERAL,
+	ISOCHRON_PRINTF_OP_SIGNED,
+	ISOCHRON_PRINTF_OP_UNSIGNED,
+	ISOCHRON_PRINTF_OP_HEX,
+	ISOCHRON_PRINTF_OP_TIME,
+};
 
-	strcpy(buf, tmp);
+/* A literal span of the format string, or a variable or expression to be
+ * printed
+ */
+struct isochron_printf_op {
+	enum isochron_printf_op_type type;
+	size_t offset;	/* in ctx->literals, or in isochron_printf_variables */
+	size_t size;	/* of the literal span, or of the variable */
+	const struct isochron_expr *expr;
+};
 
-	return size;
-}
+/* The printf format and arguments, compiled once per report into a list of
+ * operations, so that the per-packet work does not involve parsing anything.
+ */
+struct isochron_printf_ctx {
+	struct isochron_printf_op ops[ISOCHRON_PRINTF_MAX_NUM_OPS];
+	struct isochron_expr exprs[ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS];
+	char literals[ISOCHRON_LOG_PRINTF_BUF_SIZE];
+	int num_ops;
+	int num_exprs;
+	/* Upper bound for the output length of one packet */
+	size_t max_len;
+};
 
-static int
-isochron_printf_unsigned_int(char *buf, const char *buf_end_ptr,
-			     const struct isochron_variable_code *vc,
-			     const struct isochron_printf_variables *v)
+static const char isochron_digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static char *isochron_fmt_unsigned(char *p, __u64 val)
 {
-	__u64 *var64 = (__u64 *)((char *)v + vc->offset);
-	__u32 *var32 = (__u32 *)((char *)v + vc->offset);
-	char tmp[30];
-	size_t size;
-
-	switch (vc->size) {
-	case sizeof(__u64):
-		sprintf(tmp, "%llu", *var64);
-		break;
-	case sizeof(__u32):
-		sprintf(tmp, "%u", *var32);
-		break;
-	default:
-		fprintf(stderr,
-			"Unrecognized variable size %zu for a signed int\n",
-			vc->size);
-		return -EINVAL;
-	}
+	char tmp[20];
+	char *end = tmp + sizeof(tmp);
+	char *q = end;
+	size_t len;
 
-	size = strlen(tmp);
+	while (val >= 100) {
+		unsigned int i = (val % 100) * 2;
 
-	if (buf + size >= buf_end_ptr) {
-		fprintf(stderr,
-			"Destination buffer not large enough to print unsigned int\n");
-		return -EINVAL;
+		val /= 100;
+		*--q = isochron_digit_pairs[i + 1];
+		*--q = isochron_digit_pairs[i];
+	}
+	if (val >= 10) {
+		*--q = isochron_digit_pairs[val * 2 + 1];
+		*--q = isochron_digit_pairs[val * 2];
+	} else {
+		*--q = '0' + val;
 	}
 
-	strcpy(buf, tmp);
+	len = end - q;
+	memcpy(p, q, len);
 
-	return size;
+	return p + len;
 }
 
-static int
-isochron_printf_hex_int(char *buf, const char *buf_end_ptr,
-			const struct isochron_variable_code *vc,
-			const struct isochron_printf_variables *v)
+static char *isochron_fmt_signed(char *p, __s64 val)
 {
-	__u64 *var64 = (__u64 *)((char *)v + vc->offset);
-	__u32 *var32 = (__u32 *)((char *)v + vc->offset);
-	char tmp[30];
-	size_t size;
-
-	switch (vc->size) {
-	case sizeof(__u64):
-		sprintf(tmp, "%llx", *var64);
-		break;
-	case sizeof(__u32):
-		sprintf(tmp, "%x", *var32);
-		break;
-	default:
-		fprintf(stderr,
-			"Unrecognized variable size %zu for a signed int\n",
-			vc->size);
-		return -EINVAL;
+	if (val < 0) {
+		*p++ = '-';
+		return isochron_fmt_unsigned(p, -(__u64)val);
 	}
 
-	size = strlen(tmp);
+	return isochron_fmt_unsigned(p, val);
+}
 
-	if (buf + size >= buf_end_ptr) {
-		fprintf(stderr,
-			"Destination buffer not large enough to print hex int\n");
-		return -EINVAL;
-	}
+static char *isochron_fmt_hex(char *p, __u64 val)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char tmp[16];
+	char *end = tmp + sizeof(tmp);
+	char *q = end;
+	size_t len;
+
+	do {
+		*--q = hex_digits[val & 0xf];
+		val >>= 4;
+	} while (val);
 
-	strcpy(buf, tmp);
+	len = end - q;
+	memcpy(p, q, len);
 
-	return size;
+	return p + len;
 }
 
-static int
-isochron_printf_time(char *buf, const char *buf_end_ptr,
-		     const struct isochron_variable_code *vc,
-		     const struct isochron_printf_variables *v)
+/* Same output as ns_sprintf() */
+static char *isochron_fmt_time(char *p, __s64 ns)
 {
-	__u64 *var64 = (__u64 *)((char *)v + vc->offset);
-	char tmp[TIMESPEC_BUFSIZ];
-
-	if (vc->size != sizeof(__s64)) {
-		fprintf(stderr, "Unexpected size %zu for a time format\n",
-			vc->size);
-		return -EINVAL;
-	}
+	struct timespec ts = ns_to_timespec(ns);
+	long nsec = ts.tv_nsec;
+	int i;
 
-	ns_sprintf(tmp, *var64);
+	p = isochron_fmt_signed(p, ts.tv_sec);
+	*p++ = '.';
 
-	if (buf + strlen(tmp) >= buf_end_ptr) {
-		fprintf(stderr,
-			"Destination buffer not large enough to print time\n");
-		return -EINVAL;
+	for (i = 8; i >= 0; i--) {
+		p[i] = '0' + nsec % 10;
+		nsec /= 10;
 	}
 
-	strcpy(buf, tmp);
-
-	return strlen(tmp);
+	return p + 9;
 }
 
-static int
-isochron_printf_one_var(char *buf_ptr, const char *buf_end_ptr,
-			const struct isochron_printf_variables *v,
-			char var_code, char printf_code)
+static int isochron_printf_op_type(const struct isochron_variable_code *vc,
+				   char var_code, char printf_code,
+				   enum isochron_printf_op_type *type)
 {
-	const struct isochron_variable_code *vc = &variable_codes[(__u8 )var_code];
-
-	if (!vc->valid_formats) {
-		fprintf(stderr, "Unknown variable code '%c'\n", var_code);
-		return -EINVAL;
-	}
-
 	switch (printf_code) {
 	case 'd':
 		if (!(vc->valid_formats & ISOCHRON_FMT_SIGNED)) {
@@ -606,7 +986,8 @@ isochron_printf_one_var(char *buf_ptr, const char *buf_end_ptr,
 			return -EINVAL;
 		}
 
-		return isochron_printf_signed_int(buf_ptr, buf_end_ptr, vc, v);
+		*type = ISOCHRON_PRINTF_OP_SIGNED;
+		break;
 	case 'u':
 		if (!(vc->valid_formats & ISOCHRON_FMT_UNSIGNED)) {
 			fprintf(stderr,
@@ -615,7 +996,8 @@ isochron_printf_one_var(char *buf_ptr, const char *buf_end_ptr,
 			return -EINVAL;
 		}
 
-		return isochron_printf_unsigned_int(buf_ptr, buf_end_ptr, vc, v);
+		*type = ISOCHRON_PRINTF_OP_UNSIGNED;
+		break;
 	case 'x':
 		if (!(vc->valid_formats & ISOCHRON_FMT_HEX)) {
 			fprintf(stderr,
@@ -624,7 +1006,8 @@ isochron_printf_one_var(char *buf_ptr, const char *buf_end_ptr,
 			return -EINVAL;
 		}
 
-		return isochron_printf_hex_int(buf_ptr, buf_end_ptr, vc, v);
+		*type = ISOCHRON_PRINTF_OP_HEX;
+		break;
 	case 'T':
 		if (!(vc->valid_formats & ISOCHRON_FMT_TIME)) {
 			fprintf(stderr,
@@ -633,132 +1016,496 @@ isochron_printf_one_var(char *buf_ptr, const char *buf_end_ptr,
 			return -EINVAL;
 		}
 
-		return isochron_printf_time(buf_ptr, buf_end_ptr, vc, v);
+		if (vc->size != sizeof(__s64)) {
+			fprintf(stderr,
+				"Unexpected size %zu for a time format\n",
+				vc->size);
+			return -EINVAL;
+		}
+
+		*type = ISOCHRON_PRINTF_OP_TIME;
+		break;
 	default:
 		fprintf(stderr, "Unknown printf code '%c'\n", printf_code);
 		return -EINVAL;
 	}
-}
 
-static int buf_copy_verbatim(char *dest, const char *dest_end, const char *src,
-			     size_t size)
-{
-	if (dest + size >= dest_end) {
-		fprintf(stderr,
-			"Buffer not large enough for printf format\n");
+	if (vc->size != sizeof(__u64) && vc->size != sizeof(__u32)) {
+		fprintf(stderr, "Unrecognized variable size %zu\n", vc->size);
 		return -EINVAL;
 	}
 
-	memcpy(dest, src, size);
-	return size;
+	return 0;
 }
 
-static int
-isochron_printf_one_packet(const struct isochron_printf_variables *v,
-			   const char *printf_fmt, const char *printf_args)
+/* Expressions evaluate to signed 64-bit integers and can be printed in any
+ * format.
+ */
+static const struct isochron_variable_code isochron_expr_code = {
+	.name = "expression",
+	.size = sizeof(__s64),
+	.valid_formats = ISOCHRON_FMT_TIME |
+			 ISOCHRON_FMT_SIGNED |
+			 ISOCHRON_FMT_UNSIGNED |
+			 ISOCHRON_FMT_HEX,
+};
+
+static int isochron_expr_var_get(void *priv, char code, size_t *offset,
+				 size_t *size)
 {
-	const char *fmt_end_ptr = printf_fmt + strlen(printf_fmt);
-	char buf[ISOCHRON_LOG_PRINTF_BUF_SIZE];
-	const char *args_ptr = printf_args;
-	const char *fmt_ptr = printf_fmt;
-	const char *args_end_ptr;
-	char *buf_ptr = buf;
-	char *percent, code;
-	char *buf_end_ptr;
-	int rc;
+	const struct isochron_variable_code *vc = &variable_codes[(__u8)code];
 
-	buf_end_ptr = buf + ISOCHRON_LOG_PRINTF_BUF_SIZE - 1;
-	args_end_ptr = printf_args + strlen(printf_args);
+	if (!vc->valid_formats)
+		return -EINVAL;
 
-	do {
-		percent = strchr(fmt_ptr, '%');
-		if (!percent) {
-			rc = buf_copy_verbatim(buf_ptr, buf_end_ptr, fmt_ptr,
-					       strlen(fmt_ptr));
-			if (rc < 0)
-				return rc;
+	*offset = vc->offset;
+	*size = vc->size;
 
-			buf_ptr += rc;
-		} else {
-			if (percent + 1 >= fmt_end_ptr) {
-				fprintf(stderr,
-					"Illegal percent placement at the end of the printf format\n");
-				return -EINVAL;
-			}
+	return 0;
+}
 
-			code = *(percent + 1);
-			/* Escaped %% */
-			if (code == '%') {
-				/* Copy up to and including the first percent */
-				rc = buf_copy_verbatim(buf_ptr, buf_end_ptr, fmt_ptr,
-						       percent + 1 - fmt_ptr);
-				if (rc < 0)
-					return rc;
-
-				buf_ptr += rc;
-				/* Jump past both percent signs */
-				fmt_ptr = percent + 2;
-				continue;
-			}
+/* Compile the expression in braces at *@args_ptr, and consume it */
+static int isochron_printf_compile_expr(struct isochron_printf_ctx *ctx,
+					const char **args_ptr,
+					const char *args_end_ptr,
+					struct isochron_printf_op *op)
+{
+	const char *str = *args_ptr + 1;
+	const char *close;
+	int rc;
 
-			if (args_ptr >= args_end_ptr) {
-				fprintf(stderr,
-					"Not enough arguments for format\n");
-				return -EINVAL;
-			}
+	close = memchr(str, '}', args_end_ptr - str);
+	if (!close) {
+		fprintf(stderr, "Unterminated expression in printf arguments\n");
+		return -EINVAL;
+	}
 
-			/* First copy verbatim up to the percent sign */
-			rc = buf_copy_verbatim(buf_ptr, buf_end_ptr, fmt_ptr,
-					       (percent - fmt_ptr));
-			if (rc < 0)
-				return rc;
-			buf_ptr += rc;
+	rc = isochron_expr_compile(&ctx->exprs[ctx->num_exprs], str,
+				   close - str, isochron_expr_var_get, NULL);
+	if (rc)
+		return rc;
 
-			rc = isochron_printf_one_var(buf_ptr, buf_end_ptr,
-						     v, *args_ptr, code);
-			if (rc < 0)
-				return rc;
+	op->expr = &ctx->exprs[ctx->num_exprs++];
+	*args_ptr = close + 1;
+
+	return 0;
+}
+
+/* Append a literal span to the last op if that is a literal too */
+static void isochron_printf_add_literal(struct isochron_printf_ctx *ctx,
+					size_t *literals_len, const char *str,
+					size_t len)
+{
+	struct isochron_printf_op *op = NULL;
+
+	if (!len)
+		return;
+
+	if (ctx->num_ops)
+		op = &ctx->ops[ctx->num_ops - 1];
+
+	if (!op || op->type != ISOCHRON_PRINTF_OP_LITERAL) {
+		op = &ctx->ops[ctx->num_ops++];
+		op->type = ISOCHRON_PRINTF_OP_LITERAL;
+		op->offset = *literals_len;
+		op->size = 0;
+		op->expr = NULL;
+	}
+
+	memcpy(ctx->literals + *literals_len, str, len);
+	*literals_len += len;
+	op->size += len;
+	ctx->max_len += len;
+}
 
-			/* Advance past what we've just printed */
-			buf_ptr += rc;
+static int isochron_printf_compile(struct isochron_printf_ctx *ctx,
+				   const char *printf_fmt,
+				   const char *printf_args)
+{
+	const char *fmt_end_ptr = printf_fmt + strlen(printf_fmt);
+	const char *args_end_ptr = printf_args + strlen(printf_args);
+	const struct isochron_variable_code *vc;
+	const char *args_ptr = printf_args;
+	const char *fmt_ptr = printf_fmt;
+	struct isochron_printf_op *op;
+	size_t literals_len = 0;
+	char *percent, code;
+	int num_args = 0;
+	int rc;
+
+	if (fmt_end_ptr - printf_fmt >= ISOCHRON_LOG_PRINTF_BUF_SIZE) {
+		fprintf(stderr,
+			"Buffer not large enough for printf format\n");
+		return -EINVAL;
+	}
+
+	ctx->num_ops = 0;
+	ctx->num_exprs = 0;
+	ctx->max_len = 0;
+
+	while ((percent = strchr(fmt_ptr, '%')) != NULL) {
+		if (percent + 1 >= fmt_end_ptr) {
+			fprintf(stderr,
+				"Illegal percent placement at the end of the printf format\n");
+			return -EINVAL;
+		}
 
-			/* Jump past the percent and past the code character */
+		code = *(percent + 1);
+		/* Escaped %%: copy up to and including the first percent */
+		if (code == '%') {
+			isochron_printf_add_literal(ctx, &literals_len, fmt_ptr,
+						    percent + 1 - fmt_ptr);
+			/* Jump past both percent signs */
 			fmt_ptr = percent + 2;
+			continue;
+		}
+
+		if (args_ptr >= args_end_ptr) {
+			fprintf(stderr, "Not enough arguments for format\n");
+			return -EINVAL;
+		}
+
+		if (num_args++ == ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS) {
+			fprintf(stderr, "Too many printf arguments, maximum is %d\n",
+				ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS);
+			return -EINVAL;
+		}
+
+		/* First copy verbatim up to the percent sign */
+		isochron_printf_add_literal(ctx, &literals_len, fmt_ptr,
+					    percent - fmt_ptr);
+
+		if (*args_ptr == '{')
+			vc = &isochron_expr_code;
+		else
+			vc = &variable_codes[(__u8)*args_ptr];
+		if (!vc->valid_formats) {
+			fprintf(stderr, "Unknown variable code '%c'\n",
+				*args_ptr);
+			return -EINVAL;
+		}
+
+		op = &ctx->ops[ctx->num_ops++];
+		op->offset = vc->offset;
+		op->size = vc->size;
+		op->expr = NULL;
+
+		rc = isochron_printf_op_type(vc, *args_ptr, code, &op->type);
+		if (rc)
+			return rc;
+
+		ctx->max_len += ISOCHRON_PRINTF_MAX_VAR_LEN;
+
+		/* Jump past the percent and past the code character */
+		fmt_ptr = percent + 2;
 
-			/* Consume one argument */
+		/* Consume one argument */
+		if (vc == &isochron_expr_code) {
+			rc = isochron_printf_compile_expr(ctx, &args_ptr,
+							  args_end_ptr, op);
+			if (rc)
+				return rc;
+		} else {
 			args_ptr++;
 		}
-	} while (percent);
+	}
 
-	/* Avoid uselessly memsetting the whole buffer to zero,
-	 * just make sure it is NULL-terminated
-	 */
-	*buf_ptr = 0;
+	isochron_printf_add_literal(ctx, &literals_len, fmt_ptr,
+				    fmt_end_ptr - fmt_ptr);
 
 	if (args_ptr < args_end_ptr) {
 		fprintf(stderr, "printf arguments left unconsumed\n");
 		return -EINVAL;
 	}
 
-	if (buf[0])
-		fputs(buf, stdout);
+	return 0;
+}
+
+static int isochron_printf_write(const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	if (!len)
+		return 0;
+
+	ret = write_exact(STDOUT_FILENO, buf, len);
+	if (ret <= 0) {
+		perror("write");
+		return ret ? -errno : -EIO;
+	}
 
 	return 0;
 }
 
-static void isochron_process_stat(const struct isochron_printf_variables *v,
-				  struct isochron_stats *stats,
-				  bool taprio, bool txtime)
+static void isochron_printf_teardown(struct isochron_printf_ctx *ctx)
 {
-	struct isochron_packet_metrics *entry;
+	int i;
 
-	entry = calloc(1, sizeof(*entry));
-	if (!entry)
-		return;
+	for (i = 0; i < ctx->num_exprs; i++)
+		isochron_expr_free(&ctx->exprs[i]);
+	ctx->num_exprs = 0;
+}
+
+static int isochron_printf_init(struct isochron_printf_ctx *ctx,
+				const char *printf_fmt,
+				const char *printf_args)
+{
+	int rc;
+
+	rc = isochron_printf_compile(ctx, printf_fmt, printf_args);
+	if (rc) {
+		isochron_printf_teardown(ctx);
+		return rc;
+	}
+
+	/* Anything printed so far through stdio must come out first */
+	if (ctx->num_ops)
+		fflush(stdout);
+
+	return 0;
+}
+
+/* Print one packet to @p, which must have room for ctx->max_len bytes.
+ * Returns the end of the output.
+ */
+static char *isochron_printf_one_packet(const struct isochron_printf_ctx *ctx,
+					const struct isochron_printf_variables *v,
+					char *p)
+{
+	const struct isochron_printf_op *op, *ops_end;
+	const char *var;
+	__u64 val;
+
+	ops_end = ctx->ops + ctx->num_ops;
+
+	for (op = ctx->ops; op != ops_end; op++) {
+		if (op->type == ISOCHRON_PRINTF_OP_LITERAL) {
+			memcpy(p, ctx->literals + op->offset, op->size);
+			p += op->size;
+			continue;
+		}
+
+		var = (const char *)v + op->offset;
+		if (op->expr)
+			val = isochron_expr_eval(op->expr, v);
+		else if (op->size == sizeof(__u64))
+			val = *(const __u64 *)var;
+		else if (op->type == ISOCHRON_PRINTF_OP_SIGNED)
+			val = *(const __s32 *)var;
+		else
+			val = *(const __u32 *)var;
+
+		switch (op->type) {
+		case ISOCHRON_PRINTF_OP_SIGNED:
+			p = isochron_fmt_signed(p, val);
+			break;
+		case ISOCHRON_PRINTF_OP_UNSIGNED:
+			p = isochron_fmt_unsigned(p, val);
+			break;
+		case ISOCHRON_PRINTF_OP_HEX:
+			p = isochron_fmt_hex(p, val);
+			break;
+		case ISOCHRON_PRINTF_OP_TIME:
+			p = isochron_fmt_time(p, val);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return p;
+}
+
+static void isochron_metric_update(struct isochron_metric_stats *ms,
+				   __s64 val, __u32 seqid, int count)
+{
+	double delta = (double)val - ms->mean;
+
+	/* On equal values, the highest sequence number wins */
+	if (count == 1 || val <= ms->min) {
+		ms->min = val;
+		ms->seqid_of_min = seqid;
+	}
+	if (count == 1 || val >= ms->max) {
+		ms->max = val;
+		ms->seqid_of_max = seqid;
+	}
+
+	ms->mean += delta / count;
+	ms->m2 += delta * ((double)val - ms->mean);
+}
+
+static size_t isochron_hist_index(__u64 val)
+{
+	int shift;
+
+	if (val < 2 * ISOCHRON_HIST_SUB_BUCKETS)
+		return val;
+
+	shift = 63 - __builtin_clzll(val) - ISOCHRON_HIST_SUB_BITS;
+
+	return ISOCHRON_HIST_SUB_BUCKETS * shift + (val >> shift);
+}
+
+static __u64 isochron_hist_lowest(size_t index)
+{
+	int shift;
+
+	if (index < 2 * ISOCHRON_HIST_SUB_BUCKETS)
+		return index;
+
+	shift = index / ISOCHRON_HIST_SUB_BUCKETS - 1;
+
+	return (__u64)(index - ISOCHRON_HIST_SUB_BUCKETS * shift) << shift;
+}
+
+static __u64 isochron_hist_highest(size_t index)
+{
+	if (index == ISOCHRON_HIST_NUM_BUCKETS - 1)
+		return ULLONG_MAX;
+
+	return isochron_hist_lowest(index + 1) - 1;
+}
+
+static void isochron_hist_add(struct isochron_metric_hist *hist, __s64 val)
+{
+	if (val < 0)
+		hist->neg[isochron_hist_index(-(__u64)val)]++;
+	else
+		hist->pos[isochron_hist_index(val)]++;
+}
+
+static __s64 isochron_hist_bucket_select(const struct isochron_metric_hist *hist,
+					 __u64 rank)
+{
+	__u64 count = 0;
+	size_t i;
+
+	for (i = ISOCHRON_HIST_NUM_BUCKETS; i-- > 0; ) {
+		count += hist->neg[i];
+		if (count > rank)
+			return -(__s64)isochron_hist_lowest(i);
+	}
+
+	for (i = 0; i < ISOCHRON_HIST_NUM_BUCKETS; i++) {
+		count += hist->pos[i];
+		if (count > rank)
+			return isochron_hist_highest(i);
+	}
+
+	return 0;
+}
 
-	entry->seqid = v->seqid;
-	entry->wakeup_to_hw_ts = v->tx_hwts - v->tx_wakeup;
-	entry->hw_rx_deadline_delta = v->rx_hwts - v->tx_scheduled;
+/* Returns the highest value equivalent to the bucket holding the
+ * rank-th smallest value (starting from 0), clamped to the observed range
+ * of the metric, since the bucket may extend beyond it.
+ */
+static __s64 isochron_hist_select(const struct isochron_metric_hist *hist,
+				  const struct isochron_metric_stats *ms,
+				  __u64 rank)
+{
+	__s64 val = isochron_hist_bucket_select(hist, rank);
+
+	return min(max(val, ms->min), ms->max);
+}
+
+static void isochron_swap(__s64 *a, __s64 *b)
+{
+	__s64 tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/* Quickselect: partially reorder arr[lo..hi] such that arr[k] holds the
+ * value it would have if the array were sorted, with no larger values to
+ * its left and no smaller ones to its right.
+ */
+static __s64 isochron_select(__s64 *arr, long lo, long hi, long k)
+{
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		long i = lo, j = hi;
+		__s64 pivot;
+
+		/* Median of three */
+		if (arr[mid] < arr[lo])
+			isochron_swap(&arr[mid], &arr[lo]);
+		if (arr[hi] < arr[lo])
+			isochron_swap(&arr[hi], &arr[lo]);
+		if (arr[hi] < arr[mid])
+			isochron_swap(&arr[hi], &arr[mid]);
+		pivot = arr[mid];
+
+		while (i <= j) {
+			while (arr[i] < pivot)
+				i++;
+			while (arr[j] > pivot)
+				j--;
+			if (i <= j)
+				isochron_swap(&arr[i++], &arr[j--]);
+		}
+
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+
+	return arr[k];
+}
+
+static int isochron_stats_num_metrics(const struct isochron_stats *stats)
+{
+	return __ISOCHRON_METRIC_MAX + stats->num_user_metrics;
+}
+
+static int isochron_stats_init(struct isochron_stats *stats, size_t capacity,
+			       bool exact, bool hist,
+			       const struct isochron_user_metric *user_metrics,
+			       int num_user_metrics)
+{
+	int i;
+
+	stats->user_metrics = user_metrics;
+	stats->num_user_metrics = num_user_metrics;
+
+	if (hist) {
+		stats->hists = calloc(isochron_stats_num_metrics(stats),
+				      sizeof(*stats->hists));
+		if (!stats->hists)
+			return -ENOMEM;
+	}
+
+	if (!exact)
+		return 0;
+
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++) {
+		stats->columns[i] = calloc(capacity, sizeof(__s64));
+		if (!stats->columns[i])
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void isochron_stats_teardown(struct isochron_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < ISOCHRON_STATS_MAX_METRICS; i++)
+		free(stats->columns[i]);
+	free(stats->hists);
+}
+
+static void isochron_compute_metrics(const struct isochron_printf_variables *v,
+				     __s64 *metrics, bool taprio, bool txtime)
+{
+	metrics[ISOCHRON_METRIC_WAKEUP_TO_HW_TS] = v->tx_hwts - v->tx_wakeup;
+	metrics[ISOCHRON_METRIC_HW_RX_DEADLINE_DELTA] = v->rx_hwts -
+							v->tx_scheduled;
 	/* When tc-taprio or tc-etf offload is enabled, we know that the
 	 * MAC TX timestamp will be larger than the gate event, because the
 	 * application's schedule should be the same as the NIC's schedule.
@@ -775,15 +1522,31 @@ static void isochron_process_stat(const struct isochron_printf_variables *v,
 	 * losing deadlines".
 	 */
 	if (taprio || txtime)
-		entry->latency_budget = v->tx_hwts - v->tx_scheduled;
+		metrics[ISOCHRON_METRIC_LATENCY_BUDGET] = v->tx_hwts -
+							  v->tx_scheduled;
 	else
-		entry->latency_budget = v->tx_scheduled - v->tx_hwts;
-	entry->path_delay = v->rx_hwts - v->tx_hwts;
-	entry->wakeup_latency = v->tx_wakeup -
-				(v->tx_scheduled - v->advance_time);
-	entry->sender_latency = v->tx_swts - v->tx_wakeup;
-	entry->driver_latency = v->tx_swts - v->tx_sched;
-	entry->arrival_latency = v->arrival - v->rx_hwts;
+		metrics[ISOCHRON_METRIC_LATENCY_BUDGET] = v->tx_scheduled -
+							  v->tx_hwts;
+	metrics[ISOCHRON_METRIC_PATH_DELAY] = v->rx_hwts - v->tx_hwts;
+	metrics[ISOCHRON_METRIC_WAKEUP_LATENCY] = v->tx_wakeup -
+		(v->tx_scheduled - v->advance_time);
+	metrics[ISOCHRON_METRIC_SENDER_LATENCY] = v->tx_swts - v->tx_wakeup;
+	metrics[ISOCHRON_METRIC_DRIVER_LATENCY] = v->tx_swts - v->tx_sched;
+	metrics[ISOCHRON_METRIC_ARRIVAL_LATENCY] = v->arrival - v->rx_hwts;
+}
+
+static void isochron_process_stat(const struct isochron_printf_variables *v,
+				  struct isochron_stats *stats,
+				  bool taprio, bool txtime)
+{
+	__s64 metrics[ISOCHRON_STATS_MAX_METRICS];
+	int i;
+
+	isochron_compute_metrics(v, metrics, taprio, txtime);
+
+	for (i = 0; i < stats->num_user_metrics; i++)
+		metrics[__ISOCHRON_METRIC_MAX + i] =
+			isochron_expr_eval(&stats->user_metrics[i].expr, v);
 
 	if (v->tx_hwts > v->tx_scheduled)
 		stats->hw_tx_deadline_misses++;
@@ -791,54 +1554,189 @@ static void isochron_process_stat(const struct isochron_printf_variables *v,
 	stats->frame_count++;
 	stats->tx_sync_offset_mean += v->tx_hwts - v->tx_swts;
 	stats->rx_sync_offset_mean += v->rx_hwts - v->rx_swts;
-	stats->path_delay_mean += entry->path_delay;
+	stats->path_delay_mean += metrics[ISOCHRON_METRIC_PATH_DELAY];
+
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++) {
+		isochron_metric_update(&stats->metrics[i], metrics[i],
+				       v->seqid, stats->frame_count);
+		if (stats->columns[i])
+			stats->columns[i][stats->frame_count - 1] = metrics[i];
+		if (stats->hists)
+			isochron_hist_add(&stats->hists[i], metrics[i]);
+	}
+}
 
-	LIST_INSERT_HEAD(&stats->entries, entry, list);
+static const char *isochron_metric_name(enum isochron_metric metric,
+					bool taprio, bool txtime)
+{
+	switch (metric) {
+	case ISOCHRON_METRIC_WAKEUP_TO_HW_TS:
+		return "Wakeup to HW TX timestamp";
+	case ISOCHRON_METRIC_HW_RX_DEADLINE_DELTA:
+		return "TX time to HW RX timestamp";
+	case ISOCHRON_METRIC_LATENCY_BUDGET:
+		return taprio || txtime ? "MAC latency" :
+		       "Application latency budget";
+	case ISOCHRON_METRIC_PATH_DELAY:
+		return "Path delay";
+	case ISOCHRON_METRIC_WAKEUP_LATENCY:
+		return "Wakeup latency";
+	case ISOCHRON_METRIC_SENDER_LATENCY:
+		return "Sender latency";
+	case ISOCHRON_METRIC_DRIVER_LATENCY:
+		return "Driver latency";
+	case ISOCHRON_METRIC_ARRIVAL_LATENCY:
+		return "Arrival latency";
+	default:
+		return "Unknown";
+	}
+}
+
+static const char *isochron_stats_metric_name(const struct isochron_stats *stats,
+					      int metric, bool taprio,
+					      bool txtime)
+{
+	if (metric >= __ISOCHRON_METRIC_MAX)
+		return stats->user_metrics[metric - __ISOCHRON_METRIC_MAX].name;
+
+	return isochron_metric_name(metric, taprio, txtime);
+}
+
+/* Names of the metrics as given on the command line */
+static const char * const isochron_metric_keys[__ISOCHRON_METRIC_MAX] = {
+	[ISOCHRON_METRIC_WAKEUP_TO_HW_TS] = "wakeup-to-hw-ts",
+	[ISOCHRON_METRIC_HW_RX_DEADLINE_DELTA] = "hw-rx-deadline-delta",
+	[ISOCHRON_METRIC_LATENCY_BUDGET] = "latency-budget",
+	[ISOCHRON_METRIC_PATH_DELAY] = "path-delay",
+	[ISOCHRON_METRIC_WAKEUP_LATENCY] = "wakeup-latency",
+	[ISOCHRON_METRIC_SENDER_LATENCY] = "sender-latency",
+	[ISOCHRON_METRIC_DRIVER_LATENCY] = "driver-latency",
+	[ISOCHRON_METRIC_ARRIVAL_LATENCY] = "arrival-latency",
+};
+
+int isochron_metric_from_key(const char *key)
+{
+	int i;
+
+	for (i = 0; i < __ISOCHRON_METRIC_MAX; i++)
+		if (!strcmp(key, isochron_metric_keys[i]))
+			return i;
+
+	return -EINVAL;
 }
 
-/* For a given metric, iterate through the list of metric structures of each
- * packet and calculate minimum, maximum, average, standard deviation.
+/* Nearest-rank percentiles. The requested percentiles are sorted, so each
+ * selection only needs to look at the values right of the previous one.
  */
-static void isochron_metric_compute_stats(const struct isochron_stats *stats,
-					  struct isochron_metric_stats *ms,
-					  int metric_offset,
-					  bool interpret_in_reverse)
-{
-	struct isochron_packet_metrics *entry;
-	double sumsqr = 0;
-
-	ms->seqid_of_max = 1;
-	ms->seqid_of_min = 1;
-	ms->min = LONG_MAX;
-	ms->max = LONG_MIN;
-	ms->mean = 0;
-
-	LIST_FOREACH(entry, &stats->entries, list) {
-		__s64 *metric = (__s64 *)((char *)entry + metric_offset);
-		__s64 val = interpret_in_reverse ? -(*metric) : *metric;
-
-		if (val < ms->min) {
-			ms->min = val;
-			ms->seqid_of_min = entry->seqid;
-		}
-		if (val > ms->max) {
-			ms->max = val;
-			ms->seqid_of_max = entry->seqid;
+static void isochron_print_percentiles(struct isochron_stats *stats,
+				       const double *percentiles,
+				       int num_percentiles, bool taprio,
+				       bool txtime)
+{
+	size_t n = stats->frame_count;
+	int i, j;
+
+	printf("Percentiles (%s):\n", stats->columns[0] ? "exact" :
+	       "approximate");
+
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++) {
+		size_t lo = 0;
+
+		printf("%s:", isochron_stats_metric_name(stats, i, taprio,
+							 txtime));
+
+		for (j = 0; j < num_percentiles; j++) {
+			double rank = ceil(percentiles[j] * n / 100.0);
+			size_t k = rank < 1 ? 0 : (size_t)rank - 1;
+			__s64 val;
+
+			if (k >= n)
+				k = n - 1;
+
+			if (stats->columns[i]) {
+				val = isochron_select(stats->columns[i], lo,
+						      n - 1, k);
+				lo = k;
+			} else {
+				val = isochron_hist_select(&stats->hists[i],
+							   &stats->metrics[i],
+							   k);
+			}
+
+			printf(" p%.10g %lld", percentiles[j], val);
 		}
-		ms->mean += val;
+
+		printf("\n");
+	}
+}
+
+/* Dump the non-empty buckets of all metrics in CSV format, as the lowest
+ * value of the bucket and the number of packets in it.
+ */
+static int isochron_dump_histograms(const struct isochron_stats *stats,
+				    const char *file, bool taprio,
+				    bool txtime)
+{
+	FILE *fp;
+	size_t j;
+	int i;
+
+	fp = fopen(file, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %m\n", file);
+		return -errno;
+	}
+
+	fprintf(fp, "metric,value,count\n");
+
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++) {
+		const struct isochron_metric_hist *hist = &stats->hists[i];
+		const char *name = isochron_stats_metric_name(stats, i, taprio,
+							      txtime);
+
+		for (j = ISOCHRON_HIST_NUM_BUCKETS; j-- > 0; )
+			if (hist->neg[j])
+				fprintf(fp, "%s,%lld,%llu\n", name,
+					-(__s64)isochron_hist_highest(j),
+					hist->neg[j]);
+
+		for (j = 0; j < ISOCHRON_HIST_NUM_BUCKETS; j++)
+			if (hist->pos[j])
+				fprintf(fp, "%s,%llu,%llu\n", name,
+					isochron_hist_lowest(j),
+					hist->pos[j]);
+	}
+
+	if (fclose(fp)) {
+		fprintf(stderr, "Failed to write %s: %m\n", file);
+		return -errno;
 	}
 
-	ms->mean /= (double)stats->frame_count;
+	return 0;
+}
+
+static void isochron_stats_finalize(struct isochron_stats *stats)
+{
+	int i;
 
-	LIST_FOREACH(entry, &stats->entries, list) {
-		__s64 *metric = (__s64 *)((char *)entry + metric_offset);
-		__s64 val = interpret_in_reverse ? -(*metric) : *metric;
-		double deviation = (double)val - ms->mean;
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++) {
+		struct isochron_metric_stats *ms = &stats->metrics[i];
 
-		sumsqr += deviation * deviation;
+		ms->stddev = sqrt(ms->m2 / (double)stats->frame_count);
 	}
+}
 
-	ms->stddev = sqrt(sumsqr / (double)stats->frame_count);
+/* Statistics of the metric's opposite, -x */
+static void isochron_metric_stats_reverse(const struct isochron_metric_stats *ms,
+					  struct isochron_metric_stats *rev)
+{
+	rev->min = -ms->max;
+	rev->max = -ms->min;
+	rev->seqid_of_min = ms->seqid_of_max;
+	rev->seqid_of_max = ms->seqid_of_min;
+	rev->mean = -ms->mean;
+	rev->m2 = ms->m2;
+	rev->stddev = ms->stddev;
 }
 
 static void isochron_print_metric_stats(const char *name,
@@ -850,412 +1748,3487 @@ static void isochron_print_metric_stats(const char *name,
 	       ms->seqid_of_min, ms->seqid_of_max);
 }
 
-int isochron_print_stats(struct isochron_log *send_log,
-			 struct isochron_log *rcv_log,
-			 const char *printf_fmt, const char *printf_args,
-			 unsigned long start, unsigned long stop, bool summary,
-			 bool omit_sync, bool taprio, bool txtime,
-			 __s64 base_time, __s64 advance_time, __s64 shift_time,
-			 __s64 cycle_time, __s64 window_size)
+/* Combine the statistics of a later range of packets into @dst, using
+ * Chan's parallel variant of Welford's algorithm. On equal values, the
+ * later range has the highest sequence number and wins.
+ */
+static void isochron_metric_merge(struct isochron_metric_stats *dst,
+				  int dst_count,
+				  const struct isochron_metric_stats *src,
+				  int src_count)
 {
-	struct isochron_rcv_pkt_data dummy_rcv_pkt = {};
-	struct isochron_metric_stats sender_latency_ms;
-	struct isochron_metric_stats wakeup_latency_ms;
-	struct isochron_metric_stats driver_latency_ms;
-	struct isochron_packet_metrics *entry, *tmp;
-	struct isochron_send_pkt_data *pkt_arr;
-	struct isochron_stats stats = {0};
-	struct isochron_metric_stats ms;
-	__u64 not_tx_timestamped = 0;
-	__u64 not_received = 0;
-	size_t pkt_arr_size;
-	__u32 seqid;
-	int rc = 0;
+	double delta, count = dst_count + src_count;
 
-	LIST_INIT(&stats.entries);
+	if (!src_count)
+		return;
 
-	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
-	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+	if (!dst_count) {
+		*dst = *src;
+		return;
+	}
 
-	if (start == 0 || start > pkt_arr_size ||
-	    stop == 0 || stop > pkt_arr_size) {
-		fprintf(stderr, "Trying to index an out-of-bounds element\n");
-		return -ERANGE;
+	if (src->min <= dst->min) {
+		dst->min = src->min;
+		dst->seqid_of_min = src->seqid_of_min;
+	}
+	if (src->max >= dst->max) {
+		dst->max = src->max;
+		dst->seqid_of_max = src->seqid_of_max;
 	}
 
-	for (seqid = start; seqid <= stop; seqid++) {
-		struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
-		struct isochron_rcv_pkt_data *rcv_pkt;
-		struct isochron_printf_variables v;
-		bool missing = false;
+	delta = src->mean - dst->mean;
+	dst->mean += delta * src_count / count;
+	dst->m2 += src->m2 + delta * delta * dst_count * src_count / count;
+}
 
-		if (seqid != __be32_to_cpu(send_pkt->seqid))
-			/* Incomplete log, send_pkt->seqid is 0, exit */
-			break;
+static void isochron_stats_merge(struct isochron_stats *dst,
+				 const struct isochron_stats *src)
+{
+	int i;
+
+	for (i = 0; i < isochron_stats_num_metrics(dst); i++) {
+		isochron_metric_merge(&dst->metrics[i], dst->frame_count,
+				      &src->metrics[i], src->frame_count);
+		/* Keep the values of all ranges contiguous */
+		if (dst->columns[i])
+			memmove(dst->columns[i] + dst->frame_count,
+				src->columns[i],
+				src->frame_count * sizeof(__s64));
+	}
 
-		if (!__be64_to_cpu(send_pkt->swts) ||
-		    !__be64_to_cpu(send_pkt->sched_ts) ||
-		    !__be64_to_cpu(send_pkt->hwts)) {
-			not_tx_timestamped++;
-			missing = true;
-		}
+	dst->frame_count += src->frame_count;
+	dst->hw_tx_deadline_misses += src->hw_tx_deadline_misses;
+	dst->not_tx_timestamped += src->not_tx_timestamped;
+	dst->not_received += src->not_received;
+	dst->sync_lost += src->sync_lost;
+	dst->tx_sync_offset_mean += src->tx_sync_offset_mean;
+	dst->rx_sync_offset_mean += src->rx_sync_offset_mean;
+	dst->path_delay_mean += src->path_delay_mean;
+}
 
-		/* For packets that didn't reach the receiver, at least report
-		 * the TX timestamps and seqid for debugging purposes, and use
+static void isochron_hist_merge(struct isochron_metric_hist *dst,
+				const struct isochron_metric_hist *src)
+{
+	size_t i;
+
+	for (i = 0; i < ISOCHRON_HIST_NUM_BUCKETS; i++) {
+		dst->pos[i] += src->pos[i];
+		dst->neg[i] += src->neg[i];
+	}
+}
+
+/* The log is incomplete after the first packet with an unexpected seqid.
+ * Returns the last seqid up to @stop which can be reported on.
+ */
+static unsigned long
+isochron_log_last_seqid(const struct isochron_send_pkt_data *pkt_arr,
+			unsigned long start, unsigned long stop)
+{
+	unsigned long seqid;
+
+	for (seqid = start; seqid <= stop; seqid++)
+		if (seqid != __be32_to_cpu(pkt_arr[seqid - 1].seqid))
+			break;
+
+	return seqid - 1;
+}
+
+/* The range of packets to report on is split into fixed-size blocks, which
+ * are processed by worker threads in any order. The partial statistics of
+ * the blocks are merged, and their printf output is written, in the order
+ * of the blocks, so the report does not depend on the number of threads.
+ */
+struct isochron_report_job {
+	const struct isochron_printf_ctx *printf_ctx;
+	struct isochron_log *send_log;
+	struct isochron_log *rcv_log;
+	/* Statistics of the entire range, and partial ones of each block */
+	struct isochron_stats *total;
+	struct isochron_stats *blocks;
+	size_t num_blocks;
+	unsigned long start;
+	unsigned long stop;
+	bool summary;
+	bool taprio;
+	bool txtime;
+	__s64 base_time;
+	__s64 advance_time;
+	__s64 shift_time;
+	__s64 cycle_time;
+	__s64 window_size;
+	size_t next_block;
+	/* Index of the block whose printf output goes next */
+	size_t next_output;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int rc;
+};
+
+struct isochron_report_worker {
+	struct isochron_report_job *job;
+	struct isochron_metric_hist *hists;
+	char *buf;
+	pthread_t tid;
+	bool threaded;
+};
+
+static void isochron_report_fail(struct isochron_report_job *job, int rc)
+{
+	pthread_mutex_lock(&job->lock);
+	if (!job->rc)
+		__atomic_store_n(&job->rc, rc, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/* Wait for the turn of this block, then write its printf output */
+static int isochron_report_output(struct isochron_report_job *job,
+				  size_t block, const char *buf, size_t len)
+{
+	int rc;
+
+	pthread_mutex_lock(&job->lock);
+	while (job->next_output != block && !job->rc)
+		pthread_cond_wait(&job->cond, &job->lock);
+	rc = job->rc;
+	pthread_mutex_unlock(&job->lock);
+	if (rc)
+		return rc;
+
+	rc = isochron_printf_write(buf, len);
+	if (rc)
+		return rc;
+
+	pthread_mutex_lock(&job->lock);
+	job->next_output++;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+
+	return 0;
+}
+
+static int isochron_report_block(struct isochron_report_worker *w,
+				 size_t block)
+{
+	struct isochron_report_job *job = w->job;
+	struct isochron_stats *stats = &job->blocks[block];
+	struct isochron_rcv_pkt_data dummy_rcv_pkt = {};
+	struct isochron_send_pkt_data *pkt_arr;
+	unsigned long first, last, seqid;
+	char *p = w->buf;
+	int i;
+
+	pkt_arr = (struct isochron_send_pkt_data *)job->send_log->buf;
+	first = job->start + block * ISOCHRON_REPORT_BLOCK_SIZE;
+	last = first + ISOCHRON_REPORT_BLOCK_SIZE - 1;
+	if (last > job->stop)
+		last = job->stop;
+
+	stats->user_metrics = job->total->user_metrics;
+	stats->num_user_metrics = job->total->num_user_metrics;
+	for (i = 0; i < isochron_stats_num_metrics(stats); i++)
+		if (job->total->columns[i])
+			stats->columns[i] = job->total->columns[i] +
+					    block * ISOCHRON_REPORT_BLOCK_SIZE;
+	stats->hists = w->hists;
+
+	for (seqid = first; seqid <= last; seqid++) {
+		struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
+		struct isochron_rcv_pkt_data *rcv_pkt;
+		struct isochron_printf_variables v;
+		bool missing = false;
+
+		if (!__be64_to_cpu(send_pkt->swts) ||
+		    !__be64_to_cpu(send_pkt->sched_ts) ||
+		    !__be64_to_cpu(send_pkt->hwts)) {
+			stats->not_tx_timestamped++;
+			missing = true;
+		}
+
+		/* For packets that didn't reach the receiver, at least report
+		 * the TX timestamps and seqid for debugging purposes, and use
 		 * a dummy received packet with all RX timestamps set to zero
 		 */
-		rcv_pkt = isochron_rcv_log_find(rcv_log, send_pkt->seqid);
+		rcv_pkt = isochron_rcv_log_find(job->rcv_log, send_pkt->seqid);
 		if (!rcv_pkt) {
 			rcv_pkt = &dummy_rcv_pkt;
 			missing = true;
-			not_received++;
+			stats->not_received++;
+		}
+
+		isochron_printf_vars_get(send_pkt, rcv_pkt, job->base_time,
+					 job->advance_time, job->shift_time,
+					 job->cycle_time, job->window_size, &v);
+
+		if (w->buf)
+			p = isochron_printf_one_packet(job->printf_ctx, &v, p);
+
+		if (__be32_to_cpu(send_pkt->flags) & ISOCHRON_PKT_SYNC_LOST) {
+			stats->sync_lost++;
+			continue;
+		}
+
+		if (job->summary && !missing)
+			isochron_process_stat(&v, stats, job->taprio,
+					      job->txtime);
+	}
+
+	if (!w->buf)
+		return 0;
+
+	return isochron_report_output(job, block, w->buf, p - w->buf);
+}
+
+static void *isochron_report_worker(void *arg)
+{
+	struct isochron_report_worker *w = arg;
+	struct isochron_report_job *job = w->job;
+	size_t block;
+	int rc;
+
+	while (!__atomic_load_n(&job->rc, __ATOMIC_RELAXED)) {
+		block = __atomic_fetch_add(&job->next_block, 1,
+					   __ATOMIC_RELAXED);
+		if (block >= job->num_blocks)
+			break;
+
+		rc = isochron_report_block(w, block);
+		if (rc) {
+			isochron_report_fail(job, rc);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Run the job on @num_threads threads, then merge the partial statistics of
+ * the blocks, in order, into the total.
+ */
+static int isochron_report_run(struct isochron_report_job *job,
+			       long num_threads)
+{
+	const struct isochron_printf_ctx *printf_ctx = job->printf_ctx;
+	struct isochron_report_worker *workers;
+	size_t b;
+	long i;
+	int j, rc;
+
+	if ((size_t)num_threads > job->num_blocks)
+		num_threads = job->num_blocks;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	workers = calloc(num_threads, sizeof(*workers));
+	if (!workers)
+		return -ENOMEM;
+
+	for (i = 0; i < num_threads; i++) {
+		struct isochron_report_worker *w = &workers[i];
+
+		w->job = job;
+
+		if (printf_ctx->num_ops) {
+			w->buf = malloc(ISOCHRON_REPORT_BLOCK_SIZE *
+					printf_ctx->max_len);
+			if (!w->buf) {
+				rc = -ENOMEM;
+				goto out;
+			}
+		}
+
+		if (job->total->hists) {
+			w->hists = calloc(isochron_stats_num_metrics(job->total),
+					  sizeof(*w->hists));
+			if (!w->hists) {
+				rc = -ENOMEM;
+				goto out;
+			}
+		}
+	}
+
+	/* The calling thread is the first worker */
+	for (i = 1; i < num_threads; i++) {
+		rc = pthread_create(&workers[i].tid, NULL,
+				    isochron_report_worker, &workers[i]);
+		if (rc) {
+			pr_err(-rc, "failed to create worker thread: %m\n");
+			isochron_report_fail(job, -rc);
+			break;
+		}
+
+		workers[i].threaded = true;
+	}
+
+	isochron_report_worker(&workers[0]);
+
+	for (i = 1; i < num_threads; i++)
+		if (workers[i].threaded)
+			pthread_join(workers[i].tid, NULL);
+
+	rc = job->rc;
+	if (rc)
+		goto out;
+
+	for (b = 0; b < job->num_blocks; b++)
+		isochron_stats_merge(job->total, &job->blocks[b]);
+
+	for (i = 0; i < num_threads && job->total->hists; i++)
+		for (j = 0; j < isochron_stats_num_metrics(job->total); j++)
+			isochron_hist_merge(&job->total->hists[j],
+					    &workers[i].hists[j]);
+out:
+	for (i = 0; i < num_threads; i++) {
+		free(workers[i].hists);
+		free(workers[i].buf);
+	}
+	free(workers);
+
+	return rc;
+}
+
+static void isochron_user_metrics_free(struct isochron_user_metric *user_metrics,
+				       int num_user_metrics)
+{
+	int i;
+
+	for (i = 0; i < num_user_metrics; i++)
+		isochron_expr_free(&user_metrics[i].expr);
+}
+
+/* Parse a semicolon-separated list of name=expression pairs */
+static int isochron_user_metrics_parse(struct isochron_user_metric *user_metrics,
+				       int *num_user_metrics, const char *str)
+{
+	const char *entry = str, *end, *eq, *name;
+	struct isochron_user_metric *um;
+	size_t name_len;
+	int rc;
+
+	*num_user_metrics = 0;
+
+	while (*entry) {
+		end = strchr(entry, ';');
+		if (!end)
+			end = entry + strlen(entry);
+
+		eq = memchr(entry, '=', end - entry);
+		if (!eq) {
+			fprintf(stderr, "Expected name=expression in \"%.*s\"\n",
+				(int)(end - entry), entry);
+			rc = -EINVAL;
+			goto err;
+		}
+
+		for (name = entry; name < eq && isspace((unsigned char)*name);
+		     name++)
+			;
+		for (name_len = eq - name;
+		     name_len && isspace((unsigned char)name[name_len - 1]);
+		     name_len--)
+			;
+
+		if (!name_len || name_len >= ISOCHRON_USER_METRIC_NAME_LEN) {
+			fprintf(stderr, "Invalid metric name \"%.*s\"\n",
+				(int)(eq - entry), entry);
+			rc = -EINVAL;
+			goto err;
+		}
+
+		if (*num_user_metrics == ISOCHRON_MAX_USER_METRICS) {
+			fprintf(stderr, "Too many metrics, maximum is %d\n",
+				ISOCHRON_MAX_USER_METRICS);
+			rc = -EINVAL;
+			goto err;
+		}
+
+		um = &user_metrics[*num_user_metrics];
+		memcpy(um->name, name, name_len);
+		um->name[name_len] = 0;
+
+		rc = isochron_expr_compile(&um->expr, eq + 1, end - eq - 1,
+					   isochron_expr_var_get, NULL);
+		if (rc)
+			goto err;
+
+		(*num_user_metrics)++;
+
+		entry = *end ? end + 1 : end;
+	}
+
+	return 0;
+
+err:
+	isochron_user_metrics_free(user_metrics, *num_user_metrics);
+	*num_user_metrics = 0;
+	return rc;
+}
+
+/* Print the summary of @stats, which accounts for @num_packets packets in
+ * total. Does not modify the running sums, so that it can be called
+ * repeatedly while following a log that is still being written. Returns
+ * false if no packet could be accounted for.
+ */
+static bool isochron_print_summary(struct isochron_stats *stats,
+				   size_t num_packets, bool omit_sync,
+				   bool taprio, bool txtime, __s64 cycle_time,
+				   const struct isochron_user_metric *user_metrics,
+				   int num_user_metrics)
+{
+	struct isochron_metric_stats *sender_latency_ms;
+	struct isochron_metric_stats *wakeup_latency_ms;
+	struct isochron_metric_stats *driver_latency_ms;
+	double tx_sync_offset_mean, rx_sync_offset_mean, path_delay_mean;
+	struct isochron_metric_stats *ms;
+	struct isochron_metric_stats rev;
+	int i;
+
+	if (stats->not_tx_timestamped) {
+		printf("Packets not completely TX timestamped: %llu (%.3lf%%)\n",
+		       stats->not_tx_timestamped,
+		       100.0f * stats->not_tx_timestamped / num_packets);
+	}
+
+	if (stats->not_received) {
+		printf("Packets not received: %llu (%.3lf%%)\n",
+		       stats->not_received,
+		       100.0f * stats->not_received / num_packets);
+	}
+
+	if (stats->sync_lost) {
+		printf("Packets excluded due to sync loss: %llu (%.3lf%%)\n",
+		       stats->sync_lost,
+		       100.0f * stats->sync_lost / num_packets);
+	}
+
+	if (!stats->frame_count) {
+		printf("Could not calculate statistics, no packets were received\n");
+		return false;
+	}
+
+	tx_sync_offset_mean = stats->tx_sync_offset_mean / stats->frame_count;
+	rx_sync_offset_mean = stats->rx_sync_offset_mean / stats->frame_count;
+	path_delay_mean = stats->path_delay_mean / stats->frame_count;
+
+	if (llabs((long long)tx_sync_offset_mean) > NSEC_PER_SEC &&
+	    !omit_sync) {
+		printf("Sender PHC not synchronized (mean PHC to system time "
+		       "diff %.3lf ns larger than 1 second)\n",
+		       tx_sync_offset_mean);
+	}
+	if (llabs((long long)rx_sync_offset_mean) > NSEC_PER_SEC &&
+	    !omit_sync) {
+		printf("Receiver PHC not synchronized (mean PHC to system time "
+		       "diff %.3lf ns larger than 1 second)\n",
+		       rx_sync_offset_mean);
+	}
+	if (llabs((long long)path_delay_mean) > NSEC_PER_SEC &&
+	    !omit_sync) {
+		printf("Sender and receiver not synchronized (mean path delay "
+		       "%.3lf ns larger than 1 second)\n",
+		       path_delay_mean);
+	}
+
+	isochron_stats_finalize(stats);
+
+	printf("Summary:\n");
+
+	/* Path delay */
+	isochron_print_metric_stats("Path delay",
+				    &stats->metrics[ISOCHRON_METRIC_PATH_DELAY]);
+
+	/* Wakeup to HW TX timestamp */
+	isochron_print_metric_stats("Wakeup to HW TX timestamp",
+				    &stats->metrics[ISOCHRON_METRIC_WAKEUP_TO_HW_TS]);
+
+	/* HW RX deadline delta (TX time to HW RX timestamp) */
+	ms = &stats->metrics[ISOCHRON_METRIC_HW_RX_DEADLINE_DELTA];
+	if (ms->mean > 0) {
+		isochron_print_metric_stats("Packets arrived later than scheduled. TX time to HW RX timestamp",
+					    ms);
+	} else {
+		isochron_metric_stats_reverse(ms, &rev);
+		isochron_print_metric_stats("Packets arrived earlier than scheduled. HW RX timestamp to TX time",
+					    &rev);
+	}
+
+	/* Latency budget, interpreted differently depending on testing mode */
+	ms = &stats->metrics[ISOCHRON_METRIC_LATENCY_BUDGET];
+	if (taprio || txtime)
+		isochron_print_metric_stats("MAC latency", ms);
+	else
+		isochron_print_metric_stats("Application latency budget", ms);
+
+	sender_latency_ms = &stats->metrics[ISOCHRON_METRIC_SENDER_LATENCY];
+	isochron_print_metric_stats("Sender latency", sender_latency_ms);
+
+	/* Wakeup latency */
+	wakeup_latency_ms = &stats->metrics[ISOCHRON_METRIC_WAKEUP_LATENCY];
+	isochron_print_metric_stats("Wakeup latency", wakeup_latency_ms);
+
+	/* Driver latency */
+	driver_latency_ms = &stats->metrics[ISOCHRON_METRIC_DRIVER_LATENCY];
+	isochron_print_metric_stats("Driver latency", driver_latency_ms);
+
+	/* Arrival latency */
+	isochron_print_metric_stats("Arrival latency",
+				    &stats->metrics[ISOCHRON_METRIC_ARRIVAL_LATENCY]);
+
+	/* User-defined metrics */
+	for (i = 0; i < num_user_metrics; i++)
+		isochron_print_metric_stats(user_metrics[i].name,
+					    &stats->metrics[__ISOCHRON_METRIC_MAX + i]);
+
+	printf("Sending one packet takes on average %.3lf%% of the cycle time (min %.3lf%% max %.3lf%%)\n",
+	       100.0f * sender_latency_ms->mean / cycle_time,
+	       100.0f * sender_latency_ms->min / cycle_time,
+	       100.0f * sender_latency_ms->max / cycle_time);
+	printf("Waking up takes on average %.3lf%% of the cycle time (min %.3lf%% max %.3lf%%)\n",
+	       100.0f * wakeup_latency_ms->mean / cycle_time,
+	       100.0f * wakeup_latency_ms->min / cycle_time,
+	       100.0f * wakeup_latency_ms->max / cycle_time);
+	printf("Driver takes on average %.3lf%% of the cycle time to send a packet (min %.3lf%% max %.3lf%%)\n",
+	       100.0f * driver_latency_ms->mean / cycle_time,
+	       100.0f * driver_latency_ms->min / cycle_time,
+	       100.0f * driver_latency_ms->max / cycle_time);
+
+	/* HW TX deadline misses */
+	if (!taprio && !txtime)
+		printf("HW TX deadline misses: %d (%.3lf%%)\n",
+		       stats->hw_tx_deadline_misses,
+		       100.0f * stats->hw_tx_deadline_misses / stats->frame_count);
+
+	return true;
+}
+
+int isochron_print_stats(struct isochron_log *send_log,
+			 struct isochron_log *rcv_log,
+			 const char *printf_fmt, const char *printf_args,
+			 unsigned long start, unsigned long stop, bool summary,
+			 const double *percentiles, int num_percentiles,
+			 bool approximate, const char *histogram_file,
+			 bool omit_sync, bool taprio, bool txtime,
+			 __s64 base_time, __s64 advance_time, __s64 shift_time,
+			 __s64 cycle_time, __s64 window_size, long num_threads,
+			 const char *user_metrics_str)
+{
+	struct isochron_user_metric user_metrics[ISOCHRON_MAX_USER_METRICS];
+	struct isochron_send_pkt_data *pkt_arr;
+	struct isochron_printf_ctx printf_ctx;
+	struct isochron_report_job job = {0};
+	struct isochron_stats stats = {0};
+	int num_user_metrics = 0;
+	size_t pkt_arr_size;
+	int rc = 0;
+
+	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
+	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+
+	if (start == 0 || start > pkt_arr_size ||
+	    stop == 0 || stop > pkt_arr_size) {
+		fprintf(stderr, "Trying to index an out-of-bounds element\n");
+		return -ERANGE;
+	}
+
+	rc = isochron_printf_init(&printf_ctx, printf_fmt, printf_args);
+	if (rc)
+		return rc;
+
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (summary) {
+		rc = isochron_user_metrics_parse(user_metrics,
+						 &num_user_metrics,
+						 user_metrics_str);
+		if (rc)
+			goto out;
+
+		rc = isochron_stats_init(&stats, stop - start + 1,
+					 num_percentiles && !approximate,
+					 (num_percentiles && approximate) ||
+					 histogram_file, user_metrics,
+					 num_user_metrics);
+		if (rc) {
+			fprintf(stderr, "Failed to allocate memory for statistics\n");
+			goto out;
+		}
+	}
+
+	job.printf_ctx = &printf_ctx;
+	job.send_log = send_log;
+	job.rcv_log = rcv_log;
+	job.total = &stats;
+	job.start = start;
+	job.stop = isochron_log_last_seqid(pkt_arr, start, stop);
+	job.summary = summary;
+	job.taprio = taprio;
+	job.txtime = txtime;
+	job.base_time = base_time;
+	job.advance_time = advance_time;
+	job.shift_time = shift_time;
+	job.cycle_time = cycle_time;
+	job.window_size = window_size;
+	job.num_blocks = (job.stop - start + ISOCHRON_REPORT_BLOCK_SIZE) /
+			 ISOCHRON_REPORT_BLOCK_SIZE;
+	job.blocks = calloc(job.num_blocks, sizeof(*job.blocks));
+	if (!job.blocks && job.num_blocks) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = isochron_report_run(&job, num_threads);
+	if (rc || !summary)
+		goto out;
+
+	if (!isochron_print_summary(&stats, pkt_arr_size, omit_sync, taprio,
+				    txtime, cycle_time, user_metrics,
+				    num_user_metrics))
+		goto out;
+
+	if (num_percentiles)
+		isochron_print_percentiles(&stats, percentiles,
+					   num_percentiles, taprio, txtime);
+
+	if (histogram_file)
+		rc = isochron_dump_histograms(&stats, histogram_file, taprio,
+					      txtime);
+
+out:
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
+	free(job.blocks);
+	isochron_stats_teardown(&stats);
+	isochron_user_metrics_free(user_metrics, num_user_metrics);
+	isochron_printf_teardown(&printf_ctx);
+
+	return rc;
+}
+
+static int isochron_window_grow(struct isochron_stats *stats,
+				size_t *capacity)
+{
+	size_t new_capacity = *capacity ? 2 * *capacity : 1024;
+	__s64 *column;
+	int i;
+
+	for (i = 0; i < __ISOCHRON_METRIC_MAX; i++) {
+		column = realloc(stats->columns[i],
+				 new_capacity * sizeof(__s64));
+		if (!column)
+			return -ENOMEM;
+
+		stats->columns[i] = column;
+	}
+
+	*capacity = new_capacity;
+
+	return 0;
+}
+
+/* Print the statistics of one window, then reset them for the next one.
+ * Returns true if the maximum of any metric exceeded its threshold.
+ */
+static bool isochron_window_print(struct isochron_stats *stats, long index,
+				  __u32 first, __u32 last,
+				  const __s64 *thresholds, bool taprio,
+				  bool txtime)
+{
+	size_t n = stats->frame_count;
+	bool exceeded = false;
+	int i;
+
+	if (!n) {
+		printf("Window %ld seqid %u-%u: no packets received\n",
+		       index, first, last);
+		return false;
+	}
+
+	for (i = 0; i < __ISOCHRON_METRIC_MAX; i++) {
+		const struct isochron_metric_stats *ms = &stats->metrics[i];
+		double rank = ceil(99.0 * n / 100.0);
+		__s64 p99;
+
+		p99 = isochron_select(stats->columns[i], 0, n - 1,
+				      (size_t)rank - 1);
+
+		printf("Window %ld seqid %u-%u: %s: min %lld max %lld mean %.3lf p99 %lld",
+		       index, first, last,
+		       isochron_metric_name(i, taprio, txtime),
+		       ms->min, ms->max, ms->mean, p99);
+
+		if (thresholds && ms->max > thresholds[i]) {
+			printf(", max at seqid %d above threshold %lld",
+			       ms->seqid_of_max, thresholds[i]);
+			exceeded = true;
 		}
 
-		isochron_printf_vars_get(send_pkt, rcv_pkt, base_time,
-					 advance_time, shift_time, cycle_time,
-					 window_size, &v);
+		printf("\n");
+		memset(&stats->metrics[i], 0, sizeof(stats->metrics[i]));
+	}
+
+	stats->frame_count = 0;
+
+	return exceeded;
+}
+
+/* Windowed statistics, fed one packet at a time in seqid order, and printed
+ * as soon as a packet from the next window is seen.
+ */
+struct isochron_windows {
+	struct isochron_stats stats;
+	size_t capacity;
+	unsigned long window_packets;
+	__s64 window_time;
+	const __s64 *thresholds;
+	bool taprio;
+	bool txtime;
+	__u32 start;
+	__s64 first_scheduled;
+	long index;
+	__u32 first;
+	__u32 last;
+	long num_windows;
+	long num_exceeded;
+};
+
+static int isochron_windows_init(struct isochron_windows *w, __u32 start,
+				 unsigned long window_packets,
+				 __s64 window_time, const __s64 *thresholds,
+				 bool taprio, bool txtime)
+{
+	int rc;
+
+	memset(w, 0, sizeof(*w));
+	w->start = start;
+	w->window_packets = window_packets;
+	w->window_time = window_time;
+	w->thresholds = thresholds;
+	w->taprio = taprio;
+	w->txtime = txtime;
+	w->index = -1;
+
+	if (!window_packets)
+		return 0;
+
+	rc = isochron_stats_init(&w->stats, window_packets, true, false,
+				 NULL, 0);
+	if (rc)
+		return rc;
+
+	w->capacity = window_packets;
+
+	return 0;
+}
+
+static void isochron_windows_flush(struct isochron_windows *w)
+{
+	if (w->index < 0)
+		return;
+
+	w->num_windows++;
+	w->num_exceeded += isochron_window_print(&w->stats, w->index,
+						 w->first, w->last,
+						 w->thresholds, w->taprio,
+						 w->txtime);
+}
+
+/* Account for the packet with @seqid, whose variables are @v, or NULL if
+ * it has not been completely timestamped or received.
+ */
+static int isochron_windows_add(struct isochron_windows *w, __u32 seqid,
+				__s64 scheduled,
+				const struct isochron_printf_variables *v)
+{
+	long this_index;
+	int rc;
+
+	if (w->index < 0)
+		w->first_scheduled = scheduled;
+
+	if (w->window_packets)
+		this_index = (seqid - w->start) / w->window_packets;
+	else
+		this_index = (scheduled - w->first_scheduled) / w->window_time;
+
+	if (this_index != w->index) {
+		isochron_windows_flush(w);
+		w->index = this_index;
+		w->first = seqid;
+	}
+
+	w->last = seqid;
+
+	if (!v)
+		return 0;
+
+	if ((size_t)w->stats.frame_count == w->capacity) {
+		rc = isochron_window_grow(&w->stats, &w->capacity);
+		if (rc)
+			return rc;
+	}
+
+	isochron_process_stat(v, &w->stats, w->taprio, w->txtime);
+
+	return 0;
+}
+
+/* Print the last, possibly partial, window */
+static void isochron_windows_finish(struct isochron_windows *w)
+{
+	isochron_windows_flush(w);
+
+	if (w->thresholds)
+		printf("Windows above threshold: %ld out of %ld\n",
+		       w->num_exceeded, w->num_windows);
+}
+
+static void isochron_windows_teardown(struct isochron_windows *w)
+{
+	isochron_stats_teardown(&w->stats);
+}
+
+int isochron_print_windows(struct isochron_log *send_log,
+			   struct isochron_log *rcv_log,
+			   unsigned long start, unsigned long stop,
+			   unsigned long window_packets, __s64 window_time,
+			   const __s64 *thresholds, bool taprio, bool txtime,
+			   __s64 base_time, __s64 advance_time,
+			   __s64 shift_time, __s64 cycle_time,
+			   __s64 window_size)
+{
+	struct isochron_rcv_pkt_data dummy_rcv_pkt = {};
+	struct isochron_send_pkt_data *pkt_arr;
+	struct isochron_windows w;
+	size_t pkt_arr_size;
+	__u32 seqid;
+	int rc = 0;
+
+	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
+	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+
+	if (start == 0 || start > pkt_arr_size ||
+	    stop == 0 || stop > pkt_arr_size) {
+		fprintf(stderr, "Trying to index an out-of-bounds element\n");
+		return -ERANGE;
+	}
+
+	stop = isochron_log_last_seqid(pkt_arr, start, stop);
+	if (stop < start)
+		return 0;
+
+	rc = isochron_windows_init(&w, start, window_packets, window_time,
+				   thresholds, taprio, txtime);
+	if (rc)
+		goto out;
+
+	for (seqid = start; seqid <= stop; seqid++) {
+		struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
+		struct isochron_rcv_pkt_data *rcv_pkt;
+		struct isochron_printf_variables v;
+		bool missing = false;
+
+		if (!__be64_to_cpu(send_pkt->swts) ||
+		    !__be64_to_cpu(send_pkt->sched_ts) ||
+		    !__be64_to_cpu(send_pkt->hwts))
+			missing = true;
+
+		rcv_pkt = isochron_rcv_log_find(rcv_log, send_pkt->seqid);
+		if (!rcv_pkt) {
+			rcv_pkt = &dummy_rcv_pkt;
+			missing = true;
+		}
+
+		/* The packet still counts towards the window boundaries */
+		if (__be32_to_cpu(send_pkt->flags) & ISOCHRON_PKT_SYNC_LOST)
+			missing = true;
+
+		isochron_printf_vars_get(send_pkt, rcv_pkt, base_time,
+					 advance_time, shift_time, cycle_time,
+					 window_size, &v);
+
+		rc = isochron_windows_add(&w, seqid, v.tx_scheduled,
+					  missing ? NULL : &v);
+		if (rc)
+			goto out;
+	}
+
+	isochron_windows_finish(&w);
+
+out:
+	if (rc == -ENOMEM)
+		fprintf(stderr, "Failed to allocate memory for statistics\n");
+	isochron_windows_teardown(&w);
+
+	return rc;
+}
+
+/* Number of spectral peaks considered per period to print, since the
+ * harmonics of a non-sinusoidal disturbance collapse into a single period.
+ */
+#define ISOCHRON_PERIOD_CANDIDATES	4
+
+struct isochron_period {
+	size_t bin;
+	double magnitude;
+	/* Fundamental period, in cycles */
+	double cycles;
+	double correlation;
+	bool confirmed;
+};
+
+/* Replace the spectrum of the zero-padded samples with their linear
+ * autocorrelation, as the transform of the power spectrum. Since the power
+ * spectrum is real and even, the forward transform is its own inverse, up
+ * to a scale factor which is irrelevant after normalization. The real part
+ * of bin k of the result is the autocorrelation at a lag of k cycles.
+ */
+static int isochron_autocorrelate(double complex *spectrum, size_t n)
+{
+	double *p = (double *)spectrum;
+	size_t k;
+
+	/* The k-th double lives in bin k / 2, which was already consumed */
+	for (k = 0; k <= n / 2; k++) {
+		double mag = cabs(spectrum[k]);
+
+		p[k] = mag * mag;
+	}
+
+	for (k = 1; k < n / 2; k++)
+		p[n - k] = p[k];
+
+	return fft_real(spectrum, n);
+}
+
+/* Unbiased autocorrelation at @lag, normalized to the signal power */
+static double isochron_autocorr_at(const double complex *r, size_t num_cycles,
+				   size_t lag)
+{
+	if (creal(r[0]) <= 0)
+		return 0;
+
+	return creal(r[lag]) / creal(r[0]) * num_cycles / (num_cycles - lag);
+}
+
+/* Strongest autocorrelation of the lags which are within the frequency
+ * resolution of the spectrum around @center.
+ */
+static double isochron_autocorr_peak(const double complex *r,
+				     size_t num_cycles, double center,
+				     double spread, size_t *best_lag)
+{
+	size_t max_lag = num_cycles / 2, lo, hi, lag;
+	double corr, best = -INFINITY;
+
+	lo = center - spread - 1 < 1 ? 1 : (size_t)(center - spread - 1);
+	hi = min((size_t)ceil(center + spread + 1), max_lag);
+
+	for (lag = lo; lag <= hi; lag++) {
+		corr = isochron_autocorr_at(r, num_cycles, lag);
+		if (corr > best) {
+			best = corr;
+			*best_lag = lag;
+		}
+	}
+
+	return best;
+}
+
+/* A spectral peak may be a harmonic of a non-sinusoidal disturbance, such
+ * as a train of spikes, whose spectrum has peaks of similar magnitude at
+ * all multiples of the fundamental frequency. The fundamental period is
+ * the shortest multiple of the peak's period at which the signal strongly
+ * correlates with itself. Another disturbance makes the correlation peak
+ * at the common multiples of both periods, so the threshold is relative
+ * to that.
+ */
+static void isochron_period_fundamental(const double complex *r, size_t n,
+					size_t num_cycles,
+					struct isochron_period *period)
+{
+	double harmonic = (double)n / period->bin;
+	/* Half a bin of uncertainty in the frequency of the peak */
+	double spread = harmonic / (2 * period->bin);
+	size_t max_lag = num_cycles / 2, lag = 0;
+	double corr, best = 0;
+	size_t m;
+
+	period->cycles = harmonic;
+	period->confirmed = false;
+
+	for (m = 1; m * harmonic <= max_lag; m++) {
+		corr = isochron_autocorr_peak(r, num_cycles, m * harmonic,
+					      m * spread, &lag);
+		best = max(best, corr);
+	}
+
+	if (best <= 0)
+		return;
+
+	for (m = 1; m * harmonic <= max_lag; m++) {
+		corr = isochron_autocorr_peak(r, num_cycles, m * harmonic,
+					      m * spread, &lag);
+		if (corr >= 0.5 * best)
+			break;
+	}
+
+	period->correlation = corr;
+	period->confirmed = true;
+
+	/* The spectral estimate is more precise than an integer lag */
+	if (m == 1)
+		return;
+
+	period->cycles = lag;
+
+	/* Parabolic interpolation of the autocorrelation peak */
+	if (lag > 1 && lag < max_lag) {
+		double prev = isochron_autocorr_at(r, num_cycles, lag - 1);
+		double next = isochron_autocorr_at(r, num_cycles, lag + 1);
+		double denom = prev - 2 * corr + next;
+
+		if (denom < 0)
+			period->cycles += 0.5 * (prev - next) / denom;
+	}
+}
+
+static bool isochron_spectrum_is_peak(const double complex *spectrum,
+				      size_t n, size_t k, size_t lobe)
+{
+	double mag = cabs(spectrum[k]);
+	size_t lo, hi, j;
+
+	lo = k > lobe ? k - lobe : 0;
+	hi = min(k + lobe, n / 2);
+
+	for (j = lo; j < k; j++)
+		if (cabs(spectrum[j]) >= mag)
+			return false;
+
+	for (j = k + 1; j <= hi; j++)
+		if (cabs(spectrum[j]) > mag)
+			return false;
+
+	return true;
+}
+
+/* Whether period @a is a whole multiple of period @b, within the frequency
+ * resolution of @num_cycles samples.
+ */
+static bool isochron_period_multiple(double a, double b, size_t num_cycles)
+{
+	double m = round(a / b);
+	double tolerance = max(max(1.0, 0.01 * a), a * a / num_cycles);
+
+	return m >= 1 && fabs(a - m * b) <= tolerance;
+}
+
+/* Resample a metric onto the grid of cycles, by the scheduled TX time of
+ * the packets, then list the strongest local maxima of its spectrum,
+ * folding harmonics into their fundamental period. The mean is subtracted
+ * first, and cycles without a valid measurement are filled in with it, so
+ * that they do not contribute to the spectrum. The samples are zero-padded
+ * to at least twice their length, so that the autocorrelation computed
+ * from the spectrum does not wrap around.
+ */
+int isochron_print_periodicity(struct isochron_log *send_log,
+			       struct isochron_log *rcv_log,
+			       unsigned long start, unsigned long stop,
+			       int metric, int num_periods, bool taprio,
+			       bool txtime, __s64 base_time,
+			       __s64 advance_time, __s64 shift_time,
+			       __s64 cycle_time, __s64 window_size)
+{
+	struct isochron_send_pkt_data *pkt_arr;
+	struct isochron_period *candidates = NULL, *periods = NULL;
+	int num_candidates = 0, max_candidates;
+	size_t num_cycles, n, k, lobe, count = 0;
+	__s64 first_scheduled, last_scheduled;
+	double complex *spectrum = NULL;
+	int i, num_found = 0, rc = 0;
+	size_t pkt_arr_size;
+	double *x, sum = 0;
+	__u32 seqid;
+
+	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
+	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+
+	if (start == 0 || start > pkt_arr_size ||
+	    stop == 0 || stop > pkt_arr_size) {
+		fprintf(stderr, "Trying to index an out-of-bounds element\n");
+		return -ERANGE;
+	}
+
+	if (cycle_time <= 0) {
+		fprintf(stderr, "Periodicity analysis requires a cycle time\n");
+		return -EINVAL;
+	}
+
+	stop = isochron_log_last_seqid(pkt_arr, start, stop);
+	if (stop < start)
+		return 0;
+
+	first_scheduled = __be64_to_cpu(pkt_arr[start - 1].scheduled);
+	last_scheduled = __be64_to_cpu(pkt_arr[stop - 1].scheduled);
+	num_cycles = (last_scheduled - first_scheduled) / cycle_time + 1;
+	if (last_scheduled < first_scheduled || num_cycles < 4) {
+		printf("Not enough cycles for periodicity analysis\n");
+		return 0;
+	}
+
+	for (n = 4; n < 2 * num_cycles; n <<= 1)
+		;
+
+	max_candidates = num_periods * ISOCHRON_PERIOD_CANDIDATES;
+
+	spectrum = calloc(n / 2 + 1, sizeof(*spectrum));
+	candidates = calloc(max_candidates, sizeof(*candidates));
+	periods = calloc(num_periods, sizeof(*periods));
+	if (!spectrum || !candidates || !periods) {
+		fprintf(stderr, "Failed to allocate memory for the spectrum\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* The samples are the first n doubles, then zero padding */
+	x = (double *)spectrum;
+	for (k = 0; k < num_cycles; k++)
+		x[k] = NAN;
+
+	for (seqid = start; seqid <= stop; seqid++) {
+		struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
+		__s64 metrics[__ISOCHRON_METRIC_MAX];
+		struct isochron_rcv_pkt_data *rcv_pkt;
+		struct isochron_printf_variables v;
+		__s64 scheduled;
+
+		if (!__be64_to_cpu(send_pkt->swts) ||
+		    !__be64_to_cpu(send_pkt->sched_ts) ||
+		    !__be64_to_cpu(send_pkt->hwts))
+			continue;
+
+		if (__be32_to_cpu(send_pkt->flags) & ISOCHRON_PKT_SYNC_LOST)
+			continue;
+
+		rcv_pkt = isochron_rcv_log_find(rcv_log, send_pkt->seqid);
+		if (!rcv_pkt)
+			continue;
+
+		scheduled = __be64_to_cpu(send_pkt->scheduled);
+		k = (scheduled - first_scheduled + cycle_time / 2) / cycle_time;
+		if (scheduled < first_scheduled || k >= num_cycles)
+			continue;
+
+		isochron_printf_vars_get(send_pkt, rcv_pkt, base_time,
+					 advance_time, shift_time, cycle_time,
+					 window_size, &v);
+		isochron_compute_metrics(&v, metrics, taprio, txtime);
+
+		if (isnan(x[k]))
+			count++;
+		else
+			sum -= x[k];
+		x[k] = metrics[metric];
+		sum += metrics[metric];
+	}
+
+	if (count < 4) {
+		printf("Not enough packets for periodicity analysis\n");
+		goto out;
+	}
+
+	for (k = 0; k < num_cycles; k++)
+		x[k] = isnan(x[k]) ? 0 : x[k] - sum / count;
+
+	rc = fft_real(spectrum, n);
+	if (rc) {
+		fprintf(stderr, "Failed to compute the spectrum\n");
+		goto out;
+	}
+
+	/* Keep the strongest peaks sorted by decreasing magnitude. With the
+	 * zero padding, a peak spans more than one bin, and its sidelobes are
+	 * local maxima too, so only keep the maxima within the frequency
+	 * resolution of the unpadded samples.
+	 */
+	lobe = (n + num_cycles - 1) / num_cycles;
+
+	for (k = 1; k < n / 2; k++) {
+		double mag = cabs(spectrum[k]);
+
+		if (!isochron_spectrum_is_peak(spectrum, n, k, lobe))
+			continue;
+
+		if (num_candidates == max_candidates &&
+		    mag <= candidates[num_candidates - 1].magnitude)
+			continue;
+
+		if (num_candidates < max_candidates)
+			num_candidates++;
+
+		for (i = num_candidates - 1; i > 0; i--) {
+			if (candidates[i - 1].magnitude >= mag)
+				break;
+			candidates[i] = candidates[i - 1];
+		}
+
+		candidates[i].bin = k;
+		candidates[i].magnitude = mag;
+	}
+
+	rc = isochron_autocorrelate(spectrum, n);
+	if (rc) {
+		fprintf(stderr, "Failed to compute the autocorrelation\n");
+		goto out;
+	}
+
+	/* Candidates are sorted by decreasing magnitude, so each period is
+	 * printed with the amplitude of its strongest spectral component.
+	 * Weaker periods which are multiples of a stronger one are already
+	 * explained by it, and are skipped.
+	 */
+	for (k = 0; k < (size_t)num_candidates && num_found < num_periods; k++) {
+		struct isochron_period *period = &candidates[k];
+
+		isochron_period_fundamental(spectrum, n, num_cycles, period);
+
+		for (i = 0; i < num_found; i++)
+			if (isochron_period_multiple(period->cycles,
+						     periods[i].cycles,
+						     num_cycles))
+				break;
+
+		if (i == num_found)
+			periods[num_found++] = *period;
+	}
+
+	printf("Periodicity of %s over %zu cycles of %lld ns:\n",
+	       isochron_metric_name(metric, taprio, txtime), num_cycles,
+	       cycle_time);
+
+	for (i = 0; i < num_found; i++) {
+		double cycles = periods[i].cycles;
+
+		/* Amplitude of the equivalent sinusoid */
+		printf("Period %.0lf ns (%.3lf cycles): amplitude %.3lf ns",
+		       cycles * cycle_time, cycles,
+		       2 * periods[i].magnitude / num_cycles);
+
+		if (periods[i].confirmed)
+			printf(", autocorrelation %.3lf", periods[i].correlation);
+
+		printf("\n");
+	}
+
+out:
+	free(periods);
+	free(candidates);
+	free(spectrum);
+
+	return rc;
+}
+
+struct isochron_outlier {
+	__s64 value;
+	__u32 seqid;
+};
+
+/* Min-heap of the largest values seen so far, the smallest one at the root */
+static void isochron_outlier_sift_down(struct isochron_outlier *heap,
+				       int num, int i)
+{
+	struct isochron_outlier tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && heap[child + 1].value < heap[child].value)
+			child++;
+		if (heap[i].value <= heap[child].value)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void isochron_outlier_sift_up(struct isochron_outlier *heap, int i)
+{
+	struct isochron_outlier tmp;
+	int parent;
+
+	while (i && heap[parent = (i - 1) / 2].value > heap[i].value) {
+		tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/* Largest value first, and the earliest packet among equal values */
+static int isochron_outlier_cmp(const void *a, const void *b)
+{
+	const struct isochron_outlier *oa = a, *ob = b;
+
+	if (oa->value != ob->value)
+		return oa->value < ob->value ? 1 : -1;
+
+	return oa->seqid < ob->seqid ? -1 : oa->seqid > ob->seqid;
+}
+
+/* Get the variables of the packet with @seqid, returning false if it was
+ * not completely timestamped or not received.
+ */
+static bool isochron_outlier_vars_get(struct isochron_send_pkt_data *pkt_arr,
+				      struct isochron_log *rcv_log,
+				      __u32 seqid, __s64 base_time,
+				      __s64 advance_time, __s64 shift_time,
+				      __s64 cycle_time, __s64 window_size,
+				      struct isochron_printf_variables *v)
+{
+	struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
+	struct isochron_rcv_pkt_data *rcv_pkt;
+
+	if (!__be64_to_cpu(send_pkt->swts) ||
+	    !__be64_to_cpu(send_pkt->sched_ts) ||
+	    !__be64_to_cpu(send_pkt->hwts))
+		return false;
+
+	rcv_pkt = isochron_rcv_log_find(rcv_log, send_pkt->seqid);
+	if (!rcv_pkt)
+		return false;
+
+	isochron_printf_vars_get(send_pkt, rcv_pkt, base_time, advance_time,
+				 shift_time, cycle_time, window_size, v);
+
+	return true;
+}
+
+/* The time between the programmed wakeup and the arrival at the receiver
+ * application, split into consecutive stages which add up to it.
+ */
+static void isochron_print_stages(const char *prefix, __u32 seqid,
+				  const struct isochron_expr *expr,
+				  const struct isochron_printf_variables *v)
+{
+	if (!v) {
+		printf("%sseqid %u: not completely timestamped or not received\n",
+		       prefix, seqid);
+		return;
+	}
+
+	printf("%sseqid %u: value %lld, wakeup %lld sender %lld qdisc+driver %lld MAC %lld path %lld arrival %lld\n",
+	       prefix, seqid, isochron_expr_eval(expr, v),
+	       v->tx_wakeup - (v->tx_scheduled - v->advance_time),
+	       v->tx_sched - v->tx_wakeup, v->tx_swts - v->tx_sched,
+	       v->tx_hwts - v->tx_swts, v->rx_hwts - v->tx_hwts,
+	       v->arrival - v->rx_hwts);
+}
+
+/* Find the @num_outliers packets with the largest value of the expression
+ * @expr_str in a single pass, keeping only the best candidates so far in a
+ * bounded heap, then print how the latency of each one, and of the
+ * @context packets around it, was distributed across the stages of the
+ * pipeline.
+ */
+int isochron_print_outliers(struct isochron_log *send_log,
+			    struct isochron_log *rcv_log,
+			    unsigned long start, unsigned long stop,
+			    const char *expr_str, int num_outliers,
+			    int context, __s64 base_time, __s64 advance_time,
+			    __s64 shift_time, __s64 cycle_time,
+			    __s64 window_size)
+{
+	struct isochron_send_pkt_data *pkt_arr;
+	struct isochron_printf_variables v;
+	struct isochron_outlier *heap;
+	struct isochron_expr expr;
+	unsigned long seqid, s;
+	size_t pkt_arr_size;
+	int num = 0, i, rc;
+	__s64 value;
+
+	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
+	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+
+	if (start == 0 || start > pkt_arr_size ||
+	    stop == 0 || stop > pkt_arr_size) {
+		fprintf(stderr, "Trying to index an out-of-bounds element\n");
+		return -ERANGE;
+	}
+
+	stop = isochron_log_last_seqid(pkt_arr, start, stop);
+
+	rc = isochron_expr_compile(&expr, expr_str, strlen(expr_str),
+				   isochron_expr_var_get, NULL);
+	if (rc)
+		return rc;
+
+	heap = calloc(num_outliers, sizeof(*heap));
+	if (!heap) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (seqid = start; seqid <= stop; seqid++) {
+		if (__be32_to_cpu(pkt_arr[seqid - 1].flags) &
+		    ISOCHRON_PKT_SYNC_LOST)
+			continue;
+
+		if (!isochron_outlier_vars_get(pkt_arr, rcv_log, seqid,
+					       base_time, advance_time,
+					       shift_time, cycle_time,
+					       window_size, &v))
+			continue;
+
+		value = isochron_expr_eval(&expr, &v);
+
+		if (num < num_outliers) {
+			heap[num].value = value;
+			heap[num].seqid = seqid;
+			isochron_outlier_sift_up(heap, num++);
+		} else if (value > heap[0].value) {
+			heap[0].value = value;
+			heap[0].seqid = seqid;
+			isochron_outlier_sift_down(heap, num, 0);
+		}
+	}
+
+	qsort(heap, num, sizeof(*heap), isochron_outlier_cmp);
+
+	printf("Top %d packets by %s:\n", num, expr_str);
+
+	for (i = 0; i < num; i++) {
+		printf("Outlier %d:\n", i + 1);
+
+		for (s = heap[i].seqid > start + context ?
+			 heap[i].seqid - context : start;
+		     s <= stop && s <= heap[i].seqid + (unsigned long)context;
+		     s++) {
+			bool valid;
+
+			valid = isochron_outlier_vars_get(pkt_arr, rcv_log, s,
+							  base_time,
+							  advance_time,
+							  shift_time,
+							  cycle_time,
+							  window_size, &v);
+			isochron_print_stages(s == heap[i].seqid ? "  * " :
+					      "    ", s, &expr,
+					      valid ? &v : NULL);
+		}
+	}
+
+	free(heap);
+out:
+	isochron_expr_free(&expr);
+
+	return rc;
+}
+
+/* Variables exported when no --export-args are given */
+#define ISOCHRON_EXPORT_DEFAULT_ARGS	"qSwTtsaRrBAHCW"
+#define ISOCHRON_EXPORT_MAX_COLUMNS	32
+#define ISOCHRON_EXPORT_BATCH_SIZE	65536
+/* Enough for the Arrow schema of ISOCHRON_EXPORT_MAX_COLUMNS columns */
+#define ISOCHRON_ARROW_MAX_METADATA	16384
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define ISOCHRON_NPY_BYTE_ORDER		'<'
+#define ISOCHRON_ARROW_ENDIANNESS	0
+#else
+#define ISOCHRON_NPY_BYTE_ORDER		'>'
+#define ISOCHRON_ARROW_ENDIANNESS	1
+#endif
+
+/* Arrow columnar format constants (format/Message.fbs, format/Schema.fbs) */
+#define ARROW_METADATA_V5		4
+#define ARROW_MESSAGE_SCHEMA		1
+#define ARROW_MESSAGE_RECORD_BATCH	3
+#define ARROW_TYPE_INT			2
+#define ARROW_CONTINUATION		0xffffffff
+
+struct isochron_export_column {
+	const struct isochron_variable_code *vc;
+	void *buf;
+	int fd;
+};
+
+struct isochron_export {
+	enum isochron_export_format format;
+	struct isochron_export_column columns[ISOCHRON_EXPORT_MAX_COLUMNS];
+	int num_columns;
+	int fd;
+};
+
+/* Minimal flatbuffer builder. Unlike the reference implementation, it
+ * lays out objects front to back: every table is preceded by its vtable,
+ * and the objects it references are written after it, with their offsets
+ * patched in once known. All values are little endian.
+ */
+struct isochron_fb {
+	__u8 buf[ISOCHRON_ARROW_MAX_METADATA];
+	size_t len;
+};
+
+static void fb_put_at(struct isochron_fb *fb, size_t pos, __u64 val,
+		      size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		fb->buf[pos + i] = val >> (8 * i);
+}
+
+static void fb_put(struct isochron_fb *fb, __u64 val, size_t size)
+{
+	fb_put_at(fb, fb->len, val, size);
+	fb->len += size;
+}
+
+static void fb_pad(struct isochron_fb *fb, size_t align)
+{
+	while (fb->len % align)
+		fb->buf[fb->len++] = 0;
+}
+
+/* Point the uoffset_t at @pos to the object at @target */
+static void fb_patch(struct isochron_fb *fb, size_t pos, size_t target)
+{
+	fb_put_at(fb, pos, target - pos, sizeof(__u32));
+}
+
+/* Write a table with scalar or offset fields, given in schema order.
+ * A field of size 0 is absent. The position of each field is returned
+ * in @pos, for offsets to be patched.
+ */
+static size_t fb_table(struct isochron_fb *fb, int num_fields,
+		       const size_t *sizes, const __u64 *vals, size_t *pos)
+{
+	size_t vtable_size = 4 + 2 * num_fields;
+	size_t vtable, table;
+	int i;
+
+	while ((fb->len + vtable_size) % 4)
+		fb->buf[fb->len++] = 0;
+
+	vtable = fb->len;
+	fb->len += vtable_size;
+	table = fb->len;
+	/* soffset_t from the table back to its vtable */
+	fb_put(fb, table - vtable, sizeof(__s32));
+
+	for (i = 0; i < num_fields; i++) {
+		size_t field_offset = 0;
+
+		if (sizes[i]) {
+			fb_pad(fb, sizes[i]);
+			pos[i] = fb->len;
+			field_offset = fb->len - table;
+			fb_put(fb, vals[i], sizes[i]);
+		}
+
+		fb_put_at(fb, vtable + 4 + 2 * i, field_offset, sizeof(__u16));
+	}
+
+	fb_put_at(fb, vtable, vtable_size, sizeof(__u16));
+	fb_put_at(fb, vtable + 2, fb->len - table, sizeof(__u16));
+
+	return table;
+}
+
+/* Start a vector whose elements need @align, return its position */
+static size_t fb_vector(struct isochron_fb *fb, size_t count, size_t align)
+{
+	size_t vec;
+
+	while ((fb->len + sizeof(__u32)) % align)
+		fb->buf[fb->len++] = 0;
+
+	vec = fb->len;
+	fb_put(fb, count, sizeof(__u32));
+
+	return vec;
+}
+
+static size_t fb_string(struct isochron_fb *fb, const char *str)
+{
+	size_t len = strlen(str);
+	size_t vec;
+
+	vec = fb_vector(fb, len, sizeof(__u32));
+	memcpy(fb->buf + fb->len, str, len + 1);
+	fb->len += len + 1;
+
+	return vec;
+}
+
+/* Message table: version, header_type, header, bodyLength */
+static size_t fb_arrow_message(struct isochron_fb *fb, int header_type,
+			       size_t body_len, size_t *header_pos)
+{
+	const size_t sizes[] = { 2, 1, 4, 8 };
+	const __u64 vals[] = { ARROW_METADATA_V5, header_type, 0, body_len };
+	size_t pos[ARRAY_SIZE(sizes)];
+	size_t table;
+
+	/* Root uoffset_t */
+	fb->len = 0;
+	fb_put(fb, 0, sizeof(__u32));
+
+	table = fb_table(fb, ARRAY_SIZE(sizes), sizes, vals, pos);
+	fb_patch(fb, 0, table);
+	*header_pos = pos[2];
+
+	return table;
+}
+
+static size_t isochron_export_padded_len(size_t len)
+{
+	return (len + 7) & ~(size_t)7;
+}
+
+/* Encapsulated message: continuation marker, metadata length, flatbuffer
+ * padded to 8 bytes, then the body.
+ */
+static int isochron_arrow_write_message(struct isochron_export *exp,
+					struct isochron_fb *fb, size_t num_rows)
+{
+	static const __u8 zeroes[8];
+	__u8 prefix[8];
+	ssize_t ret;
+	int i;
+
+	fb_pad(fb, 8);
+
+	prefix[0] = prefix[1] = prefix[2] = prefix[3] = 0xff;
+	prefix[4] = fb->len;
+	prefix[5] = fb->len >> 8;
+	prefix[6] = fb->len >> 16;
+	prefix[7] = fb->len >> 24;
+
+	ret = write_exact(exp->fd, prefix, sizeof(prefix));
+	if (ret <= 0)
+		goto err;
+
+	ret = write_exact(exp->fd, fb->buf, fb->len);
+	if (ret <= 0)
+		goto err;
+
+	for (i = 0; i < exp->num_columns && num_rows; i++) {
+		const struct isochron_export_column *col = &exp->columns[i];
+		size_t len = num_rows * col->vc->size;
+
+		ret = write_exact(exp->fd, col->buf, len);
+		if (ret <= 0)
+			goto err;
+
+		if (isochron_export_padded_len(len) == len)
+			continue;
+
+		ret = write_exact(exp->fd, zeroes,
+				  isochron_export_padded_len(len) - len);
+		if (ret <= 0)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	perror("write");
+	return ret ? -errno : -EIO;
+}
+
+static int isochron_arrow_write_schema(struct isochron_export *exp)
+{
+	struct isochron_fb *fb;
+	size_t schema_pos[2], field_pos[6], int_pos[2];
+	size_t header, table, fields, vec;
+	int i, rc;
+
+	fb = calloc(1, sizeof(*fb));
+	if (!fb)
+		return -ENOMEM;
+
+	fb_arrow_message(fb, ARROW_MESSAGE_SCHEMA, 0, &header);
+
+	/* Schema table: endianness, fields */
+	table = fb_table(fb, 2, (const size_t []){ 2, 4 },
+			 (const __u64 []){ ISOCHRON_ARROW_ENDIANNESS, 0 },
+			 schema_pos);
+	fb_patch(fb, header, table);
+
+	fields = fb_vector(fb, exp->num_columns, sizeof(__u32));
+	fb->len += exp->num_columns * sizeof(__u32);
+	fb_patch(fb, schema_pos[1], fields);
+
+	for (i = 0; i < exp->num_columns; i++) {
+		const struct isochron_variable_code *vc = exp->columns[i].vc;
+
+		/* Field table: name, nullable, type_type, type, dictionary,
+		 * children
+		 */
+		table = fb_table(fb, 6, (const size_t []){ 4, 1, 1, 4, 0, 4 },
+				 (const __u64 []){ 0, false, ARROW_TYPE_INT,
+						   0, 0, 0 },
+				 field_pos);
+		fb_patch(fb, fields + sizeof(__u32) * (i + 1), table);
+
+		fb_patch(fb, field_pos[0], fb_string(fb, vc->name));
+
+		/* Int table: bitWidth, is_signed */
+		table = fb_table(fb, 2, (const size_t []){ 4, 1 },
+				 (const __u64 []){ 8 * vc->size,
+				   !!(vc->valid_formats & ISOCHRON_FMT_SIGNED) },
+				 int_pos);
+		fb_patch(fb, field_pos[3], table);
+
+		vec = fb_vector(fb, 0, sizeof(__u32));
+		fb_patch(fb, field_pos[5], vec);
+	}
+
+	rc = isochron_arrow_write_message(exp, fb, 0);
+	free(fb);
+
+	return rc;
+}
+
+static int isochron_arrow_write_batch(struct isochron_export *exp,
+				      size_t num_rows)
+{
+	size_t body_len = 0, offset = 0;
+	size_t batch_pos[3], header, table, vec;
+	struct isochron_fb *fb;
+	int i, rc;
+
+	fb = calloc(1, sizeof(*fb));
+	if (!fb)
+		return -ENOMEM;
+
+	for (i = 0; i < exp->num_columns; i++)
+		body_len += isochron_export_padded_len(num_rows *
+						       exp->columns[i].vc->size);
+
+	fb_arrow_message(fb, ARROW_MESSAGE_RECORD_BATCH, body_len, &header);
+
+	/* RecordBatch table: length, nodes, buffers */
+	table = fb_table(fb, 3, (const size_t []){ 8, 4, 4 },
+			 (const __u64 []){ num_rows, 0, 0 }, batch_pos);
+	fb_patch(fb, header, table);
+
+	/* FieldNode structs: length, null_count */
+	vec = fb_vector(fb, exp->num_columns, 8);
+	fb_patch(fb, batch_pos[1], vec);
+	for (i = 0; i < exp->num_columns; i++) {
+		fb_put(fb, num_rows, sizeof(__s64));
+		fb_put(fb, 0, sizeof(__s64));
+	}
+
+	/* Buffer structs: offset, length. Each column has an empty validity
+	 * bitmap, since there are no nulls, followed by its values.
+	 */
+	vec = fb_vector(fb, 2 * exp->num_columns, 8);
+	fb_patch(fb, batch_pos[2], vec);
+	for (i = 0; i < exp->num_columns; i++) {
+		size_t len = num_rows * exp->columns[i].vc->size;
+
+		fb_put(fb, offset, sizeof(__s64));
+		fb_put(fb, 0, sizeof(__s64));
+		fb_put(fb, offset, sizeof(__s64));
+		fb_put(fb, len, sizeof(__s64));
+		offset += isochron_export_padded_len(len);
+	}
+
+	rc = isochron_arrow_write_message(exp, fb, num_rows);
+	free(fb);
+
+	return rc;
+}
+
+static int isochron_arrow_write_eos(struct isochron_export *exp)
+{
+	static const __u8 eos[8] = { 0xff, 0xff, 0xff, 0xff };
+	ssize_t ret;
+
+	ret = write_exact(exp->fd, eos, sizeof(eos));
+	if (ret <= 0) {
+		perror("write");
+		return ret ? -errno : -EIO;
+	}
+
+	return 0;
+}
+
+static int isochron_npy_open(struct isochron_export_column *col,
+			     const char *dir, size_t num_rows)
+{
+	char path[PATH_MAX];
+	char header[128];
+	size_t header_len;
+	ssize_t ret;
+	int len;
+
+	len = snprintf(path, sizeof(path), "%s/%s.npy", dir, col->vc->name);
+	if (len >= (int)sizeof(path)) {
+		fprintf(stderr, "Export path too long\n");
+		return -ENAMETOOLONG;
+	}
+
+	/* Magic, version 1.0, then the header length, little endian */
+	memcpy(header, "\x93NUMPY\x01\x00", 8);
+	len = snprintf(header + 10, sizeof(header) - 10,
+		       "{'descr': '%c%c%zu', 'fortran_order': False, 'shape': (%zu,), }",
+		       ISOCHRON_NPY_BYTE_ORDER,
+		       (col->vc->valid_formats & ISOCHRON_FMT_SIGNED) ? 'i' : 'u',
+		       col->vc->size, num_rows);
+
+	/* Pad with spaces and a newline, for the data to be 64-byte aligned */
+	header_len = 10 + len + 1;
+	header_len = (header_len + 63) & ~(size_t)63;
+	if (header_len > sizeof(header)) {
+		fprintf(stderr, "NumPy header too long\n");
+		return -EINVAL;
+	}
+
+	memset(header + 10 + len, ' ', header_len - 10 - len - 1);
+	header[header_len - 1] = '\n';
+	header[8] = (header_len - 10) & 0xff;
+	header[9] = (header_len - 10) >> 8;
+
+	col->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (col->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %m\n", path);
+		return -errno;
+	}
+
+	ret = write_exact(col->fd, header, header_len);
+	if (ret <= 0) {
+		perror("write");
+		return ret ? -errno : -EIO;
+	}
+
+	return 0;
+}
+
+static int isochron_npy_write_batch(struct isochron_export *exp,
+				    size_t num_rows)
+{
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < exp->num_columns; i++) {
+		const struct isochron_export_column *col = &exp->columns[i];
+
+		ret = write_exact(col->fd, col->buf,
+				  num_rows * col->vc->size);
+		if (ret <= 0) {
+			perror("write");
+			return ret ? -errno : -EIO;
+		}
+	}
+
+	return 0;
+}
+
+static int isochron_export_write_batch(struct isochron_export *exp,
+				       size_t num_rows)
+{
+	if (!num_rows)
+		return 0;
+
+	if (exp->format == ISOCHRON_EXPORT_ARROW)
+		return isochron_arrow_write_batch(exp, num_rows);
+
+	return isochron_npy_write_batch(exp, num_rows);
+}
+
+static int isochron_export_init(struct isochron_export *exp,
+				enum isochron_export_format format,
+				const char *export_args, const char *path,
+				size_t num_rows)
+{
+	const char *arg;
+	int i, rc;
+
+	exp->format = format;
+	exp->num_columns = 0;
+	exp->fd = -1;
+
+	if (!export_args || !strlen(export_args))
+		export_args = ISOCHRON_EXPORT_DEFAULT_ARGS;
+
+	for (arg = export_args; *arg; arg++) {
+		const struct isochron_variable_code *vc;
+		struct isochron_export_column *col;
+
+		vc = &variable_codes[(__u8)*arg];
+		if (!vc->valid_formats) {
+			fprintf(stderr, "Unknown variable code '%c'\n", *arg);
+			return -EINVAL;
+		}
+
+		for (i = 0; i < exp->num_columns; i++) {
+			if (exp->columns[i].vc == vc) {
+				fprintf(stderr,
+					"Variable '%c' exported more than once\n",
+					*arg);
+				return -EINVAL;
+			}
+		}
+
+		col = &exp->columns[exp->num_columns++];
+		col->vc = vc;
+		col->fd = -1;
+		col->buf = malloc(ISOCHRON_EXPORT_BATCH_SIZE * vc->size);
+		if (!col->buf)
+			return -ENOMEM;
+	}
+
+	if (format == ISOCHRON_EXPORT_ARROW) {
+		exp->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (exp->fd < 0) {
+			fprintf(stderr, "Failed to open %s: %m\n", path);
+			return -errno;
+		}
+
+		return isochron_arrow_write_schema(exp);
+	}
+
+	if (mkdir(path, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Failed to create directory %s: %m\n", path);
+		return -errno;
+	}
+
+	for (i = 0; i < exp->num_columns; i++) {
+		rc = isochron_npy_open(&exp->columns[i], path, num_rows);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void isochron_export_teardown(struct isochron_export *exp)
+{
+	int i;
+
+	for (i = 0; i < exp->num_columns; i++) {
+		if (exp->columns[i].fd >= 0)
+			close(exp->columns[i].fd);
+		free(exp->columns[i].buf);
+	}
+
+	if (exp->fd >= 0)
+		close(exp->fd);
+}
+
+int isochron_log_export(struct isochron_log *send_log,
+			struct isochron_log *rcv_log,
+			enum isochron_export_format format, const char *path,
+			const char *export_args, unsigned long start,
+			unsigned long stop, __s64 base_time,
+			__s64 advance_time, __s64 shift_time,
+			__s64 cycle_time, __s64 window_size)
+{
+	struct isochron_rcv_pkt_data dummy_rcv_pkt = {};
+	struct isochron_send_pkt_data *pkt_arr;
+	size_t pkt_arr_size, num_rows = 0, batch = 0;
+	struct isochron_export *exp;
+	__u32 seqid;
+	int i, rc;
+
+	pkt_arr = (struct isochron_send_pkt_data *)send_log->buf;
+	pkt_arr_size = send_log->size / sizeof(*pkt_arr);
+
+	if (start == 0 || start > pkt_arr_size ||
+	    stop == 0 || stop > pkt_arr_size) {
+		fprintf(stderr, "Trying to index an out-of-bounds element\n");
+		return -ERANGE;
+	}
+
+	/* The NumPy header needs the number of rows up front */
+	stop = isochron_log_last_seqid(pkt_arr, start, stop);
+
+	for (seqid = start; seqid <= stop; seqid++)
+		if (!(__be32_to_cpu(pkt_arr[seqid - 1].flags) &
+		      ISOCHRON_PKT_SYNC_LOST))
+			num_rows++;
+
+	exp = calloc(1, sizeof(*exp));
+	if (!exp)
+		return -ENOMEM;
+
+	rc = isochron_export_init(exp, format, export_args, path, num_rows);
+	if (rc)
+		goto out;
+
+	for (seqid = start; seqid <= stop; seqid++) {
+		struct isochron_send_pkt_data *send_pkt = &pkt_arr[seqid - 1];
+		struct isochron_rcv_pkt_data *rcv_pkt;
+		struct isochron_printf_variables v;
+
+		if (__be32_to_cpu(send_pkt->flags) & ISOCHRON_PKT_SYNC_LOST)
+			continue;
+
+		/* Like for printf, packets that were not received have
+		 * their RX timestamps set to zero
+		 */
+		rcv_pkt = isochron_rcv_log_find(rcv_log, send_pkt->seqid);
+		if (!rcv_pkt)
+			rcv_pkt = &dummy_rcv_pkt;
+
+		isochron_printf_vars_get(send_pkt, rcv_pkt, base_time,
+					 advance_time, shift_time, cycle_time,
+					 window_size, &v);
+
+		for (i = 0; i < exp->num_columns; i++) {
+			const struct isochron_variable_code *vc;
+
+			vc = exp->columns[i].vc;
+			memcpy((char *)exp->columns[i].buf + batch * vc->size,
+			       (char *)&v + vc->offset, vc->size);
+		}
+
+		if (++batch < ISOCHRON_EXPORT_BATCH_SIZE)
+			continue;
+
+		rc = isochron_export_write_batch(exp, batch);
+		if (rc)
+			goto out;
+
+		batch = 0;
+	}
+
+	rc = isochron_export_write_batch(exp, batch);
+	if (rc)
+		goto out;
+
+	if (format == ISOCHRON_EXPORT_ARROW)
+		rc = isochron_arrow_write_eos(exp);
+
+out:
+	isochron_export_teardown(exp);
+	free(exp);
+
+	return rc;
+}
+
+int isochron_log_init(struct isochron_log *log, size_t size)
+{
+	log->buf = calloc(sizeof(char), size);
+	if (!log->buf)
+		return -ENOMEM;
+
+	log->size = size;
+
+	return 0;
+}
+
+void isochron_log_teardown(struct isochron_log *log)
+{
+	free(log->buf);
+}
+
+int isochron_log_for_each_pkt(struct isochron_log *log, size_t pkt_size,
+			      void *priv, isochron_log_walk_cb_t cb)
+{
+	size_t i, pkt_arr_size = log->size / pkt_size;
+	int rc;
+
+	for (i = 0; i < pkt_arr_size; i++) {
+		void *pkt = (void *)((__u8 *)log->buf + i * pkt_size);
+
+		rc = cb(priv, pkt);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static int isochron_log_read_at(int fd, off_t offset, void *buf, size_t count)
+{
+	ssize_t len;
+
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -errno;
+
+	if (!count)
+		return 0;
+
+	len = read_exact(fd, buf, count);
+	if (len < 0)
+		return len;
+	if ((size_t)len != count)
+		return -EIO;
+
+	return 0;
+}
+
+static int isochron_log_write_at(int fd, off_t offset, const void *buf,
+				 size_t count)
+{
+	ssize_t len;
+
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -errno;
+
+	if (!count)
+		return 0;
+
+	len = write_exact(fd, buf, count);
+	if (len < 0)
+		return len;
+	if ((size_t)len != count)
+		return -EIO;
+
+	return 0;
+}
+
+static ssize_t isochron_log_pread(int fd, void *buf, size_t count,
+				  off_t offset)
+{
+	size_t total_read = 0;
+	ssize_t ret;
+
+	while (total_read != count) {
+		ret = pread(fd, (char *)buf + total_read, count - total_read,
+			    offset + total_read);
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			break;
+		total_read += ret;
+	}
+
+	return total_read;
+}
+
+static int isochron_log_pwrite(int fd, const void *buf, size_t count,
+			       off_t offset)
+{
+	size_t written = 0;
+	ssize_t ret;
+
+	while (written != count) {
+		ret = pwrite(fd, (const char *)buf + written, count - written,
+			     offset + written);
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return -EIO;
+		written += ret;
+	}
+
+	return 0;
+}
+
+struct isochron_log_load_range {
+	pthread_t	tid;
+	bool		threaded;
+	int		fd;
+	void		*buf;
+	size_t		count;
+	off_t		offset;
+	ssize_t		rc;
+};
+
+static void *isochron_log_load_thread(void *arg)
+{
+	struct isochron_log_load_range *range = arg;
+
+	range->rc = isochron_log_pread(range->fd, range->buf, range->count,
+				       range->offset);
+
+	return NULL;
+}
+
+/* Large logs are split into ranges which are read by multiple threads, so
+ * that loading them is bound by the storage bandwidth and not by a single
+ * core copying out of the page cache.
+ */
+static int isochron_log_pread_parallel(int fd, void *buf, size_t count,
+				       off_t offset)
+{
+	struct isochron_log_load_range ranges[ISOCHRON_LOG_LOAD_MAX_THREADS];
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_ranges, range_size, i;
+	ssize_t len;
+	int rc = 0;
+
+	num_ranges = count / ISOCHRON_LOG_LOAD_RANGE_SIZE;
+	if (num_cpus > 0 && num_ranges > (size_t)num_cpus)
+		num_ranges = num_cpus;
+	if (num_ranges > ISOCHRON_LOG_LOAD_MAX_THREADS)
+		num_ranges = ISOCHRON_LOG_LOAD_MAX_THREADS;
+
+	if (num_ranges <= 1) {
+		len = isochron_log_pread(fd, buf, count, offset);
+		if (len < 0)
+			return len;
+
+		return (size_t)len == count ? 0 : -EIO;
+	}
+
+	range_size = (count + num_ranges - 1) / num_ranges;
+
+	for (i = 0; i < num_ranges; i++) {
+		struct isochron_log_load_range *range = &ranges[i];
+		size_t start = i * range_size;
+
+		range->fd = fd;
+		range->buf = (char *)buf + start;
+		range->offset = offset + start;
+		range->count = min(range_size, count - start);
+
+		range->threaded = !pthread_create(&range->tid, NULL,
+						  isochron_log_load_thread,
+						  range);
+		/* Fall back to reading the range from this thread */
+		if (!range->threaded)
+			isochron_log_load_thread(range);
+	}
+
+	for (i = 0; i < num_ranges; i++) {
+		struct isochron_log_load_range *range = &ranges[i];
+
+		if (range->threaded)
+			pthread_join(range->tid, NULL);
+
+		if (rc)
+			continue;
+
+		if (range->rc < 0)
+			rc = range->rc;
+		else if ((size_t)range->rc != range->count)
+			rc = -EIO;
+	}
+
+	return rc;
+}
+
+/* Read as much as the file contains of a log which may have been truncated
+ * by a crash. The part of the buffer past the end of the file keeps the
+ * zeroes it was allocated with, which looks the same as packets that were
+ * never logged.
+ */
+static int isochron_log_read_partial(int fd, off_t offset, void *buf,
+				     size_t count, off_t file_size,
+				     bool *truncated)
+{
+	if (!count)
+		return 0;
+
+	if (offset >= file_size) {
+		count = 0;
+		*truncated = true;
+	} else if (offset + (off_t)count > file_size) {
+		count = file_size - offset;
+		*truncated = true;
+	}
+
+	return isochron_log_pread_parallel(fd, buf, count, offset);
+}
+
+/* Locate the file offset of a session. Single-session log files are
+ * treated as containers with a single session starting at offset 0.
+ */
+static int isochron_log_session_start(int fd, long session, off_t *start,
+				      long *num_sessions, bool *container)
+{
+	struct isochron_container_header ch;
+	struct isochron_session_dir dir;
+	off_t dir_start;
+	long i;
+	int rc;
+
+	rc = isochron_log_read_at(fd, 0, &ch, sizeof(ch));
+	if (rc) {
+		fprintf(stderr, "Failed to read file header: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	if (!memcmp(ch.magic, isochron_magic, strlen(isochron_magic))) {
+		*num_sessions = 1;
+		*container = false;
+		*start = 0;
+		return 0;
+	}
+
+	if (memcmp(ch.magic, isochron_container_magic,
+		   strlen(isochron_container_magic))) {
+		fprintf(stderr, "Unrecognized file format\n");
+		return -EINVAL;
+	}
+
+	if (__be32_to_cpu(ch.version) != ISOCHRON_CONTAINER_VERSION) {
+		fprintf(stderr,
+			"Unsupported container version %d, expected %d\n",
+			__be32_to_cpu(ch.version), ISOCHRON_CONTAINER_VERSION);
+		return -EINVAL;
+	}
+
+	*num_sessions = __be32_to_cpu(ch.num_sessions);
+	*container = true;
+	*start = 0;
+
+	if (session < 0 || session >= *num_sessions)
+		return 0;
+
+	dir_start = __be64_to_cpu(ch.first_dir);
+
+	for (i = session; ; i -= ISOCHRON_SESSION_DIR_SIZE) {
+		rc = isochron_log_read_at(fd, dir_start, &dir, sizeof(dir));
+		if (rc) {
+			fprintf(stderr, "Failed to read session directory: %s\n",
+				strerror(-rc));
+			return rc;
+		}
+
+		if (i < ISOCHRON_SESSION_DIR_SIZE)
+			break;
+
+		dir_start = __be64_to_cpu(dir.next);
+	}
+
+	if (i >= __be32_to_cpu(dir.num_entries)) {
+		fprintf(stderr, "Session directory is inconsistent\n");
+		return -EINVAL;
+	}
+
+	*start = __be64_to_cpu(dir.entries[i].start);
+
+	return 0;
+}
+
+int isochron_log_num_sessions(const char *file, long *num_sessions,
+			      bool *container)
+{
+	off_t start;
+	int fd, rc;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		return -errno;
+	}
+
+	rc = isochron_log_session_start(fd, -1, &start, num_sessions,
+					container);
+
+	close(fd);
+
+	return rc;
+}
+
+/* Passing NULL logs reads only the session parameters, without allocating
+ * and reading in the packet logs.
+ */
+int isochron_log_load(const char *file, long session,
+		      struct isochron_log *send_log,
+		      struct isochron_log *rcv_log,
+		      struct isochron_log *sync_log,
+		      struct isochron_log *annotation_log, long *packet_count,
+		      long *frame_size, bool *omit_sync, bool *do_ts,
+		      bool *taprio, bool *txtime, bool *deadline,
+		      __s64 *base_time, __s64 *advance_time, __s64 *shift_time,
+		      __s64 *cycle_time, __s64 *window_size)
+{
+	struct isochron_log_file_header header;
+	bool truncated = false;
+	long num_sessions;
+	struct stat st;
+	bool container;
+	off_t start;
+	int fd, rc;
+	int flags;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		rc = -errno;
+		goto out;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		rc = -errno;
+		goto out_close;
+	}
+
+	rc = isochron_log_session_start(fd, session, &start, &num_sessions,
+					&container);
+	if (rc)
+		goto out_close;
+
+	if (session < 0 || session >= num_sessions) {
+		fprintf(stderr, "Session %ld out of range, file has %ld\n",
+			session, num_sessions);
+		rc = -ERANGE;
+		goto out_close;
+	}
+
+	rc = isochron_log_read_at(fd, start, &header, sizeof(header));
+	if (rc) {
+		fprintf(stderr, "Failed to read log header from file: %s\n",
+			strerror(-rc));
+		goto out_close;
+	}
+
+	if (memcmp(header.magic, isochron_magic, strlen(isochron_magic))) {
+		fprintf(stderr, "Unrecognized file format\n");
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	flags = __be16_to_cpu(header.flags);
+	*omit_sync = !!(flags & ISOCHRON_FLAG_OMIT_SYNC);
+	*do_ts = !!(flags & ISOCHRON_FLAG_DO_TS);
+	*taprio = !!(flags & ISOCHRON_FLAG_TAPRIO);
+	*txtime = !!(flags & ISOCHRON_FLAG_TXTIME);
+	*deadline = !!(flags & ISOCHRON_FLAG_DEADLINE);
+
+	*packet_count = __be32_to_cpu(header.packet_count);
+	*frame_size = __be16_to_cpu(header.frame_size);
+	*base_time = (__s64 )__be64_to_cpu(header.base_time);
+	*advance_time = (__s64 )__be64_to_cpu(header.advance_time);
+	*shift_time = (__s64 )__be64_to_cpu(header.shift_time);
+	*cycle_time = (__s64 )__be64_to_cpu(header.cycle_time);
+	*window_size = (__s64 )__be64_to_cpu(header.window_size);
+
+	if (!send_log) {
+		close(fd);
+		return 0;
+	}
+
+	rc = isochron_log_init(send_log, __be32_to_cpu(header.send_log_size));
+	if (rc) {
+		fprintf(stderr, "failed to allocate memory for send log\n");
+		goto out_close;
+	}
+
+	rc = isochron_log_read_partial(fd, start +
+				       __be64_to_cpu(header.send_log_start),
+				       send_log->buf, send_log->size,
+				       st.st_size, &truncated);
+	if (rc) {
+		fprintf(stderr, "Failed to read sender log: %s\n",
+			strerror(-rc));
+		goto out_send_log_teardown;
+	}
+
+	rc = isochron_log_init(rcv_log, __be32_to_cpu(header.rcv_log_size));
+	if (rc) {
+		fprintf(stderr, "failed to allocate memory for rcv log\n");
+		goto out_send_log_teardown;
+	}
+
+	rc = isochron_log_read_partial(fd, start +
+				       __be64_to_cpu(header.rcv_log_start),
+				       rcv_log->buf, rcv_log->size,
+				       st.st_size, &truncated);
+	if (rc) {
+		fprintf(stderr, "Failed to read receiver log: %s\n",
+			strerror(-rc));
+		goto out_rcv_log_teardown;
+	}
+
+	/* Logs saved without --sync-sample-interval have no sync samples */
+	sync_log->buf = NULL;
+	sync_log->size = 0;
+
+	if (header.sync_log_size) {
+		rc = isochron_log_init(sync_log,
+				       __be32_to_cpu(header.sync_log_size));
+		if (rc) {
+			fprintf(stderr, "failed to allocate memory for sync log\n");
+			goto out_rcv_log_teardown;
+		}
+
+		rc = isochron_log_read_partial(fd, start +
+					       __be64_to_cpu(header.sync_log_start),
+					       sync_log->buf, sync_log->size,
+					       st.st_size, &truncated);
+		if (rc) {
+			fprintf(stderr, "Failed to read sync log: %s\n",
+				strerror(-rc));
+			goto out_sync_log_teardown;
+		}
+	}
+
+	/* Logs older than version 5 have no annotations */
+	annotation_log->buf = NULL;
+	annotation_log->size = 0;
+
+	if (__be32_to_cpu(header.version) >= 5 && header.annotation_log_size) {
+		rc = isochron_log_init(annotation_log,
+				       __be32_to_cpu(header.annotation_log_size));
+		if (rc) {
+			fprintf(stderr, "failed to allocate memory for annotations\n");
+			goto out_sync_log_teardown;
+		}
+
+		rc = isochron_log_read_partial(fd, start +
+					       __be64_to_cpu(header.annotation_log_start),
+					       annotation_log->buf,
+					       annotation_log->size,
+					       st.st_size, &truncated);
+		if (rc) {
+			fprintf(stderr, "Failed to read annotations: %s\n",
+				strerror(-rc));
+			goto out_annotation_log_teardown;
+		}
+	}
+
+	if (truncated)
+		fprintf(stderr,
+			"Warning: log file is truncated, reporting only on the packets it contains\n");
+	else if (flags & ISOCHRON_FLAG_INCOMPLETE)
+		fprintf(stderr,
+			"Warning: log was not completed, reporting only on the packets captured\n");
+
+	close(fd);
+
+	return 0;
+
+out_annotation_log_teardown:
+	isochron_log_teardown(annotation_log);
+out_sync_log_teardown:
+	isochron_log_teardown(sync_log);
+out_rcv_log_teardown:
+	isochron_log_teardown(rcv_log);
+out_send_log_teardown:
+	isochron_log_teardown(send_log);
+out_close:
+	close(fd);
+out:
+	return rc;
+}
+
+static void
+isochron_log_header_init(struct isochron_log_file_header *header,
+			 const struct isochron_log *send_log,
+			 const struct isochron_log *rcv_log,
+			 const struct isochron_log *sync_log,
+			 const struct isochron_log *annotation_log,
+			 long packet_count, long frame_size, bool omit_sync,
+			 bool do_ts, bool taprio, bool txtime, bool deadline,
+			 __s64 base_time, __s64 advance_time,
+			 __s64 shift_time, __s64 cycle_time,
+			 __s64 window_size)
+{
+	int flags = 0;
+
+	if (omit_sync)
+		flags |= ISOCHRON_FLAG_OMIT_SYNC;
+	if (do_ts)
+		flags |= ISOCHRON_FLAG_DO_TS;
+	if (taprio)
+		flags |= ISOCHRON_FLAG_TAPRIO;
+	if (txtime)
+		flags |= ISOCHRON_FLAG_TXTIME;
+	if (deadline)
+		flags |= ISOCHRON_FLAG_DEADLINE;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, isochron_magic, strlen(isochron_magic));
+	header->version = __cpu_to_be32(annotation_log->size ?
+					ISOCHRON_LOG_VERSION :
+					ISOCHRON_LOG_VERSION_NO_ANNOTATIONS);
+	header->packet_count = __cpu_to_be32(packet_count);
+	header->frame_size = __cpu_to_be16(frame_size);
+	header->flags = __cpu_to_be16(flags);
+	header->base_time = __cpu_to_be64(base_time);
+	header->advance_time = __cpu_to_be64(advance_time);
+	header->shift_time = __cpu_to_be64(shift_time);
+	header->cycle_time = __cpu_to_be64(cycle_time);
+	header->window_size = __cpu_to_be64(window_size);
+	/* Log offsets are relative to the start of the session */
+	header->send_log_start = __cpu_to_be64(sizeof(*header));
+	header->send_log_size = __cpu_to_be32(send_log->size);
+	header->rcv_log_start = __cpu_to_be64(sizeof(*header) + send_log->size);
+	header->rcv_log_size = __cpu_to_be32(rcv_log->size);
+	header->sync_log_start = __cpu_to_be64(sizeof(*header) + send_log->size +
+					       rcv_log->size);
+	header->sync_log_size = __cpu_to_be32(sync_log->size);
+	header->annotation_log_start = __cpu_to_be64(sizeof(*header) +
+						     send_log->size +
+						     rcv_log->size +
+						     sync_log->size);
+	header->annotation_log_size = __cpu_to_be32(annotation_log->size);
+}
+
+static int
+isochron_log_write_session(int fd, off_t start,
+			   const struct isochron_log_file_header *header,
+			   const struct isochron_log *send_log,
+			   const struct isochron_log *rcv_log,
+			   const struct isochron_log *sync_log,
+			   const struct isochron_log *annotation_log)
+{
+	int rc;
+
+	rc = isochron_log_write_at(fd, start, header, sizeof(*header));
+	if (rc) {
+		fprintf(stderr, "Failed to write log header to file: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	rc = isochron_log_write_at(fd, start + sizeof(*header),
+				   send_log->buf, send_log->size);
+	if (rc) {
+		fprintf(stderr, "Failed to write send log to file: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	rc = isochron_log_write_at(fd, start + sizeof(*header) + send_log->size,
+				   rcv_log->buf, rcv_log->size);
+	if (rc) {
+		fprintf(stderr, "Failed to write receive log to file: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	rc = isochron_log_write_at(fd, start + sizeof(*header) + send_log->size +
+				   rcv_log->size, sync_log->buf,
+				   sync_log->size);
+	if (rc) {
+		fprintf(stderr, "Failed to write sync log to file: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	rc = isochron_log_write_at(fd, start + sizeof(*header) + send_log->size +
+				   rcv_log->size + sync_log->size,
+				   annotation_log->buf, annotation_log->size);
+	if (rc) {
+		fprintf(stderr, "Failed to write annotations to file: %s\n",
+			strerror(-rc));
+		return rc;
+	}
+
+	return 0;
+}
+
+int isochron_log_save(const char *file, const struct isochron_log *send_log,
+		      const struct isochron_log *rcv_log,
+		      const struct isochron_log *sync_log,
+		      const struct isochron_log *annotation_log,
+		      long packet_count,
+		      long frame_size, bool omit_sync, bool do_ts, bool taprio,
+		      bool txtime, bool deadline, __s64 base_time,
+		      __s64 advance_time, __s64 shift_time, __s64 cycle_time,
+		      __s64 window_size)
+{
+	struct isochron_log_file_header header;
+	int fd, rc;
+
+	isochron_log_header_init(&header, send_log, rcv_log, sync_log,
+				 annotation_log, packet_count, frame_size,
+				 omit_sync, do_ts, taprio, txtime, deadline,
+				 base_time, advance_time, shift_time,
+				 cycle_time, window_size);
+
+	fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, FILEMODE);
+	if (fd < 0) {
+		perror("open");
+		return -errno;
+	}
+
+	rc = isochron_log_write_session(fd, 0, &header, send_log, rcv_log,
+					sync_log, annotation_log);
+
+	close(fd);
+
+	return rc;
+}
+
+static int isochron_log_container_init(int fd)
+{
+	struct isochron_container_header ch = {
+		.version	= __cpu_to_be32(ISOCHRON_CONTAINER_VERSION),
+		.first_dir	= __cpu_to_be64(sizeof(ch)),
+		.last_dir	= __cpu_to_be64(sizeof(ch)),
+	};
+	struct isochron_session_dir dir = {};
+	int rc;
+
+	memcpy(ch.magic, isochron_container_magic,
+	       strlen(isochron_container_magic));
+
+	rc = isochron_log_write_at(fd, sizeof(ch), &dir, sizeof(dir));
+	if (rc)
+		return rc;
+
+	return isochron_log_write_at(fd, 0, &ch, sizeof(ch));
+}
+
+static int isochron_log_sync_fd(int fd, const char *what)
+{
+	int rc;
+
+	if (fdatasync(fd) < 0) {
+		rc = -errno;
+		fprintf(stderr, "Failed to sync %s to disk: %s\n", what,
+			strerror(-rc));
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Sessions are appended at the end of the file and only become visible to
+ * readers after the session directory and then the container header are
+ * updated to point to them. Each of these steps is synced to disk before
+ * the next one, so an interrupted append (including by a crash) leaves the
+ * previously saved sessions intact.
+ */
+int isochron_log_append(const char *file, const struct isochron_log *send_log,
+			const struct isochron_log *rcv_log,
+			const struct isochron_log *sync_log,
+			const struct isochron_log *annotation_log,
+			long packet_count,
+			long frame_size, bool omit_sync, bool do_ts,
+			bool taprio, bool txtime, bool deadline,
+			__s64 base_time, __s64 advance_time, __s64 shift_time,
+			__s64 cycle_time, __s64 window_size)
+{
+	struct isochron_log_file_header header;
+	struct isochron_container_header ch;
+	struct isochron_session_dir dir;
+	__u32 num_entries, num_sessions;
+	off_t start, dir_start;
+	struct stat st;
+	size_t size;
+	int fd, rc;
+
+	isochron_log_header_init(&header, send_log, rcv_log, sync_log,
+				 annotation_log, packet_count, frame_size,
+				 omit_sync, do_ts, taprio, txtime, deadline,
+				 base_time, advance_time, shift_time,
+				 cycle_time, window_size);
+
+	fd = open(file, O_CREAT | O_RDWR, FILEMODE);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		return -errno;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		rc = -errno;
+		goto out_close;
+	}
+
+	if (!st.st_size) {
+		rc = isochron_log_container_init(fd);
+		if (rc) {
+			fprintf(stderr, "Failed to initialize container: %s\n",
+				strerror(-rc));
+			goto out_close;
+		}
+
+		rc = isochron_log_sync_fd(fd, "container header");
+		if (rc)
+			goto out_close;
+	}
+
+	rc = isochron_log_read_at(fd, 0, &ch, sizeof(ch));
+	if (rc) {
+		fprintf(stderr, "Failed to read container header: %s\n",
+			strerror(-rc));
+		goto out_close;
+	}
+
+	if (memcmp(ch.magic, isochron_container_magic,
+		   strlen(isochron_container_magic))) {
+		fprintf(stderr,
+			"%s is not a multi-session container, refusing to append to it\n",
+			file);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	if (__be32_to_cpu(ch.version) != ISOCHRON_CONTAINER_VERSION) {
+		fprintf(stderr,
+			"Unsupported container version %d, expected %d\n",
+			__be32_to_cpu(ch.version), ISOCHRON_CONTAINER_VERSION);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	dir_start = __be64_to_cpu(ch.last_dir);
+
+	rc = isochron_log_read_at(fd, dir_start, &dir, sizeof(dir));
+	if (rc) {
+		fprintf(stderr, "Failed to read session directory: %s\n",
+			strerror(-rc));
+		goto out_close;
+	}
+
+	start = lseek(fd, 0, SEEK_END);
+	if (start < 0) {
+		perror("lseek");
+		rc = -errno;
+		goto out_close;
+	}
+
+	rc = isochron_log_write_session(fd, start, &header, send_log, rcv_log,
+					sync_log, annotation_log);
+	if (rc)
+		goto out_close;
+
+	rc = isochron_log_sync_fd(fd, "session");
+	if (rc)
+		goto out_close;
+
+	size = sizeof(header) + send_log->size + rcv_log->size + sync_log->size +
+	       annotation_log->size;
+	num_entries = __be32_to_cpu(dir.num_entries);
+	num_sessions = __be32_to_cpu(ch.num_sessions);
+
+	if (num_entries == ISOCHRON_SESSION_DIR_SIZE) {
+		off_t new_dir_start = start + size;
+		__be64 next = __cpu_to_be64(new_dir_start);
+
+		memset(&dir, 0, sizeof(dir));
+		dir.num_entries = __cpu_to_be32(1);
+		dir.entries[0].start = __cpu_to_be64(start);
+		dir.entries[0].size = __cpu_to_be64(size);
+
+		rc = isochron_log_write_at(fd, new_dir_start, &dir,
+					   sizeof(dir));
+		if (rc)
+			goto out_dir_err;
+
+		rc = isochron_log_sync_fd(fd, "session directory");
+		if (rc)
+			goto out_close;
+
+		rc = isochron_log_write_at(fd, dir_start +
+					   offsetof(struct isochron_session_dir, next),
+					   &next, sizeof(next));
+		if (rc)
+			goto out_dir_err;
+
+		ch.last_dir = __cpu_to_be64(new_dir_start);
+	} else {
+		dir.entries[num_entries].start = __cpu_to_be64(start);
+		dir.entries[num_entries].size = __cpu_to_be64(size);
+		dir.num_entries = __cpu_to_be32(num_entries + 1);
+
+		rc = isochron_log_write_at(fd, dir_start, &dir, sizeof(dir));
+		if (rc)
+			goto out_dir_err;
+	}
+
+	rc = isochron_log_sync_fd(fd, "session directory");
+	if (rc)
+		goto out_close;
+
+	ch.num_sessions = __cpu_to_be32(num_sessions + 1);
+
+	rc = isochron_log_write_at(fd, 0, &ch, sizeof(ch));
+	if (rc) {
+		fprintf(stderr, "Failed to update container header: %s\n",
+			strerror(-rc));
+		goto out_close;
+	}
+
+	rc = isochron_log_sync_fd(fd, "container header");
+	if (rc)
+		goto out_close;
+
+	close(fd);
+
+	return 0;
+
+out_dir_err:
+	fprintf(stderr, "Failed to update session directory: %s\n",
+		strerror(-rc));
+out_close:
+	close(fd);
+	return rc;
+}
+
+static int isochron_log_map_msync(struct isochron_log_map *map, int flags)
+{
+	if (msync(map->addr, map->len, flags) < 0) {
+		perror("Failed to sync log file");
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* Back the send and receive logs with a shared mapping of a single-session
+ * log file, so that packets land in the page cache as they are logged and
+ * survive the process being killed. The header is written first and marks
+ * the log as incomplete until isochron_log_map_complete() is called.
+ */
+int isochron_log_map_create(struct isochron_log_map *map, const char *file,
+			    struct isochron_log *send_log,
+			    struct isochron_log *rcv_log,
+			    struct isochron_log *sync_log,
+			    struct isochron_log *annotation_log,
+			    size_t send_log_size, size_t rcv_log_size,
+			    size_t sync_log_size, size_t annotation_log_size,
+			    long packet_count,
+			    long frame_size, bool omit_sync, bool do_ts,
+			    bool taprio, bool txtime, bool deadline,
+			    __s64 base_time, __s64 advance_time,
+			    __s64 shift_time, __s64 cycle_time,
+			    __s64 window_size)
+{
+	struct isochron_log_file_header *header;
+	size_t len;
+	void *addr;
+	int fd, rc;
+
+	len = sizeof(*header) + send_log_size + rcv_log_size + sync_log_size +
+	      annotation_log_size;
+
+	fd = open(file, O_CREAT | O_RDWR | O_TRUNC, FILEMODE);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		return -errno;
+	}
+
+	if (ftruncate(fd, len) < 0) {
+		perror("Failed to resize log file");
+		rc = -errno;
+		goto out_close;
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("Failed to map log file");
+		rc = -errno;
+		goto out_close;
+	}
+
+	send_log->buf = (char *)addr + sizeof(*header);
+	send_log->size = send_log_size;
+	rcv_log->buf = send_log->buf + send_log_size;
+	rcv_log->size = rcv_log_size;
+	sync_log->buf = rcv_log->buf + rcv_log_size;
+	sync_log->size = sync_log_size;
+	annotation_log->buf = sync_log->buf + sync_log_size;
+	annotation_log->size = annotation_log_size;
+
+	header = addr;
+	isochron_log_header_init(header, send_log, rcv_log, sync_log,
+				 annotation_log, packet_count, frame_size,
+				 omit_sync, do_ts, taprio, txtime, deadline,
+				 base_time, advance_time, shift_time,
+				 cycle_time, window_size);
+	header->flags |= __cpu_to_be16(ISOCHRON_FLAG_INCOMPLETE);
+
+	map->addr = addr;
+	map->len = len;
+	map->fd = fd;
+
+	rc = isochron_log_map_msync(map, MS_SYNC);
+	if (rc) {
+		munmap(addr, len);
+		goto out_close;
+	}
+
+	return 0;
+
+out_close:
+	close(fd);
+	return rc;
+}
+
+/* Periodic flush while the test is running. Only schedules the writeback
+ * of the dirty pages, so as to not block the monitoring loop for a time
+ * proportional to the log size.
+ */
+int isochron_log_map_sync(struct isochron_log_map *map)
+{
+	return isochron_log_map_msync(map, MS_ASYNC);
+}
 
-		rc = isochron_printf_one_packet(&v, printf_fmt, printf_args);
-		if (rc)
-			goto out;
+int isochron_log_map_complete(struct isochron_log_map *map)
+{
+	struct isochron_log_file_header *header = map->addr;
 
-		if (summary && !missing)
-			isochron_process_stat(&v, &stats, taprio, txtime);
-	}
+	header->flags &= ~__cpu_to_be16(ISOCHRON_FLAG_INCOMPLETE);
 
-	if (!summary)
-		return 0;
+	return isochron_log_map_msync(map, MS_SYNC);
+}
 
-	if (not_tx_timestamped) {
-		printf("Packets not completely TX timestamped: %llu (%.3lf%%)\n",
-		       not_tx_timestamped,
-		       100.0f * not_tx_timestamped / pkt_arr_size);
+void isochron_log_map_destroy(struct isochron_log_map *map)
+{
+	munmap(map->addr, map->len);
+	close(map->fd);
+}
+
+/* A packet which is still not completely timestamped or received by the
+ * time that a packet scheduled this much later has been sent is given up
+ * on, and counted as missing.
+ */
+#define ISOCHRON_FOLLOW_SETTLE_TIME	(5 * NSEC_PER_SEC)
+
+/* Incremental report on a log which is still being written through
+ * isochron_log_map_create(). The file is mapped read-only, so the entries
+ * filled in by the sender become visible without reading it again, and
+ * each packet is accounted for exactly once, when it settles.
+ */
+struct isochron_follow {
+	const struct isochron_log_file_header *header;
+	void *addr;
+	size_t len;
+	struct isochron_log send_log;
+	struct isochron_log rcv_log;
+	__u32 packet_count;
+	/* Packets up to @written have been sent, up to @next reported on */
+	__u32 written;
+	__u32 next;
+	bool summary;
+	bool windowed;
+	struct isochron_stats stats;
+	struct isochron_windows windows;
+	bool omit_sync;
+	bool taprio;
+	bool txtime;
+	__s64 base_time;
+	__s64 advance_time;
+	__s64 shift_time;
+	__s64 cycle_time;
+	__s64 window_size;
+};
+
+static int isochron_follow_open(struct isochron_follow *f, const char *file)
+{
+	const struct isochron_log_file_header *header;
+	struct isochron_log_file_header h;
+	size_t send_log_size, rcv_log_size;
+	long num_sessions;
+	struct stat st;
+	bool container;
+	off_t start;
+	int fd, rc;
+	int flags;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		return -errno;
 	}
 
-	if (not_received) {
-		printf("Packets not received: %llu (%.3lf%%)\n", not_received,
-		       100.0f * not_received / pkt_arr_size);
+	rc = isochron_log_session_start(fd, 0, &start, &num_sessions,
+					&container);
+	if (rc)
+		goto out_close;
+
+	if (container) {
+		fprintf(stderr,
+			"Following a multi-session container is not supported\n");
+		rc = -EINVAL;
+		goto out_close;
 	}
 
-	if (!stats.frame_count) {
-		printf("Could not calculate statistics, no packets were received\n");
-		return 0;
+	rc = isochron_log_read_at(fd, 0, &h, sizeof(h));
+	if (rc) {
+		fprintf(stderr, "Failed to read log header from file: %s\n",
+			strerror(-rc));
+		goto out_close;
 	}
 
-	stats.tx_sync_offset_mean /= stats.frame_count;
-	stats.rx_sync_offset_mean /= stats.frame_count;
-	stats.path_delay_mean /= stats.frame_count;
+	send_log_size = __be32_to_cpu(h.send_log_size);
+	rcv_log_size = __be32_to_cpu(h.rcv_log_size);
+	f->len = sizeof(h) + send_log_size + rcv_log_size;
 
-	if (llabs((long long)stats.tx_sync_offset_mean) > NSEC_PER_SEC &&
-	    !omit_sync) {
-		printf("Sender PHC not synchronized (mean PHC to system time "
-		       "diff %.3lf ns larger than 1 second)\n",
-		       stats.tx_sync_offset_mean);
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		rc = -errno;
+		goto out_close;
 	}
-	if (llabs((long long)stats.rx_sync_offset_mean) > NSEC_PER_SEC &&
-	    !omit_sync) {
-		printf("Receiver PHC not synchronized (mean PHC to system time "
-		       "diff %.3lf ns larger than 1 second)\n",
-		       stats.rx_sync_offset_mean);
+
+	if ((size_t)st.st_size < f->len ||
+	    __be64_to_cpu(h.send_log_start) != sizeof(h) ||
+	    __be64_to_cpu(h.rcv_log_start) != sizeof(h) + send_log_size) {
+		fprintf(stderr,
+			"Log file was not created by isochron send --mmap-output\n");
+		rc = -EINVAL;
+		goto out_close;
 	}
-	if (llabs((long long)stats.path_delay_mean) > NSEC_PER_SEC &&
-	    !omit_sync) {
-		printf("Sender and receiver not synchronized (mean path delay "
-		       "%.3lf ns larger than 1 second)\n",
-		       stats.path_delay_mean);
+
+	f->addr = mmap(NULL, f->len, PROT_READ, MAP_SHARED, fd, 0);
+	if (f->addr == MAP_FAILED) {
+		perror("Failed to map log file");
+		rc = -errno;
+		goto out_close;
 	}
 
-	printf("Summary:\n");
+	header = f->addr;
+	f->header = header;
+	f->send_log.buf = (char *)f->addr + sizeof(*header);
+	f->send_log.size = send_log_size;
+	f->rcv_log.buf = f->send_log.buf + send_log_size;
+	f->rcv_log.size = rcv_log_size;
+	f->packet_count = send_log_size / sizeof(struct isochron_send_pkt_data);
+
+	flags = __be16_to_cpu(h.flags);
+	f->omit_sync = !!(flags & ISOCHRON_FLAG_OMIT_SYNC);
+	f->taprio = !!(flags & ISOCHRON_FLAG_TAPRIO);
+	f->txtime = !!(flags & ISOCHRON_FLAG_TXTIME);
+	f->base_time = (__s64 )__be64_to_cpu(h.base_time);
+	f->advance_time = (__s64 )__be64_to_cpu(h.advance_time);
+	f->shift_time = (__s64 )__be64_to_cpu(h.shift_time);
+	f->cycle_time = (__s64 )__be64_to_cpu(h.cycle_time);
+	f->window_size = (__s64 )__be64_to_cpu(h.window_size);
 
-	/* Path delay */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       path_delay), false);
-	isochron_print_metric_stats("Path delay", &ms);
+out_close:
+	close(fd);
+	return rc;
+}
 
-	/* Wakeup to HW TX timestamp */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       wakeup_to_hw_ts), false);
-	isochron_print_metric_stats("Wakeup to HW TX timestamp", &ms);
+static bool isochron_follow_complete(const struct isochron_follow *f)
+{
+	return !(__be16_to_cpu(f->header->flags) & ISOCHRON_FLAG_INCOMPLETE);
+}
 
-	/* HW RX deadline delta (TX time to HW RX timestamp) */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       hw_rx_deadline_delta), false);
-	if (ms.mean > 0) {
-		isochron_print_metric_stats("Packets arrived later than scheduled. TX time to HW RX timestamp",
-					    &ms);
-	} else {
-		isochron_metric_compute_stats(&stats, &ms,
-					      offsetof(struct isochron_packet_metrics,
-						       hw_rx_deadline_delta), true);
-		isochron_print_metric_stats("Packets arrived earlier than scheduled. HW RX timestamp to TX time",
-					    &ms);
-	}
+/* Account for the packets which settled since the last call. When the
+ * log is complete, nothing is left to wait for.
+ */
+static int isochron_follow_update(struct isochron_follow *f, bool complete)
+{
+	struct isochron_send_pkt_data *pkt_arr, *send_pkt;
+	struct isochron_rcv_pkt_data dummy_rcv_pkt = {};
+	struct isochron_rcv_pkt_data *rcv_pkt;
+	struct isochron_printf_variables v;
+	bool not_tx_timestamped, missing;
+	__s64 newest_scheduled;
+	int rc;
 
-	/* Latency budget, interpreted differently depending on testing mode */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       latency_budget), false);
-	if (taprio || txtime)
-		isochron_print_metric_stats("MAC latency", &ms);
-	else
-		isochron_print_metric_stats("Application latency budget", &ms);
+	pkt_arr = (struct isochron_send_pkt_data *)f->send_log.buf;
 
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       sender_latency), false);
-	isochron_print_metric_stats("Sender latency", &ms);
-	sender_latency_ms = ms;
+	while (f->written < f->packet_count &&
+	       __be32_to_cpu(pkt_arr[f->written].seqid) == f->written + 1)
+		f->written++;
 
-	/* Wakeup latency */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       wakeup_latency), false);
-	wakeup_latency_ms = ms;
-	isochron_print_metric_stats("Wakeup latency", &ms);
+	if (!f->written)
+		return 0;
 
-	/* Driver latency */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       driver_latency), false);
-	driver_latency_ms = ms;
-	isochron_print_metric_stats("Driver latency", &ms);
+	newest_scheduled = __be64_to_cpu(pkt_arr[f->written - 1].scheduled);
 
-	/* Arrival latency */
-	isochron_metric_compute_stats(&stats, &ms,
-				      offsetof(struct isochron_packet_metrics,
-					       arrival_latency), false);
-	isochron_print_metric_stats("Arrival latency", &ms);
+	for (; f->next < f->written; f->next++) {
+		send_pkt = &pkt_arr[f->next];
 
-	printf("Sending one packet takes on average %.3lf%% of the cycle time (min %.3lf%% max %.3lf%%)\n",
-	       100.0f * sender_latency_ms.mean / cycle_time,
-	       100.0f * sender_latency_ms.min / cycle_time,
-	       100.0f * sender_latency_ms.max / cycle_time);
-	printf("Waking up takes on average %.3lf%% of the cycle time (min %.3lf%% max %.3lf%%)\n",
-	       100.0f * wakeup_latency_ms.mean / cycle_time,
-	       100.0f * wakeup_latency_ms.min / cycle_time,
-	       100.0f * wakeup_latency_ms.max / cycle_time);
-	printf("Driver takes on average %.3lf%% of the cycle time to send a packet (min %.3lf%% max %.3lf%%)\n",
-	       100.0f * driver_latency_ms.mean / cycle_time,
-	       100.0f * driver_latency_ms.min / cycle_time,
-	       100.0f * driver_latency_ms.max / cycle_time);
+		not_tx_timestamped = !__be64_to_cpu(send_pkt->swts) ||
+				     !__be64_to_cpu(send_pkt->sched_ts) ||
+				     !__be64_to_cpu(send_pkt->hwts);
 
-	/* HW TX deadline misses */
-	if (!taprio && !txtime)
-		printf("HW TX deadline misses: %d (%.3lf%%)\n",
-		       stats.hw_tx_deadline_misses,
-		       100.0f * stats.hw_tx_deadline_misses / stats.frame_count);
+		rcv_pkt = isochron_rcv_log_find(&f->rcv_log, send_pkt->seqid);
+		missing = not_tx_timestamped || !rcv_pkt;
+		if (!rcv_pkt)
+			rcv_pkt = &dummy_rcv_pkt;
 
-out:
-	LIST_FOREACH_SAFE(entry, &stats.entries, list, tmp) {
-		LIST_REMOVE(entry, list);
-		free(entry);
-	}
+		/* Wait for the timestamps and the receiver log to catch up */
+		if (missing && !complete &&
+		    newest_scheduled - (__s64)__be64_to_cpu(send_pkt->scheduled) <
+		    ISOCHRON_FOLLOW_SETTLE_TIME)
+			break;
 
-	return rc;
-}
+		isochron_printf_vars_get(send_pkt, rcv_pkt, f->base_time,
+					 f->advance_time, f->shift_time,
+					 f->cycle_time, f->window_size, &v);
 
-int isochron_log_init(struct isochron_log *log, size_t size)
-{
-	log->buf = calloc(sizeof(char), size);
-	if (!log->buf)
-		return -ENOMEM;
+		if (f->windowed) {
+			rc = isochron_windows_add(&f->windows, f->next + 1,
+						  v.tx_scheduled,
+						  missing ? NULL : &v);
+			if (rc)
+				return rc;
+		}
 
-	log->size = size;
+		if (!f->summary)
+			continue;
+
+		if (not_tx_timestamped)
+			f->stats.not_tx_timestamped++;
+		if (rcv_pkt == &dummy_rcv_pkt)
+			f->stats.not_received++;
+		if (!missing)
+			isochron_process_stat(&v, &f->stats, f->taprio,
+					      f->txtime);
+	}
 
 	return 0;
 }
 
-void isochron_log_teardown(struct isochron_log *log)
+static void isochron_follow_print(struct isochron_follow *f)
 {
-	free(log->buf);
+	printf("Reported on %u of %u packets\n", f->next, f->packet_count);
+
+	if (f->next)
+		isochron_print_summary(&f->stats, f->next, f->omit_sync,
+				       f->taprio, f->txtime, f->cycle_time,
+				       NULL, 0);
+
+	fflush(stdout);
 }
 
-int isochron_log_for_each_pkt(struct isochron_log *log, size_t pkt_size,
-			      void *priv, isochron_log_walk_cb_t cb)
+int isochron_log_follow(const char *file, __s64 interval, bool summary,
+			unsigned long window_packets, __s64 window_time,
+			const __s64 *thresholds)
 {
-	size_t i, pkt_arr_size = log->size / pkt_size;
+	struct isochron_follow f = {0};
+	struct timespec interval_ts;
+	bool complete;
 	int rc;
 
-	for (i = 0; i < pkt_arr_size; i++) {
-		void *pkt = (void *)((__u8 *)log->buf + i * pkt_size);
+	rc = isochron_follow_open(&f, file);
+	if (rc)
+		return rc;
 
-		rc = cb(priv, pkt);
+	f.summary = summary;
+	f.windowed = window_packets || window_time;
+
+	if (f.windowed) {
+		rc = isochron_windows_init(&f.windows, 1, window_packets,
+					   window_time, thresholds, f.taprio,
+					   f.txtime);
 		if (rc)
-			return rc;
+			goto out;
 	}
 
-	return 0;
+	interval_ts = ns_to_timespec(interval);
+
+	do {
+		complete = isochron_follow_complete(&f);
+
+		rc = isochron_follow_update(&f, complete);
+		if (rc)
+			goto out;
+
+		if (complete || signal_received)
+			break;
+
+		if (summary)
+			isochron_follow_print(&f);
+
+		/* Interrupted by a signal is fine, that is checked above */
+		nanosleep(&interval_ts, NULL);
+	} while (!signal_received);
+
+	if (f.windowed)
+		isochron_windows_finish(&f.windows);
+
+	if (summary)
+		isochron_follow_print(&f);
+
+out:
+	if (rc == -ENOMEM)
+		fprintf(stderr, "Failed to allocate memory for statistics\n");
+	if (f.windowed)
+		isochron_windows_teardown(&f.windows);
+	munmap(f.addr, f.len);
+
+	return rc;
 }
 
-int isochron_log_load(const char *file, struct isochron_log *send_log,
-		      struct isochron_log *rcv_log, long *packet_count,
-		      long *frame_size, bool *omit_sync, bool *do_ts,
-		      bool *taprio, bool *txtime, bool *deadline,
-		      __s64 *base_time, __s64 *advance_time, __s64 *shift_time,
-		      __s64 *cycle_time, __s64 *window_size)
+/* Open one session of a log file for reading it in pieces, without loading
+ * it in memory. Reads are done with pread() and are therefore safe to be
+ * issued concurrently from multiple threads.
+ */
+int isochron_log_file_open(struct isochron_log_file *f, const char *file,
+			   long session)
 {
-	struct isochron_log_file_header header;
-	size_t len;
-	int fd, rc;
-	int flags;
+	long num_sessions;
+	bool container;
+	off_t start;
+	int rc;
 
-	fd = open(file, O_RDONLY);
-	if (fd < 0) {
+	f->fd = open(file, O_RDONLY);
+	if (f->fd < 0) {
 		fprintf(stderr, "Failed to open file %s: %m\n", file);
-		rc = fd;
-		goto out;
+		return -errno;
+	}
+
+	rc = isochron_log_session_start(f->fd, session, &start, &num_sessions,
+					&container);
+	if (rc)
+		goto out_close;
+
+	if (session < 0 || session >= num_sessions) {
+		fprintf(stderr, "Session %ld out of range, %s has %ld\n",
+			session, file, num_sessions);
+		rc = -ERANGE;
+		goto out_close;
 	}
 
-	len = read_exact(fd, &header, sizeof(header));
-	if (len <= 0) {
-		perror("Failed to read log header from file");
-		rc = len;
+	rc = isochron_log_read_at(f->fd, start, &f->header, sizeof(f->header));
+	if (rc) {
+		fprintf(stderr, "Failed to read log header from %s: %s\n",
+			file, strerror(-rc));
 		goto out_close;
 	}
 
-	if (memcmp(header.magic, isochron_magic, strlen(isochron_magic))) {
+	if (memcmp(f->header.magic, isochron_magic, strlen(isochron_magic))) {
 		fprintf(stderr, "Unrecognized file format\n");
 		rc = -EINVAL;
 		goto out_close;
 	}
 
-	flags = __be16_to_cpu(header.flags);
-	*omit_sync = !!(flags & ISOCHRON_FLAG_OMIT_SYNC);
-	*do_ts = !!(flags & ISOCHRON_FLAG_DO_TS);
-	*taprio = !!(flags & ISOCHRON_FLAG_TAPRIO);
-	*txtime = !!(flags & ISOCHRON_FLAG_TXTIME);
-	*deadline = !!(flags & ISOCHRON_FLAG_DEADLINE);
+	f->send_log_start = start + __be64_to_cpu(f->header.send_log_start);
+	f->rcv_log_start = start + __be64_to_cpu(f->header.rcv_log_start);
+	f->num_send_pkts = __be32_to_cpu(f->header.send_log_size) /
+			   sizeof(struct isochron_send_pkt_data);
+	f->num_rcv_pkts = __be32_to_cpu(f->header.rcv_log_size) /
+			  sizeof(struct isochron_rcv_pkt_data);
 
-	*packet_count = __be32_to_cpu(header.packet_count);
-	*frame_size = __be16_to_cpu(header.frame_size);
-	*base_time = (__s64 )__be64_to_cpu(header.base_time);
-	*advance_time = (__s64 )__be64_to_cpu(header.advance_time);
-	*shift_time = (__s64 )__be64_to_cpu(header.shift_time);
-	*cycle_time = (__s64 )__be64_to_cpu(header.cycle_time);
-	*window_size = (__s64 )__be64_to_cpu(header.window_size);
+	return 0;
 
-	if (lseek(fd, __be64_to_cpu(header.send_log_start), SEEK_SET) < 0) {
-		perror("Failed to seek to the sender log");
-		rc = -errno;
-		goto out_close;
-	}
+out_close:
+	close(f->fd);
+	return rc;
+}
 
-	rc = isochron_log_init(send_log, __be32_to_cpu(header.send_log_size));
-	if (rc) {
-		fprintf(stderr, "failed to allocate memory for send log\n");
-		goto out_close;
-	}
+/* Create a single-session log file of a given size, which takes the test
+ * parameters from the header of another log file. The packets are filled
+ * in afterwards through isochron_log_file_write().
+ */
+int isochron_log_file_create(struct isochron_log_file *f, const char *file,
+			     const struct isochron_log_file *tmpl,
+			     __u32 packet_count)
+{
+	size_t send_log_size, rcv_log_size;
+	int flags;
+	int rc;
 
-	len = read_exact(fd, send_log->buf, send_log->size);
-	if (len <= 0) {
-		perror("Failed to read sender log");
-		rc = len;
-		goto out_send_log_teardown;
+	send_log_size = packet_count * sizeof(struct isochron_send_pkt_data);
+	rcv_log_size = packet_count * sizeof(struct isochron_rcv_pkt_data);
+	flags = __be16_to_cpu(tmpl->header.flags) & ~ISOCHRON_FLAG_INCOMPLETE;
+
+	f->header = tmpl->header;
+	f->header.version = __cpu_to_be32(ISOCHRON_LOG_VERSION_NO_ANNOTATIONS);
+	f->header.packet_count = __cpu_to_be32(packet_count);
+	f->header.flags = __cpu_to_be16(flags);
+	f->header.send_log_start = __cpu_to_be64(sizeof(f->header));
+	f->header.send_log_size = __cpu_to_be32(send_log_size);
+	f->header.rcv_log_start = __cpu_to_be64(sizeof(f->header) +
+						send_log_size);
+	f->header.rcv_log_size = __cpu_to_be32(rcv_log_size);
+	/* Sync samples and annotations are not carried over */
+	f->header.sync_log_start = 0;
+	f->header.sync_log_size = 0;
+	f->header.annotation_log_start = 0;
+	f->header.annotation_log_size = 0;
+	f->send_log_start = sizeof(f->header);
+	f->rcv_log_start = sizeof(f->header) + send_log_size;
+	f->num_send_pkts = packet_count;
+	f->num_rcv_pkts = packet_count;
+
+	f->fd = open(file, O_CREAT | O_RDWR | O_TRUNC, FILEMODE);
+	if (f->fd < 0) {
+		fprintf(stderr, "Failed to open file %s: %m\n", file);
+		return -errno;
 	}
 
-	if (lseek(fd, __be64_to_cpu(header.rcv_log_start), SEEK_SET) < 0) {
-		perror("Failed to seek to the receiver log");
+	if (ftruncate(f->fd, sizeof(f->header) + send_log_size +
+		      rcv_log_size) < 0) {
+		perror("Failed to resize log file");
 		rc = -errno;
-		goto out_send_log_teardown;
+		goto out_close;
 	}
 
-	rc = isochron_log_init(rcv_log, __be32_to_cpu(header.rcv_log_size));
+	rc = isochron_log_pwrite(f->fd, &f->header, sizeof(f->header), 0);
 	if (rc) {
-		fprintf(stderr, "failed to allocate memory for rcv log\n");
-		goto out_send_log_teardown;
-	}
-
-	len = read_exact(fd, rcv_log->buf, rcv_log->size);
-	if (len <= 0) {
-		perror("Failed to read receiver log");
-		rc = len;
-		goto out_rcv_log_teardown;
+		fprintf(stderr, "Failed to write log header to %s: %s\n",
+			file, strerror(-rc));
+		goto out_close;
 	}
 
-	close(fd);
-
 	return 0;
 
-out_rcv_log_teardown:
-	isochron_log_teardown(rcv_log);
-out_send_log_teardown:
-	isochron_log_teardown(send_log);
 out_close:
-	close(fd);
-out:
+	close(f->fd);
 	return rc;
 }
 
-int isochron_log_save(const char *file, const struct isochron_log *send_log,
-		      const struct isochron_log *rcv_log, long packet_count,
-		      long frame_size, bool omit_sync, bool do_ts, bool taprio,
-		      bool txtime, bool deadline, __s64 base_time,
-		      __s64 advance_time, __s64 shift_time, __s64 cycle_time,
-		      __s64 window_size)
+void isochron_log_file_close(struct isochron_log_file *f)
 {
-	struct isochron_log_file_header header = {
-		.version	= __cpu_to_be32(ISOCHRON_LOG_VERSION),
-		.packet_count	= __cpu_to_be32(packet_count),
-		.frame_size	= __cpu_to_be16(frame_size),
-		.base_time	= __cpu_to_be64(base_time),
-		.advance_time	= __cpu_to_be64(advance_time),
-		.shift_time	= __cpu_to_be64(shift_time),
-		.cycle_time	= __cpu_to_be64(cycle_time),
-		.window_size	= __cpu_to_be64(window_size),
-	};
-	int flags = 0;
-	size_t len;
-	int fd;
+	close(f->fd);
+}
 
-	if (omit_sync)
-		flags |= ISOCHRON_FLAG_OMIT_SYNC;
-	if (do_ts)
-		flags |= ISOCHRON_FLAG_DO_TS;
-	if (taprio)
-		flags |= ISOCHRON_FLAG_TAPRIO;
-	if (txtime)
-		flags |= ISOCHRON_FLAG_TXTIME;
-	if (deadline)
-		flags |= ISOCHRON_FLAG_DEADLINE;
+/* Read a range of send and receive log entries. Entries past the end of a
+ * truncated file are returned as zeroes, i.e. as packets which were never
+ * logged.
+ */
+int isochron_log_file_read(const struct isochron_log_file *f,
+			   struct isochron_send_pkt_data *send_pkts,
+			   struct isochron_rcv_pkt_data *rcv_pkts,
+			   __u32 first, __u32 count)
+{
+	size_t send_count = 0, rcv_count = 0;
+	ssize_t len;
 
-	memcpy(header.magic, isochron_magic, strlen(isochron_magic));
-	header.flags = __cpu_to_be16(flags);
-	header.send_log_start = __cpu_to_be64(sizeof(header));
-	header.send_log_size = __cpu_to_be32(send_log->size);
-	header.rcv_log_start = __cpu_to_be64(sizeof(header) + send_log->size);
-	header.rcv_log_size = __cpu_to_be32(rcv_log->size);
+	memset(send_pkts, 0, count * sizeof(*send_pkts));
+	memset(rcv_pkts, 0, count * sizeof(*rcv_pkts));
 
-	fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, FILEMODE);
-	if (fd < 0) {
-		perror("open");
-		return fd;
-	}
+	if (first < f->num_send_pkts)
+		send_count = min(count, f->num_send_pkts - first);
+	if (first < f->num_rcv_pkts)
+		rcv_count = min(count, f->num_rcv_pkts - first);
 
-	len = write_exact(fd, &header, sizeof(header));
-	if (len <= 0) {
-		perror("Failed to write log header to file");
-		close(fd);
+	len = isochron_log_pread(f->fd, send_pkts,
+				 send_count * sizeof(*send_pkts),
+				 f->send_log_start + first * sizeof(*send_pkts));
+	if (len < 0)
 		return len;
-	}
 
-	len = write_exact(fd, send_log->buf, send_log->size);
-	if (len <= 0) {
-		perror("Failed to write send log to file");
-		close(fd);
+	len = isochron_log_pread(f->fd, rcv_pkts,
+				 rcv_count * sizeof(*rcv_pkts),
+				 f->rcv_log_start + first * sizeof(*rcv_pkts));
+	if (len < 0)
 		return len;
-	}
 
-	len = write_exact(fd, rcv_log->buf, rcv_log->size);
-	if (len <= 0) {
-		perror("Failed to write receive log to file");
-		close(fd);
-		return len;
-	}
+	return 0;
+}
 
-	close(fd);
+int isochron_log_file_write(const struct isochron_log_file *f,
+			    const struct isochron_send_pkt_data *send_pkts,
+			    const struct isochron_rcv_pkt_data *rcv_pkts,
+			    __u32 first, __u32 count)
+{
+	int rc;
 
-	return 0;
+	if (first + count > f->num_send_pkts)
+		return -ERANGE;
+
+	rc = isochron_log_pwrite(f->fd, send_pkts, count * sizeof(*send_pkts),
+				 f->send_log_start + first * sizeof(*send_pkts));
+	if (rc)
+		return rc;
+
+	return isochron_log_pwrite(f->fd, rcv_pkts, count * sizeof(*rcv_pkts),
+				   f->rcv_log_start + first * sizeof(*rcv_pkts));
+}
+
+/* Check whether packets from two log files can be meaningfully combined,
+ * i.e. whether they were sent with the same schedule. The base time is
+ * allowed to differ.
+ */
+bool isochron_log_file_params_match(const struct isochron_log_file *a,
+				    const struct isochron_log_file *b)
+{
+	int a_flags = __be16_to_cpu(a->header.flags) & ~ISOCHRON_FLAG_INCOMPLETE;
+	int b_flags = __be16_to_cpu(b->header.flags) & ~ISOCHRON_FLAG_INCOMPLETE;
+
+	return a->header.frame_size == b->header.frame_size &&
+	       a_flags == b_flags &&
+	       a->header.advance_time == b->header.advance_time &&
+	       a->header.shift_time == b->header.shift_time &&
+	       a->header.cycle_time == b->header.cycle_time &&
+	       a->header.window_size == b->header.window_size;
 }
@@ -12,10 +12,16 @@
 
 #define ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS		256
 #define ISOCHRON_LOG_PRINTF_BUF_SIZE			4096
+#define ISOCHRON_LOG_MAX_ANNOTATIONS			64
+
+/* Packets sent during an annotated sync loss, marked when the log is
+ * reported on
+ */
+#define ISOCHRON_PKT_SYNC_LOST				(1 << 0)
 
 struct isochron_send_pkt_data {
 	__be32 seqid;
-	__be32 reserved;
+	__be32 flags;
 	__be64 scheduled;
 	__be64 wakeup;
 	__be64 hwts;
@@ -31,11 +37,92 @@ struct isochron_rcv_pkt_data {
 	__be64 swts;
 } __attribute((packed));
 
+/* Offset between the sender's system clock and its PHC, sampled periodically
+ * during the test. Both are expressed in TAI.
+ */
+struct isochron_sync_sample {
+	__be64 ts;
+	__be64 offset; /* system clock minus PHC */
+	__be64 delay;
+} __attribute((packed));
+
+enum isochron_annotation_type {
+	ISOCHRON_ANNOTATION_NONE,
+	ISOCHRON_ANNOTATION_SYNC_LOSS,
+};
+
+/* Time interval (in TAI) during which the test data is suspect. Unused
+ * entries have a type of ISOCHRON_ANNOTATION_NONE.
+ */
+struct isochron_annotation {
+	__be64 start;
+	__be64 stop;
+	__be32 type;
+	__be32 reserved;
+} __attribute((packed));
+
+#define ISOCHRON_ANNOTATION_LOG_SIZE \
+	(ISOCHRON_LOG_MAX_ANNOTATIONS * sizeof(struct isochron_annotation))
+
+struct isochron_log_file_header {
+	char		magic[8];
+	__be32		version;
+	__be32		packet_count;
+	__be16		frame_size;
+	__be16		flags;
+	__be32		sync_log_size;
+	__be64		base_time;
+	__be64		advance_time;
+	__be64		shift_time;
+	__be64		cycle_time;
+	__be64		window_size;
+	__be64		send_log_start;
+	__be64		rcv_log_start;
+	__be32		send_log_size;
+	__be32		rcv_log_size;
+	__be64		sync_log_start;
+	__be64		annotation_log_start;
+	__be32		annotation_log_size;
+	__be32		reserved;
+} __attribute((packed));
+
 struct isochron_log {
 	size_t		size;
 	char		*buf;
 };
 
+struct isochron_log_file {
+	struct isochron_log_file_header header;
+	off_t		send_log_start;
+	off_t		rcv_log_start;
+	__u32		num_send_pkts;
+	__u32		num_rcv_pkts;
+	int		fd;
+};
+
+struct isochron_log_map {
+	void		*addr;
+	size_t		len;
+	int		fd;
+};
+
+enum isochron_metric {
+	ISOCHRON_METRIC_WAKEUP_TO_HW_TS,
+	ISOCHRON_METRIC_HW_RX_DEADLINE_DELTA,
+	ISOCHRON_METRIC_LATENCY_BUDGET,
+	ISOCHRON_METRIC_PATH_DELAY,
+	ISOCHRON_METRIC_WAKEUP_LATENCY,
+	ISOCHRON_METRIC_SENDER_LATENCY,
+	ISOCHRON_METRIC_DRIVER_LATENCY,
+	ISOCHRON_METRIC_ARRIVAL_LATENCY,
+	__ISOCHRON_METRIC_MAX,
+};
+
+enum isochron_export_format {
+	ISOCHRON_EXPORT_NPY,
+	ISOCHRON_EXPORT_ARROW,
+};
+
 int isochron_log_init(struct isochron_log *log, size_t size);
 void *isochron_log_get_entry(struct isochron_log *log, size_t entry_size,
 			     int index);
@@ -53,29 +140,137 @@ int isochron_log_send_pkt(struct isochron_log *log,
 			  const struct isochron_send_pkt_data *send_pkt);
 int isochron_log_rcv_pkt(struct isochron_log *log,
 			 const struct isochron_rcv_pkt_data *rcv_pkt);
+void isochron_log_sync_sample(struct isochron_log *log, unsigned long index,
+			      const struct isochron_sync_sample *sample);
+int isochron_log_sync_finish(struct isochron_log *log, unsigned long count);
+int isochron_log_sync_correct(struct isochron_log *send_log,
+			      const struct isochron_log *sync_log,
+			      unsigned long start, unsigned long stop,
+			      bool correct, __s64 excursion);
+int isochron_log_annotate(struct isochron_log *log,
+			  enum isochron_annotation_type type,
+			  __s64 start, __s64 stop);
+int isochron_log_sync_loss(struct isochron_log *send_log,
+			   const struct isochron_log *annotation_log,
+			   unsigned long start, unsigned long stop,
+			   bool exclude);
 
 int isochron_print_stats(struct isochron_log *send_log,
 			 struct isochron_log *rcv_log,
 			 const char *printf_fmt, const char *printf_args,
 			 unsigned long start, unsigned long stop, bool summary,
+			 const double *percentiles, int num_percentiles,
+			 bool approximate, const char *histogram_file,
 			 bool omit_sync, bool taprio, bool txtime,
 			 __s64 base_time, __s64 advance_time, __s64 shift_time,
-			 __s64 cycle_time, __s64 window_size);
+			 __s64 cycle_time, __s64 window_size, long num_threads,
+			 const char *user_metrics);
+
+int isochron_print_windows(struct isochron_log *send_log,
+			   struct isochron_log *rcv_log,
+			   unsigned long start, unsigned long stop,
+			   unsigned long window_packets, __s64 window_time,
+			   const __s64 *thresholds, bool taprio, bool txtime,
+			   __s64 base_time, __s64 advance_time,
+			   __s64 shift_time, __s64 cycle_time,
+			   __s64 window_size);
+int isochron_metric_from_key(const char *key);
+
+int isochron_log_follow(const char *file, __s64 interval, bool summary,
+			unsigned long window_packets, __s64 window_time,
+			const __s64 *thresholds);
+
+int isochron_print_periodicity(struct isochron_log *send_log,
+			       struct isochron_log *rcv_log,
+			       unsigned long start, unsigned long stop,
+			       int metric, int num_periods, bool taprio,
+			       bool txtime, __s64 base_time,
+			       __s64 advance_time, __s64 shift_time,
+			       __s64 cycle_time, __s64 window_size);
+
+int isochron_print_outliers(struct isochron_log *send_log,
+			    struct isochron_log *rcv_log,
+			    unsigned long start, unsigned long stop,
+			    const char *expr, int num_outliers, int context,
+			    __s64 base_time, __s64 advance_time,
+			    __s64 shift_time, __s64 cycle_time,
+			    __s64 window_size);
+
+int isochron_log_export(struct isochron_log *send_log,
+			struct isochron_log *rcv_log,
+			enum isochron_export_format format, const char *path,
+			const char *export_args, unsigned long start,
+			unsigned long stop, __s64 base_time,
+			__s64 advance_time, __s64 shift_time,
+			__s64 cycle_time, __s64 window_size);
 
 size_t isochron_log_buf_tlv_size(struct isochron_log *log);
 
-int isochron_log_load(const char *file, struct isochron_log *send_log,
-		      struct isochron_log *rcv_log, long *packet_count,
+int isochron_log_num_sessions(const char *file, long *num_sessions,
+			      bool *container);
+
+int isochron_log_load(const char *file, long session,
+		      struct isochron_log *send_log,
+		      struct isochron_log *rcv_log,
+		      struct isochron_log *sync_log,
+		      struct isochron_log *annotation_log, long *packet_count,
 		      long *frame_size, bool *omit_sync, bool *do_ts,
 		      bool *taprio, bool *txtime, bool *deadline,
 		      __s64 *base_time, __s64 *advance_time, __s64 *shift_time,
 		      __s64 *cycle_time, __s64 *window_size);
 
 int isochron_log_save(const char *file, const struct isochron_log *send_log,
-		      const struct isochron_log *rcv_log, long packet_count,
+		      const struct isochron_log *rcv_log,
+		      const struct isochron_log *sync_log,
+		      const struct isochron_log *annotation_log,
+		      long packet_count,
 		      long frame_size, bool omit_sync, bool do_ts, bool taprio,
 		      bool txtime, bool deadline, __s64 base_time,
 		      __s64 advance_time, __s64 shift_time, __s64 cycle_time,
 		      __s64 window_size);
 
+int isochron_log_append(const char *file, const struct isochron_log *send_log,
+			const struct isochron_log *rcv_log,
+			const struct isochron_log *sync_log,
+			const struct isochron_log *annotation_log,
+			long packet_count,
+			long frame_size, bool omit_sync, bool do_ts,
+			bool taprio, bool txtime, bool deadline,
+			__s64 base_time, __s64 advance_time, __s64 shift_time,
+			__s64 cycle_time, __s64 window_size);
+
+int isochron_log_map_create(struct isochron_log_map *map, const char *file,
+			    struct isochron_log *send_log,
+			    struct isochron_log *rcv_log,
+			    struct isochron_log *sync_log,
+			    struct isochron_log *annotation_log,
+			    size_t send_log_size, size_t rcv_log_size,
+			    size_t sync_log_size, size_t annotation_log_size,
+			    long packet_count,
+			    long frame_size, bool omit_sync, bool do_ts,
+			    bool taprio, bool txtime, bool deadline,
+			    __s64 base_time, __s64 advance_time,
+			    __s64 shift_time, __s64 cycle_time,
+			    __s64 window_size);
+int isochron_log_map_sync(struct isochron_log_map *map);
+int isochron_log_map_complete(struct isochron_log_map *map);
+void isochron_log_map_destroy(struct isochron_log_map *map);
+
+int isochron_log_file_open(struct isochron_log_file *f, const char *file,
+			   long session);
+int isochron_log_file_create(struct isochron_log_file *f, const char *file,
+			     const struct isochron_log_file *tmpl,
+			     __u32 packet_count);
+void isochron_log_file_close(struct isochron_log_file *f);
+int isochron_log_file_read(const struct isochron_log_file *f,
+			   struct isochron_send_pkt_data *send_pkts,
+			   struct isochron_rcv_pkt_data *rcv_pkts,
+			   __u32 first, __u32 count);
+int isochron_log_file_write(const struct isochron_log_file *f,
+			    const struct isochron_send_pkt_data *send_pkts,
+			    const struct isochron_rcv_pkt_data *rcv_pkts,
+			    __u32 first, __u32 count);
+bool isochron_log_file_params_match(const struct isochron_log_file *a,
+				    const struct isochron_log_file *b);
+
 #endif
@@ -4,8 +4,13 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include "argparser.h"
 #include "common.h"
+#include "isochron.h"
 #include "management.h"
 #include "ptpmon.h"
 #include "rtnl.h"
@@ -14,6 +19,14 @@
 struct isochron_mgmt_handler {
 	const struct isochron_mgmt_ops *ops;
 	struct isochron_error *error_table;
+	/* Refuse SET operations */
+	bool read_only;
+	/* Request being reassembled: header followed by payload */
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+	/* Payload bytes of a dropped request still to be skipped */
+	size_t discard;
 };
 
 const char *mid_to_string(enum isochron_management_id mid)
@@ -109,6 +122,12 @@ const char *mid_to_string(enum isochron_management_id mid)
 		return "CURRENT_CLOCK_TAI";
 	case ISOCHRON_MID_OPER_BASE_TIME:
 		return "OPER_BASE_TIME";
+	case ISOCHRON_MID_LOG_SUBSCRIBE:
+		return "LOG_SUBSCRIBE";
+	case ISOCHRON_MID_LOG_CHUNK:
+		return "LOG_CHUNK";
+	case ISOCHRON_MID_EVENT_SUBSCRIBE:
+		return "EVENT_SUBSCRIBE";
 	default:
 		return "UNKNOWN";
 	}
@@ -142,6 +161,50 @@ static void isochron_send_empty_tlv(struct sk *sock,
 	isochron_send_tlv(sock, ISOCHRON_RESPONSE, mid, 0);
 }
 
+static int isochron_drain_sk(struct sk *sock, size_t len)
+{
+	unsigned char junk[BUFSIZ];
+	int rc;
+
+	while (len) {
+		size_t count = min(len, (size_t)BUFSIZ);
+
+		rc = sk_recv(sock, junk, count, 0);
+		if (rc) {
+			sk_err(sock, rc,
+			       "Error while draining %zu bytes from socket: %m\n",
+			       len);
+			return rc;
+		}
+		len -= count;
+	};
+
+	return 0;
+}
+
+/* Synchronous clients do not subscribe to events, but the socket may still be
+ * shared with an earlier subscription. Skip over any notification which might
+ * precede the response.
+ */
+static int isochron_recv_msg(struct sk *sock,
+			     struct isochron_management_message *msg)
+{
+	int rc;
+
+	while (1) {
+		rc = sk_recv(sock, msg, sizeof(*msg), 0);
+		if (rc)
+			return rc;
+
+		if (msg->action != ISOCHRON_NOTIFICATION)
+			return 0;
+
+		rc = isochron_drain_sk(sock, __be32_to_cpu(msg->payload_length));
+		if (rc)
+			return rc;
+	}
+}
+
 int isochron_collect_rcv_log(struct sk *sock, struct isochron_log *rcv_log)
 {
 	struct isochron_management_message msg;
@@ -152,7 +215,7 @@ int isochron_collect_rcv_log(struct sk *sock, struct isochron_log *rcv_log)
 	if (rc)
 		return rc;
 
-	rc = sk_recv(sock, &msg, sizeof(msg), 0);
+	rc = isochron_recv_msg(sock, &msg);
 	if (rc) {
 		sk_err(sock, rc,
 		       "Failed to receive GET response message header for log: %m\n");
@@ -177,27 +240,6 @@ int isochron_collect_rcv_log(struct sk *sock, struct isochron_log *rcv_log)
 	return isochron_log_recv(rcv_log, sock);
 }
 
-static int isochron_drain_sk(struct sk *sock, size_t len)
-{
-	unsigned char junk[BUFSIZ];
-	int rc;
-
-	while (len) {
-		size_t count = min(len, (size_t)BUFSIZ);
-
-		rc = sk_recv(sock, junk, count, 0);
-		if (rc) {
-			sk_err(sock, rc,
-			       "Error while draining %zu bytes from socket: %m\n",
-			       len);
-			return rc;
-		}
-		len -= count;
-	};
-
-	return 0;
-}
-
 int isochron_query_mid_error(struct sk *sock, enum isochron_management_id mid,
 			     struct isochron_error *err)
 {
@@ -211,7 +253,7 @@ int isochron_query_mid_error(struct sk *sock, enum isochron_management_id mid,
 	if (rc)
 		return rc;
 
-	rc = sk_recv(sock, &msg, sizeof(msg), 0);
+	rc = isochron_recv_msg(sock, &msg);
 	if (rc) {
 		sk_err(sock, rc,
 		       "Failed to receive GET_ERR response message header: %m\n");
@@ -337,6 +379,167 @@ static void isochron_print_mid_error(struct sk *sock,
 		pr_err(err.rc, "Remote error %d: %m\n", err.rc);
 }
 
+/* Retrieve the log entries which the remote end has completed since the
+ * previous call, and place them at their index in @log, which must be sized
+ * for the entire test.
+ */
+int isochron_collect_log_chunk(struct sk *sock, struct isochron_log *log,
+			       size_t entry_size, bool *complete)
+{
+	struct isochron_management_message msg;
+	size_t payload_length, tlv_length;
+	struct isochron_log_chunk chunk;
+	struct isochron_tlv tlv;
+	__u32 start, count;
+	void *dest;
+	int rc;
+
+	rc = isochron_send_tlv(sock, ISOCHRON_GET, ISOCHRON_MID_LOG_CHUNK, 0);
+	if (rc)
+		return rc;
+
+	rc = isochron_recv_msg(sock, &msg);
+	if (rc) {
+		sk_err(sock, rc,
+		       "Failed to receive GET response message header for log chunk: %m\n");
+		return rc;
+	}
+
+	if (msg.version != ISOCHRON_MANAGEMENT_VERSION ||
+	    msg.action != ISOCHRON_RESPONSE) {
+		fprintf(stderr, "Unexpected reply to log chunk request\n");
+		return -EBADMSG;
+	}
+
+	payload_length = __be32_to_cpu(msg.payload_length);
+	if (payload_length < sizeof(tlv)) {
+		fprintf(stderr, "Log chunk reply too short\n");
+		isochron_drain_sk(sock, payload_length);
+		return -EBADMSG;
+	}
+
+	rc = sk_recv(sock, &tlv, sizeof(tlv), 0);
+	if (rc) {
+		sk_err(sock, rc,
+		       "Failed to receive GET response TLV for log chunk: %m\n");
+		return rc;
+	}
+
+	tlv_length = __be32_to_cpu(tlv.length_field);
+	if (__be16_to_cpu(tlv.tlv_type) != ISOCHRON_TLV_MANAGEMENT ||
+	    __be16_to_cpu(tlv.management_id) != ISOCHRON_MID_LOG_CHUNK ||
+	    tlv_length < sizeof(chunk)) {
+		isochron_drain_sk(sock, tlv_length);
+		isochron_print_mid_error(sock, ISOCHRON_MID_LOG_CHUNK);
+		return -EBADMSG;
+	}
+
+	rc = sk_recv(sock, &chunk, sizeof(chunk), 0);
+	if (rc) {
+		sk_err(sock, rc, "Failed to receive log chunk header: %m\n");
+		return rc;
+	}
+
+	tlv_length -= sizeof(chunk);
+	start = __be32_to_cpu(chunk.start);
+	count = __be32_to_cpu(chunk.count);
+
+	if ((__u64)tlv_length != (__u64)count * entry_size ||
+	    ((__u64)start + count) * entry_size > log->size) {
+		fprintf(stderr,
+			"Log chunk of %u entries starting at %u does not fit log of %zu entries\n",
+			count, start, log->size / entry_size);
+		isochron_drain_sk(sock, tlv_length);
+		return -EBADMSG;
+	}
+
+	if (count) {
+		dest = isochron_log_get_entry(log, entry_size, start);
+
+		rc = sk_recv(sock, dest, count * entry_size, 0);
+		if (rc) {
+			sk_err(sock, rc, "Failed to receive log chunk: %m\n");
+			return rc;
+		}
+	}
+
+	*complete = chunk.complete;
+
+	return 0;
+}
+
+/* Place the ISOCHRON_MID_LOG_CHUNK data received as part of a transaction
+ * at its index in @log.
+ */
+int isochron_log_chunk_parse(struct isochron_log *log, size_t entry_size,
+			     const void *data, size_t len, bool *complete)
+{
+	const struct isochron_log_chunk *chunk = data;
+	__u32 start, count;
+
+	if (len < sizeof(*chunk)) {
+		fprintf(stderr, "Log chunk reply too short\n");
+		return -EBADMSG;
+	}
+
+	len -= sizeof(*chunk);
+	start = __be32_to_cpu(chunk->start);
+	count = __be32_to_cpu(chunk->count);
+
+	if ((__u64)len != (__u64)count * entry_size ||
+	    ((__u64)start + count) * entry_size > log->size) {
+		fprintf(stderr,
+			"Log chunk of %u entries starting at %u does not fit log of %zu entries\n",
+			count, start, log->size / entry_size);
+		return -EBADMSG;
+	}
+
+	if (count)
+		memcpy(isochron_log_get_entry(log, entry_size, start),
+		       chunk + 1, count * entry_size);
+
+	*complete = chunk->complete;
+
+	return 0;
+}
+
+/* To be called once the test has ended, to wait for the remote end to
+ * complete its log. Gives up, keeping the missing entries zeroed out, if
+ * this takes longer than @timeout nanoseconds.
+ */
+int isochron_collect_log_tail(struct sk *sock, struct isochron_log *log,
+			      size_t entry_size, __s64 timeout)
+{
+	struct timespec interval = ns_to_timespec(NSEC_PER_SEC / 10);
+	struct timespec now_ts;
+	bool complete = false;
+	__s64 deadline;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+	deadline = timespec_to_ns(&now_ts) + timeout;
+
+	while (1) {
+		rc = isochron_collect_log_chunk(sock, log, entry_size,
+						&complete);
+		if (rc || complete)
+			return rc;
+
+		clock_gettime(CLOCK_MONOTONIC, &now_ts);
+		if (timespec_to_ns(&now_ts) >= deadline)
+			break;
+
+		if (signal_received)
+			return -EINTR;
+
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL);
+	}
+
+	fprintf(stderr, "Timed out waiting for remote log to complete\n");
+
+	return 0;
+}
+
 int isochron_query_mid(struct sk *sock, enum isochron_management_id mid,
 		       void *data, size_t data_len)
 {
@@ -352,7 +555,7 @@ int isochron_query_mid(struct sk *sock, enum isochron_management_id mid,
 		return rc;
 	}
 
-	rc = sk_recv(sock, &msg, sizeof(msg), 0);
+	rc = isochron_recv_msg(sock, &msg);
 	if (rc) {
 		sk_err(sock, rc,
 		       "Failed to receive response message header for MID %s: %m\n",
@@ -565,6 +768,32 @@ error:
 	isochron_send_empty_tlv(sock, mid);
 }
 
+struct isochron_txn_op {
+	enum isochron_tlv_type type;
+	enum isochron_management_id mid;
+	/* Destination of the GET data, or callback for variable-length data */
+	void *data;
+	size_t data_len;
+	isochron_txn_get_cb_t *cb;
+};
+
+struct isochron_txn {
+	/* Message header, followed by the TLVs added so far */
+	unsigned char *buf;
+	size_t len;
+	struct isochron_txn_op *ops;
+	int num_ops;
+	/* First error encountered while building the transaction */
+	int err;
+	/* Outcome of the last commit */
+	int rc;
+	__s64 submit_time;
+	__s64 rtt;
+	/* Entry in the list of the connection's requests in flight */
+	TAILQ_ENTRY(isochron_txn) list;
+	__u16 request_id;
+};
+
 static int isochron_update_mid(struct sk *sock, enum isochron_management_id mid,
 			       void *data, size_t data_len)
 {
@@ -578,15 +807,20 @@ static int isochron_update_mid(struct sk *sock, enum isochron_management_id mid,
 	if (!tmp_buf)
 		return -ENOMEM;
 
+	sk_cork(sock);
 	rc = isochron_send_tlv(sock, ISOCHRON_SET, mid, data_len);
-	if (rc)
+	if (!rc)
+		rc = sk_send(sock, data, data_len);
+	if (rc) {
+		sk_uncork(sock);
 		goto out;
+	}
 
-	rc = sk_send(sock, data, data_len);
+	rc = sk_uncork(sock);
 	if (rc)
 		goto out;
 
-	rc = sk_recv(sock, &msg, sizeof(msg), 0);
+	rc = isochron_recv_msg(sock, &msg);
 	if (rc)
 		goto out;
 
@@ -697,440 +931,1820 @@ out:
 	return rc;
 }
 
+/* Single-operation updates, for the callers which do not batch them. The
+ * TLV is built by the same helpers as batched transactions, but is sent as
+ * a plain SET message rather than as an ISOCHRON_TRANSACTION, which nodes
+ * running an older version do not understand.
+ */
+static int isochron_update_commit(struct sk *sock, struct isochron_txn *txn)
+{
+	struct isochron_tlv *tlv;
+	int rc;
+
+	if (!txn)
+		return -ENOMEM;
+
+	rc = txn->err;
+	if (rc)
+		goto out;
+
+	tlv = (struct isochron_tlv *)(txn->buf +
+				      sizeof(struct isochron_management_message));
+
+	rc = isochron_update_mid(sock, __be16_to_cpu(tlv->management_id),
+				 isochron_tlv_data(tlv),
+				 __be32_to_cpu(tlv->length_field));
+out:
+	isochron_txn_destroy(txn);
+
+	return rc;
+}
+
 int isochron_update_packet_count(struct sk *sock, long count)
 {
-	struct isochron_packet_count packet_count = {
-		.count = __cpu_to_be64(count),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_packet_count(txn, count);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_PACKET_COUNT,
-				   &packet_count, sizeof(packet_count));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_packet_size(struct sk *sock, int size)
 {
-	struct isochron_packet_size p = {
-		.size = __cpu_to_be32(size),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_packet_size(txn, size);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_PACKET_SIZE,
-				   &p, sizeof(p));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_destination_mac(struct sk *sock, unsigned char *addr)
 {
-	struct isochron_mac_addr mac = {};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	ether_addr_copy(mac.addr, addr);
+	if (txn)
+		isochron_txn_set_destination_mac(txn, addr);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_DESTINATION_MAC, &mac,
-				   sizeof(mac));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_source_mac(struct sk *sock, unsigned char *addr)
 {
-	struct isochron_mac_addr mac = {};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	ether_addr_copy(mac.addr, addr);
+	if (txn)
+		isochron_txn_set_source_mac(txn, addr);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SOURCE_MAC, &mac,
-				   sizeof(mac));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_node_role(struct sk *sock, enum isochron_role role)
 {
-	struct isochron_node_role r = {
-		.role = __cpu_to_be32(role),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_NODE_ROLE, &r, sizeof(r));
+	if (txn)
+		isochron_txn_set_node_role(txn, role);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_if_name(struct sk *sock, const char if_name[IFNAMSIZ])
 {
-	struct isochron_if_name ifn = {};
-	int rc;
+	struct isochron_txn *txn = isochron_txn_create();
 
-	rc = if_name_copy(ifn.name, if_name);
-	if (rc) {
-		fprintf(stderr, "Truncation while copying string\n");
-		return rc;
-	}
+	if (txn)
+		isochron_txn_set_if_name(txn, if_name);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_IF_NAME,
-				   &ifn, sizeof(ifn));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_priority(struct sk *sock, int priority)
 {
-	struct isochron_priority p = {
-		.priority = __cpu_to_be32(priority),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_priority(txn, priority);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_PRIORITY, &p, sizeof(p));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_stats_port(struct sk *sock, __u16 port)
 {
-	struct isochron_port p = {
-		.port = __cpu_to_be16(port),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_stats_port(txn, port);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_STATS_PORT, &p, sizeof(p));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_base_time(struct sk *sock, __u64 base_time)
 {
-	struct isochron_time t = {
-		.time = __cpu_to_be64(base_time),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_BASE_TIME, &t, sizeof(t));
+	if (txn)
+		isochron_txn_set_base_time(txn, base_time);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_advance_time(struct sk *sock, __u64 advance_time)
 {
-	struct isochron_time t = {
-		.time = __cpu_to_be64(advance_time),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_advance_time(txn, advance_time);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_ADVANCE_TIME,
-				   &t, sizeof(t));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_shift_time(struct sk *sock, __u64 shift_time)
 {
-	struct isochron_time t = {
-		.time = __cpu_to_be64(shift_time),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SHIFT_TIME,
-				   &t, sizeof(t));
+	if (txn)
+		isochron_txn_set_shift_time(txn, shift_time);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_cycle_time(struct sk *sock, __u64 cycle_time)
 {
-	struct isochron_time t = {
-		.time = __cpu_to_be64(cycle_time),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_cycle_time(txn, cycle_time);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_CYCLE_TIME,
-				   &t, sizeof(t));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_window_size(struct sk *sock, __u64 window_time)
 {
-	struct isochron_time t = {
-		.time = __cpu_to_be64(window_time),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_WINDOW_SIZE,
-				   &t, sizeof(t));
+	if (txn)
+		isochron_txn_set_window_size(txn, window_time);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_domain_number(struct sk *sock, int domain_number)
 {
-	struct isochron_domain_number d = {
-		.domain_number = domain_number,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_domain_number(txn, domain_number);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_DOMAIN_NUMBER,
-				   &d, sizeof(d));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_transport_specific(struct sk *sock, int transport_specific)
 {
-	struct isochron_transport_specific t = {
-		.transport_specific = transport_specific,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_TRANSPORT_SPECIFIC,
-				   &t, sizeof(t));
+	if (txn)
+		isochron_txn_set_transport_specific(txn, transport_specific);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_uds(struct sk *sock, const char uds_remote[UNIX_PATH_MAX])
 {
-	struct isochron_uds u = {};
-	int rc;
+	struct isochron_txn *txn = isochron_txn_create();
 
-	rc = uds_copy(u.name, uds_remote);
-	if (rc) {
-		fprintf(stderr, "Truncation while copying string\n");
-		return rc;
-	}
+	if (txn)
+		isochron_txn_set_uds(txn, uds_remote);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_UDS, &u, sizeof(u));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_num_readings(struct sk *sock, int num_readings)
 {
-	struct isochron_num_readings n = {
-		.num_readings = __cpu_to_be32(num_readings),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_NUM_READINGS,
-				   &n, sizeof(n));
+	if (txn)
+		isochron_txn_set_num_readings(txn, num_readings);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_sysmon_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_sysmon_enabled(txn, enabled);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SYSMON_ENABLED,
-				   &f, sizeof(f));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_ptpmon_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_PTPMON_ENABLED,
-				   &f, sizeof(f));
+	if (txn)
+		isochron_txn_set_ptpmon_enabled(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_ts_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_ts_enabled(txn, enabled);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_TS_ENABLED,
-				   &f, sizeof(f));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_vid(struct sk *sock, __u16 vid)
 {
-	struct isochron_vid v = {
-		.vid = __cpu_to_be16(vid),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_VID, &v, sizeof(v));
+	if (txn)
+		isochron_txn_set_vid(txn, vid);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_ethertype(struct sk *sock, __u16 ethertype)
 {
-	struct isochron_ethertype e = {
-		.ethertype = __cpu_to_be16(ethertype),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_ETHERTYPE, &e, sizeof(e));
+	if (txn)
+		isochron_txn_set_ethertype(txn, ethertype);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_quiet_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_quiet_enabled(txn, enabled);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_QUIET_ENABLED,
-				   &f, sizeof(f));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_taprio_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_TAPRIO_ENABLED,
-				   &f, sizeof(f));
+	if (txn)
+		isochron_txn_set_taprio_enabled(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_txtime_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_txtime_enabled(txn, enabled);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_TXTIME_ENABLED,
-				   &f, sizeof(f));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_deadline_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_DEADLINE_ENABLED,
-				   &f, sizeof(f));
+	if (txn)
+		isochron_txn_set_deadline_enabled(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_utc_offset(struct sk *sock, int offset)
 {
-	struct isochron_utc_offset u = {
-		.offset = __cpu_to_be16(offset),
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_utc_offset(txn, offset);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_UTC_OFFSET,
-				   &u, sizeof(u));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_ip_destination(struct sk *sock, struct ip_address *addr)
 {
-	struct isochron_ip_address i;
-	int rc;
+	struct isochron_txn *txn = isochron_txn_create();
 
-	i.family = __cpu_to_be32(addr->family);
-	memcpy(i.addr, &addr->addr6, 16);
-	rc = if_name_copy(i.bound_if_name, addr->bound_if_name);
-	if (rc) {
-		fprintf(stderr, "Truncation while copying string\n");
-		return rc;
-	}
+	if (txn)
+		isochron_txn_set_ip_destination(txn, addr);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_IP_DESTINATION,
-				   &i, sizeof(i));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_l2_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_l2_enabled(txn, enabled);
 
-	return isochron_update_mid(sock, ISOCHRON_MID_L2_ENABLED, &f, sizeof(f));
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_l4_enabled(struct sk *sock, bool enabled)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
-	};
+	struct isochron_txn *txn = isochron_txn_create();
 
-	return isochron_update_mid(sock, ISOCHRON_MID_L4_ENABLED, &f, sizeof(f));
+	if (txn)
+		isochron_txn_set_l4_enabled(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
 }
 
 int isochron_update_data_port(struct sk *sock, __u16 port)
 {
-	struct isochron_port p = {
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_data_port(txn, port);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_sched_fifo(struct sk *sock, bool enabled)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_sched_fifo(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_sched_rr(struct sk *sock, bool enabled)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_sched_rr(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_sched_priority(struct sk *sock, int priority)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_sched_priority(txn, priority);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_cpu_mask(struct sk *sock, unsigned long cpumask)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_cpu_mask(txn, cpumask);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_test_state(struct sk *sock, enum test_state state)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_test_state(txn, state);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_sync_monitor_enabled(struct sk *sock, bool enabled)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_sync_monitor_enabled(txn, enabled);
+
+	return isochron_update_commit(sock, txn);
+}
+
+int isochron_update_log_subscribe(struct sk *sock, __u32 chunk_size)
+{
+	struct isochron_txn *txn = isochron_txn_create();
+
+	if (txn)
+		isochron_txn_set_log_subscribe(txn, chunk_size);
+
+	return isochron_update_commit(sock, txn);
+}
+
+static void isochron_tlv_next(struct isochron_tlv **tlv, size_t *len)
+{
+	size_t tlv_size_bytes;
+
+	tlv_size_bytes = __be32_to_cpu((*tlv)->length_field) + sizeof(**tlv);
+	*len += tlv_size_bytes;
+	*tlv = (struct isochron_tlv *)((unsigned char *)*tlv + tlv_size_bytes);
+}
+
+
+struct isochron_txn *isochron_txn_create(void)
+{
+	struct isochron_txn *txn;
+
+	txn = calloc(1, sizeof(*txn));
+	if (!txn)
+		return NULL;
+
+	txn->len = sizeof(struct isochron_management_message);
+	txn->buf = calloc(1, txn->len);
+	if (!txn->buf) {
+		free(txn);
+		return NULL;
+	}
+
+	return txn;
+}
+
+void isochron_txn_destroy(struct isochron_txn *txn)
+{
+	free(txn->ops);
+	free(txn->buf);
+	free(txn);
+}
+
+bool isochron_txn_empty(const struct isochron_txn *txn)
+{
+	return !txn->num_ops;
+}
+
+int isochron_txn_rc(const struct isochron_txn *txn)
+{
+	return txn->rc;
+}
+
+/* Time elapsed between sending the transaction and receiving its response */
+__s64 isochron_txn_rtt(const struct isochron_txn *txn)
+{
+	return txn->rtt;
+}
+
+static struct isochron_txn_op *
+isochron_txn_add(struct isochron_txn *txn, enum isochron_tlv_type type,
+		 enum isochron_management_id mid, const void *data,
+		 size_t data_len)
+{
+	size_t tlv_size = sizeof(struct isochron_tlv) + data_len;
+	struct isochron_txn_op *ops, *op;
+	struct isochron_tlv *tlv;
+	unsigned char *buf;
+
+	if (txn->err)
+		return NULL;
+
+	buf = realloc(txn->buf, txn->len + tlv_size);
+	if (!buf)
+		goto err_nomem;
+
+	txn->buf = buf;
+
+	ops = realloc(txn->ops, (txn->num_ops + 1) * sizeof(*ops));
+	if (!ops)
+		goto err_nomem;
+
+	txn->ops = ops;
+
+	tlv = (struct isochron_tlv *)(txn->buf + txn->len);
+	tlv->tlv_type = __cpu_to_be16(type);
+	tlv->management_id = __cpu_to_be16(mid);
+	tlv->length_field = __cpu_to_be32(data_len);
+	if (data_len)
+		memcpy(isochron_tlv_data(tlv), data, data_len);
+
+	txn->len += tlv_size;
+
+	op = &ops[txn->num_ops++];
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->mid = mid;
+
+	return op;
+
+err_nomem:
+	txn->err = -ENOMEM;
+	return NULL;
+}
+
+int isochron_txn_add_set(struct isochron_txn *txn,
+			 enum isochron_management_id mid,
+			 const void *data, size_t data_len)
+{
+	if (!isochron_txn_add(txn, ISOCHRON_TLV_SET, mid, data, data_len))
+		return txn->err;
+
+	return 0;
+}
+
+/* The GET data is placed in @data once the transaction is committed */
+int isochron_txn_add_get(struct isochron_txn *txn,
+			 enum isochron_management_id mid,
+			 void *data, size_t data_len)
+{
+	struct isochron_txn_op *op;
+
+	op = isochron_txn_add(txn, ISOCHRON_TLV_GET, mid, NULL, 0);
+	if (!op)
+		return txn->err;
+
+	op->data = data;
+	op->data_len = data_len;
+
+	return 0;
+}
+
+int isochron_txn_add_get_cb(struct isochron_txn *txn,
+			    enum isochron_management_id mid,
+			    isochron_txn_get_cb_t *cb, void *priv)
+{
+	struct isochron_txn_op *op;
+
+	op = isochron_txn_add(txn, ISOCHRON_TLV_GET, mid, NULL, 0);
+	if (!op)
+		return txn->err;
+
+	op->cb = cb;
+	op->data = priv;
+
+	return 0;
+}
+
+static int isochron_txn_op_result(const struct isochron_txn_op *op,
+				  struct isochron_tlv *tlv, size_t len)
+{
+	const char *action = op->type == ISOCHRON_TLV_GET ? "query" : "update";
+	size_t tlv_length, data_length, extack_length;
+	char extack[ISOCHRON_EXTACK_SIZE] = {};
+	struct isochron_tlv_result *result;
+	unsigned char *data;
+	int rc;
+
+	if (len < sizeof(*tlv) + sizeof(*result)) {
+		fprintf(stderr,
+			"Failed to %s MID %s: result missing from transaction response\n",
+			action, mid_to_string(op->mid));
+		return -EBADMSG;
+	}
+
+	tlv_length = __be32_to_cpu(tlv->length_field);
+	if (tlv_length < sizeof(*result) || tlv_length > len - sizeof(*tlv)) {
+		fprintf(stderr,
+			"Failed to %s MID %s: invalid TLV length %zu in transaction response\n",
+			action, mid_to_string(op->mid), tlv_length);
+		return -EBADMSG;
+	}
+
+	if (__be16_to_cpu(tlv->tlv_type) != ISOCHRON_TLV_RESULT ||
+	    __be16_to_cpu(tlv->management_id) != op->mid) {
+		fprintf(stderr,
+			"Failed to %s MID %s: unexpected TLV type %d for MID %s in transaction response\n",
+			action, mid_to_string(op->mid),
+			__be16_to_cpu(tlv->tlv_type),
+			mid_to_string(__be16_to_cpu(tlv->management_id)));
+		return -EBADMSG;
+	}
+
+	result = isochron_tlv_data(tlv);
+	data = (unsigned char *)(result + 1);
+	rc = (int)__be32_to_cpu(result->rc);
+	data_length = __be32_to_cpu(result->data_length);
+
+	if (data_length > tlv_length - sizeof(*result)) {
+		fprintf(stderr,
+			"Failed to %s MID %s: data length %zu exceeds TLV length %zu\n",
+			action, mid_to_string(op->mid), data_length,
+			tlv_length);
+		return -EBADMSG;
+	}
+
+	if (rc) {
+		extack_length = tlv_length - sizeof(*result) - data_length;
+		memcpy(extack, data + data_length,
+		       min(extack_length, (size_t)ISOCHRON_EXTACK_SIZE - 1));
+
+		if (strlen(extack))
+			fprintf(stderr, "Failed to %s MID %s: remote error %d: %s\n",
+				action, mid_to_string(op->mid), rc, extack);
+		else
+			pr_err(rc, "Failed to %s MID %s: remote error %d: %m\n",
+			       action, mid_to_string(op->mid), rc);
+		return rc;
+	}
+
+	if (op->type != ISOCHRON_TLV_GET)
+		return 0;
+
+	if (op->cb)
+		return op->cb(op->data, data, data_length);
+
+	if (data_length != op->data_len) {
+		fprintf(stderr,
+			"Failed to query MID %s: expected %zu bytes in response, got %zu\n",
+			mid_to_string(op->mid), op->data_len, data_length);
+		return -EBADMSG;
+	}
+
+	if (data_length)
+		memcpy(op->data, data, data_length);
+
+	return 0;
+}
+
+static int isochron_txn_parse_response(struct isochron_txn *txn,
+				       unsigned char *buf, size_t len)
+{
+	struct isochron_tlv *tlv = (struct isochron_tlv *)buf;
+	size_t parsed_len = 0;
+	int i, rc;
+
+	for (i = 0; i < txn->num_ops; i++) {
+		rc = isochron_txn_op_result(&txn->ops[i], tlv,
+					    len - parsed_len);
+		if (rc)
+			return rc;
+
+		isochron_tlv_next(&tlv, &parsed_len);
+	}
+
+	return 0;
+}
+
+static int isochron_txn_frame(struct isochron_txn *txn, __u16 request_id)
+{
+	struct isochron_management_message *msg;
+	size_t payload_length;
+
+	if (txn->err)
+		return txn->err;
+
+	payload_length = txn->len - sizeof(*msg);
+	if (payload_length > UINT32_MAX) {
+		fprintf(stderr, "Transaction too large at %zu bytes\n",
+			payload_length);
+		return -EMSGSIZE;
+	}
+
+	msg = (struct isochron_management_message *)txn->buf;
+	msg->version = ISOCHRON_MANAGEMENT_VERSION;
+	msg->action = ISOCHRON_TRANSACTION;
+	msg->request_id = __cpu_to_be16(request_id);
+	msg->payload_length = __cpu_to_be32(payload_length);
+
+	txn->request_id = request_id;
+
+	return 0;
+}
+
+static bool isochron_txn_response_valid(const struct isochron_txn *txn,
+					const struct isochron_management_message *rsp)
+{
+	if (rsp->version == ISOCHRON_MANAGEMENT_VERSION &&
+	    rsp->action == ISOCHRON_RESPONSE &&
+	    __be16_to_cpu(rsp->request_id) == txn->request_id)
+		return true;
+
+	fprintf(stderr,
+		"Unexpected version %d action %d request ID %d in response to transaction %d\n",
+		rsp->version, rsp->action, __be16_to_cpu(rsp->request_id),
+		txn->request_id);
+
+	return false;
+}
+
+/* Send all operations of @txn in a single message, and wait for the
+ * response. Returns the error of the first operation which failed.
+ */
+int isochron_txn_commit(struct sk *sock, struct isochron_txn *txn)
+{
+	struct isochron_management_message rsp;
+	unsigned char *buf = NULL;
+	size_t payload_length;
+	int rc;
+
+	rc = isochron_txn_frame(txn, 0);
+	if (rc)
+		goto out;
+
+	rc = sk_send(sock, txn->buf, txn->len);
+	if (rc) {
+		sk_err(sock, rc, "Failed to send transaction: %m\n");
+		goto out;
+	}
+
+	rc = isochron_recv_msg(sock, &rsp);
+	if (rc) {
+		sk_err(sock, rc,
+		       "Failed to receive transaction response header: %m\n");
+		goto out;
+	}
+
+	payload_length = __be32_to_cpu(rsp.payload_length);
+
+	if (!isochron_txn_response_valid(txn, &rsp)) {
+		isochron_drain_sk(sock, payload_length);
+		rc = -EBADMSG;
+		goto out;
+	}
+
+	if (payload_length) {
+		buf = malloc(payload_length);
+		if (!buf) {
+			isochron_drain_sk(sock, payload_length);
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		rc = sk_recv(sock, buf, payload_length, 0);
+		if (rc) {
+			sk_err(sock, rc,
+			       "Failed to receive transaction response: %m\n");
+			goto out;
+		}
+	}
+
+	rc = isochron_txn_parse_response(txn, buf, payload_length);
+out:
+	free(buf);
+	txn->rc = rc;
+
+	return rc;
+}
+
+/* A management connection with asynchronous transactions in flight */
+struct isochron_mgmt_conn {
+	struct sk *sock;
+	TAILQ_HEAD(txn_head, isochron_txn) pending;
+	/* Response being reassembled: header followed by payload */
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+	/* Set once the connection is no longer usable */
+	int err;
+	/* Receives the events of ISOCHRON_NOTIFICATION messages */
+	isochron_event_cb_t *event_cb;
+	void *event_priv;
+	LIST_ENTRY(isochron_mgmt_conn) list;
+};
+
+struct isochron_mgmt_async {
+	int epoll_fd;
+	LIST_HEAD(conn_head, isochron_mgmt_conn) conns;
+	int num_pending;
+	/* First error of a transaction completed since the last wait */
+	int err;
+	__u16 next_request_id;
+};
+
+struct isochron_mgmt_async *isochron_mgmt_async_create(void)
+{
+	struct isochron_mgmt_async *async;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return NULL;
+
+	async->epoll_fd = epoll_create1(0);
+	if (async->epoll_fd < 0) {
+		perror("epoll_create1");
+		free(async);
+		return NULL;
+	}
+
+	LIST_INIT(&async->conns);
+
+	return async;
+}
+
+static void isochron_mgmt_async_done(struct isochron_mgmt_async *async,
+				     struct isochron_mgmt_conn *conn,
+				     struct isochron_txn *txn, int rc)
+{
+	TAILQ_REMOVE(&conn->pending, txn, list);
+	async->num_pending--;
+
+	txn->rc = rc;
+	if (rc && !async->err)
+		async->err = rc;
+}
+
+/* Complete all transactions in flight on @conn with @rc, and stop
+ * monitoring it
+ */
+static void isochron_mgmt_conn_fail(struct isochron_mgmt_async *async,
+				    struct isochron_mgmt_conn *conn, int rc)
+{
+	struct isochron_txn *txn;
+
+	while ((txn = TAILQ_FIRST(&conn->pending)) != NULL)
+		isochron_mgmt_async_done(async, conn, txn, rc);
+
+	if (!conn->err)
+		epoll_ctl(async->epoll_fd, EPOLL_CTL_DEL, sk_fd(conn->sock),
+			  NULL);
+
+	conn->err = rc;
+	conn->len = 0;
+}
+
+void isochron_mgmt_async_destroy(struct isochron_mgmt_async *async)
+{
+	struct isochron_mgmt_conn *conn;
+
+	while ((conn = LIST_FIRST(&async->conns)) != NULL) {
+		isochron_mgmt_conn_fail(async, conn, -ECANCELED);
+		LIST_REMOVE(conn, list);
+		free(conn->buf);
+		free(conn);
+	}
+
+	close(async->epoll_fd);
+	free(async);
+}
+
+static struct isochron_mgmt_conn *
+isochron_mgmt_async_get_conn(struct isochron_mgmt_async *async,
+			     struct sk *sock)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+	};
+	struct isochron_mgmt_conn *conn;
+
+	LIST_FOREACH(conn, &async->conns, list)
+		if (conn->sock == sock)
+			return conn;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->sock = sock;
+	TAILQ_INIT(&conn->pending);
+
+	ev.data.ptr = conn;
+	if (epoll_ctl(async->epoll_fd, EPOLL_CTL_ADD, sk_fd(sock), &ev) < 0) {
+		perror("epoll_ctl");
+		free(conn);
+		return NULL;
+	}
+
+	LIST_INSERT_HEAD(&async->conns, conn, list);
+
+	return conn;
+}
+
+static __s64 isochron_mgmt_now(void)
+{
+	struct timespec now_ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+
+	return timespec_to_ns(&now_ts);
+}
+
+/* Send @txn right away, without waiting for its response */
+int isochron_mgmt_async_submit(struct isochron_mgmt_async *async,
+			       struct sk *sock, struct isochron_txn *txn)
+{
+	struct isochron_mgmt_conn *conn;
+	int rc;
+
+	conn = isochron_mgmt_async_get_conn(async, sock);
+	if (!conn) {
+		txn->rc = -ENOMEM;
+		return txn->rc;
+	}
+
+	if (conn->err) {
+		txn->rc = conn->err;
+		return txn->rc;
+	}
+
+	rc = isochron_txn_frame(txn, ++async->next_request_id);
+	if (rc) {
+		txn->rc = rc;
+		return rc;
+	}
+
+	txn->submit_time = isochron_mgmt_now();
+
+	rc = sk_send(sock, txn->buf, txn->len);
+	if (rc) {
+		sk_err(sock, rc, "Failed to send transaction: %m\n");
+		txn->rc = rc;
+		return rc;
+	}
+
+	txn->rc = -EINPROGRESS;
+	TAILQ_INSERT_TAIL(&conn->pending, txn, list);
+	async->num_pending++;
+
+	return 0;
+}
+
+static void isochron_mgmt_conn_complete(struct isochron_mgmt_async *async,
+					struct isochron_mgmt_conn *conn)
+{
+	struct isochron_management_message *rsp;
+	struct isochron_txn *txn;
+
+	int rc = -EBADMSG;
+
+	txn = TAILQ_FIRST(&conn->pending);
+	txn->rtt = isochron_mgmt_now() - txn->submit_time;
+
+	rsp = (struct isochron_management_message *)conn->buf;
+	if (isochron_txn_response_valid(txn, rsp))
+		rc = isochron_txn_parse_response(txn,
+						 (unsigned char *)(rsp + 1),
+						 conn->len - sizeof(*rsp));
+
+	isochron_mgmt_async_done(async, conn, txn, rc);
+	conn->len = 0;
+}
+
+/* Notifications are not answers to anything, and may be interleaved with
+ * the responses of the transactions in flight.
+ */
+static void isochron_mgmt_conn_notify(struct isochron_mgmt_conn *conn)
+{
+	struct isochron_management_message *msg;
+	size_t len, parsed_len = 0, tlv_len;
+	struct isochron_tlv *tlv;
+
+	msg = (struct isochron_management_message *)conn->buf;
+	len = conn->len - sizeof(*msg);
+	tlv = (struct isochron_tlv *)(msg + 1);
+	conn->len = 0;
+
+	if (msg->version != ISOCHRON_MANAGEMENT_VERSION || !conn->event_cb)
+		return;
+
+	while (len - parsed_len >= sizeof(*tlv)) {
+		tlv_len = __be32_to_cpu(tlv->length_field);
+		if (tlv_len > len - parsed_len - sizeof(*tlv))
+			break;
+
+		if (__be16_to_cpu(tlv->tlv_type) == ISOCHRON_TLV_EVENT)
+			conn->event_cb(conn->event_priv,
+				       __be16_to_cpu(tlv->management_id),
+				       isochron_tlv_data(tlv), tlv_len);
+
+		isochron_tlv_next(&tlv, &parsed_len);
+	}
+}
+
+/* Consume what is available on the socket, completing the transactions
+ * whose response was fully received.
+ */
+static int isochron_mgmt_conn_read(struct isochron_mgmt_async *async,
+				   struct isochron_mgmt_conn *conn)
+{
+	struct isochron_management_message *rsp;
+	size_t expected, received;
+	bool polled = false;
+	unsigned char *tmp;
+	int rc;
+
+	while (1) {
+		expected = sizeof(*rsp);
+		if (conn->len >= sizeof(*rsp)) {
+			rsp = (struct isochron_management_message *)conn->buf;
+			expected += __be32_to_cpu(rsp->payload_length);
+		}
+
+		if (conn->len == expected) {
+			if (rsp->action == ISOCHRON_NOTIFICATION) {
+				isochron_mgmt_conn_notify(conn);
+			} else if (TAILQ_EMPTY(&conn->pending)) {
+				fprintf(stderr, "Unsolicited management message\n");
+				conn->len = 0;
+			} else {
+				isochron_mgmt_conn_complete(async, conn);
+			}
+			continue;
+		}
+
+		/* Once what was read ahead is consumed, let epoll report
+		 * whether the kernel has more, instead of finding out
+		 * through a failed read.
+		 */
+		if (polled && !sk_pending(conn->sock))
+			return 0;
+
+		if (conn->size < expected) {
+			tmp = realloc(conn->buf, expected);
+			if (!tmp)
+				return -ENOMEM;
+
+			conn->buf = tmp;
+			conn->size = expected;
+		}
+
+		rc = sk_recv_nowait(conn->sock, conn->buf + conn->len,
+				    expected - conn->len, &received);
+		if (rc)
+			return rc;
+
+		if (!received)
+			return 0;
+
+		conn->len += received;
+		polled = true;
+	}
+}
+
+/* Process what the connections have received, waiting at most @timeout
+ * milliseconds for something to arrive if nothing was read ahead.
+ */
+static int isochron_mgmt_async_dispatch(struct isochron_mgmt_async *async,
+					int timeout)
+{
+	struct epoll_event events[16];
+	struct isochron_mgmt_conn *conn;
+	int i, cnt, rc;
+
+	/* Responses read ahead during a previous wait are not visible to
+	 * epoll, so don't block if there were any
+	 */
+	LIST_FOREACH(conn, &async->conns, list) {
+		if (conn->err || !sk_pending(conn->sock))
+			continue;
+
+		rc = isochron_mgmt_conn_read(async, conn);
+		if (rc)
+			isochron_mgmt_conn_fail(async, conn, rc);
+
+		timeout = 0;
+	}
+
+	cnt = epoll_wait(async->epoll_fd, events, ARRAY_SIZE(events), timeout);
+	if (cnt < 0) {
+		if (errno == EINTR && !signal_received)
+			return 0;
+
+		rc = -errno;
+		if (errno != EINTR)
+			perror("epoll_wait");
+
+		/* The responses still in flight would desynchronize the
+		 * connections
+		 */
+		LIST_FOREACH(conn, &async->conns, list)
+			if (!TAILQ_EMPTY(&conn->pending))
+				isochron_mgmt_conn_fail(async, conn, rc);
+
+		return rc;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		conn = events[i].data.ptr;
+
+		rc = isochron_mgmt_conn_read(async, conn);
+		if (rc) {
+			sk_err(conn->sock, rc,
+			       "Failed to receive transaction response: %m\n");
+			isochron_mgmt_conn_fail(async, conn, rc);
+		}
+	}
+
+	return 0;
+}
+
+/* Wait until all submitted transactions have completed. Returns the first
+ * error of a transaction which failed.
+ */
+int isochron_mgmt_async_wait(struct isochron_mgmt_async *async)
+{
+	int rc;
+
+	while (async->num_pending) {
+		rc = isochron_mgmt_async_dispatch(async, -1);
+		if (rc)
+			break;
+	}
+
+	rc = async->err;
+	async->err = 0;
+
+	return rc;
+}
+
+/* Deliver the notifications which arrive within @timeout_ms milliseconds,
+ * along with the responses of the transactions in flight. Returns a
+ * negative error code if interrupted by a signal.
+ */
+int isochron_mgmt_async_poll(struct isochron_mgmt_async *async,
+			     int timeout_ms)
+{
+	return isochron_mgmt_async_dispatch(async, timeout_ms);
+}
+
+int isochron_mgmt_async_set_event_cb(struct isochron_mgmt_async *async,
+				     struct sk *sock, isochron_event_cb_t *cb,
+				     void *priv)
+{
+	struct isochron_mgmt_conn *conn;
+
+	conn = isochron_mgmt_async_get_conn(async, sock);
+	if (!conn)
+		return -ENOMEM;
+
+	conn->event_cb = cb;
+	conn->event_priv = priv;
+
+	return 0;
+}
+
+int isochron_txn_set_packet_count(struct isochron_txn *txn, long count)
+{
+	struct isochron_packet_count p = {
+		.count = __cpu_to_be64(count),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_PACKET_COUNT,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_packet_size(struct isochron_txn *txn, int size)
+{
+	struct isochron_packet_size p = {
+		.size = __cpu_to_be32(size),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_PACKET_SIZE,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_destination_mac(struct isochron_txn *txn,
+				     unsigned char *addr)
+{
+	struct isochron_mac_addr p = {};
+
+	ether_addr_copy(p.addr, addr);
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_DESTINATION_MAC,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_source_mac(struct isochron_txn *txn, unsigned char *addr)
+{
+	struct isochron_mac_addr p = {};
+
+	ether_addr_copy(p.addr, addr);
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SOURCE_MAC,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_node_role(struct isochron_txn *txn,
+			       enum isochron_role role)
+{
+	struct isochron_node_role p = {
+		.role = __cpu_to_be32(role),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_NODE_ROLE, &p, sizeof(p));
+}
+
+int isochron_txn_set_if_name(struct isochron_txn *txn,
+			     const char if_name[IFNAMSIZ])
+{
+	struct isochron_if_name p = {};
+	int rc;
+
+	rc = if_name_copy(p.name, if_name);
+	if (rc) {
+		fprintf(stderr, "Truncation while copying string\n");
+		if (!txn->err)
+			txn->err = rc;
+		return rc;
+	}
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_IF_NAME, &p, sizeof(p));
+}
+
+int isochron_txn_set_priority(struct isochron_txn *txn, int priority)
+{
+	struct isochron_priority p = {
+		.priority = __cpu_to_be32(priority),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_PRIORITY, &p, sizeof(p));
+}
+
+int isochron_txn_set_stats_port(struct isochron_txn *txn, __u16 port)
+{
+	struct isochron_port p = {
 		.port = __cpu_to_be16(port),
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_DATA_PORT, &p, sizeof(p));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_STATS_PORT,
+				    &p, sizeof(p));
 }
 
-int isochron_update_sched_fifo(struct sk *sock, bool enabled)
+int isochron_txn_set_base_time(struct isochron_txn *txn, __u64 base_time)
+{
+	struct isochron_time p = {
+		.time = __cpu_to_be64(base_time),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_BASE_TIME, &p, sizeof(p));
+}
+
+int isochron_txn_set_advance_time(struct isochron_txn *txn, __u64 advance_time)
+{
+	struct isochron_time p = {
+		.time = __cpu_to_be64(advance_time),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_ADVANCE_TIME,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_shift_time(struct isochron_txn *txn, __u64 shift_time)
+{
+	struct isochron_time p = {
+		.time = __cpu_to_be64(shift_time),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SHIFT_TIME,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_cycle_time(struct isochron_txn *txn, __u64 cycle_time)
+{
+	struct isochron_time p = {
+		.time = __cpu_to_be64(cycle_time),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_CYCLE_TIME,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_window_size(struct isochron_txn *txn, __u64 window_time)
+{
+	struct isochron_time p = {
+		.time = __cpu_to_be64(window_time),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_WINDOW_SIZE,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_domain_number(struct isochron_txn *txn, int domain_number)
+{
+	struct isochron_domain_number p = {
+		.domain_number = domain_number,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_DOMAIN_NUMBER,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_transport_specific(struct isochron_txn *txn,
+					int transport_specific)
+{
+	struct isochron_transport_specific p = {
+		.transport_specific = transport_specific,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_TRANSPORT_SPECIFIC,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_uds(struct isochron_txn *txn,
+			 const char uds_remote[UNIX_PATH_MAX])
+{
+	struct isochron_uds p = {};
+	int rc;
+
+	rc = uds_copy(p.name, uds_remote);
+	if (rc) {
+		fprintf(stderr, "Truncation while copying string\n");
+		if (!txn->err)
+			txn->err = rc;
+		return rc;
+	}
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_UDS, &p, sizeof(p));
+}
+
+int isochron_txn_set_num_readings(struct isochron_txn *txn, int num_readings)
+{
+	struct isochron_num_readings p = {
+		.num_readings = __cpu_to_be32(num_readings),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_NUM_READINGS,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_sysmon_enabled(struct isochron_txn *txn, bool enabled)
 {
-	struct isochron_feature_enabled f = {
+	struct isochron_feature_enabled p = {
 		.enabled = enabled,
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SCHED_FIFO_ENABLED,
-				   &f, sizeof(f));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SYSMON_ENABLED,
+				    &p, sizeof(p));
 }
 
-int isochron_update_sched_rr(struct sk *sock, bool enabled)
+int isochron_txn_set_ptpmon_enabled(struct isochron_txn *txn, bool enabled)
 {
-	struct isochron_feature_enabled f = {
+	struct isochron_feature_enabled p = {
 		.enabled = enabled,
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SCHED_RR_ENABLED,
-				   &f, sizeof(f));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_PTPMON_ENABLED,
+				    &p, sizeof(p));
 }
 
-int isochron_update_sched_priority(struct sk *sock, int priority)
+int isochron_txn_set_sync_monitor_enabled(struct isochron_txn *txn,
+					  bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SYNC_MONITOR_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_ts_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_TS_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_vid(struct isochron_txn *txn, __u16 vid)
+{
+	struct isochron_vid p = {
+		.vid = __cpu_to_be16(vid),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_VID, &p, sizeof(p));
+}
+
+int isochron_txn_set_ethertype(struct isochron_txn *txn, __u16 etype)
+{
+	struct isochron_ethertype p = {
+		.ethertype = __cpu_to_be16(etype),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_ETHERTYPE, &p, sizeof(p));
+}
+
+int isochron_txn_set_quiet_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_QUIET_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_taprio_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_TAPRIO_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_txtime_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_TXTIME_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_deadline_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_DEADLINE_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_utc_offset(struct isochron_txn *txn, int offset)
+{
+	struct isochron_utc_offset p = {
+		.offset = __cpu_to_be16(offset),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_UTC_OFFSET,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_ip_destination(struct isochron_txn *txn,
+				    struct ip_address *addr)
+{
+	struct isochron_ip_address p = {};
+	int rc;
+
+	p.family = __cpu_to_be32(addr->family);
+	memcpy(p.addr, &addr->addr6, 16);
+	rc = if_name_copy(p.bound_if_name, addr->bound_if_name);
+	if (rc) {
+		fprintf(stderr, "Truncation while copying string\n");
+		if (!txn->err)
+			txn->err = rc;
+		return rc;
+	}
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_IP_DESTINATION,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_l2_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_L2_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_l4_enabled(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_L4_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_data_port(struct isochron_txn *txn, __u16 port)
+{
+	struct isochron_port p = {
+		.port = __cpu_to_be16(port),
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_DATA_PORT, &p, sizeof(p));
+}
+
+int isochron_txn_set_sched_fifo(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SCHED_FIFO_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_sched_rr(struct isochron_txn *txn, bool enabled)
+{
+	struct isochron_feature_enabled p = {
+		.enabled = enabled,
+	};
+
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SCHED_RR_ENABLED,
+				    &p, sizeof(p));
+}
+
+int isochron_txn_set_sched_priority(struct isochron_txn *txn, int priority)
 {
 	struct isochron_sched_priority p = {
 		.sched_priority = __cpu_to_be32(priority),
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SCHED_PRIORITY,
-				   &p, sizeof(p));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_SCHED_PRIORITY,
+				    &p, sizeof(p));
 }
 
-int isochron_update_cpu_mask(struct sk *sock, unsigned long cpumask)
+int isochron_txn_set_cpu_mask(struct isochron_txn *txn, unsigned long cpumask)
 {
-	struct isochron_cpu_mask c = {
+	struct isochron_cpu_mask p = {
 		.cpu_mask = __cpu_to_be64(cpumask),
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_CPU_MASK, &c, sizeof(c));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_CPU_MASK, &p, sizeof(p));
 }
 
-int isochron_update_test_state(struct sk *sock, enum test_state state)
+int isochron_txn_set_test_state(struct isochron_txn *txn,
+				enum test_state state)
 {
-	struct isochron_test_state t = {
+	struct isochron_test_state p = {
 		.test_state = state,
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_TEST_STATE, &t, sizeof(t));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_TEST_STATE, &p, sizeof(p));
 }
 
-int isochron_update_sync_monitor_enabled(struct sk *sock, bool enabled)
+int isochron_txn_set_log_subscribe(struct isochron_txn *txn, __u32 chunk_size)
 {
-	struct isochron_feature_enabled f = {
-		.enabled = enabled,
+	struct isochron_log_subscribe p = {
+		.chunk_size = __cpu_to_be32(chunk_size),
 	};
 
-	return isochron_update_mid(sock, ISOCHRON_MID_SYNC_MONITOR_ENABLED,
-				   &f, sizeof(f));
+	return isochron_txn_add_set(txn, ISOCHRON_MID_LOG_SUBSCRIBE,
+				    &p, sizeof(p));
 }
 
-static void isochron_tlv_next(struct isochron_tlv **tlv, size_t *len)
+int isochron_txn_set_event_subscribe(struct isochron_txn *txn, __u32 events,
+				     __s64 interval)
 {
-	size_t tlv_size_bytes;
+	struct isochron_event_subscribe p = {
+		.events = __cpu_to_be32(events),
+		.interval = __cpu_to_be64(interval),
+	};
 
-	tlv_size_bytes = __be32_to_cpu((*tlv)->length_field) + sizeof(**tlv);
-	*len += tlv_size_bytes;
-	*tlv = (struct isochron_tlv *)((unsigned char *)tlv + tlv_size_bytes);
+	return isochron_txn_add_set(txn, ISOCHRON_MID_EVENT_SUBSCRIBE,
+				    &p, sizeof(p));
 }
 
-int isochron_mgmt_event(struct sk *sock, struct isochron_mgmt_handler *handler,
-			void *priv)
+/* Run the operation described by @tlv within a transaction, and return
+ * the GET data, if any, through @data and @data_len.
+ */
+static int isochron_mgmt_txn_op(struct sk *sock, struct isochron_tlv *tlv,
+				void *priv, enum isochron_management_id mid,
+				const struct isochron_mgmt_ops *ops,
+				bool read_only, char *extack, void **data,
+				size_t *data_len)
 {
-	struct isochron_management_message msg;
-	const struct isochron_mgmt_ops *ops;
+	size_t tlv_len = __be32_to_cpu(tlv->length_field);
+	struct isochron_tlv *rsp_tlv;
+	size_t captured;
+	void *buf;
+	int rc;
+
+	switch (__be16_to_cpu(tlv->tlv_type)) {
+	case ISOCHRON_TLV_SET:
+		if (read_only && !ops->per_connection) {
+			mgmt_extack(extack, "SET of MID %s refused on read-only connection",
+				    mid_to_string(mid));
+			return -EPERM;
+		}
+
+		if (!ops->set) {
+			mgmt_extack(extack, "Unhandled SET for MID %s",
+				    mid_to_string(mid));
+			return -EOPNOTSUPP;
+		}
+
+		if (tlv_len != ops->struct_size) {
+			mgmt_extack(extack,
+				    "Expected %zu bytes for SET of MID %s, got %zu",
+				    ops->struct_size, mid_to_string(mid),
+				    tlv_len);
+			return -EINVAL;
+		}
+
+		return ops->set(priv, isochron_tlv_data(tlv), extack);
+	case ISOCHRON_TLV_GET:
+		if (!ops->get) {
+			mgmt_extack(extack, "Unhandled GET for MID %s",
+				    mid_to_string(mid));
+			return -EOPNOTSUPP;
+		}
+
+		/* The GET handlers send a complete response message, which
+		 * needs to be repackaged as a transaction result.
+		 */
+		sk_capture_start(sock);
+		rc = ops->get(priv, extack);
+		buf = sk_capture_stop(sock, &captured);
+		if (rc)
+			return rc;
+
+		if (captured < sizeof(struct isochron_management_message) +
+			       sizeof(*rsp_tlv))
+			goto err_capture;
+
+		captured -= sizeof(struct isochron_management_message) +
+			    sizeof(*rsp_tlv);
+		rsp_tlv = (struct isochron_tlv *)((unsigned char *)buf +
+			  sizeof(struct isochron_management_message));
+
+		*data = isochron_tlv_data(rsp_tlv);
+		*data_len = __be32_to_cpu(rsp_tlv->length_field);
+		if (*data_len > captured)
+			goto err_capture;
+
+		return 0;
+	default:
+		mgmt_extack(extack, "Unexpected TLV type %d in transaction",
+			    __be16_to_cpu(tlv->tlv_type));
+		return -EINVAL;
+	}
+
+err_capture:
+	mgmt_extack(extack, "Failed to retrieve GET response for MID %s",
+		    mid_to_string(mid));
+	return -EIO;
+}
+
+static int isochron_mgmt_txn_result(unsigned char **buf, size_t *len,
+				    enum isochron_management_id mid, int rc,
+				    const void *data, size_t data_len,
+				    const char *extack)
+{
+	size_t extack_len = rc ? strlen(extack) : 0;
+	struct isochron_tlv_result *result;
+	size_t tlv_len, size;
+	struct isochron_tlv *tlv;
+	unsigned char *tmp;
+
+	tlv_len = sizeof(*result) + data_len + extack_len;
+	size = *len + sizeof(*tlv) + tlv_len;
+
+	tmp = realloc(*buf, size);
+	if (!tmp)
+		return -ENOMEM;
+
+	tlv = (struct isochron_tlv *)(tmp + *len);
+	tlv->tlv_type = __cpu_to_be16(ISOCHRON_TLV_RESULT);
+	tlv->management_id = __cpu_to_be16(mid);
+	tlv->length_field = __cpu_to_be32(tlv_len);
+
+	result = isochron_tlv_data(tlv);
+	result->rc = __cpu_to_be32(rc);
+	result->data_length = __cpu_to_be32(data_len);
+
+	if (data_len)
+		memcpy(result + 1, data, data_len);
+	if (extack_len)
+		memcpy((unsigned char *)(result + 1) + data_len, extack,
+		       extack_len);
+
+	*buf = tmp;
+	*len = size;
+
+	return 0;
+}
+
+/* Process the operations of an ISOCHRON_TRANSACTION message in order, and
+ * send back a single response with their results. Once an operation fails,
+ * those which follow it are not performed, and fail with -ECANCELED.
+ * The results are also kept in the error table, for the benefit of
+ * GET_ERROR.
+ */
+static int isochron_mgmt_txn(struct sk *sock,
+			     struct isochron_mgmt_handler *handler, void *priv,
+			     __be16 request_id, unsigned char *req, size_t len)
+{
+	struct isochron_tlv *tlv = (struct isochron_tlv *)req;
+	struct isochron_management_message *msg;
+	struct isochron_error cancelled = {};
 	enum isochron_management_id mid;
+	size_t rsp_len = sizeof(*msg);
 	struct isochron_error *err;
-	unsigned char buf[BUFSIZ];
-	struct isochron_tlv *tlv;
 	size_t parsed_len = 0;
-	size_t len;
+	unsigned char *rsp;
+	bool failed = false;
+	size_t data_len;
+	void *data;
 	int rc;
 
-	rc = sk_recv(sock, &msg, sizeof(msg), 0);
-	if (rc) {
-		sk_err(sock, rc, "Failed to receive message header: %m\n");
-		return rc;
+	rsp = calloc(1, rsp_len);
+	if (!rsp)
+		return -ENOMEM;
+
+	while (len - parsed_len >= sizeof(*tlv)) {
+		if (__be32_to_cpu(tlv->length_field) >
+		    len - parsed_len - sizeof(*tlv)) {
+			fprintf(stderr, "Truncated TLV in transaction\n");
+			break;
+		}
+
+		mid = __be16_to_cpu(tlv->management_id);
+		data = NULL;
+		data_len = 0;
+
+		if (failed) {
+			err = &cancelled;
+			err->rc = -ECANCELED;
+		} else if (mid < 0 || mid >= __ISOCHRON_MID_MAX) {
+			err = &cancelled;
+			mgmt_extack(err->extack, "Unrecognized MID %d", mid);
+			err->rc = -EINVAL;
+		} else {
+			err = &handler->error_table[mid];
+			*err->extack = 0;
+			err->rc = isochron_mgmt_txn_op(sock, tlv, priv, mid,
+						       &handler->ops[mid],
+						       handler->read_only,
+						       err->extack, &data,
+						       &data_len);
+		}
+
+		rc = isochron_mgmt_txn_result(&rsp, &rsp_len, mid, err->rc,
+					      data, data_len, err->extack);
+		if (rc)
+			goto out;
+
+		if (err->rc)
+			failed = true;
+		*cancelled.extack = 0;
+
+		isochron_tlv_next(&tlv, &parsed_len);
 	}
 
-	if (msg.version != ISOCHRON_MANAGEMENT_VERSION) {
+	msg = (struct isochron_management_message *)rsp;
+	msg->version = ISOCHRON_MANAGEMENT_VERSION;
+	msg->action = ISOCHRON_RESPONSE;
+	msg->request_id = request_id;
+	msg->payload_length = __cpu_to_be32(rsp_len - sizeof(*msg));
+
+	rc = sk_send(sock, rsp, rsp_len);
+out:
+	free(rsp);
+
+	return rc;
+}
+
+/* Decide, from its header, whether the request being reassembled is worth
+ * receiving. The payload of those which are not is skipped, to stay in
+ * sync with the stream.
+ */
+static bool isochron_mgmt_msg_acceptable(const struct isochron_management_message *msg)
+{
+	size_t len = __be32_to_cpu(msg->payload_length);
+
+	if (msg->version != ISOCHRON_MANAGEMENT_VERSION) {
 		fprintf(stderr, "Expected management version %d, got %d\n",
-			ISOCHRON_MANAGEMENT_VERSION, msg.version);
-		return 0;
+			ISOCHRON_MANAGEMENT_VERSION, msg->version);
+		return false;
 	}
 
-	switch (msg.action) {
+	switch (msg->action) {
 	case ISOCHRON_GET:
 	case ISOCHRON_SET:
 	case ISOCHRON_GET_ERROR:
+	case ISOCHRON_TRANSACTION:
 		break;
 	default:
-		fprintf(stderr, "Unexpected action %d\n", msg.action);
-		return 0;
+		fprintf(stderr, "Unexpected action %d\n", msg->action);
+		return false;
 	}
 
-	len = __be32_to_cpu(msg.payload_length);
-	if (len >= BUFSIZ) {
-		fprintf(stderr, "GET message too large at %zd, max %d\n", len, BUFSIZ);
-		return 0;
+	/* The length comes from the peer, don't let it size the allocation */
+	if (len > ISOCHRON_MGMT_MAX_REQUEST) {
+		fprintf(stderr, "Dropping %zu byte message, larger than %d\n",
+			len, ISOCHRON_MGMT_MAX_REQUEST);
+		return false;
 	}
 
-	rc = sk_recv(sock, buf, len, 0);
-	if (rc) {
-		sk_err(sock, rc, "Failed to receive message body: %m\n");
-		return rc;
-	}
+	return true;
+}
+
+/* Process a request received in full by isochron_mgmt_event() */
+static int isochron_mgmt_msg(struct sk *sock,
+			     struct isochron_mgmt_handler *handler, void *priv)
+{
+	const struct isochron_management_message *msg;
+	const struct isochron_mgmt_ops *ops;
+	enum isochron_management_id mid;
+	struct isochron_error *err;
+	struct isochron_tlv *tlv;
+	unsigned char *buf;
+	size_t parsed_len = 0;
+	size_t len;
+
+	msg = (const struct isochron_management_message *)handler->buf;
+	buf = handler->buf + sizeof(*msg);
+	len = handler->len - sizeof(*msg);
+
+	if (msg->action == ISOCHRON_TRANSACTION)
+		return isochron_mgmt_txn(sock, handler, priv, msg->request_id,
+					 buf, len);
 
 	tlv = (struct isochron_tlv *)buf;
 
-	while (parsed_len < (size_t)len) {
+	while (len - parsed_len >= sizeof(*tlv)) {
+		if (__be32_to_cpu(tlv->length_field) >
+		    len - parsed_len - sizeof(*tlv)) {
+			fprintf(stderr, "Truncated TLV in message\n");
+			break;
+		}
+
 		if (__be16_to_cpu(tlv->tlv_type) != ISOCHRON_TLV_MANAGEMENT)
 			goto next;
 
@@ -1144,11 +2758,20 @@ int isochron_mgmt_event(struct sk *sock, struct isochron_mgmt_handler *handler,
 		ops = &handler->ops[mid];
 		err = &handler->error_table[mid];
 
-		switch (msg.action) {
+		switch (msg->action) {
 		case ISOCHRON_GET:
 			isochron_mgmt_tlv_get(sock, priv, mid, ops, err);
 			break;
 		case ISOCHRON_SET:
+			if (handler->read_only && !ops->per_connection) {
+				mgmt_extack(err->extack,
+					    "SET of MID %s refused on read-only connection",
+					    mid_to_string(mid));
+				err->rc = -EPERM;
+				isochron_send_empty_tlv(sock, mid);
+				break;
+			}
+
 			isochron_mgmt_tlv_set(sock, tlv, priv, mid, ops, err);
 			break;
 		case ISOCHRON_GET_ERROR:
@@ -1164,6 +2787,102 @@ next:
 	return 0;
 }
 
+/* Skip over what is available of the payload of a dropped request */
+static int isochron_mgmt_discard(struct sk *sock,
+				 struct isochron_mgmt_handler *handler,
+				 size_t *received)
+{
+	unsigned char scratch[BUFSIZ];
+	int rc;
+
+	rc = sk_recv_nowait(sock, scratch, min(handler->discard,
+					       sizeof(scratch)), received);
+	if (rc)
+		return rc;
+
+	handler->discard -= *received;
+
+	return 0;
+}
+
+/* Process the management messages available on @sock, without waiting for
+ * the rest of those which arrived incompletely: these are reassembled in
+ * the buffer of @handler until a later event completes them, so a peer
+ * sending a partial request cannot stall the caller's event loop. Each
+ * response is corked so that it leaves in a single write, however many
+ * pieces the handlers produce it in. Messages read ahead together with
+ * the first one are processed as well, since poll() no longer reports
+ * them.
+ */
+int isochron_mgmt_event(struct sk *sock, struct isochron_mgmt_handler *handler,
+			void *priv)
+{
+	struct isochron_management_message *msg = NULL;
+	size_t expected, received;
+	bool polled = false;
+	unsigned char *tmp;
+	int rc, err;
+
+	while (1) {
+		expected = sizeof(*msg);
+		if (handler->len >= sizeof(*msg)) {
+			msg = (struct isochron_management_message *)handler->buf;
+			expected += __be32_to_cpu(msg->payload_length);
+		}
+
+		if (handler->len == sizeof(*msg) && !handler->discard &&
+		    !isochron_mgmt_msg_acceptable(msg)) {
+			handler->discard = expected - sizeof(*msg);
+			handler->len = 0;
+			continue;
+		}
+
+		if (!handler->discard && handler->len == expected) {
+			sk_cork(sock);
+			rc = isochron_mgmt_msg(sock, handler, priv);
+			err = sk_uncork(sock);
+			handler->len = 0;
+			if (rc)
+				return rc;
+			if (err) {
+				sk_err(sock, err, "Failed to send response: %m\n");
+				return err;
+			}
+			continue;
+		}
+
+		if (polled && !sk_pending(sock))
+			return 0;
+
+		if (handler->discard) {
+			rc = isochron_mgmt_discard(sock, handler, &received);
+		} else {
+			if (handler->size < expected) {
+				tmp = realloc(handler->buf, expected);
+				if (!tmp)
+					return -ENOMEM;
+
+				handler->buf = tmp;
+				handler->size = expected;
+			}
+
+			rc = sk_recv_nowait(sock, handler->buf + handler->len,
+					    expected - handler->len, &received);
+			if (!rc)
+				handler->len += received;
+		}
+		if (rc) {
+			sk_err(sock, rc, "Failed to receive message: %m\n");
+			return rc;
+		}
+
+		if (!received)
+			return 0;
+
+		polled = true;
+	}
+}
+
 int isochron_forward_log(struct sk *sock, struct isochron_log *log,
 			 size_t size, char *extack)
 {
@@ -1180,6 +2899,56 @@ int isochron_forward_log(struct sk *sock, struct isochron_log *log,
 	return isochron_log_init(log, size);
 }
 
+/* Forward the log entries between the subscriber's position and @horizon,
+ * which is the index of the first entry not yet completed by the caller.
+ * Entries are sent in multiples of the subscription's chunk size, except
+ * for the tail of the log.
+ */
+int isochron_forward_log_chunk(struct sk *sock, struct isochron_log *log,
+			       size_t entry_size,
+			       struct isochron_log_subscription *sub,
+			       __u32 horizon, char *extack)
+{
+	__u32 num_entries = log->size / entry_size;
+	struct isochron_log_chunk chunk = {};
+	__u32 count = 0;
+	void *entries;
+	int rc;
+
+	if (!sub->chunk_size) {
+		mgmt_extack(extack, "No subscription to log chunks");
+		return -EINVAL;
+	}
+
+	if (horizon > num_entries)
+		horizon = num_entries;
+
+	if (horizon > sub->next) {
+		count = horizon - sub->next;
+		if (horizon != num_entries)
+			count -= count % sub->chunk_size;
+	}
+
+	entries = isochron_log_get_entry(log, entry_size, sub->next);
+
+	chunk.start = __cpu_to_be32(sub->next);
+	chunk.count = __cpu_to_be32(count);
+	chunk.complete = (sub->next + count == num_entries);
+
+	rc = isochron_send_tlv(sock, ISOCHRON_RESPONSE, ISOCHRON_MID_LOG_CHUNK,
+			       sizeof(chunk) + count * entry_size);
+	if (rc)
+		return rc;
+
+	sk_send(sock, &chunk, sizeof(chunk));
+	if (count)
+		sk_send(sock, entries, count * entry_size);
+
+	sub->next += count;
+
+	return 0;
+}
+
 int isochron_forward_sysmon_offset(struct sk *sock, struct sysmon *sysmon,
 				   char *extack)
 {
@@ -1214,18 +2983,15 @@ int isochron_forward_ptpmon_offset(struct sk *sock, struct ptpmon *ptpmon,
 				   char *extack)
 {
 	struct isochron_ptpmon_offset po;
-	struct current_ds current_ds;
 	__s64 ptpmon_offset;
 	int rc;
 
-	rc = ptpmon_query_clock_mid(ptpmon, MID_CURRENT_DATA_SET,
-				    &current_ds, sizeof(current_ds));
+	rc = ptpmon_get_master_offset(ptpmon, &ptpmon_offset);
 	if (rc) {
 		mgmt_extack(extack, "Failed to read ptpmon offset: %m");
 		return rc;
 	}
 
-	ptpmon_offset = master_offset_from_current_ds(&current_ds);
 	po.offset = __cpu_to_be64(ptpmon_offset);
 
 	rc = isochron_send_tlv(sock, ISOCHRON_RESPONSE,
@@ -1345,19 +3111,14 @@ int isochron_forward_gm_clock_identity(struct sk *sock, struct ptpmon *ptpmon,
 				       char *extack)
 {
 	struct isochron_gm_clock_identity gm;
-	struct parent_data_set parent_ds;
 	int rc;
 
-	rc = ptpmon_query_clock_mid(ptpmon, MID_PARENT_DATA_SET,
-				    &parent_ds, sizeof(parent_ds));
+	rc = ptpmon_get_gm_identity(ptpmon, &gm.clock_identity);
 	if (rc) {
 		mgmt_extack(extack, "Failed to read ptpmon GM clockID: %m");
 		return rc;
 	}
 
-	memcpy(&gm.clock_identity, &parent_ds.grandmaster_identity,
-	       sizeof(gm.clock_identity));
-
 	rc = isochron_send_tlv(sock, ISOCHRON_RESPONSE,
 			       ISOCHRON_MID_GM_CLOCK_IDENTITY,
 			       sizeof(gm));
@@ -1483,6 +3244,444 @@ int isochron_query_oper_base_time(struct sk *sock, __s64 *base_time)
 	return 0;
 }
 
+/* Large enough for one TLV of each event type */
+#define ISOCHRON_NOTIFICATION_BUFSIZ	256
+
+struct isochron_notifier {
+	struct isochron_event_sampler *sampler;
+	struct sk *sock;
+	__u32 events;
+	__s64 interval;
+	/* CLOCK_MONOTONIC time at which the node state is next due */
+	__s64 next;
+	/* Events reported at least once since subscribing */
+	__u32 reported;
+	/* Last reported state, to only notify about changes */
+	enum port_link_state link_state;
+	enum port_state port_state;
+	struct clock_identity gm_clkid;
+	enum test_state test_state;
+	/* Notification being built */
+	unsigned char buf[ISOCHRON_NOTIFICATION_BUFSIZ];
+	size_t len;
+	LIST_ENTRY(isochron_notifier) list;
+};
+
+struct isochron_event_sampler {
+	int timer_fd;
+	LIST_HEAD(notifier_head, isochron_notifier) notifiers;
+};
+
+/* The node state, sampled once on behalf of all subscribers which are due */
+struct isochron_node_sample {
+	bool have_link_state;
+	enum port_link_state link_state;
+	bool have_port_state;
+	enum port_state port_state;
+	bool have_gm_clkid;
+	struct clock_identity gm_clkid;
+	bool have_sync;
+	struct isochron_event_sync sync;
+};
+
+struct isochron_event_sampler *isochron_event_sampler_create(void)
+{
+	struct isochron_event_sampler *sampler;
+
+	sampler = calloc(1, sizeof(*sampler));
+	if (!sampler)
+		return NULL;
+
+	sampler->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (sampler->timer_fd < 0) {
+		perror("timerfd_create");
+		free(sampler);
+		return NULL;
+	}
+
+	LIST_INIT(&sampler->notifiers);
+
+	return sampler;
+}
+
+void isochron_event_sampler_destroy(struct isochron_event_sampler *sampler)
+{
+	close(sampler->timer_fd);
+	free(sampler);
+}
+
+int isochron_event_sampler_fd(const struct isochron_event_sampler *sampler)
+{
+	return sampler->timer_fd;
+}
+
+/* Arm the timer for the subscriber due the soonest, or disarm it if there
+ * is none.
+ */
+static int isochron_event_sampler_arm(struct isochron_event_sampler *sampler)
+{
+	struct isochron_notifier *notifier;
+	struct itimerspec its = {};
+	__s64 next = 0;
+
+	LIST_FOREACH(notifier, &sampler->notifiers, list) {
+		if (!notifier->events)
+			continue;
+
+		if (!next || notifier->next < next)
+			next = notifier->next;
+	}
+
+	if (next)
+		its.it_value = ns_to_timespec(next);
+
+	if (timerfd_settime(sampler->timer_fd, TFD_TIMER_ABSTIME, &its,
+			    NULL) < 0)
+		return -errno;
+
+	return 0;
+}
+
+struct isochron_notifier *
+isochron_notifier_create(struct isochron_event_sampler *sampler,
+			 struct sk *sock)
+{
+	struct isochron_notifier *notifier;
+
+	notifier = calloc(1, sizeof(*notifier));
+	if (!notifier)
+		return NULL;
+
+	notifier->sampler = sampler;
+	notifier->sock = sock;
+	LIST_INSERT_HEAD(&sampler->notifiers, notifier, list);
+
+	return notifier;
+}
+
+void isochron_notifier_destroy(struct isochron_notifier *notifier)
+{
+	LIST_REMOVE(notifier, list);
+	free(notifier);
+}
+
+int isochron_notifier_subscribe(struct isochron_notifier *notifier,
+				const struct isochron_event_subscribe *sub,
+				char *extack)
+{
+	__s64 interval = __be64_to_cpu(sub->interval);
+	__u32 events = __be32_to_cpu(sub->events);
+	__s64 now = isochron_mgmt_now();
+	int rc;
+
+	if (events & ~(BIT(__ISOCHRON_EVENT_MAX) - 1)) {
+		mgmt_extack(extack, "Unknown events in mask 0x%x", events);
+		return -EINVAL;
+	}
+
+	if (events && interval <= 0) {
+		mgmt_extack(extack, "Invalid event interval %lld",
+			    (long long)interval);
+		return -EINVAL;
+	}
+
+	/* A new subscriber gets the full node state right away, and changes
+	 * to the interval of an existing one keep the baseline it already
+	 * has.
+	 */
+	if (events && !notifier->events) {
+		notifier->reported = 0;
+		notifier->next = now;
+	} else {
+		notifier->next = now + interval;
+	}
+
+	notifier->events = events;
+	notifier->interval = interval;
+
+	rc = isochron_event_sampler_arm(notifier->sampler);
+	if (rc) {
+		mgmt_extack(extack, "Failed to arm event timer: %m");
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Returns true if @event should be reported, either because the subscriber
+ * has not seen it yet or because it changed.
+ */
+static bool isochron_notifier_changed(struct isochron_notifier *notifier,
+				      enum isochron_event event, bool changed)
+{
+	if (!(notifier->events & BIT(event)))
+		return false;
+
+	if (notifier->reported & BIT(event) && !changed)
+		return false;
+
+	notifier->reported |= BIT(event);
+
+	return true;
+}
+
+static void isochron_notifier_add(struct isochron_notifier *notifier,
+				  enum isochron_event event,
+				  const void *data, size_t size)
+{
+	struct isochron_tlv *tlv;
+
+	if (!notifier->len)
+		notifier->len = sizeof(struct isochron_management_message);
+
+	if (notifier->len + sizeof(*tlv) + size > sizeof(notifier->buf))
+		return;
+
+	tlv = (struct isochron_tlv *)(notifier->buf + notifier->len);
+	tlv->tlv_type = __cpu_to_be16(ISOCHRON_TLV_EVENT);
+	tlv->management_id = __cpu_to_be16(event);
+	tlv->length_field = __cpu_to_be32(size);
+	memcpy(tlv + 1, data, size);
+
+	notifier->len += sizeof(*tlv) + size;
+}
+
+/* Send all events gathered so far as a single notification */
+static int isochron_notifier_flush(struct isochron_notifier *notifier)
+{
+	struct isochron_management_message *msg;
+	size_t len = notifier->len;
+
+	if (!len)
+		return 0;
+
+	msg = (struct isochron_management_message *)notifier->buf;
+	memset(msg, 0, sizeof(*msg));
+	msg->version = ISOCHRON_MANAGEMENT_VERSION;
+	msg->action = ISOCHRON_NOTIFICATION;
+	msg->payload_length = __cpu_to_be32(len - sizeof(*msg));
+
+	notifier->len = 0;
+
+	return sk_send(notifier->sock, notifier->buf, len);
+}
+
+static void isochron_node_sample_sync(struct isochron_node_sample *sample,
+				      struct isochron_node_status *status)
+{
+	struct time_properties_ds time_properties_ds;
+	struct isochron_event_sync *sync = &sample->sync;
+	__s64 sysmon_offset, sysmon_delay;
+	__s64 ptpmon_offset;
+	__u64 sysmon_ts;
+	int rc;
+
+	sample->have_sync = true;
+
+	rc = sysmon_get_offset(status->sysmon, &sysmon_offset, &sysmon_ts,
+			       &sysmon_delay);
+	if (rc)
+		goto out;
+
+	rc = ptpmon_get_master_offset(status->ptpmon, &ptpmon_offset);
+	if (rc)
+		goto out;
+
+	rc = ptpmon_query_clock_mid(status->ptpmon,
+				    MID_TIME_PROPERTIES_DATA_SET,
+				    &time_properties_ds,
+				    sizeof(time_properties_ds));
+	if (rc)
+		goto out;
+
+	sync->sysmon_offset = __cpu_to_be64(sysmon_offset);
+	sync->ptpmon_offset = __cpu_to_be64(ptpmon_offset);
+	sync->utc_offset = time_properties_ds.current_utc_offset;
+
+	status->utc_offset = __be16_to_cpu(sync->utc_offset);
+	status->have_utc_offset = true;
+out:
+	sync->rc = __cpu_to_be32(rc);
+}
+
+/* Query the sources of the @events which some subscriber is due for */
+static void isochron_node_sample(struct isochron_node_sample *sample,
+				 struct isochron_node_status *status,
+				 __u32 events)
+{
+	bool running;
+	int rc;
+
+	if (status->rtnl && status->if_name &&
+	    (events & BIT(ISOCHRON_EVENT_LINK_STATE))) {
+		rc = rtnl_query_link_state(status->rtnl, status->if_name,
+					   &running);
+		sample->have_link_state = true;
+		sample->link_state = PORT_LINK_STATE_UNKNOWN;
+		if (!rc)
+			sample->link_state = running ? PORT_LINK_STATE_RUNNING :
+						       PORT_LINK_STATE_DOWN;
+	}
+
+	if (status->ptpmon && status->rtnl && status->if_name &&
+	    (events & BIT(ISOCHRON_EVENT_PORT_STATE))) {
+		rc = ptpmon_query_port_state_by_name(status->ptpmon,
+						     status->if_name,
+						     status->rtnl,
+						     &sample->port_state);
+		sample->have_port_state = !rc;
+	}
+
+	if (status->ptpmon && (events & BIT(ISOCHRON_EVENT_GM_CHANGE))) {
+		rc = ptpmon_get_gm_identity(status->ptpmon, &sample->gm_clkid);
+		sample->have_gm_clkid = !rc;
+	}
+
+	if (status->ptpmon && status->sysmon &&
+	    (events & BIT(ISOCHRON_EVENT_SYNC)))
+		isochron_node_sample_sync(sample, status);
+}
+
+static void isochron_notifier_add_test_state(struct isochron_notifier *notifier,
+					     enum test_state test_state)
+{
+	struct isochron_test_state s = {
+		.test_state = test_state,
+	};
+
+	if (!isochron_notifier_changed(notifier, ISOCHRON_EVENT_TEST_STATE,
+				       test_state != notifier->test_state))
+		return;
+
+	notifier->test_state = test_state;
+	isochron_notifier_add(notifier, ISOCHRON_EVENT_TEST_STATE, &s,
+			      sizeof(s));
+}
+
+/* A subscriber which has not read the previous output yet is not sent
+ * more. Its last reported state is left alone, so that what changed in the
+ * meantime is reported once it catches up.
+ */
+static bool isochron_notifier_behind(const struct isochron_notifier *notifier)
+{
+	return sk_tx_queued(notifier->sock) != 0;
+}
+
+/* Notify a subscriber of what changed in @sample since its last interval */
+static int isochron_notifier_report(struct isochron_notifier *notifier,
+				    const struct isochron_node_sample *sample,
+				    const struct isochron_node_status *status)
+{
+	if (isochron_notifier_behind(notifier))
+		return 0;
+
+	if (sample->have_link_state &&
+	    isochron_notifier_changed(notifier, ISOCHRON_EVENT_LINK_STATE,
+				      sample->link_state != notifier->link_state)) {
+		struct isochron_port_link_state s = {
+			.link_state = sample->link_state,
+		};
+
+		notifier->link_state = sample->link_state;
+		isochron_notifier_add(notifier, ISOCHRON_EVENT_LINK_STATE,
+				      &s, sizeof(s));
+	}
+
+	if (sample->have_port_state &&
+	    isochron_notifier_changed(notifier, ISOCHRON_EVENT_PORT_STATE,
+				      sample->port_state != notifier->port_state)) {
+		struct isochron_port_state s = {
+			.state = sample->port_state,
+		};
+
+		notifier->port_state = sample->port_state;
+		isochron_notifier_add(notifier, ISOCHRON_EVENT_PORT_STATE,
+				      &s, sizeof(s));
+	}
+
+	if (sample->have_gm_clkid &&
+	    isochron_notifier_changed(notifier, ISOCHRON_EVENT_GM_CHANGE,
+				      !clockid_eq(&sample->gm_clkid,
+						  &notifier->gm_clkid))) {
+		struct isochron_gm_clock_identity gm;
+
+		memcpy(&gm.clock_identity, &sample->gm_clkid,
+		       sizeof(gm.clock_identity));
+		memcpy(&notifier->gm_clkid, &sample->gm_clkid,
+		       sizeof(notifier->gm_clkid));
+		isochron_notifier_add(notifier, ISOCHRON_EVENT_GM_CHANGE,
+				      &gm, sizeof(gm));
+	}
+
+	if (sample->have_sync && (notifier->events & BIT(ISOCHRON_EVENT_SYNC)))
+		isochron_notifier_add(notifier, ISOCHRON_EVENT_SYNC,
+				      &sample->sync, sizeof(sample->sync));
+
+	/* Changes of the test state are pushed through
+	 * isochron_notifier_test_state(), this reports it to new subscribers
+	 * and to those which were behind at the time of the change
+	 */
+	if (status->have_test_state)
+		isochron_notifier_add_test_state(notifier, status->test_state);
+
+	return isochron_notifier_flush(notifier);
+}
+
+/* Once the timer has expired, sample the node state a single time for all
+ * subscribers which are due, and notify each of them of what changed since
+ * the last time. A subscriber which cannot be notified is skipped, its
+ * broken connection is noticed on its socket.
+ */
+int isochron_event_sampler_event(struct isochron_event_sampler *sampler,
+				 struct isochron_node_status *status)
+{
+	struct isochron_node_sample sample = {};
+	struct isochron_notifier *notifier;
+	__u64 expirations;
+	__u32 events = 0;
+	__s64 now;
+
+	status->have_utc_offset = false;
+
+	if (read(sampler->timer_fd, &expirations, sizeof(expirations)) < 0)
+		return errno == EAGAIN ? 0 : -errno;
+
+	now = isochron_mgmt_now();
+
+	LIST_FOREACH(notifier, &sampler->notifiers, list)
+		if (notifier->events && notifier->next <= now)
+			events |= notifier->events;
+
+	isochron_node_sample(&sample, status, events);
+
+	LIST_FOREACH(notifier, &sampler->notifiers, list) {
+		if (!notifier->events || notifier->next > now)
+			continue;
+
+		isochron_notifier_report(notifier, &sample, status);
+
+		/* Intervals missed while the event loop was busy are
+		 * skipped rather than caught up with
+		 */
+		notifier->next += ((now - notifier->next) / notifier->interval + 1) *
+				  notifier->interval;
+	}
+
+	return isochron_event_sampler_arm(sampler);
+}
+
+/* Report a test state change right away, without waiting for the timer */
+int isochron_notifier_test_state(struct isochron_notifier *notifier,
+				 enum test_state test_state)
+{
+	if (isochron_notifier_behind(notifier))
+		return 0;
+
+	isochron_notifier_add_test_state(notifier, test_state);
+
+	return isochron_notifier_flush(notifier);
+}
+
 struct isochron_mgmt_handler *
 isochron_mgmt_handler_create(const struct isochron_mgmt_ops *ops)
 {
@@ -1508,5 +3707,24 @@ isochron_mgmt_handler_create(const struct isochron_mgmt_ops *ops)
 void isochron_mgmt_handler_destroy(struct isochron_mgmt_handler *handler)
 {
 	free(handler->error_table);
+	free(handler->buf);
 	free(handler);
 }
+
+/* Forget the partially received request of a connection which was closed,
+ * before @handler serves another one.
+ */
+void isochron_mgmt_handler_reset(struct isochron_mgmt_handler *handler)
+{
+	handler->len = 0;
+	handler->discard = 0;
+}
+
+/* Make the connection served by @handler unable to change the state of the
+ * program, while still being able to query it.
+ */
+void isochron_mgmt_handler_set_read_only(struct isochron_mgmt_handler *handler,
+					 bool read_only)
+{
+	handler->read_only = read_only;
+}
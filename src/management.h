@@ -16,6 +16,14 @@
 #define ISOCHRON_DATA_PORT	6000 /* UDP */
 #define ISOCHRON_MANAGEMENT_VERSION 2
 #define ISOCHRON_EXTACK_SIZE	1020
+#define ISOCHRON_LOG_CHUNK_SIZE	1024 /* packets */
+/* Upper bound for the payload of a request received by a management server,
+ * which is much larger than a transaction setting all MIDs at once.
+ */
+#define ISOCHRON_MGMT_MAX_REQUEST	65536 /* bytes */
+#define ISOCHRON_DATA_TIMEOUT	5 /* seconds */
+/* How long to wait after the test for the receiver log to complete */
+#define ISOCHRON_LOG_TAIL_TIMEOUT	((ISOCHRON_DATA_TIMEOUT + 1) * NSEC_PER_SEC)
 
 /* Don't forget to update mid_to_string() when adding new members */
 enum isochron_management_id {
@@ -64,6 +72,9 @@ enum isochron_management_id {
 	ISOCHRON_MID_PORT_LINK_STATE,
 	ISOCHRON_MID_CURRENT_CLOCK_TAI,
 	ISOCHRON_MID_OPER_BASE_TIME,
+	ISOCHRON_MID_LOG_SUBSCRIBE,
+	ISOCHRON_MID_LOG_CHUNK,
+	ISOCHRON_MID_EVENT_SUBSCRIBE,
 	__ISOCHRON_MID_MAX,
 };
 
@@ -72,6 +83,16 @@ enum isochron_management_action {
 	ISOCHRON_SET,
 	ISOCHRON_RESPONSE,
 	ISOCHRON_GET_ERROR,
+	/* A sequence of ISOCHRON_TLV_GET and ISOCHRON_TLV_SET operations,
+	 * answered by a single ISOCHRON_RESPONSE message which carries an
+	 * ISOCHRON_TLV_RESULT for each of them, in the same order.
+	 */
+	ISOCHRON_TRANSACTION,
+	/* Sent by the server unprompted, to clients which subscribed through
+	 * ISOCHRON_MID_EVENT_SUBSCRIBE. Carries ISOCHRON_TLV_EVENT TLVs and
+	 * may arrive between any two responses.
+	 */
+	ISOCHRON_NOTIFICATION,
 };
 
 enum isochron_role {
@@ -93,12 +114,35 @@ enum port_link_state {
 
 enum isochron_tlv_type {
 	ISOCHRON_TLV_MANAGEMENT = 0,
+	/* Only valid within ISOCHRON_TRANSACTION messages and their response */
+	ISOCHRON_TLV_GET,
+	ISOCHRON_TLV_SET,
+	ISOCHRON_TLV_RESULT,
+	/* Only valid within ISOCHRON_NOTIFICATION messages. The management_id
+	 * field holds an enum isochron_event.
+	 */
+	ISOCHRON_TLV_EVENT,
+};
+
+/* Each event type is reported once after subscribing, then whenever it
+ * changes, except for ISOCHRON_EVENT_SYNC which is reported periodically.
+ */
+enum isochron_event {
+	ISOCHRON_EVENT_SYNC,		/* struct isochron_event_sync */
+	ISOCHRON_EVENT_PORT_STATE,	/* struct isochron_port_state */
+	ISOCHRON_EVENT_GM_CHANGE,	/* struct isochron_gm_clock_identity */
+	ISOCHRON_EVENT_LINK_STATE,	/* struct isochron_port_link_state */
+	ISOCHRON_EVENT_TEST_STATE,	/* struct isochron_test_state */
+	__ISOCHRON_EVENT_MAX,
 };
 
 struct isochron_management_message {
 	__u8		version;
 	__u8		action;
-	__be16		reserved;
+	/* Chosen by the client for ISOCHRON_TRANSACTION, and echoed back in
+	 * the response. Zero for all other messages.
+	 */
+	__be16		request_id;
 	__be32		payload_length;
 	/* TLVs follow */
 } __attribute((packed));
@@ -109,6 +153,15 @@ struct isochron_tlv {
 	__be32		length_field;
 } __attribute((packed));
 
+/* ISOCHRON_TLV_RESULT: followed by @data_length bytes of GET data, then by
+ * the extack message, which takes up the remainder of the TLV and is not
+ * NULL terminated.
+ */
+struct isochron_tlv_result {
+	__be32			rc;
+	__be32			data_length;
+} __attribute((packed));
+
 /* ISOCHRON_MID_SYSMON_OFFSET */
 struct isochron_sysmon_offset {
 	__be64			offset;
@@ -264,11 +317,58 @@ struct isochron_port_link_state {
 	__u8			reserved[3];
 } __attribute((packed));
 
+/* ISOCHRON_MID_LOG_SUBSCRIBE */
+struct isochron_log_subscribe {
+	__be32			chunk_size;
+	__u8			reserved[4];
+} __attribute((packed));
+
+/* ISOCHRON_MID_LOG_CHUNK, followed by @count log entries */
+struct isochron_log_chunk {
+	__be32			start;
+	__be32			count;
+	__u8			complete;
+	__u8			reserved[3];
+} __attribute((packed));
+
+/* ISOCHRON_MID_EVENT_SUBSCRIBE */
+struct isochron_event_subscribe {
+	/* Mask of BIT(enum isochron_event), zero to unsubscribe */
+	__be32			events;
+	__u8			reserved[4];
+	/* How often to sample the node state, in nanoseconds */
+	__be64			interval;
+} __attribute((packed));
+
+/* ISOCHRON_EVENT_SYNC */
+struct isochron_event_sync {
+	__be64			sysmon_offset;
+	__be64			ptpmon_offset;
+	__be16			utc_offset;
+	__u8			reserved[2];
+	/* Non-zero if the offsets could not be sampled */
+	__be32			rc;
+} __attribute((packed));
+
+/* Server-side state of a log chunk subscriber.
+ * @chunk_size: number of entries which make up a chunk. Zero if there is no
+ *		subscriber.
+ * @next:	index of the first log entry not yet forwarded.
+ */
+struct isochron_log_subscription {
+	__u32 chunk_size;
+	__u32 next;
+};
+
 const char *mid_to_string(enum isochron_management_id mid);
 
 int isochron_send_tlv(struct sk *sock, enum isochron_management_action action,
 		      enum isochron_management_id mid, size_t size);
 int isochron_collect_rcv_log(struct sk *sock, struct isochron_log *rcv_log);
+int isochron_collect_log_chunk(struct sk *sock, struct isochron_log *log,
+			       size_t entry_size, bool *complete);
+int isochron_collect_log_tail(struct sk *sock, struct isochron_log *log,
+			      size_t entry_size, __s64 timeout);
 int isochron_query_mid(struct sk *sock, enum isochron_management_id mid,
 		       void *data, size_t data_len);
 
@@ -309,6 +409,154 @@ int isochron_update_sched_rr(struct sk *sock, bool enabled);
 int isochron_update_sched_priority(struct sk *sock, int priority);
 int isochron_update_cpu_mask(struct sk *sock, unsigned long cpumask);
 int isochron_update_test_state(struct sk *sock, enum test_state state);
+int isochron_update_log_subscribe(struct sk *sock, __u32 chunk_size);
+
+/* Where the server samples the state reported through notifications. Any
+ * of the sources may be missing, in which case the events which depend on
+ * it are not reported.
+ */
+struct isochron_node_status {
+	struct ptpmon *ptpmon;
+	struct sysmon *sysmon;
+	const char *if_name;
+	struct mnl_socket *rtnl;
+	bool have_test_state;
+	enum test_state test_state;
+	/* Output: the UTC offset sampled for ISOCHRON_EVENT_SYNC */
+	bool have_utc_offset;
+	int utc_offset;
+};
+
+/* Samples the node state on behalf of all event subscribers of a server,
+ * at most once per expiry however many of them are due. Its file
+ * descriptor becomes readable when the earliest subscriber is due.
+ */
+struct isochron_event_sampler;
+
+struct isochron_event_sampler *isochron_event_sampler_create(void);
+void isochron_event_sampler_destroy(struct isochron_event_sampler *sampler);
+int isochron_event_sampler_fd(const struct isochron_event_sampler *sampler);
+int isochron_event_sampler_event(struct isochron_event_sampler *sampler,
+				 struct isochron_node_status *status);
+
+/* Server-side state of an event subscriber */
+struct isochron_notifier;
+
+struct isochron_notifier *
+isochron_notifier_create(struct isochron_event_sampler *sampler,
+			 struct sk *sock);
+void isochron_notifier_destroy(struct isochron_notifier *notifier);
+int isochron_notifier_subscribe(struct isochron_notifier *notifier,
+				const struct isochron_event_subscribe *sub,
+				char *extack);
+int isochron_notifier_test_state(struct isochron_notifier *notifier,
+				 enum test_state test_state);
+
+/* Client-side builder of ISOCHRON_TRANSACTION messages. The operations are
+ * performed by the remote end in the order in which they were added, and
+ * processing stops at the first one that fails. Errors while building the
+ * transaction are deferred until isochron_txn_commit().
+ */
+struct isochron_txn;
+
+struct isochron_txn *isochron_txn_create(void);
+void isochron_txn_destroy(struct isochron_txn *txn);
+int isochron_txn_add_set(struct isochron_txn *txn,
+			 enum isochron_management_id mid,
+			 const void *data, size_t data_len);
+int isochron_txn_add_get(struct isochron_txn *txn,
+			 enum isochron_management_id mid,
+			 void *data, size_t data_len);
+int isochron_txn_commit(struct sk *sock, struct isochron_txn *txn);
+bool isochron_txn_empty(const struct isochron_txn *txn);
+int isochron_txn_rc(const struct isochron_txn *txn);
+__s64 isochron_txn_rtt(const struct isochron_txn *txn);
+
+/* Called with the data of a variable-length GET response */
+typedef int isochron_txn_get_cb_t(void *priv, void *data, size_t len);
+
+int isochron_txn_add_get_cb(struct isochron_txn *txn,
+			    enum isochron_management_id mid,
+			    isochron_txn_get_cb_t *cb, void *priv);
+
+/* Client which has transactions in flight towards several nodes at once,
+ * and completes them as the responses arrive. Transactions towards the
+ * same node are pipelined, and are matched to their response by request
+ * ID. The caller retains ownership of the transactions, whose results are
+ * available through isochron_txn_rc() once isochron_mgmt_async_wait()
+ * returns.
+ */
+struct isochron_mgmt_async;
+
+struct isochron_mgmt_async *isochron_mgmt_async_create(void);
+void isochron_mgmt_async_destroy(struct isochron_mgmt_async *async);
+int isochron_mgmt_async_submit(struct isochron_mgmt_async *async,
+			       struct sk *sock, struct isochron_txn *txn);
+int isochron_mgmt_async_wait(struct isochron_mgmt_async *async);
+
+/* Called for each event of the notifications received on a connection */
+typedef void isochron_event_cb_t(void *priv, enum isochron_event event,
+				 void *data, size_t len);
+
+int isochron_mgmt_async_set_event_cb(struct isochron_mgmt_async *async,
+				     struct sk *sock, isochron_event_cb_t *cb,
+				     void *priv);
+int isochron_mgmt_async_poll(struct isochron_mgmt_async *async,
+			     int timeout_ms);
+
+int isochron_log_chunk_parse(struct isochron_log *log, size_t entry_size,
+			     const void *data, size_t len, bool *complete);
+
+int isochron_txn_set_packet_count(struct isochron_txn *txn, long count);
+int isochron_txn_set_packet_size(struct isochron_txn *txn, int size);
+int isochron_txn_set_destination_mac(struct isochron_txn *txn,
+				     unsigned char *addr);
+int isochron_txn_set_source_mac(struct isochron_txn *txn, unsigned char *addr);
+int isochron_txn_set_node_role(struct isochron_txn *txn,
+			       enum isochron_role role);
+int isochron_txn_set_if_name(struct isochron_txn *txn,
+			     const char if_name[IFNAMSIZ]);
+int isochron_txn_set_priority(struct isochron_txn *txn, int priority);
+int isochron_txn_set_stats_port(struct isochron_txn *txn, __u16 port);
+int isochron_txn_set_base_time(struct isochron_txn *txn, __u64 base_time);
+int isochron_txn_set_advance_time(struct isochron_txn *txn,
+				  __u64 advance_time);
+int isochron_txn_set_shift_time(struct isochron_txn *txn, __u64 shift_time);
+int isochron_txn_set_cycle_time(struct isochron_txn *txn, __u64 cycle_time);
+int isochron_txn_set_window_size(struct isochron_txn *txn, __u64 window_time);
+int isochron_txn_set_domain_number(struct isochron_txn *txn,
+				   int domain_number);
+int isochron_txn_set_transport_specific(struct isochron_txn *txn,
+					int transport_specific);
+int isochron_txn_set_uds(struct isochron_txn *txn,
+			 const char uds_remote[UNIX_PATH_MAX]);
+int isochron_txn_set_num_readings(struct isochron_txn *txn, int num_readings);
+int isochron_txn_set_sysmon_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_ptpmon_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_sync_monitor_enabled(struct isochron_txn *txn,
+					  bool enabled);
+int isochron_txn_set_ts_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_vid(struct isochron_txn *txn, __u16 vid);
+int isochron_txn_set_ethertype(struct isochron_txn *txn, __u16 etype);
+int isochron_txn_set_quiet_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_taprio_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_txtime_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_deadline_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_utc_offset(struct isochron_txn *txn, int offset);
+int isochron_txn_set_ip_destination(struct isochron_txn *txn,
+				    struct ip_address *addr);
+int isochron_txn_set_l2_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_l4_enabled(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_data_port(struct isochron_txn *txn, __u16 port);
+int isochron_txn_set_sched_fifo(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_sched_rr(struct isochron_txn *txn, bool enabled);
+int isochron_txn_set_sched_priority(struct isochron_txn *txn, int priority);
+int isochron_txn_set_cpu_mask(struct isochron_txn *txn, unsigned long cpumask);
+int isochron_txn_set_test_state(struct isochron_txn *txn,
+				enum test_state state);
+int isochron_txn_set_log_subscribe(struct isochron_txn *txn, __u32 chunk_size);
+int isochron_txn_set_event_subscribe(struct isochron_txn *txn, __u32 events,
+				     __s64 interval);
 
 static inline void *isochron_tlv_data(struct isochron_tlv *tlv)
 {
@@ -320,6 +568,10 @@ typedef int isochron_mgmt_tlv_set_cb_t(void *priv, void *ptr);
 
 int isochron_forward_log(struct sk *sock, struct isochron_log *log,
 			 size_t size, char *extack);
+int isochron_forward_log_chunk(struct sk *sock, struct isochron_log *log,
+			       size_t entry_size,
+			       struct isochron_log_subscription *sub,
+			       __u32 horizon, char *extack);
 int isochron_forward_sysmon_offset(struct sk *sock, struct sysmon *sysmon,
 				   char *extack);
 int isochron_forward_ptpmon_offset(struct sk *sock, struct ptpmon *ptpmon,
@@ -356,6 +608,10 @@ struct isochron_mgmt_ops {
 	int (*get)(void *priv, char *extack);
 	int (*set)(void *priv, void *ptr, char *extack);
 	size_t struct_size;
+	/* The SET only affects the connection it was received on, so it is
+	 * allowed on read-only connections too
+	 */
+	bool per_connection;
 };
 
 struct isochron_mgmt_handler;
@@ -363,6 +619,9 @@ struct isochron_mgmt_handler;
 struct isochron_mgmt_handler *
 isochron_mgmt_handler_create(const struct isochron_mgmt_ops *ops);
 void isochron_mgmt_handler_destroy(struct isochron_mgmt_handler *handler);
+void isochron_mgmt_handler_reset(struct isochron_mgmt_handler *handler);
+void isochron_mgmt_handler_set_read_only(struct isochron_mgmt_handler *handler,
+					 bool read_only);
 
 int isochron_mgmt_event(struct sk *sock, struct isochron_mgmt_handler *handler,
 			void *priv);
@@ -10,6 +10,7 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "argparser.h"
 #include "common.h"
@@ -30,12 +31,34 @@ struct isochron_orch_node {
 	struct sk *mgmt_sock;
 	long sync_threshold;
 	bool collect_sync_stats;
+	struct isochron_log log;
+	bool log_complete;
+	/* Set on senders whose log and that of their receiver are written
+	 * straight into the output file
+	 */
+	struct isochron_log_map log_map;
+	bool log_mapped;
+	/* Transaction of the current management phase */
+	struct isochron_txn *txn;
+	/* Fed with the sync state pushed by the node, if monitored */
+	struct syncmon_node *syncmon_node;
+	__s64 event_interval;
+	/* Set on the first notification after subscribing */
+	bool have_status;
+	/* A state change which the orchestrator has not yet reacted to */
+	bool status_changed;
 	union {
 		/* ISOCHRON_ROLE_SEND */
 		struct {
 			struct isochron_send *send;
+			/* Parameters which the node was last configured
+			 * with, or NULL if it has not been yet
+			 */
+			struct isochron_send *marshalled;
 			enum test_state test_state;
 			char exec[BUFSIZ];
+			/* Unparsed, for appending the sweep options to it */
+			char exec_line[BUFSIZ];
 			__s64 oper_base_time;
 			size_t num_rtt_measurements;
 			__s64 rtt;
@@ -48,79 +71,487 @@ struct isochron_orch_node {
 	};
 };
 
+enum isochron_sweep_mode {
+	ISOCHRON_SWEEP_CARTESIAN,
+	ISOCHRON_SWEEP_ZIP,
+};
+
+/* An option of a sender which takes a list of values during the sweep */
+struct isochron_sweep_key {
+	char node_name[BUFSIZ];
+	char option[BUFSIZ];
+	struct isochron_orch_node *node;
+	char **values;
+	size_t num_values;
+	/* Value used by the current sweep point */
+	size_t index;
+};
+
+struct isochron_sweep {
+	enum isochron_sweep_mode mode;
+	struct isochron_sweep_key *keys;
+	int num_keys;
+	size_t num_points;
+};
+
 struct isochron_orch {
 	LIST_HEAD(nodes_head, isochron_orch_node) nodes;
 	char input_filename[PATH_MAX];
 	struct syncmon *syncmon;
+	struct isochron_mgmt_async *async;
+	struct isochron_sweep sweep;
+	/* The nodes were in sync at the end of the previous test */
+	bool in_sync;
 };
 
+/* Events which the nodes push during the sync wait and during the test */
+#define ISOCHRON_ORCH_EVENTS		(BIT(__ISOCHRON_EVENT_MAX) - 1)
+#define ISOCHRON_ORCH_SYNC_INTERVAL	(NSEC_PER_SEC / 10)
+#define ISOCHRON_ORCH_BASELINE_TIMEOUT	NSEC_PER_SEC
+#define ISOCHRON_SWEEP_SECTION		"[sweep]"
+#define ISOCHRON_SWEEP_MAX_VALUES	1024
+#define ISOCHRON_SWEEP_MAX_POINTS	65536
+
+typedef int prog_txn_build_t(struct isochron_orch_node *node,
+			     struct isochron_txn *txn);
+typedef void prog_txn_done_t(struct isochron_orch_node *node,
+			     struct isochron_txn *txn);
+
 static void isochron_node_rtt_init(struct isochron_orch_node *node)
 {
 	node->max_rtt = 0;
 	node->num_rtt_measurements = 0;
 }
 
-static void isochron_node_rtt_before(struct isochron_orch_node *node)
+static void isochron_node_rtt_record(struct isochron_orch_node *node,
+				     __s64 rtt)
 {
-	struct timespec now_ts;
+	node->rtt = rtt;
+	node->num_rtt_measurements++;
 
-	clock_gettime(CLOCK_MONOTONIC, &now_ts);
-	node->rtt = -timespec_to_ns(&now_ts);
+	if (node->max_rtt < node->rtt)
+		node->max_rtt = node->rtt;
+}
+
+static void isochron_node_rtt_finalize(struct isochron_orch_node *node)
+{
+	printf("Max TCP round trip time to node %s over %zu measurements is %lld ns\n",
+	       node->name, node->num_rtt_measurements, node->max_rtt);
+}
+
+/* Have @build create a transaction for each node, send them to all nodes
+ * at once, and wait for all responses. Nodes whose transaction @build
+ * leaves empty are skipped. @done is called for the nodes whose
+ * transaction succeeded.
+ */
+static int prog_nodes_txn(struct isochron_orch *prog, prog_txn_build_t *build,
+			  prog_txn_done_t *done, const char *desc)
+{
+	struct isochron_orch_node *node;
+	int rc = 0, err;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		node->txn = isochron_txn_create();
+		if (!node->txn) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		rc = build(node, node->txn);
+		if (rc)
+			break;
+
+		if (isochron_txn_empty(node->txn))
+			continue;
+
+		rc = isochron_mgmt_async_submit(prog->async, node->mgmt_sock,
+						node->txn);
+		if (rc) {
+			pr_err(rc, "Failed to %s node %s: %m\n", desc,
+			       node->name);
+			break;
+		}
+	}
+
+	/* Collect the responses to what was sent even in case of error */
+	isochron_mgmt_async_wait(prog->async);
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (!node->txn)
+			continue;
+
+		if (!rc && !isochron_txn_empty(node->txn)) {
+			err = isochron_txn_rc(node->txn);
+			if (err) {
+				pr_err(err, "Failed to %s node %s: %m\n", desc,
+				       node->name);
+				rc = err;
+			} else if (done) {
+				done(node, node->txn);
+			}
+		}
+
+		isochron_txn_destroy(node->txn);
+		node->txn = NULL;
+	}
+
+	return rc;
+}
+
+static bool prog_event_valid(struct isochron_orch_node *node,
+			     enum isochron_event event, size_t len,
+			     size_t expected)
+{
+	if (len == expected)
+		return true;
+
+	fprintf(stderr, "Malformed event %d from node %s\n", event,
+		node->name);
+
+	return false;
+}
+
+static void prog_node_event_cb(void *priv, enum isochron_event event,
+			       void *data, size_t len)
+{
+	struct isochron_orch_node *node = priv;
+	struct syncmon_node *sn = node->syncmon_node;
+	struct isochron_gm_clock_identity *gm = data;
+	struct isochron_port_link_state *link = data;
+	struct isochron_port_state *port = data;
+	struct isochron_test_state *test = data;
+	struct isochron_event_sync *sync = data;
+
+	node->have_status = true;
+
+	switch (event) {
+	case ISOCHRON_EVENT_SYNC:
+		if (!sn || !prog_event_valid(node, event, len, sizeof(*sync)))
+			break;
+
+		syncmon_push_sync(sn, (int)__be32_to_cpu(sync->rc),
+				  __be64_to_cpu(sync->sysmon_offset),
+				  __be64_to_cpu(sync->ptpmon_offset),
+				  __be16_to_cpu(sync->utc_offset));
+		break;
+	case ISOCHRON_EVENT_PORT_STATE:
+		if (!sn || !prog_event_valid(node, event, len, sizeof(*port)))
+			break;
+
+		syncmon_push_port_state(sn, port->state);
+		node->status_changed = true;
+		break;
+	case ISOCHRON_EVENT_GM_CHANGE:
+		if (!sn || !prog_event_valid(node, event, len, sizeof(*gm)))
+			break;
+
+		syncmon_push_gm(sn, &gm->clock_identity);
+		node->status_changed = true;
+		break;
+	case ISOCHRON_EVENT_LINK_STATE:
+		if (!sn || !prog_event_valid(node, event, len, sizeof(*link)))
+			break;
+
+		syncmon_push_link_state(sn, link->link_state);
+		node->status_changed = true;
+		break;
+	case ISOCHRON_EVENT_TEST_STATE:
+		if (node->role != ISOCHRON_ROLE_SEND ||
+		    !prog_event_valid(node, event, len, sizeof(*test)))
+			break;
+
+		node->test_state = test->test_state;
+		node->status_changed = true;
+		break;
+	default:
+		break;
+	}
+}
+
+static int prog_build_event_subscribe_txn(struct isochron_orch_node *node,
+					  struct isochron_txn *txn)
+{
+	__u32 events = node->event_interval ? ISOCHRON_ORCH_EVENTS : 0;
+
+	return isochron_txn_set_event_subscribe(txn, events,
+						node->event_interval);
+}
+
+/* Have all nodes push their state every @interval, or stop them from doing
+ * so if @interval is zero. Once unsubscribed, no notification can arrive
+ * in the middle of a synchronous request.
+ */
+static int prog_subscribe_events(struct isochron_orch *prog, __s64 interval)
+{
+	struct isochron_orch_node *node;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		node->event_interval = interval;
+		if (!interval)
+			node->have_status = false;
+	}
+
+	return prog_nodes_txn(prog, prog_build_event_subscribe_txn, NULL,
+			      interval ? "subscribe to events of" :
+					 "unsubscribe from events of");
 }
 
-static void isochron_node_rtt_after(struct isochron_orch_node *node)
+static __s64 prog_now(void)
 {
 	struct timespec now_ts;
 
 	clock_gettime(CLOCK_MONOTONIC, &now_ts);
-	node->rtt += timespec_to_ns(&now_ts);
-	node->num_rtt_measurements++;
 
-	if (node->max_rtt < node->rtt)
-		node->max_rtt = node->rtt;
+	return timespec_to_ns(&now_ts);
 }
 
-static void isochron_node_rtt_finalize(struct isochron_orch_node *node)
+/* Deliver notifications until @deadline, as nanoseconds of
+ * CLOCK_MONOTONIC. Returns true if any node changed state meanwhile.
+ */
+static bool prog_poll_events(struct isochron_orch *prog, __s64 deadline)
 {
-	printf("Max TCP round trip time to node %s over %zu measurements is %lld ns\n",
-	       node->name, node->num_rtt_measurements, node->max_rtt);
+	struct isochron_orch_node *node;
+	bool changed = false;
+	__s64 now;
+	int rc;
+
+	while (!signal_received) {
+		LIST_FOREACH(node, &prog->nodes, list) {
+			if (node->status_changed)
+				changed = true;
+			node->status_changed = false;
+		}
+
+		if (changed)
+			break;
+
+		now = prog_now();
+		if (now >= deadline)
+			break;
+
+		/* Round up to the next millisecond */
+		rc = isochron_mgmt_async_poll(prog->async,
+					      (deadline - now + 999999) / 1000000);
+		if (rc)
+			break;
+	}
+
+	return changed;
+}
+
+static void prog_syncmon_wait(void *priv, const struct timespec *deadline)
+{
+	prog_poll_events(priv, timespec_to_ns(deadline));
+}
+
+/* Give the sync check a starting point by waiting for every node to
+ * report its state once
+ */
+static int prog_wait_event_baseline(struct isochron_orch *prog)
+{
+	__s64 deadline = prog_now() + ISOCHRON_ORCH_BASELINE_TIMEOUT;
+	struct isochron_orch_node *node;
+	bool complete;
+
+	do {
+		complete = true;
+		LIST_FOREACH(node, &prog->nodes, list)
+			if (!node->have_status)
+				complete = false;
+		if (complete)
+			return 0;
+
+		prog_poll_events(prog, min(deadline,
+					   prog_now() + ISOCHRON_ORCH_SYNC_INTERVAL));
+
+		if (signal_received)
+			return -EINTR;
+	} while (prog_now() < deadline);
+
+	LIST_FOREACH(node, &prog->nodes, list)
+		if (!node->have_status)
+			fprintf(stderr, "Node %s did not report its state\n",
+				node->name);
+
+	return 0;
+}
+
+static size_t prog_node_log_entry_size(const struct isochron_orch_node *node)
+{
+	if (node->role == ISOCHRON_ROLE_SEND)
+		return sizeof(struct isochron_send_pkt_data);
+
+	return sizeof(struct isochron_rcv_pkt_data);
+}
+
+static unsigned long
+prog_node_packet_count(const struct isochron_orch_node *node)
+{
+	if (node->role == ISOCHRON_ROLE_SEND)
+		return node->send->iterations;
+
+	return node->sender->send->iterations;
+}
+
+static void prog_teardown_logs(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_RCV || !node->sender->log_mapped)
+			continue;
+
+		isochron_log_map_destroy(&node->sender->log_map);
+		node->sender->log_mapped = false;
+		node->sender->log.buf = NULL;
+		node->log.buf = NULL;
+		memset(&node->sender->send->annotation_log, 0,
+		       sizeof(node->sender->send->annotation_log));
+	}
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role == ISOCHRON_ROLE_SEND &&
+		    node->send->annotation_log.buf) {
+			isochron_log_teardown(&node->send->annotation_log);
+			memset(&node->send->annotation_log, 0,
+			       sizeof(node->send->annotation_log));
+		}
+
+		if (!node->log.buf)
+			continue;
+
+		isochron_log_teardown(&node->log);
+		node->log.buf = NULL;
+	}
 }
 
-static int prog_query_test_state(struct isochron_orch_node *node,
-				 enum test_state *state)
+static int prog_build_log_subscribe_txn(struct isochron_orch_node *node,
+					struct isochron_txn *txn)
 {
-	struct isochron_test_state t;
+	return isochron_txn_set_log_subscribe(txn, ISOCHRON_LOG_CHUNK_SIZE);
+}
+
+/* Each node will send its log in chunks as the test progresses, so that
+ * by the time the test ends, there is little left to transfer. Unless
+ * sessions are appended to a container, the chunks of a sender and of its
+ * receiver are placed directly in a mapping of their output file rather
+ * than being buffered until the end.
+ */
+static int prog_subscribe_logs(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node, *sender;
+	size_t entry_size;
 	int rc;
 
-	rc = isochron_query_mid(node->mgmt_sock, ISOCHRON_MID_TEST_STATE,
-				&t, sizeof(t));
-	if (rc) {
-		fprintf(stderr, "Test state missing from node %s reply\n",
-			node->name);
-		return rc;
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_RCV)
+			continue;
+
+		sender = node->sender;
+		if (sender->send->append_output)
+			continue;
+
+		rc = isochron_send_map_log(sender->send, &sender->log_map,
+					   &sender->log, &node->log);
+		if (rc)
+			goto err;
+
+		sender->log_mapped = true;
+		sender->log_complete = false;
+		node->log_complete = false;
+	}
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->log.buf)
+			continue;
+
+		entry_size = prog_node_log_entry_size(node);
+
+		rc = isochron_log_init(&node->log,
+				       prog_node_packet_count(node) *
+				       entry_size);
+		if (rc)
+			goto err;
+
+		node->log_complete = false;
+
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
+
+		rc = isochron_log_init(&node->send->annotation_log,
+				       ISOCHRON_ANNOTATION_LOG_SIZE);
+		if (rc)
+			goto err;
 	}
 
-	*state = t.test_state;
+	rc = prog_nodes_txn(prog, prog_build_log_subscribe_txn, NULL,
+			    "subscribe to log of");
+	if (rc)
+		goto err;
 
 	return 0;
+
+err:
+	prog_teardown_logs(prog);
+	return rc;
+}
+
+static int prog_node_log_chunk_cb(void *priv, void *data, size_t len)
+{
+	struct isochron_orch_node *node = priv;
+
+	return isochron_log_chunk_parse(&node->log,
+					prog_node_log_entry_size(node),
+					data, len, &node->log_complete);
 }
 
-static bool prog_all_senders_stopped(void *priv)
+static int prog_build_log_chunk_txn(struct isochron_orch_node *node,
+				    struct isochron_txn *txn)
+{
+	if (node->log_complete)
+		return 0;
+
+	return isochron_txn_add_get_cb(txn, ISOCHRON_MID_LOG_CHUNK,
+				       prog_node_log_chunk_cb, node);
+}
+
+/* Rather than repeating the test, the time during which any of the nodes
+ * was out of sync is recorded in the log of all senders
+ */
+static void prog_sync_loss(void *priv, __s64 start, __s64 stop)
 {
 	struct isochron_orch *prog = priv;
 	struct isochron_orch_node *node;
-	int rc;
 
 	LIST_FOREACH(node, &prog->nodes, list) {
 		if (node->role != ISOCHRON_ROLE_SEND)
 			continue;
 
-		if (node->test_state != ISOCHRON_TEST_STATE_RUNNING)
+		if (!node->send->annotation_log.size)
 			continue;
 
-		rc = prog_query_test_state(node, &node->test_state);
-		if (rc)
-			return false;
+		isochron_log_annotate(&node->send->annotation_log,
+				      ISOCHRON_ANNOTATION_SYNC_LOSS,
+				      start, stop);
+	}
+}
+
+/* Pick up the log chunks completed in the meantime by all nodes. The
+ * senders push their test state when it changes.
+ */
+static bool prog_monitor_test(void *priv)
+{
+	struct isochron_orch *prog = priv;
+	struct isochron_orch_node *node;
+	int rc;
+
+	rc = prog_nodes_txn(prog, prog_build_log_chunk_txn, NULL, "monitor");
+	if (rc)
+		return false;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
 
 		if (node->test_state == ISOCHRON_TEST_STATE_RUNNING)
 			return false;
@@ -394,6 +825,31 @@ static bool prog_validate_test(struct isochron_orch *prog)
 	return true;
 }
 
+/* Subscribe to the events of all nodes for the duration of the test, and
+ * start the senders, in a single round trip
+ */
+static int prog_build_start_txn(struct isochron_orch_node *node,
+				struct isochron_txn *txn)
+{
+	int rc;
+
+	rc = prog_build_event_subscribe_txn(node, txn);
+	if (rc)
+		return rc;
+
+	if (node->role != ISOCHRON_ROLE_SEND)
+		return 0;
+
+	return isochron_txn_set_test_state(txn, ISOCHRON_TEST_STATE_RUNNING);
+}
+
+static void prog_start_done(struct isochron_orch_node *node,
+			    struct isochron_txn *txn)
+{
+	if (node->role == ISOCHRON_ROLE_SEND)
+		node->test_state = ISOCHRON_TEST_STATE_RUNNING;
+}
+
 static int prog_start_senders(struct isochron_orch *prog)
 {
 	struct isochron_orch_node *node;
@@ -403,43 +859,31 @@ static int prog_start_senders(struct isochron_orch *prog)
 	if (rc)
 		return rc;
 
-	LIST_FOREACH(node, &prog->nodes, list) {
-		if (node->role != ISOCHRON_ROLE_SEND)
-			continue;
-
-		rc = isochron_update_test_state(node->mgmt_sock,
-						ISOCHRON_TEST_STATE_RUNNING);
-		if (rc) {
-			pr_err(rc, "Failed to start node %s: %m\n", node->name);
-			return rc;
-		}
+	LIST_FOREACH(node, &prog->nodes, list)
+		node->event_interval = syncmon_get_monitor_interval(prog->syncmon);
 
-		node->test_state = ISOCHRON_TEST_STATE_RUNNING;
-	}
+	rc = prog_nodes_txn(prog, prog_build_start_txn, prog_start_done,
+			    "start");
+	if (rc)
+		return rc;
 
 	prog_print_sender_base_times(prog);
 
 	return 0;
 }
 
-static int prog_stop_senders(struct isochron_orch *prog)
+static int prog_build_stop_txn(struct isochron_orch_node *node,
+			       struct isochron_txn *txn)
 {
-	struct isochron_orch_node *node;
-	int rc;
-
-	LIST_FOREACH(node, &prog->nodes, list) {
-		if (node->role != ISOCHRON_ROLE_SEND)
-			continue;
+	if (node->role != ISOCHRON_ROLE_SEND)
+		return 0;
 
-		rc = isochron_update_test_state(node->mgmt_sock,
-						ISOCHRON_TEST_STATE_IDLE);
-		if (rc) {
-			pr_err(rc, "Failed to stop node %s: %m\n", node->name);
-			return rc;
-		}
-	}
+	return isochron_txn_set_test_state(txn, ISOCHRON_TEST_STATE_IDLE);
+}
 
-	return 0;
+static int prog_stop_senders(struct isochron_orch *prog)
+{
+	return prog_nodes_txn(prog, prog_build_stop_txn, NULL, "stop");
 }
 
 static struct syncmon_node *
@@ -481,11 +925,15 @@ static int prog_init_syncmon(struct isochron_orch *prog)
 	struct isochron_orch_node *node;
 	struct syncmon *syncmon;
 	struct syncmon_node *sn;
+	int rc;
 
 	syncmon = syncmon_create();
 	if (!syncmon)
 		return -ENOMEM;
 
+	syncmon_set_push(syncmon, prog_syncmon_wait, prog);
+	syncmon_set_sync_loss_cb(syncmon, prog_sync_loss, prog);
+
 	LIST_FOREACH(node, &prog->nodes, list) {
 		if (node->role != ISOCHRON_ROLE_RCV)
 			continue;
@@ -496,11 +944,25 @@ static int prog_init_syncmon(struct isochron_orch *prog)
 			return -ENOMEM;
 		}
 
+		node->sender->syncmon_node = sn;
+
 		sn = prog_add_syncmon_receiver(syncmon, node, sn);
 		if (!sn) {
 			syncmon_destroy(syncmon);
 			return -ENOMEM;
 		}
+
+		node->syncmon_node = sn;
+	}
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		rc = isochron_mgmt_async_set_event_cb(prog->async,
+						      node->mgmt_sock,
+						      prog_node_event_cb, node);
+		if (rc) {
+			syncmon_destroy(syncmon);
+			return rc;
+		}
 	}
 
 	prog->syncmon = syncmon;
@@ -508,46 +970,77 @@ static int prog_init_syncmon(struct isochron_orch *prog)
 	return 0;
 }
 
-static int prog_collect_logs(struct isochron_orch *prog)
+/* Wait for all nodes to complete their logs, giving up after
+ * ISOCHRON_LOG_TAIL_TIMEOUT and keeping the missing entries zeroed out.
+ */
+static int prog_collect_log_tails(struct isochron_orch *prog)
 {
-	struct isochron_orch_node *node, *sender;
-	struct isochron_log send_log, rcv_log;
-	struct isochron_send *send;
+	struct timespec interval = ns_to_timespec(NSEC_PER_SEC / 10);
+	struct isochron_orch_node *node;
+	struct timespec now_ts;
+	bool complete;
+	__s64 deadline;
 	int rc;
 
-	LIST_FOREACH(node, &prog->nodes, list) {
-		if (node->role != ISOCHRON_ROLE_RCV)
-			continue;
+	LIST_FOREACH(node, &prog->nodes, list)
+		if (!node->log_complete)
+			printf("Collecting stats from %s\n", node->name);
 
-		sender = node->sender;
-		send = sender->send;
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+	deadline = timespec_to_ns(&now_ts) + ISOCHRON_LOG_TAIL_TIMEOUT;
 
-		printf("Collecting stats from %s\n", sender->name);
-		rc = isochron_collect_rcv_log(sender->mgmt_sock, &send_log);
-		if (rc) {
-			pr_err(rc, "Failed to collect sender stats: %m\n");
+	while (1) {
+		rc = prog_nodes_txn(prog, prog_build_log_chunk_txn, NULL,
+				    "collect stats from");
+		if (rc)
 			return rc;
-		}
 
-		printf("Collecting stats from %s\n", node->name);
-		rc = isochron_collect_rcv_log(node->mgmt_sock, &rcv_log);
-		if (rc) {
-			pr_err(rc, "Failed to collect receiver stats: %m\n");
-			isochron_log_teardown(&send_log);
-			return rc;
-		}
+		complete = true;
+		LIST_FOREACH(node, &prog->nodes, list)
+			if (!node->log_complete)
+				complete = false;
+		if (complete)
+			return 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &now_ts);
+		if (timespec_to_ns(&now_ts) >= deadline)
+			break;
+
+		if (signal_received)
+			return -EINTR;
+
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL);
+	}
+
+	LIST_FOREACH(node, &prog->nodes, list)
+		if (!node->log_complete)
+			fprintf(stderr,
+				"Timed out waiting for log of node %s to complete\n",
+				node->name);
+
+	return 0;
+}
+
+static int prog_collect_logs(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node, *sender;
+	int rc;
+
+	rc = prog_collect_log_tails(prog);
+	if (rc)
+		return rc;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_RCV)
+			continue;
 
-		rc = isochron_log_save(send->output_file, &send_log,
-				       &rcv_log, send->iterations,
-				       send->tx_len, send->omit_sync,
-				       send->do_ts, send->taprio,
-				       send->txtime, send->deadline,
-				       send->base_time, send->advance_time,
-				       send->shift_time, send->cycle_time,
-				       send->window_size);
-		isochron_log_teardown(&send_log);
-		isochron_log_teardown(&rcv_log);
+		sender = node->sender;
 
+		if (sender->log_mapped)
+			rc = isochron_log_map_complete(&sender->log_map);
+		else
+			rc = isochron_send_save_log(sender->send, &sender->log,
+						    &node->log);
 		if (rc) {
 			pr_err(rc, "Failed to save log: %m\n");
 			return rc;
@@ -567,22 +1060,52 @@ static int prog_run_test(struct isochron_orch *prog)
 		return rc;
 
 	do {
+		rc = prog_subscribe_events(prog, ISOCHRON_ORCH_SYNC_INTERVAL);
+		if (rc)
+			goto out;
+
+		rc = prog_wait_event_baseline(prog);
+		if (rc)
+			goto out;
+
 		/* Adapt sync check intervals to new realities */
 		syncmon_init(prog->syncmon);
 
-		rc = syncmon_wait_until_ok(prog->syncmon);
-		if (rc) {
-			pr_err(rc, "Failed to check sync status: %m\n");
-			goto out;
+		/* Nodes which were in sync at the end of the previous test
+		 * need not wait for it again, if they still are
+		 */
+		if (prog->in_sync && syncmon_check(prog->syncmon)) {
+			printf("Nodes still in sync, skipping the sync wait\n");
+		} else {
+			rc = syncmon_wait_until_ok(prog->syncmon);
+			if (rc) {
+				pr_err(rc, "Failed to check sync status: %m\n");
+				goto out;
+			}
 		}
 
+		/* The base times are calculated through synchronous
+		 * requests
+		 */
+		rc = prog_subscribe_events(prog, 0);
+		if (rc)
+			goto out;
+
+		rc = prog_subscribe_logs(prog);
+		if (rc)
+			goto out;
+
 		rc = prog_start_senders(prog);
 		if (rc)
 			goto out;
 
-		sync_ok = syncmon_monitor(prog->syncmon,
-					  prog_all_senders_stopped,
+		sync_ok = syncmon_monitor(prog->syncmon, prog_monitor_test,
 					  prog);
+		prog->in_sync = syncmon_last_check_ok(prog->syncmon);
+
+		rc = prog_subscribe_events(prog, 0);
+		if (rc)
+			goto out;
 
 		test_valid = prog_validate_test(prog);
 
@@ -596,6 +1119,8 @@ static int prog_run_test(struct isochron_orch *prog)
 		if (rc)
 			goto out;
 
+		prog_teardown_logs(prog);
+
 		if (signal_received) {
 			rc = -EINTR;
 			goto out;
@@ -603,568 +1128,886 @@ static int prog_run_test(struct isochron_orch *prog)
 	} while (!sync_ok || !test_valid);
 
 out:
+	prog_teardown_logs(prog);
 	syncmon_destroy(prog->syncmon);
 
 	return rc;
 }
 
-static int prog_marshall_data_to_receiver(struct isochron_orch_node *node)
+/* Between the points of a sweep, only the parameters which changed since
+ * the node was last configured are sent to it
+ */
+#define SEND_CHANGED(field) \
+	(!old || send->field != old->field)
+#define SEND_BUF_CHANGED(field) \
+	(!old || memcmp(&send->field, &old->field, sizeof(send->field)))
+
+static int prog_marshall_data_to_receiver(struct isochron_orch_node *node,
+					  struct isochron_txn *txn)
 {
-	struct isochron_orch_node *sender = node->sender;
+	const struct isochron_send *old = node->sender->marshalled;
+	struct isochron_send *send = node->sender->send;
 
-	return isochron_prepare_receiver(sender->send, node->mgmt_sock);
+	if (SEND_CHANGED(l2))
+		isochron_txn_set_l2_enabled(txn, send->l2);
+	if (SEND_CHANGED(l4))
+		isochron_txn_set_l4_enabled(txn, send->l4);
+	if (SEND_CHANGED(iterations))
+		isochron_txn_set_packet_count(txn, send->iterations);
+
+	return 0;
 }
 
-static int prog_marshall_data_to_sender(struct isochron_orch_node *node)
+/* The daemon keeps the sender parameters from the NODE_ROLE SET which
+ * instantiated them until the next one. A test state change from IDLE to
+ * RUNNING only runs isochron_send_interpret_args() again on what is there,
+ * and going back to IDLE only tears down the threads, the log and the data
+ * socket. So for the points of a sweep after the first, only the
+ * parameters which differ from the previously marshalled ones are sent,
+ * and the role is not set again, since that would reset all others to
+ * their defaults. The optional parameters below which are only sent when
+ * given (VLAN ID, EtherType, UTC offset, IP destination) keep their
+ * previous value on the daemon if a later point leaves them out.
+ */
+static int prog_marshall_data_to_sender(struct isochron_orch_node *node,
+					struct isochron_txn *txn)
 {
+	const struct isochron_send *old = node->marshalled;
 	struct isochron_send *send = node->send;
-	const char *if_name = send->if_name;
-	struct sk *sock = node->mgmt_sock;
-	int rc;
 
-	isochron_node_rtt_init(node);
+	if (!old)
+		isochron_txn_set_node_role(txn, ISOCHRON_ROLE_SEND);
+	if (SEND_BUF_CHANGED(if_name))
+		isochron_txn_set_if_name(txn, send->if_name);
+	if (SEND_BUF_CHANGED(dest_mac))
+		isochron_txn_set_destination_mac(txn, send->dest_mac);
+	if (SEND_BUF_CHANGED(src_mac))
+		isochron_txn_set_source_mac(txn, send->src_mac);
+	if (SEND_CHANGED(priority))
+		isochron_txn_set_priority(txn, send->priority);
+	if (SEND_CHANGED(stats_port))
+		isochron_txn_set_stats_port(txn, send->stats_port);
+	if (SEND_CHANGED(advance_time))
+		isochron_txn_set_advance_time(txn, send->advance_time);
+	if (SEND_CHANGED(shift_time))
+		isochron_txn_set_shift_time(txn, send->shift_time);
+	if (SEND_CHANGED(cycle_time))
+		isochron_txn_set_cycle_time(txn, send->cycle_time);
+	if (SEND_CHANGED(window_size))
+		isochron_txn_set_window_size(txn, send->window_size);
+	if (SEND_CHANGED(domain_number))
+		isochron_txn_set_domain_number(txn, send->domain_number);
+	if (SEND_CHANGED(transport_specific))
+		isochron_txn_set_transport_specific(txn,
+						    send->transport_specific);
+	if (SEND_BUF_CHANGED(uds_remote))
+		isochron_txn_set_uds(txn, send->uds_remote);
+	if (SEND_CHANGED(num_readings))
+		isochron_txn_set_num_readings(txn, send->num_readings);
+	if (old ? old->omit_sync != send->omit_sync : !send->omit_sync) {
+		isochron_txn_set_sysmon_enabled(txn, !send->omit_sync);
+		isochron_txn_set_ptpmon_enabled(txn, !send->omit_sync);
+	}
+	if (!old)
+		isochron_txn_set_sync_monitor_enabled(txn, false);
+	if (SEND_CHANGED(tx_len))
+		isochron_txn_set_packet_size(txn, send->tx_len);
+	if (SEND_CHANGED(do_ts))
+		isochron_txn_set_ts_enabled(txn, send->do_ts);
+	if (send->vid >= 0 && SEND_CHANGED(vid))
+		isochron_txn_set_vid(txn, send->vid);
+	if (send->etype >= 0 && SEND_CHANGED(etype))
+		isochron_txn_set_ethertype(txn, send->etype);
+	if (SEND_CHANGED(quiet))
+		isochron_txn_set_quiet_enabled(txn, send->quiet);
+	if (SEND_CHANGED(taprio))
+		isochron_txn_set_taprio_enabled(txn, send->taprio);
+	if (SEND_CHANGED(txtime))
+		isochron_txn_set_txtime_enabled(txn, send->txtime);
+	if (SEND_CHANGED(deadline))
+		isochron_txn_set_deadline_enabled(txn, send->deadline);
+	if (SEND_CHANGED(iterations))
+		isochron_txn_set_packet_count(txn, send->iterations);
+	if (send->utc_tai_offset >= 0 && SEND_CHANGED(utc_tai_offset))
+		isochron_txn_set_utc_offset(txn, send->utc_tai_offset);
+	if (send->ip_destination.family && SEND_BUF_CHANGED(ip_destination))
+		isochron_txn_set_ip_destination(txn, &send->ip_destination);
+	if (SEND_CHANGED(l2))
+		isochron_txn_set_l2_enabled(txn, send->l2);
+	if (SEND_CHANGED(l4))
+		isochron_txn_set_l4_enabled(txn, send->l4);
+	if (SEND_CHANGED(data_port))
+		isochron_txn_set_data_port(txn, send->data_port);
+	if (SEND_CHANGED(sched_fifo))
+		isochron_txn_set_sched_fifo(txn, send->sched_fifo);
+	if (SEND_CHANGED(sched_rr))
+		isochron_txn_set_sched_rr(txn, send->sched_rr);
+	if (SEND_CHANGED(sched_priority))
+		isochron_txn_set_sched_priority(txn, send->sched_priority);
+	if (SEND_CHANGED(cpumask))
+		isochron_txn_set_cpu_mask(txn, send->cpumask);
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_node_role(sock, ISOCHRON_ROLE_SEND);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update role for node %s\n",
-			node->name);
-		return rc;
-	}
+	return 0;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_if_name(sock, if_name);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update interface name for node %s\n",
-			node->name);
-		return rc;
-	}
+static int prog_receiver_mac_address_cb(void *priv, void *data, size_t len)
+{
+	struct isochron_orch_node *node = priv;
+	struct isochron_orch_node *sender = node->sender;
+	struct isochron_mac_addr *mac = data;
+	char mac_buf[MACADDR_BUFSIZ];
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_destination_mac(sock, send->dest_mac);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update MAC DA for node %s\n",
+	if (len != sizeof(*mac)) {
+		fprintf(stderr,
+			"Destination MAC missing from node %s reply\n",
 			node->name);
-		return rc;
+		return -EBADMSG;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_source_mac(sock, send->src_mac);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update MAC SA for node %s\n",
-			node->name);
-		return rc;
-	}
+	ether_addr_copy(sender->send->dest_mac, mac->addr);
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_priority(sock, send->priority);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update priority for node %s\n",
-			node->name);
-		return rc;
-	}
+	mac_addr_sprintf(mac_buf, sender->send->dest_mac);
+	printf("Destination MAC address of %s is %s\n", node->name, mac_buf);
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_stats_port(sock, send->stats_port);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update stats port for node %s\n",
-			node->name);
-		return rc;
-	}
+	return 0;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_advance_time(sock, send->advance_time);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update advance time for node %s\n",
-			node->name);
-		return rc;
-	}
+static int prog_marshall_data_from_receiver(struct isochron_orch_node *node,
+					    struct isochron_txn *txn)
+{
+	struct isochron_orch_node *sender = node->sender;
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_shift_time(sock, send->shift_time);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update shift time for node %s\n",
-			node->name);
-		return rc;
-	}
+	/* The receiver's log of previous sessions needs no draining, it is
+	 * cleared by the LOG_SUBSCRIBE which precedes every test. A GET of
+	 * the log would be held back by the receiver until it has all the
+	 * packets of a partial session, which cannot be answered within a
+	 * transaction.
+	 */
+	if (sender->send->l2 && is_zero_ether_addr(sender->send->dest_mac))
+		return isochron_txn_add_get_cb(txn,
+					       ISOCHRON_MID_DESTINATION_MAC,
+					       prog_receiver_mac_address_cb,
+					       node);
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_cycle_time(sock, send->cycle_time);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update cycle time for node %s\n",
-			node->name);
-		return rc;
-	}
+	return 0;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_window_size(sock, send->window_size);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update window size for node %s\n",
-			node->name);
-		return rc;
-	}
+static int prog_build_marshall_from_txn(struct isochron_orch_node *node,
+					struct isochron_txn *txn)
+{
+	if (node->role != ISOCHRON_ROLE_RCV)
+		return 0;
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_domain_number(sock, send->domain_number);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update domain number for node %s\n",
-			node->name);
+	return prog_marshall_data_from_receiver(node, txn);
+}
+
+static int prog_marshall_data_from_nodes(struct isochron_orch *prog)
+{
+	return prog_nodes_txn(prog, prog_build_marshall_from_txn, NULL,
+			      "query");
+}
+
+static int prog_build_marshall_to_txn(struct isochron_orch_node *node,
+				      struct isochron_txn *txn)
+{
+	if (node->role == ISOCHRON_ROLE_SEND)
+		return prog_marshall_data_to_sender(node, txn);
+
+	return prog_marshall_data_to_receiver(node, txn);
+}
+
+static void prog_marshall_to_done(struct isochron_orch_node *node,
+				  struct isochron_txn *txn)
+{
+	if (node->role != ISOCHRON_ROLE_SEND)
+		return;
+
+	isochron_node_rtt_init(node);
+	isochron_node_rtt_record(node, isochron_txn_rtt(txn));
+	isochron_node_rtt_finalize(node);
+}
+
+/* Configure all nodes in a single round trip */
+static int prog_marshall_data_to_nodes(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node;
+	int rc;
+
+	rc = prog_nodes_txn(prog, prog_build_marshall_to_txn,
+			    prog_marshall_to_done, "configure");
+	if (rc)
 		return rc;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
+
+		if (node->marshalled != node->send)
+			free(node->marshalled);
+		node->marshalled = node->send;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_transport_specific(sock,
-						send->transport_specific);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update transport specific for node %s\n",
+	return 0;
+}
+
+static int prog_open_node_connection(struct isochron_orch_node *node)
+{
+	int rc;
+
+	if (!node->port)
+		node->port = ISOCHRON_STATS_PORT;
+
+	if (node->addr.family != AF_INET && node->addr.family != AF_INET6) {
+		fprintf(stderr, "Node %s missing a \"host\" property\n",
 			node->name);
-		return rc;
+		return -EINVAL;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_uds(sock, send->uds_remote);
-	isochron_node_rtt_after(node);
+	rc = sk_connect_tcp(&node->addr, node->port, &node->mgmt_sock);
 	if (rc) {
-		fprintf(stderr, "failed to update UDS for node %s\n",
+		fprintf(stderr, "Failed to connect to node %s: %m\n",
 			node->name);
 		return rc;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_num_readings(sock, send->num_readings);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update number of readings for node %s\n",
-			node->name);
-		return rc;
+	printf("Connected to node %s\n", node->name);
+
+	return 0;
+}
+
+static int prog_validate_node(struct isochron_orch_node *node)
+{
+	if (!strlen(node->exec)) {
+		fprintf(stderr, "exec line missing from node %s\n", node->name);
+		return -EINVAL;
 	}
 
-	if (!send->omit_sync) {
-		isochron_node_rtt_before(node);
-		rc = isochron_update_sysmon_enabled(sock, true);
-		isochron_node_rtt_after(node);
-		if (rc) {
-			fprintf(stderr, "failed to enable sysmon for node %s\n",
-				node->name);
-			return rc;
-		}
+	return 0;
+}
 
-		isochron_node_rtt_before(node);
-		rc = isochron_update_ptpmon_enabled(sock, true);
-		isochron_node_rtt_after(node);
-		if (rc) {
-			fprintf(stderr, "failed to enable ptpmon for node %s\n",
-				node->name);
+static int prog_init_sender_nodes(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node;
+	int rc;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		rc = prog_validate_node(node);
+		if (rc)
 			return rc;
-		}
-	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_sync_monitor_enabled(sock, false);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr,
-			"failed to disable local sync monitoring for node %s\n",
-			node->name);
-		return rc;
+		node->collect_sync_stats = !node->send->omit_sync;
+		node->sync_threshold = node->send->sync_threshold;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_packet_size(sock, send->tx_len);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update packet size for node %s\n",
-			node->name);
-		return rc;
-	}
+	return 0;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_ts_enabled(sock, send->do_ts);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable timestamping for node %s\n",
-			node->name);
-		return rc;
-	}
+static int prog_init_receiver_nodes(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node, *rcv_node, *tmp;
+	struct isochron_send *send;
+	int rc;
 
-	if (send->vid >= 0) {
-		isochron_node_rtt_before(node);
-		rc = isochron_update_vid(sock, send->vid);
-		isochron_node_rtt_after(node);
-		if (rc) {
+	LIST_FOREACH_SAFE(node, &prog->nodes, list, tmp) {
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
+
+		send = node->send;
+
+		if (!send->stats_srv.family)
+			continue;
+
+		rcv_node = calloc(sizeof(*rcv_node), 1);
+		if (!rcv_node)
+			return -ENOMEM;
+
+		rc = snprintf(rcv_node->name, BUFSIZ, "%s's receiver",
+			      node->name);
+		if (rc >= BUFSIZ) {
 			fprintf(stderr,
-				"failed to update VLAN ID for node %s\n",
+				"Truncation while parsing node \"%s\"'s name\n",
 				node->name);
-			return rc;
+			free(rcv_node);
+			return -EINVAL;
 		}
+
+		rcv_node->addr = send->stats_srv;
+		rcv_node->port = send->stats_port;
+		rcv_node->collect_sync_stats = !send->omit_sync &&
+					       !send->omit_remote_sync;
+		rcv_node->sync_threshold = send->sync_threshold;
+		rcv_node->role = ISOCHRON_ROLE_RCV;
+		rcv_node->sender = node;
+		LIST_INSERT_HEAD(&prog->nodes, rcv_node, list);
 	}
 
-	if (send->etype >= 0) {
-		isochron_node_rtt_before(node);
-		rc = isochron_update_ethertype(sock, send->etype);
-		isochron_node_rtt_after(node);
-		if (rc) {
-			fprintf(stderr,
-				"failed to update EtherType for node %s\n",
-				node->name);
+	return 0;
+}
+
+static void prog_close_node_connection(struct isochron_orch_node *node)
+{
+	if (!node->mgmt_sock)
+		return;
+
+	sk_close(node->mgmt_sock);
+}
+
+static int prog_open_node_connections(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node;
+	int rc;
+
+	LIST_FOREACH(node, &prog->nodes, list) {
+		rc = prog_open_node_connection(node);
+		if (rc)
 			return rc;
-		}
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_quiet_enabled(sock, send->quiet);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to make node %s quiet\n",
-			node->name);
-		return rc;
-	}
+	return 0;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_taprio_enabled(sock, send->taprio);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable taprio for node %s\n",
-			node->name);
-		return rc;
-	}
+static void prog_teardown_sweep(struct isochron_orch *prog)
+{
+	struct isochron_sweep *sweep = &prog->sweep;
+	size_t i;
+	int k;
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_txtime_enabled(sock, send->txtime);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable txtime for node %s\n",
-			node->name);
-		return rc;
+	for (k = 0; k < sweep->num_keys; k++) {
+		for (i = 0; i < sweep->keys[k].num_values; i++)
+			free(sweep->keys[k].values[i]);
+		free(sweep->keys[k].values);
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_deadline_enabled(sock, send->deadline);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable deadline for node %s\n",
-			node->name);
-		return rc;
+	free(sweep->keys);
+}
+
+static void prog_teardown(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node, *tmp;
+
+	if (prog->async)
+		isochron_mgmt_async_destroy(prog->async);
+
+	LIST_FOREACH_SAFE(node, &prog->nodes, list, tmp) {
+		prog_close_node_connection(node);
+		if (node->role == ISOCHRON_ROLE_SEND) {
+			if (node->marshalled != node->send)
+				free(node->marshalled);
+			free(node->send);
+		}
+		LIST_REMOVE(node, list);
+		free(node);
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_packet_count(sock, send->iterations);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update packet count for node %s\n",
-			node->name);
+	prog_teardown_sweep(prog);
+}
+
+static int prog_exec_node_argparser(struct isochron_orch_node *node,
+				    int argc, char **argv,
+				    const char *value)
+{
+	const struct isochron_prog *prog;
+	int rc;
+
+	rc = isochron_parse_args(&argc, &argv, &prog);
+	if (rc)
 		return rc;
-	}
 
-	if (send->utc_tai_offset >= 0) {
-		isochron_node_rtt_before(node);
-		rc = isochron_update_utc_offset(sock, send->utc_tai_offset);
-		isochron_node_rtt_after(node);
-		if (rc) {
+	if (prog->main == isochron_send_main) {
+		rc = isochron_send_parse_args(argc, argv, node->send);
+		if (!rc && node->send->mmap_output) {
 			fprintf(stderr,
-				"failed to update UTC offset for node %s\n",
+				"--mmap-output is not supported for node %s, logs are collected by the orchestrator\n",
 				node->name);
-			return rc;
+			rc = -EINVAL;
 		}
-	}
-
-	if (send->ip_destination.family) {
-		isochron_node_rtt_before(node);
-		rc = isochron_update_ip_destination(sock,
-						    &send->ip_destination);
-		isochron_node_rtt_after(node);
-		if (rc) {
+		/* The daemon has no way to hand its sync samples over */
+		if (!rc && node->send->sync_sample_interval) {
 			fprintf(stderr,
-				"failed to update IP destination for node %s\n",
+				"--sync-sample-interval is not supported for node %s, the daemon does not sample the sync offsets\n",
 				node->name);
-			return rc;
+			rc = -EINVAL;
 		}
+	} else {
+		fprintf(stderr,
+			"Unsupported exec line \"%s\" for node %s\n",
+			value, node->name);
+		rc = -EINVAL;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_l2_enabled(sock, send->l2);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable L2 transport for node %s\n",
-			node->name);
-		return rc;
-	}
+	return rc;
+}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_l4_enabled(sock, send->l4);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable L4 transport for node %s\n",
-			node->name);
-		return rc;
-	}
+static int prog_parse_exec_line(struct isochron_orch_node *node,
+				const char *value)
+{
+	size_t i, len = strlen(value);
+	bool curr_char_is_quote;
+	int argc = 0, k = 0;
+	char last_quote = 0;
+	char prev = 0;
+	char **argv;
+	int rc;
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_data_port(sock, send->data_port);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to set data port for node %s\n",
-			node->name);
-		return rc;
-	}
+	for (i = 0; i < len; i++) {
+		curr_char_is_quote = (value[i] == '\'' || value[i] == '"');
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_sched_fifo(sock, send->sched_fifo);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable SCHED_FIFO for node %s\n",
-			node->name);
-		return rc;
-	}
+		if (last_quote && value[i] == last_quote)
+			/* unquote */
+			last_quote = 0;
+		else if (curr_char_is_quote)
+			/* quote and remember starting character */
+			last_quote = value[i];
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_sched_rr(sock, send->sched_rr);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to enable SCHED_RR for node %s\n",
-			node->name);
-		return rc;
+		if (curr_char_is_quote || (!last_quote && isspace(value[i])))
+			node->exec[i] = 0;
+		else
+			node->exec[i] = value[i];
+
+		if (node->exec[i] && !prev)
+			argc++;
+
+		prev = node->exec[i];
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_sched_priority(sock, send->sched_priority);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to update sched priority for node %s\n",
-			node->name);
-		return rc;
+	node->exec[len] = 0;
+
+	argv = calloc(argc, sizeof(char *));
+	if (!argv) {
+		fprintf(stderr, "low memory\n");
+		return -ENOMEM;
 	}
 
-	isochron_node_rtt_before(node);
-	rc = isochron_update_cpu_mask(sock, send->cpumask);
-	isochron_node_rtt_after(node);
-	if (rc) {
-		fprintf(stderr, "failed to set CPU mask for node %s\n",
-			node->name);
-		return rc;
+	prev = 0;
+
+	for (i = 0; i < len; i++) {
+		if (node->exec[i] && !prev)
+			argv[k++] = &node->exec[i];
+
+		prev = node->exec[i];
 	}
 
-	isochron_node_rtt_finalize(node);
+	rc = prog_exec_node_argparser(node, argc, argv, value);
 
-	return 0;
+	free(argv);
+
+	return rc;
 }
 
-static int prog_query_receiver_mac_address(struct isochron_orch_node *node)
+static int prog_parse_key_value(struct isochron_orch_node *node,
+				const char *key, const char *value)
 {
-	struct isochron_orch_node *sender = node->sender;
-	struct isochron_mac_addr mac;
-	char mac_buf[MACADDR_BUFSIZ];
 	int rc;
 
-	if (!sender->send->l2)
-		return 0;
+	if (strcmp(key, "host") == 0) {
+		rc = ip_addr_from_string(value, &node->addr);
+		if (rc) {
+			fprintf(stderr, "Invalid IP address \"%s\" for host %s\n",
+				value, node->name);
+			return rc;
+		}
+	} else if (strcmp(key, "port") == 0) {
+		errno = 0;
+		node->port = strtoul(value, NULL, 0);
+		if (errno) {
+			fprintf(stderr, "Invalid port \"%s\" for host %s\n",
+				value, node->name);
+			return -errno;
+		}
+	} else if (strcmp(key, "exec") == 0) {
+		strcpy(node->exec_line, value);
 
-	if (!is_zero_ether_addr(sender->send->dest_mac))
-		return 0;
+		rc = prog_parse_exec_line(node, value);
+		if (rc)
+			return rc;
+	} else {
+		fprintf(stderr, "Unrecognized key %s\n", key);
+	}
 
-	rc = isochron_query_mid(node->mgmt_sock, ISOCHRON_MID_DESTINATION_MAC,
-				&mac, sizeof(mac));
-	if (rc) {
-		fprintf(stderr,
-			"Destination MAC missing from node %s reply\n",
-			node->name);
-		return rc;
+	return 0;
+}
+
+static int prog_sweep_add_value(struct isochron_sweep_key *key,
+				const char *value)
+{
+	char **values;
+
+	if (key->num_values == ISOCHRON_SWEEP_MAX_VALUES) {
+		fprintf(stderr, "Too many values for sweep key %s.%s\n",
+			key->node_name, key->option);
+		return -ERANGE;
 	}
 
-	ether_addr_copy(sender->send->dest_mac, mac.addr);
+	values = realloc(key->values, (key->num_values + 1) * sizeof(*values));
+	if (!values)
+		return -ENOMEM;
 
-	mac_addr_sprintf(mac_buf, sender->send->dest_mac);
-	printf("Destination MAC address of %s is %s\n", node->name, mac_buf);
+	key->values = values;
+
+	values[key->num_values] = strdup(value);
+	if (!values[key->num_values])
+		return -ENOMEM;
+
+	key->num_values++;
 
 	return 0;
 }
 
-static int prog_drain_receiver_log(struct isochron_orch_node *node)
+/* Parse a number of a range, which is either an integer or, if @scale is
+ * NSEC_PER_SEC, a decimal number with up to 9 digits after the point
+ * (such as the sec.nsec time format), as an integer count of nanounits.
+ */
+static int prog_sweep_parse_number(const char *str, __s64 scale, __s64 *val)
 {
-	struct isochron_log rcv_log;
-	int rc;
+	const char *p = str;
+	bool neg = false;
+	__s64 frac = 0;
+	int digits = 0;
+	char *end;
 
-	rc = isochron_collect_rcv_log(node->mgmt_sock, &rcv_log);
-	if (rc)
-		return rc;
+	if (*p == '-') {
+		neg = true;
+		p++;
+	}
+
+	errno = 0;
+	*val = strtoll(p, &end, 10);
+	if (errno || end == p || *val < 0)
+		goto err;
 
-	isochron_log_teardown(&rcv_log);
+	if (*end == '.' && scale == NSEC_PER_SEC) {
+		for (end++; isdigit(*end) && digits < 9; end++, digits++)
+			frac = frac * 10 + *end - '0';
+		for (; digits < 9; digits++)
+			frac *= 10;
+	}
+
+	if (*end)
+		goto err;
+
+	*val = *val * scale + frac;
+	if (neg)
+		*val = -*val;
 
 	return 0;
+
+err:
+	fprintf(stderr, "Invalid number \"%s\" in sweep range\n", str);
+	return -EINVAL;
 }
 
-static int prog_marshall_data_from_receiver(struct isochron_orch_node *node)
+static void prog_sweep_format_number(char *buf, size_t size, __s64 val,
+				     __s64 scale)
 {
+	__s64 abs_val = llabs(val);
+
+	if (scale == 1)
+		snprintf(buf, size, "%lld", val);
+	else
+		snprintf(buf, size, "%s%lld.%09lld", val < 0 ? "-" : "",
+			 abs_val / NSEC_PER_SEC, abs_val % NSEC_PER_SEC);
+}
+
+/* A range is given as "<start>:<stop>:<step>", with the stop value
+ * included if reached
+ */
+static int prog_sweep_add_range(struct isochron_sweep_key *key, char *range)
+{
+	char *start_str, *stop_str, *step_str;
+	__s64 start, stop, step, val;
+	char buf[BUFSIZ];
+	__s64 scale = 1;
 	int rc;
 
-	rc = prog_query_receiver_mac_address(node);
+	start_str = string_trim_whitespaces(strsep(&range, ":"));
+	stop_str = range ? string_trim_whitespaces(strsep(&range, ":")) : NULL;
+	step_str = range ? string_trim_whitespaces(range) : NULL;
+	if (!stop_str || !step_str || strchr(step_str, ':')) {
+		fprintf(stderr,
+			"Invalid range for sweep key %s.%s, expected <start>:<stop>:<step>\n",
+			key->node_name, key->option);
+		return -EINVAL;
+	}
+
+	if (strchr(start_str, '.') || strchr(stop_str, '.') ||
+	    strchr(step_str, '.'))
+		scale = NSEC_PER_SEC;
+
+	rc = prog_sweep_parse_number(start_str, scale, &start);
+	if (rc)
+		return rc;
+
+	rc = prog_sweep_parse_number(stop_str, scale, &stop);
 	if (rc)
 		return rc;
 
-	rc = prog_drain_receiver_log(node);
+	rc = prog_sweep_parse_number(step_str, scale, &step);
 	if (rc)
 		return rc;
 
+	if (!step || (step > 0 && start > stop) || (step < 0 && start < stop)) {
+		fprintf(stderr,
+			"Step of sweep range for %s.%s does not lead from start to stop\n",
+			key->node_name, key->option);
+		return -EINVAL;
+	}
+
+	for (val = start; step > 0 ? val <= stop : val >= stop; val += step) {
+		prog_sweep_format_number(buf, sizeof(buf), val, scale);
+
+		rc = prog_sweep_add_value(key, buf);
+		if (rc)
+			return rc;
+	}
+
 	return 0;
 }
 
-static int prog_marshall_data_from_nodes(struct isochron_orch *prog)
+/* Keys of the sweep section are either "mode" or "<node>.<option>", where
+ * <option> is the long name, without leading dashes, of an isochron-send
+ * option taking a value. Its value is a comma-separated list of items,
+ * each being either a literal value or a range.
+ */
+static int prog_parse_sweep_key_value(struct isochron_orch *prog,
+				      const char *key, char *value)
 {
-	struct isochron_orch_node *node;
+	struct isochron_sweep *sweep = &prog->sweep;
+	struct isochron_sweep_key *keys, *k;
+	const char *dot;
+	char *item;
 	int rc;
 
-	LIST_FOREACH(node, &prog->nodes, list) {
-		if (node->role == ISOCHRON_ROLE_RCV) {
-			rc = prog_marshall_data_from_receiver(node);
-			if (rc)
-				return rc;
+	if (strcmp(key, "mode") == 0) {
+		if (strcmp(value, "cartesian") == 0) {
+			sweep->mode = ISOCHRON_SWEEP_CARTESIAN;
+		} else if (strcmp(value, "zip") == 0) {
+			sweep->mode = ISOCHRON_SWEEP_ZIP;
+		} else {
+			fprintf(stderr,
+				"Invalid sweep mode \"%s\", expected \"cartesian\" or \"zip\"\n",
+				value);
+			return -EINVAL;
 		}
+
+		return 0;
 	}
 
-	return 0;
-}
+	dot = strrchr(key, '.');
+	if (!dot || dot == key || !strlen(dot + 1)) {
+		fprintf(stderr,
+			"Invalid sweep key %s, expected <node>.<option>\n",
+			key);
+		return -EINVAL;
+	}
+
+	keys = realloc(sweep->keys, (sweep->num_keys + 1) * sizeof(*keys));
+	if (!keys)
+		return -ENOMEM;
+
+	sweep->keys = keys;
+	k = &keys[sweep->num_keys++];
+	memset(k, 0, sizeof(*k));
+	memcpy(k->node_name, key, dot - key);
+	strcpy(k->option, dot + 1);
+
+	while ((item = strsep(&value, ",")) != NULL) {
+		item = string_trim_whitespaces(item);
+		if (!strlen(item))
+			continue;
 
-static int prog_marshall_data_to_nodes(struct isochron_orch *prog)
-{
-	struct isochron_orch_node *node;
-	int rc;
+		if (strchr(item, ':'))
+			rc = prog_sweep_add_range(k, item);
+		else
+			rc = prog_sweep_add_value(k, item);
+		if (rc)
+			return rc;
+	}
 
-	LIST_FOREACH(node, &prog->nodes, list) {
-		if (node->role == ISOCHRON_ROLE_SEND) {
-			rc = prog_marshall_data_to_sender(node);
-			if (rc)
-				return rc;
-		} else if (node->role == ISOCHRON_ROLE_RCV) {
-			rc = prog_marshall_data_to_receiver(node);
-			if (rc)
-				return rc;
-		}
+	if (!k->num_values) {
+		fprintf(stderr, "No values for sweep key %s\n", key);
+		return -EINVAL;
 	}
 
 	return 0;
 }
 
-static int prog_open_node_connection(struct isochron_orch_node *node)
+/* Parse the exec line of a sender, with the options of the current sweep
+ * point appended to it (these take precedence), into a new struct
+ */
+static int prog_sweep_parse_send(struct isochron_orch *prog,
+				 struct isochron_orch_node *node,
+				 struct isochron_send **new_send)
 {
-	int rc;
+	struct isochron_sweep *sweep = &prog->sweep;
+	struct isochron_send *send, *old = node->send;
+	struct isochron_sweep_key *k;
+	char line[BUFSIZ];
+	size_t len;
+	int i, rc;
 
-	if (!node->port)
-		node->port = ISOCHRON_STATS_PORT;
+	len = snprintf(line, sizeof(line), "%s", node->exec_line);
 
-	if (node->addr.family != AF_INET && node->addr.family != AF_INET6) {
-		fprintf(stderr, "Node %s missing a \"host\" property\n",
-			node->name);
-		return -EINVAL;
+	for (i = 0; i < sweep->num_keys; i++) {
+		k = &sweep->keys[i];
+		if (k->node != node)
+			continue;
+
+		len += snprintf(line + len, sizeof(line) - len, " --%s \"%s\"",
+				k->option, k->values[k->index]);
+		if (len >= sizeof(line)) {
+			fprintf(stderr,
+				"Exec line of node %s too long for sweep\n",
+				node->name);
+			return -EINVAL;
+		}
 	}
 
-	rc = sk_connect_tcp(&node->addr, node->port, &node->mgmt_sock);
+	send = calloc(sizeof(*send), 1);
+	if (!send)
+		return -ENOMEM;
+
+	node->send = send;
+	rc = prog_parse_exec_line(node, line);
+	node->send = old;
 	if (rc) {
-		fprintf(stderr, "Failed to connect to node %s: %m\n",
-			node->name);
+		free(send);
 		return rc;
 	}
 
-	printf("Connected to node %s\n", node->name);
+	*new_send = send;
 
 	return 0;
 }
 
-static int prog_validate_node(struct isochron_orch_node *node)
+/* The connections to the nodes persist across the sweep, so the receiver
+ * of a sender cannot change
+ */
+static int prog_sweep_check_send(const struct isochron_orch_node *node,
+				 const struct isochron_send *send)
 {
-	if (!strlen(node->exec)) {
-		fprintf(stderr, "exec line missing from node %s\n", node->name);
+	if (memcmp(&send->stats_srv, &node->send->stats_srv,
+		   sizeof(send->stats_srv)) ||
+	    send->stats_port != node->send->stats_port) {
+		fprintf(stderr,
+			"The receiver of node %s cannot change during the sweep\n",
+			node->name);
 		return -EINVAL;
 	}
 
 	return 0;
 }
 
-static int prog_init_sender_nodes(struct isochron_orch *prog)
+static void prog_sweep_select_point(struct isochron_sweep *sweep,
+				    size_t point)
 {
-	struct isochron_orch_node *node;
-	int rc;
-
-	LIST_FOREACH(node, &prog->nodes, list) {
-		rc = prog_validate_node(node);
-		if (rc)
-			return rc;
-
-		node->collect_sync_stats = !node->send->omit_sync;
-		node->sync_threshold = node->send->sync_threshold;
+	struct isochron_sweep_key *k;
+	int i;
+
+	/* In the cartesian product, the first key varies the slowest */
+	for (i = sweep->num_keys - 1; i >= 0; i--) {
+		k = &sweep->keys[i];
+
+		if (sweep->mode == ISOCHRON_SWEEP_ZIP) {
+			k->index = point;
+		} else {
+			k->index = point % k->num_values;
+			point /= k->num_values;
+		}
 	}
-
-	return 0;
 }
 
-static int prog_init_receiver_nodes(struct isochron_orch *prog)
+/* Check the parameters of each sender affected by the sweep at the given
+ * point. isochron_send_parse_args() also runs them through
+ * isochron_send_interpret_args(), so this catches the combinations of
+ * values which are invalid together, not just malformed values.
+ */
+static int prog_validate_sweep_point(struct isochron_orch *prog, size_t point)
 {
-	struct isochron_orch_node *node, *rcv_node, *tmp;
+	struct isochron_sweep *sweep = &prog->sweep;
+	struct isochron_orch_node *node;
 	struct isochron_send *send;
-	int rc;
+	int i, rc;
 
-	LIST_FOREACH_SAFE(node, &prog->nodes, list, tmp) {
+	prog_sweep_select_point(sweep, point);
+
+	LIST_FOREACH(node, &prog->nodes, list) {
 		if (node->role != ISOCHRON_ROLE_SEND)
 			continue;
 
-		send = node->send;
-
-		if (!send->stats_srv.family)
+		for (i = 0; i < sweep->num_keys; i++)
+			if (sweep->keys[i].node == node)
+				break;
+		if (i == sweep->num_keys)
 			continue;
 
-		rcv_node = calloc(sizeof(*rcv_node), 1);
-		if (!rcv_node)
-			return -ENOMEM;
-
-		rc = snprintf(rcv_node->name, BUFSIZ, "%s's receiver",
-			      node->name);
-		if (rc >= BUFSIZ) {
+		rc = prog_sweep_parse_send(prog, node, &send);
+		if (!rc) {
+			rc = prog_sweep_check_send(node, send);
+			free(send);
+		}
+		if (rc) {
 			fprintf(stderr,
-				"Truncation while parsing node \"%s\"'s name\n",
-				node->name);
-			free(rcv_node);
-			return -EINVAL;
+				"Invalid parameters for node %s at sweep point %zu/%zu\n",
+				node->name, point + 1, sweep->num_points);
+			return rc;
 		}
-
-		rcv_node->addr = send->stats_srv;
-		rcv_node->port = send->stats_port;
-		rcv_node->collect_sync_stats = !send->omit_sync &&
-					       !send->omit_remote_sync;
-		rcv_node->sync_threshold = send->sync_threshold;
-		rcv_node->role = ISOCHRON_ROLE_RCV;
-		rcv_node->sender = node;
-		LIST_INSERT_HEAD(&prog->nodes, rcv_node, list);
 	}
 
 	return 0;
 }
 
-static void prog_close_node_connection(struct isochron_orch_node *node)
+/* Resolve the nodes of the sweep keys, count the points and check ahead
+ * of time that the parameters of every point are accepted, so that a bad
+ * point fails before any test runs
+ */
+static int prog_validate_sweep(struct isochron_orch *prog)
 {
-	if (!node->mgmt_sock)
-		return;
+	struct isochron_sweep *sweep = &prog->sweep;
+	struct isochron_orch_node *node;
+	struct isochron_sweep_key *k;
+	size_t point;
+	int i, rc;
 
-	sk_close(node->mgmt_sock);
-}
+	sweep->num_points = 1;
 
-static int prog_open_node_connections(struct isochron_orch *prog)
-{
-	struct isochron_orch_node *node;
-	int rc;
+	for (i = 0; i < sweep->num_keys; i++) {
+		k = &sweep->keys[i];
 
-	LIST_FOREACH(node, &prog->nodes, list) {
-		rc = prog_open_node_connection(node);
+		LIST_FOREACH(node, &prog->nodes, list)
+			if (strcmp(node->name, k->node_name) == 0)
+				break;
+
+		if (!node) {
+			fprintf(stderr, "Sweep key %s.%s refers to unknown node %s\n",
+				k->node_name, k->option, k->node_name);
+			return -EINVAL;
+		}
+
+		k->node = node;
+
+		if (sweep->mode == ISOCHRON_SWEEP_ZIP) {
+			if (i && k->num_values != sweep->num_points) {
+				fprintf(stderr,
+					"Sweep key %s.%s has %zu values, expected %zu for zip mode\n",
+					k->node_name, k->option, k->num_values,
+					sweep->num_points);
+				return -EINVAL;
+			}
+
+			sweep->num_points = k->num_values;
+		} else {
+			sweep->num_points *= k->num_values;
+			if (sweep->num_points > ISOCHRON_SWEEP_MAX_POINTS) {
+				fprintf(stderr,
+					"Sweep has more than %d points\n",
+					ISOCHRON_SWEEP_MAX_POINTS);
+				return -ERANGE;
+			}
+		}
+	}
+
+	for (point = 0; point < sweep->num_points; point++) {
+		rc = prog_validate_sweep_point(prog, point);
 		if (rc)
 			return rc;
 	}
@@ -1172,124 +2015,135 @@ static int prog_open_node_connections(struct isochron_orch *prog)
 	return 0;
 }
 
-static void prog_teardown(struct isochron_orch *prog)
-{
-	struct isochron_orch_node *node, *tmp;
-
-	LIST_FOREACH_SAFE(node, &prog->nodes, list, tmp) {
-		prog_close_node_connection(node);
-		if (node->role == ISOCHRON_ROLE_SEND)
-			free(node->send);
-		LIST_REMOVE(node, list);
-		free(node);
-	}
-}
-
-static int prog_exec_node_argparser(struct isochron_orch_node *node,
-				    int argc, char **argv,
-				    const char *value)
+static void prog_sweep_print_point(const struct isochron_sweep *sweep,
+				   size_t point)
 {
-	const struct isochron_prog *prog;
-	int rc;
+	const struct isochron_sweep_key *k;
+	int i;
 
-	rc = isochron_parse_args(&argc, &argv, &prog);
-	if (rc)
-		return rc;
+	printf("Sweep point %zu/%zu:", point + 1, sweep->num_points);
 
-	if (prog->main == isochron_send_main) {
-		rc = isochron_send_parse_args(argc, argv, node->send);
-	} else {
-		fprintf(stderr,
-			"Unsupported exec line \"%s\" for node %s\n",
-			value, node->name);
-		rc = -EINVAL;
+	for (i = 0; i < sweep->num_keys; i++) {
+		k = &sweep->keys[i];
+		printf(" %s.%s=%s", k->node_name, k->option,
+		       k->values[k->index]);
 	}
 
-	return rc;
+	printf("\n");
 }
 
-static int prog_parse_exec_line(struct isochron_orch_node *node,
-				const char *value)
+/* Replace the parameters of the senders affected by the sweep with those
+ * of the given point
+ */
+static int prog_apply_sweep_point(struct isochron_orch *prog, size_t point)
 {
-	size_t i, len = strlen(value);
-	bool curr_char_is_quote;
-	int argc = 0, k = 0;
-	char last_quote = 0;
-	char prev = 0;
-	char **argv;
-	int rc;
+	struct isochron_sweep *sweep = &prog->sweep;
+	struct isochron_orch_node *node;
+	struct isochron_send *send;
+	int i, rc;
 
-	for (i = 0; i < len; i++) {
-		curr_char_is_quote = (value[i] == '\'' || value[i] == '"');
+	prog_sweep_select_point(sweep, point);
+	prog_sweep_print_point(sweep, point);
 
-		if (last_quote && value[i] == last_quote)
-			/* unquote */
-			last_quote = 0;
-		else if (curr_char_is_quote)
-			/* quote and remember starting character */
-			last_quote = value[i];
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
 
-		if (curr_char_is_quote || (!last_quote && isspace(value[i])))
-			node->exec[i] = 0;
-		else
-			node->exec[i] = value[i];
+		for (i = 0; i < sweep->num_keys; i++)
+			if (sweep->keys[i].node == node)
+				break;
+		if (i == sweep->num_keys)
+			continue;
 
-		if (node->exec[i] && !prev)
-			argc++;
+		rc = prog_sweep_parse_send(prog, node, &send);
+		if (rc)
+			return rc;
 
-		prev = node->exec[i];
+		rc = prog_sweep_check_send(node, send);
+		if (rc) {
+			free(send);
+			return rc;
+		}
+
+		/* Learned from the receiver, if not given */
+		if (is_zero_ether_addr(send->dest_mac))
+			ether_addr_copy(send->dest_mac, node->send->dest_mac);
+		send->append_output = true;
+
+		if (node->send != node->marshalled)
+			free(node->send);
+		node->send = send;
+		node->collect_sync_stats = !send->omit_sync;
+		node->sync_threshold = send->sync_threshold;
 	}
 
-	node->exec[len] = 0;
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_RCV)
+			continue;
 
-	argv = calloc(argc, sizeof(char *));
-	if (!argv) {
-		fprintf(stderr, "low memory\n");
-		return -ENOMEM;
+		send = node->sender->send;
+		node->collect_sync_stats = !send->omit_sync &&
+					   !send->omit_remote_sync;
+		node->sync_threshold = send->sync_threshold;
 	}
 
-	prev = 0;
+	return 0;
+}
 
-	for (i = 0; i < len; i++) {
-		if (node->exec[i] && !prev)
-			argv[k++] = &node->exec[i];
+/* The points of a sweep are saved as the sessions of a single container
+ * per sender, which starts out empty unless appending was requested
+ */
+static int prog_sweep_prepare_output(struct isochron_orch *prog)
+{
+	struct isochron_orch_node *node;
 
-		prev = node->exec[i];
-	}
+	LIST_FOREACH(node, &prog->nodes, list) {
+		if (node->role != ISOCHRON_ROLE_SEND)
+			continue;
 
-	rc = prog_exec_node_argparser(node, argc, argv, value);
+		if (node->send->append_output)
+			continue;
 
-	free(argv);
+		if (unlink(node->send->output_file) && errno != ENOENT) {
+			fprintf(stderr, "Failed to remove %s: %m\n",
+				node->send->output_file);
+			return -errno;
+		}
 
-	return rc;
+		node->send->append_output = true;
+	}
+
+	return 0;
 }
 
-static int prog_parse_key_value(struct isochron_orch_node *node,
-				const char *key, const char *value)
+/* Run the test for each point of the sweep, or just once if there is no
+ * sweep, keeping the connections to the nodes open in between
+ */
+static int prog_run_sweep(struct isochron_orch *prog)
 {
+	size_t point;
 	int rc;
 
-	if (strcmp(key, "host") == 0) {
-		rc = ip_addr_from_string(value, &node->addr);
-		if (rc) {
-			fprintf(stderr, "Invalid IP address \"%s\" for host %s\n",
-				value, node->name);
+	if (prog->sweep.num_keys) {
+		rc = prog_sweep_prepare_output(prog);
+		if (rc)
 			return rc;
+	}
+
+	for (point = 0; point < prog->sweep.num_points; point++) {
+		if (prog->sweep.num_keys) {
+			rc = prog_apply_sweep_point(prog, point);
+			if (rc)
+				return rc;
 		}
-	} else if (strcmp(key, "port") == 0) {
-		errno = 0;
-		node->port = strtoul(value, NULL, 0);
-		if (errno) {
-			fprintf(stderr, "Invalid port \"%s\" for host %s\n",
-				value, node->name);
-			return -errno;
-		}
-	} else if (strcmp(key, "exec") == 0) {
-		rc = prog_parse_exec_line(node, value);
+
+		rc = prog_marshall_data_to_nodes(prog);
+		if (rc)
+			return rc;
+
+		rc = prog_run_test(prog);
 		if (rc)
 			return rc;
-	} else {
-		fprintf(stderr, "Unrecognized key %s\n", key);
 	}
 
 	return 0;
@@ -1302,6 +2156,7 @@ static int prog_parse_input_file_linewise(struct isochron_orch *prog,
 	char *end, *equal, *key, *value;
 	char *line = strtok(buf, "\n");
 	struct isochron_send *send;
+	bool in_sweep = false;
 	size_t len;
 	int rc = 0;
 
@@ -1332,6 +2187,14 @@ static int prog_parse_input_file_linewise(struct isochron_orch *prog,
 				break;
 			}
 
+			if (strcmp(line, ISOCHRON_SWEEP_SECTION) == 0) {
+				curr_node = NULL;
+				in_sweep = true;
+				goto next;
+			}
+
+			in_sweep = false;
+
 			curr_node = calloc(sizeof(*curr_node), 1);
 			if (!curr_node) {
 				rc = -ENOMEM;
@@ -1352,7 +2215,7 @@ static int prog_parse_input_file_linewise(struct isochron_orch *prog,
 			goto next;
 		}
 
-		if (!curr_node) {
+		if (!curr_node && !in_sweep) {
 			fprintf(stderr, "Unexpected line \"%s\" belonging to no section\n",
 				buf);
 			rc = -EINVAL;
@@ -1372,7 +2235,10 @@ static int prog_parse_input_file_linewise(struct isochron_orch *prog,
 		key = string_trim_whitespaces(line);
 		value = string_trim_whitespaces(equal);
 
-		rc = prog_parse_key_value(curr_node, key, value);
+		if (in_sweep)
+			rc = prog_parse_sweep_key_value(prog, key, value);
+		else
+			rc = prog_parse_key_value(curr_node, key, value);
 		if (rc)
 			break;
 
@@ -1488,6 +2354,10 @@ int isochron_orchestrate_main(int argc, char *argv[])
 	if (rc)
 		goto out;
 
+	rc = prog_validate_sweep(&prog);
+	if (rc)
+		goto out;
+
 	rc = prog_init_receiver_nodes(&prog);
 	if (rc)
 		goto out;
@@ -1496,15 +2366,17 @@ int isochron_orchestrate_main(int argc, char *argv[])
 	if (rc)
 		goto out;
 
-	rc = prog_marshall_data_from_nodes(&prog);
-	if (rc)
+	prog.async = isochron_mgmt_async_create();
+	if (!prog.async) {
+		rc = -ENOMEM;
 		goto out;
+	}
 
-	rc = prog_marshall_data_to_nodes(&prog);
+	rc = prog_marshall_data_from_nodes(&prog);
 	if (rc)
 		goto out;
 
-	rc = prog_run_test(&prog);
+	rc = prog_run_sweep(&prog);
 
 out:
 	prog_teardown(&prog);
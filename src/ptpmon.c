@@ -12,6 +12,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include "endian.h"
 #include "ptpmon.h"
@@ -28,6 +29,15 @@
 
 #define UDS_FILEMODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP) /*0660*/
 
+#define NSEC_PER_SEC		1000000000LL
+
+/* ptp4l drops subscriptions which are not renewed within this many seconds.
+ * Keep it short so that an idle ptpmon stops receiving notifications soon.
+ */
+#define PTPMON_SUBSCRIPTION_DURATION	10
+/* How long a TIME_STATUS_NP notification is trusted in lieu of a query */
+#define PTPMON_TIME_STATUS_TIMEOUT	(2 * NSEC_PER_SEC)
+
 enum ptp_message_type {
 	PTP_MSGTYPE_SYNC	= 0x0,
 	PTP_MSGTYPE_DELAY_REQ	= 0x1,
@@ -125,6 +135,26 @@ struct ptpmon {
 	int fd;
 	__u16 sequence_id;
 	struct default_ds dds;
+	/* Cached view of ptp4l, maintained by event notifications while
+	 * subscribed. Timestamps are in CLOCK_MONOTONIC nanoseconds.
+	 */
+	bool subscribed;
+	__s64 subscription_expiry;
+	__s64 subscription_retry;
+	bool subscription_warned;
+	enum port_state *port_states;
+	int num_port_states;
+	__s64 master_offset;
+	__s64 time_status_ts;
+	struct clock_identity gm_identity;
+	__s64 gm_identity_ts;
+	bool parent_ds_notified;
+	/* ptp4l port which serves a network interface, see
+	 * ptpmon_query_port_state_by_name()
+	 */
+	char port_name[MAX_IFACE_LEN + 1];
+	struct port_identity port_name_portid;
+	bool port_name_valid;
 };
 
 typedef int ptpmon_tlv_cb_t(void *priv, struct ptp_tlv *tlv, const void *tlv_data);
@@ -356,6 +386,196 @@ static int ptpmon_recv(struct ptpmon *ptpmon, struct ptp_message *msg)
 	return len < 0 ? len : 0;
 }
 
+static __s64 ptpmon_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static void ptpmon_invalidate_cache(struct ptpmon *ptpmon)
+{
+	int i;
+
+	for (i = 0; i < ptpmon->num_port_states; i++)
+		ptpmon->port_states[i] = 0;
+
+	ptpmon->time_status_ts = 0;
+	ptpmon->gm_identity_ts = 0;
+	ptpmon->parent_ds_notified = false;
+}
+
+static void ptpmon_cache_port_state(struct ptpmon *ptpmon,
+				    const struct port_identity *portid,
+				    enum port_state port_state)
+{
+	int port_number = __be16_to_cpu(portid->port_number);
+	enum port_state *port_states;
+	int i;
+
+	if (!ptpmon->subscribed || !port_number)
+		return;
+
+	if (port_number > ptpmon->num_port_states) {
+		port_states = realloc(ptpmon->port_states,
+				      port_number * sizeof(*port_states));
+		if (!port_states)
+			return;
+
+		for (i = ptpmon->num_port_states; i < port_number; i++)
+			port_states[i] = 0;
+
+		ptpmon->port_states = port_states;
+		ptpmon->num_port_states = port_number;
+	}
+
+	ptpmon->port_states[port_number - 1] = port_state;
+}
+
+static void ptpmon_handle_notification(struct ptpmon *ptpmon,
+				       struct ptp_message *msg)
+{
+	struct ptp_tlv *tlv = ptp_management_suffix(msg);
+	const struct time_status_np *time_status_np;
+	const struct parent_data_set *parent_ds;
+	const struct port_ds *port_ds;
+	enum ptp_management_id mid;
+	size_t tlv_length;
+
+	if (!ptpmon->subscribed ||
+	    msg->len < sizeof(struct ptp_management_header) + sizeof(*tlv) ||
+	    ptp_message_type(msg) != PTP_MSGTYPE_MANAGEMENT ||
+	    ptp_management_action(msg) != RESPONSE ||
+	    __be16_to_cpu(tlv->tlv_type) != TLV_MANAGEMENT)
+		return;
+
+	mid = __be16_to_cpu(tlv->management_id);
+	tlv_length = __be16_to_cpu(tlv->length_field);
+	if (sizeof(struct ptp_management_header) + sizeof(*tlv) - 2 +
+	    tlv_length > msg->len)
+		return;
+
+	switch (mid) {
+	case MID_PORT_DATA_SET:
+		if (tlv_length < sizeof(*port_ds) + 2)
+			return;
+
+		port_ds = ptp_management_tlv_data(tlv);
+		ptpmon_cache_port_state(ptpmon, &port_ds->port_identity,
+					port_ds->port_state);
+		/* The clock might have stopped synchronizing, and the GM
+		 * reported through TIME_STATUS_NP might be stale now.
+		 */
+		ptpmon->time_status_ts = 0;
+		if (!ptpmon->parent_ds_notified)
+			ptpmon->gm_identity_ts = 0;
+		break;
+	case MID_TIME_STATUS_NP:
+		if (tlv_length < sizeof(*time_status_np) + 2)
+			return;
+
+		time_status_np = ptp_management_tlv_data(tlv);
+		ptpmon->master_offset = (__s64)__be64_to_cpu(time_status_np->master_offset);
+		ptpmon->time_status_ts = ptpmon_now();
+		if (!ptpmon->parent_ds_notified && time_status_np->gm_present) {
+			ptpmon->gm_identity = time_status_np->gm_identity;
+			ptpmon->gm_identity_ts = ptpmon->time_status_ts;
+		}
+		break;
+	case MID_PARENT_DATA_SET:
+		/* Only sent by ptp4l versions which notify every GM change */
+		if (tlv_length < sizeof(*parent_ds) + 2)
+			return;
+
+		parent_ds = ptp_management_tlv_data(tlv);
+		ptpmon->gm_identity = parent_ds->grandmaster_identity;
+		ptpmon->gm_identity_ts = ptpmon_now();
+		ptpmon->parent_ds_notified = true;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Consume the notifications which ptp4l sent since the last query */
+static void ptpmon_process_events(struct ptpmon *ptpmon)
+{
+	struct ptp_message msg;
+	int len;
+
+	while (1) {
+		len = recv(ptpmon->fd, msg.buf, PTP_MSGSIZE, MSG_DONTWAIT);
+		if (len < 0)
+			break;
+
+		msg.len = len;
+		ptpmon_handle_notification(ptpmon, &msg);
+	}
+}
+
+static bool ptp_message_is_reply(struct ptp_message *msg, __be16 sequence_id,
+				 enum ptp_management_id mid)
+{
+	struct ptp_header *header = ptp_message_header(msg);
+	struct ptp_tlv *tlv = ptp_management_suffix(msg);
+	struct management_error_status *mgt;
+
+	/* Let ptp_message_parse_reply() complain about malformed replies */
+	if (msg->len < sizeof(struct ptp_management_header) + sizeof(*tlv))
+		return true;
+
+	if (header->sequence_id != sequence_id)
+		return false;
+
+	switch (__be16_to_cpu(tlv->tlv_type)) {
+	case TLV_MANAGEMENT:
+		return __be16_to_cpu(tlv->management_id) == mid;
+	case TLV_MANAGEMENT_ERROR_STATUS:
+		if (msg->len < sizeof(struct ptp_management_header) + sizeof(*mgt))
+			return true;
+
+		mgt = (struct management_error_status *)tlv;
+		return __be16_to_cpu(mgt->id) == mid;
+	default:
+		return true;
+	}
+}
+
+static bool ptp_message_is_error(struct ptp_message *msg)
+{
+	struct ptp_tlv *tlv = ptp_management_suffix(msg);
+
+	return msg->len >= sizeof(struct ptp_management_header) + sizeof(*tlv) &&
+	       __be16_to_cpu(tlv->tlv_type) == TLV_MANAGEMENT_ERROR_STATUS;
+}
+
+/* Send a management request and wait for its reply. While subscribed,
+ * notifications may arrive in the meantime, and those update the cache.
+ */
+static int ptpmon_transact(struct ptpmon *ptpmon, struct ptp_message *msg,
+			   enum ptp_management_id mid)
+{
+	__be16 sequence_id = ptp_message_header(msg)->sequence_id;
+	int err;
+
+	err = ptpmon_send(ptpmon, msg);
+	if (err)
+		return err;
+
+	while (1) {
+		err = ptpmon_recv(ptpmon, msg);
+		if (err)
+			return err;
+
+		if (ptp_message_is_reply(msg, sequence_id, mid))
+			return 0;
+
+		ptpmon_handle_notification(ptpmon, msg);
+	}
+}
+
 static void ptpmon_message_init(struct ptpmon *ptpmon, struct ptp_message *msg,
 				enum management_action action,
 				const struct port_identity *target_port_identity)
@@ -475,7 +695,7 @@ static int ptp_management_message_for_each_tlv(struct ptp_message *msg,
 				return err;
 			break;
 		case TLV_MANAGEMENT_ERROR_STATUS:
-			return ptpmon_management_error(ptp_management_tlv_data(tlv));
+			return ptpmon_management_error((struct management_error_status *)tlv);
 		default:
 			printf("unknown TLV type %d\n", tlv_type);
 		}
@@ -544,11 +764,7 @@ int ptpmon_query_port_mid_extra(struct ptpmon *ptpmon,
 
 	ptp_management_message_update_extra_len(&msg, dest_len, extra_len);
 
-	err = ptpmon_send(ptpmon, &msg);
-	if (err)
-		return err;
-
-	err = ptpmon_recv(ptpmon, &msg);
+	err = ptpmon_transact(ptpmon, &msg, mid);
 	if (err)
 		return err;
 
@@ -585,11 +801,7 @@ int ptpmon_query_port_mid(struct ptpmon *ptpmon,
 	if (!ptp_message_add_management_tlv(&msg, mid, dest_len))
 		return -ERANGE;
 
-	err = ptpmon_send(ptpmon, &msg);
-	if (err)
-		return err;
-
-	err = ptpmon_recv(ptpmon, &msg);
+	err = ptpmon_transact(ptpmon, &msg, mid);
 	if (err)
 		return err;
 
@@ -602,6 +814,186 @@ int ptpmon_query_clock_mid(struct ptpmon *ptpmon, enum ptp_management_id mid,
 	return ptpmon_query_port_mid(ptpmon, &target_all_ports, mid, dest, dest_len);
 }
 
+static int ptpmon_subscribe(struct ptpmon *ptpmon)
+{
+	struct ptpmon_tlv_parse_priv parse = {
+		.mid = MID_SUBSCRIBE_EVENTS_NP,
+		.dest_len = sizeof(struct subscribe_events_np),
+	};
+	struct subscribe_events_np *sen;
+	struct ptp_message msg;
+	int err;
+
+	ptp_message_clear(&msg);
+
+	ptpmon_message_init(ptpmon, &msg, SET, &target_all_ports);
+
+	sen = ptp_message_add_management_tlv(&msg, MID_SUBSCRIBE_EVENTS_NP,
+					     sizeof(*sen));
+	if (!sen)
+		return -ERANGE;
+
+	sen->duration = __cpu_to_be16(PTPMON_SUBSCRIPTION_DURATION);
+	sen->bitmask[0] = (1 << NOTIFY_PORT_STATE) |
+			  (1 << NOTIFY_TIME_SYNC) |
+			  (1 << NOTIFY_PARENT_DATA_SET);
+
+	err = ptpmon_transact(ptpmon, &msg, MID_SUBSCRIBE_EVENTS_NP);
+	if (err)
+		return err;
+
+	/* Older ptp4l doesn't know about event subscriptions */
+	if (ptp_message_is_error(&msg))
+		return -EOPNOTSUPP;
+
+	parse.dest = sen;
+
+	return ptp_message_parse_reply(&msg, ptpmon_copy_data_set, &parse);
+}
+
+/* Process pending notifications, and keep the event subscription alive.
+ * Returns true if the cached view of ptp4l can be used.
+ */
+static bool ptpmon_refresh(struct ptpmon *ptpmon)
+{
+	__s64 now = ptpmon_now();
+	int err;
+
+	ptpmon_process_events(ptpmon);
+
+	if (ptpmon->subscribed && now >= ptpmon->subscription_expiry) {
+		/* Notifications might have been missed */
+		ptpmon->subscribed = false;
+		ptpmon_invalidate_cache(ptpmon);
+	}
+
+	if (!ptpmon->subscribed && now < ptpmon->subscription_retry)
+		return false;
+
+	if (ptpmon->subscribed && now < ptpmon->subscription_expiry -
+	    PTPMON_SUBSCRIPTION_DURATION * NSEC_PER_SEC / 2)
+		return true;
+
+	err = ptpmon_subscribe(ptpmon);
+	if (err) {
+		if (err == -EOPNOTSUPP && !ptpmon->subscription_warned) {
+			fprintf(stderr,
+				"ptp4l does not support event subscriptions, polling instead\n");
+			ptpmon->subscription_warned = true;
+		}
+
+		ptpmon->subscribed = false;
+		ptpmon->subscription_retry = now +
+			PTPMON_SUBSCRIPTION_DURATION * NSEC_PER_SEC;
+		ptpmon_invalidate_cache(ptpmon);
+		return false;
+	}
+
+	ptpmon->subscribed = true;
+	ptpmon->subscription_expiry = now +
+		PTPMON_SUBSCRIPTION_DURATION * NSEC_PER_SEC;
+
+	return true;
+}
+
+int ptpmon_get_master_offset(struct ptpmon *ptpmon, __s64 *master_offset)
+{
+	struct current_ds current_ds;
+	int err;
+
+	if (ptpmon_refresh(ptpmon) && ptpmon->time_status_ts &&
+	    ptpmon_now() - ptpmon->time_status_ts < PTPMON_TIME_STATUS_TIMEOUT) {
+		*master_offset = ptpmon->master_offset;
+		return 0;
+	}
+
+	err = ptpmon_query_clock_mid(ptpmon, MID_CURRENT_DATA_SET,
+				     &current_ds, sizeof(current_ds));
+	if (err)
+		return err;
+
+	*master_offset = (__s64)__be64_to_cpu(current_ds.offset_from_master) >> 16;
+
+	return 0;
+}
+
+int ptpmon_get_gm_identity(struct ptpmon *ptpmon,
+			   struct clock_identity *gm_identity)
+{
+	struct parent_data_set parent_ds;
+	int err;
+
+	if (ptpmon_refresh(ptpmon) && ptpmon->gm_identity_ts &&
+	    (ptpmon->parent_ds_notified ||
+	     ptpmon_now() - ptpmon->gm_identity_ts < PTPMON_TIME_STATUS_TIMEOUT)) {
+		*gm_identity = ptpmon->gm_identity;
+		return 0;
+	}
+
+	err = ptpmon_query_clock_mid(ptpmon, MID_PARENT_DATA_SET,
+				     &parent_ds, sizeof(parent_ds));
+	if (err)
+		return err;
+
+	*gm_identity = parent_ds.grandmaster_identity;
+
+	return 0;
+}
+
+int ptpmon_get_port_state(struct ptpmon *ptpmon,
+			  const struct port_identity *portid,
+			  enum port_state *port_state)
+{
+	int port_number = __be16_to_cpu(portid->port_number);
+	struct port_ds port_ds;
+	int err;
+
+	if (ptpmon_refresh(ptpmon) && port_number &&
+	    port_number <= ptpmon->num_port_states &&
+	    ptpmon->port_states[port_number - 1]) {
+		*port_state = ptpmon->port_states[port_number - 1];
+		return 0;
+	}
+
+	err = ptpmon_query_port_mid(ptpmon, portid, MID_PORT_DATA_SET,
+				    &port_ds, sizeof(port_ds));
+	if (err) {
+		ptpmon->port_name_valid = false;
+		return err;
+	}
+
+	/* Further changes will be notified */
+	ptpmon_cache_port_state(ptpmon, portid, port_ds.port_state);
+	*port_state = port_ds.port_state;
+
+	return 0;
+}
+
+bool ptpmon_lookup_port_name(struct ptpmon *ptpmon, const char *iface,
+			     struct port_identity *portid)
+{
+	if (!ptpmon->port_name_valid || strcmp(ptpmon->port_name, iface))
+		return false;
+
+	*portid = ptpmon->port_name_portid;
+
+	return true;
+}
+
+void ptpmon_cache_port_name(struct ptpmon *ptpmon, const char *iface,
+			    const struct port_identity *portid,
+			    enum port_state port_state)
+{
+	if (strlen(iface) > MAX_IFACE_LEN)
+		return;
+
+	strcpy(ptpmon->port_name, iface);
+	ptpmon->port_name_portid = *portid;
+	ptpmon->port_name_valid = true;
+
+	ptpmon_cache_port_state(ptpmon, portid, port_state);
+}
+
 int ptpmon_open(struct ptpmon *ptpmon)
 {
 	int fd;
@@ -655,5 +1047,6 @@ struct ptpmon *ptpmon_create(int domain_number, int transport_specific,
 
 void ptpmon_destroy(struct ptpmon *ptpmon)
 {
+	free(ptpmon->port_states);
 	free(ptpmon);
 }
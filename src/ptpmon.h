@@ -159,6 +159,38 @@ struct port_properties_np {
 	char			iface[0]; /* up to MAX_IFACE_LEN */
 } __attribute((packed));
 
+/* MID_TIME_STATUS_NP */
+struct scaled_ns {
+	__be16			nanoseconds_msb;
+	__be64			nanoseconds_lsb;
+	__be16			fractional_nanoseconds;
+} __attribute((packed));
+
+struct time_status_np {
+	__be64			master_offset; /* nanoseconds */
+	__be64			ingress_time; /* nanoseconds */
+	__be32			cumulative_scaled_rate_offset;
+	__be32			scaled_last_gm_phase_change;
+	__be16			gm_time_base_indicator;
+	struct scaled_ns	last_gm_phase_change;
+	__be32			gm_present;
+	struct clock_identity	gm_identity;
+} __attribute((packed));
+
+/* MID_SUBSCRIBE_EVENTS_NP */
+#define EVENT_BITMASK_CNT				64
+
+enum ptp_notification {
+	NOTIFY_PORT_STATE,
+	NOTIFY_TIME_SYNC,
+	NOTIFY_PARENT_DATA_SET,
+};
+
+struct subscribe_events_np {
+	__be16			duration; /* seconds */
+	__u8			bitmask[EVENT_BITMASK_CNT];
+} __attribute((packed));
+
 /** Defines the state of a port. */
 enum port_state {
 	PS_INITIALIZING = 1,
@@ -241,5 +273,16 @@ int ptpmon_query_clock_mid_extra(struct ptpmon *ptpmon,
 				 enum ptp_management_id mid,
 				 void *dest, size_t dest_len,
 				 size_t extra_len);
+int ptpmon_get_master_offset(struct ptpmon *ptpmon, __s64 *master_offset);
+int ptpmon_get_gm_identity(struct ptpmon *ptpmon,
+			   struct clock_identity *gm_identity);
+int ptpmon_get_port_state(struct ptpmon *ptpmon,
+			  const struct port_identity *portid,
+			  enum port_state *port_state);
+bool ptpmon_lookup_port_name(struct ptpmon *ptpmon, const char *iface,
+			     struct port_identity *portid);
+void ptpmon_cache_port_name(struct ptpmon *ptpmon, const char *iface,
+			    const struct port_identity *portid,
+			    enum port_state port_state);
 
 #endif
@@ -35,6 +35,7 @@ struct isochron_rcv {
 	unsigned int if_index;
 	__u8 rcvbuf[BUF_SIZ];
 	struct isochron_log log;
+	struct isochron_log_subscription log_sub;
 	clockid_t clkid;
 	struct ptpmon *ptpmon;
 	struct sysmon *sysmon;
@@ -42,6 +43,8 @@ struct isochron_rcv {
 	struct isochron_mgmt_handler *mgmt_handler;
 	struct sk *mgmt_listen_sock;
 	struct sk *mgmt_sock;
+	struct isochron_event_sampler *sampler;
+	struct isochron_notifier *notifier;
 	struct sk *l4_sock;
 	struct sk *l2_sock;
 	int l2_data_fd;
@@ -56,6 +59,8 @@ struct isochron_rcv {
 	struct ip_address stats_addr;
 	unsigned long iterations;
 	unsigned long received_pkt_count;
+	__u32 highest_seqid;
+	__u32 log_chunk_horizon;
 	bool sched_fifo;
 	bool sched_rr;
 	long sched_priority;
@@ -73,7 +78,7 @@ static int prog_rearm_data_timeout_fd(struct isochron_rcv *prog)
 {
 	struct itimerspec timeout = {
 		.it_value = {
-			.tv_sec = 5,
+			.tv_sec = ISOCHRON_DATA_TIMEOUT,
 			.tv_nsec = 0,
 		},
 		.it_interval = {
@@ -114,6 +119,7 @@ static int prog_forward_isochron_log(struct isochron_rcv *prog)
 
 	isochron_log_xmit(&prog->log, prog->mgmt_sock);
 	isochron_log_teardown(&prog->log);
+	prog->log_sub.next = 0;
 	return isochron_log_init(&prog->log, prog->iterations *
 				 sizeof(struct isochron_rcv_pkt_data));
 }
@@ -133,6 +139,8 @@ static int app_loop(struct isochron_rcv *prog, __u8 *rcvbuf, size_t len,
 	if (rc)
 		return rc;
 
+	prog->data_fd_timed_out = false;
+
 	now = timespec_to_ns(&now_ts);
 	rcv_pkt.arrival = __cpu_to_be64(now);
 	if (l2) {
@@ -176,6 +184,8 @@ static int app_loop(struct isochron_rcv *prog, __u8 *rcvbuf, size_t len,
 		return rc;
 
 	prog->received_pkt_count++;
+	if (prog->highest_seqid < seqid)
+		prog->highest_seqid = seqid;
 
 	/* Expedite the log transmission if we're late */
 	if (prog->client_waiting_for_log && prog_received_all_packets(prog))
@@ -373,12 +383,15 @@ static int prog_data_fd_timeout(struct isochron_rcv *prog)
 static void prog_close_client_stats_session(struct isochron_rcv *prog)
 {
 	prog_disarm_data_timeout_fd(prog);
+	isochron_notifier_destroy(prog->notifier);
 	sk_close(prog->mgmt_sock);
+	isochron_mgmt_handler_reset(prog->mgmt_handler);
 	prog->have_client = false;
 	prog->data_fd_timed_out = false;
 	prog->client_waiting_for_log = false;
 	prog->received_pkt_count = 0;
 	prog->iterations = 0;
+	prog->log_sub.chunk_size = 0;
 }
 
 static int prog_client_connect_event(struct isochron_rcv *prog)
@@ -389,11 +402,37 @@ static int prog_client_connect_event(struct isochron_rcv *prog)
 	if (rc)
 		return rc;
 
+	prog->notifier = isochron_notifier_create(prog->sampler,
+						  prog->mgmt_sock);
+	if (!prog->notifier) {
+		sk_close(prog->mgmt_sock);
+		return -ENOMEM;
+	}
+
 	prog->have_client = true;
 
 	return 0;
 }
 
+static void prog_notifier_event(struct isochron_rcv *prog)
+{
+	struct isochron_node_status status = {
+		.ptpmon = prog->ptpmon,
+		.sysmon = prog->sysmon,
+		.if_name = prog->if_name,
+		.rtnl = prog->rtnl,
+	};
+
+	/* A subscriber which went away is noticed on its socket */
+	if (isochron_event_sampler_event(prog->sampler, &status))
+		return;
+
+	if (status.have_utc_offset) {
+		isochron_fixup_kernel_utc_offset(status.utc_offset);
+		prog->utc_tai_offset = status.utc_offset;
+	}
+}
+
 static int prog_get_packet_log(void *priv, char *extack)
 {
 	struct isochron_rcv *prog = priv;
@@ -408,6 +447,60 @@ static int prog_get_packet_log(void *priv, char *extack)
 	return prog_forward_isochron_log(prog);
 }
 
+/* Start a new collection of the log, forgetting about any previous test */
+static int prog_update_log_subscribe(void *priv, void *ptr, char *extack)
+{
+	struct isochron_log_subscribe *sub = ptr;
+	struct isochron_rcv *prog = priv;
+	int rc;
+
+	prog->log_sub.chunk_size = __be32_to_cpu(sub->chunk_size);
+	prog->log_sub.next = 0;
+	prog->log_chunk_horizon = 0;
+	prog->highest_seqid = 0;
+	prog->received_pkt_count = 0;
+	prog->data_fd_timed_out = false;
+	memset(prog->log.buf, 0, prog->log.size);
+
+	rc = prog_rearm_data_timeout_fd(prog);
+	if (rc) {
+		mgmt_extack(extack, "Could not arm timeout timer");
+		return rc;
+	}
+
+	return 0;
+}
+
+/* A packet is considered final once the data timeout expired, or once a
+ * chunk request has passed since a higher sequence number was received.
+ * The latter gives reordered packets a grace period of one polling
+ * interval of the collector.
+ */
+static int prog_forward_log_chunk(void *priv, char *extack)
+{
+	struct isochron_rcv *prog = priv;
+	__u32 horizon;
+
+	if (prog_received_all_packets(prog) ||
+	    (prog->data_fd_timed_out && prog->received_pkt_count))
+		horizon = prog->iterations;
+	else
+		horizon = prog->log_chunk_horizon;
+
+	prog->log_chunk_horizon = prog->highest_seqid;
+
+	return isochron_forward_log_chunk(prog->mgmt_sock, &prog->log,
+					  sizeof(struct isochron_rcv_pkt_data),
+					  &prog->log_sub, horizon, extack);
+}
+
+static int prog_update_event_subscribe(void *priv, void *ptr, char *extack)
+{
+	struct isochron_rcv *prog = priv;
+
+	return isochron_notifier_subscribe(prog->notifier, ptr, extack);
+}
+
 static int prog_forward_sysmon_offset(void *priv, char *extack)
 {
 	struct isochron_rcv *prog = priv;
@@ -512,6 +605,9 @@ static int prog_set_packet_count(void *priv, void *ptr, char *extack)
 	}
 
 	prog->iterations = iterations;
+	prog->log_sub.next = 0;
+	prog->log_chunk_horizon = 0;
+	prog->highest_seqid = 0;
 
 	/* Clock is ticking! */
 	rc = prog_rearm_data_timeout_fd(prog);
@@ -577,6 +673,13 @@ static const struct isochron_mgmt_ops rcv_mgmt_ops[__ISOCHRON_MID_MAX] = {
 	[ISOCHRON_MID_LOG] = {
 		.get = prog_get_packet_log,
 	},
+	[ISOCHRON_MID_LOG_SUBSCRIBE] = {
+		.set = prog_update_log_subscribe,
+		.struct_size = sizeof(struct isochron_log_subscribe),
+	},
+	[ISOCHRON_MID_LOG_CHUNK] = {
+		.get = prog_forward_log_chunk,
+	},
 	[ISOCHRON_MID_SYSMON_OFFSET] = {
 		.get = prog_forward_sysmon_offset,
 	},
@@ -601,11 +704,16 @@ static const struct isochron_mgmt_ops rcv_mgmt_ops[__ISOCHRON_MID_MAX] = {
 	[ISOCHRON_MID_CURRENT_CLOCK_TAI] = {
 		.get = prog_forward_current_clock_tai,
 	},
+	[ISOCHRON_MID_EVENT_SUBSCRIBE] = {
+		.set = prog_update_event_subscribe,
+		.struct_size = sizeof(struct isochron_event_subscribe),
+	},
 };
 
 enum pollfd_type {
 	PFD_MGMT,
 	PFD_DATA_TIMEOUT,
+	PFD_NOTIFIER,
 	PFD_DATA1,
 	PFD_DATA2,
 	__PFD_MAX,
@@ -619,10 +727,13 @@ static void prog_fill_dynamic_pfds(struct isochron_rcv *prog,
 	*l2_pfd = -1;
 	*l4_pfd = -1;
 
-	if (prog->have_client)
+	if (prog->have_client) {
 		pfd[PFD_MGMT].fd = sk_fd(prog->mgmt_sock);
-	else
+		pfd[PFD_NOTIFIER].fd = isochron_event_sampler_fd(prog->sampler);
+	} else {
 		pfd[PFD_MGMT].fd = sk_fd(prog->mgmt_listen_sock);
+		pfd[PFD_NOTIFIER].fd = -1;
+	}
 
 	if (prog->l2) {
 		*l2_pfd = *pfd_num;
@@ -646,6 +757,10 @@ static int server_loop(struct isochron_rcv *prog)
 			.fd = prog->data_timeout_fd,
 			.events = POLLIN | POLLERR | POLLPRI,
 		},
+		[PFD_NOTIFIER] = {
+			/* .fd to be filled in dynamically */
+			.events = POLLIN | POLLERR | POLLPRI,
+		},
 		[PFD_DATA1] = {
 			/* .fd to be filled in dynamically */
 			.events = POLLIN | POLLERR | POLLPRI,
@@ -723,6 +838,10 @@ static int server_loop(struct isochron_rcv *prog)
 			}
 		}
 
+		if (prog->have_client &&
+		    pfd[PFD_NOTIFIER].revents & (POLLIN | POLLERR | POLLPRI))
+			prog_notifier_event(prog);
+
 		if (pfd[PFD_DATA_TIMEOUT].revents & (POLLIN | POLLERR | POLLPRI)) {
 			__u64 expiry_count;
 
@@ -817,17 +936,30 @@ static int prog_init_mgmt_listen_sock(struct isochron_rcv *prog)
 	if (!prog->mgmt_handler)
 		return -ENOMEM;
 
+	prog->sampler = isochron_event_sampler_create();
+	if (!prog->sampler) {
+		rc = -ENOMEM;
+		goto err_sampler;
+	}
+
 	rc = sk_listen_tcp(&prog->stats_addr, prog->stats_port, 1,
 			   &prog->mgmt_listen_sock);
 	if (rc)
-		isochron_mgmt_handler_destroy(prog->mgmt_handler);
+		goto err_listen;
 
+	return 0;
+
+err_listen:
+	isochron_event_sampler_destroy(prog->sampler);
+err_sampler:
+	isochron_mgmt_handler_destroy(prog->mgmt_handler);
 	return rc;
 }
 
 static void prog_teardown_mgmt_listen_sock(struct isochron_rcv *prog)
 {
 	sk_close(prog->mgmt_listen_sock);
+	isochron_event_sampler_destroy(prog->sampler);
 	isochron_mgmt_handler_destroy(prog->mgmt_handler);
 }
 
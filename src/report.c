@@ -1,17 +1,50 @@
 // SPDX-License-Identifier: GPL-2.0
 /* Copyright 2021 NXP */
 #include <errno.h>
+#include <limits.h>
 #include <linux/limits.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "argparser.h"
 #include "common.h"
 #include "isochron.h"
 #include "log.h"
 
+#define ISOCHRON_REPORT_MAX_FILTERS		16
+#define ISOCHRON_REPORT_MAX_PERCENTILES		16
+#define ISOCHRON_REPORT_DEFAULT_NUM_PERIODS	10
+#define ISOCHRON_REPORT_MAX_NUM_PERIODS		1024
+#define ISOCHRON_REPORT_DEFAULT_FOLLOW_INTERVAL	NSEC_PER_SEC
+#define ISOCHRON_REPORT_DEFAULT_NUM_OUTLIERS	10
+#define ISOCHRON_REPORT_MAX_NUM_OUTLIERS	10000
+#define ISOCHRON_REPORT_DEFAULT_OUTLIER_CONTEXT	2
+#define ISOCHRON_REPORT_MAX_OUTLIER_CONTEXT	1000
+
+enum isochron_session_param_type {
+	SESSION_PARAM_LONG,
+	SESSION_PARAM_TIME,
+	SESSION_PARAM_BOOL,
+};
+
+struct isochron_session_param {
+	const char *name;
+	enum isochron_session_param_type type;
+	size_t offset;
+};
+
+struct isochron_session_filter {
+	const struct isochron_session_param *param;
+	__s64 value;
+};
+
 struct isochron_report {
 	struct isochron_log send_log;
 	struct isochron_log rcv_log;
+	struct isochron_log sync_log;
+	struct isochron_log annotation_log;
 	long packet_count;
 	long frame_size;
 	bool omit_sync;
@@ -29,9 +62,400 @@ struct isochron_report {
 	unsigned long stop;
 	char input_file[PATH_MAX];
 	char printf_fmt[ISOCHRON_LOG_PRINTF_BUF_SIZE];
-	char printf_args[ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS];
+	char printf_args[ISOCHRON_LOG_PRINTF_BUF_SIZE];
+	char session_filter_str[BUFSIZ];
+	struct isochron_session_filter filters[ISOCHRON_REPORT_MAX_FILTERS];
+	int num_filters;
+	long session;
+	bool list_sessions;
+	char percentiles_str[BUFSIZ];
+	double percentiles[ISOCHRON_REPORT_MAX_PERCENTILES];
+	int num_percentiles;
+	bool approximate;
+	char histogram_file[PATH_MAX];
+	char export_format_str[BUFSIZ];
+	enum isochron_export_format export_format;
+	char export_path[PATH_MAX];
+	char export_args[ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS];
+	long num_threads;
+	unsigned long window_packets;
+	__s64 window_time;
+	char window_thresholds_str[BUFSIZ];
+	/* LLONG_MAX for metrics without a threshold */
+	__s64 window_thresholds[__ISOCHRON_METRIC_MAX];
+	bool have_window_thresholds;
+	char periodicity_str[BUFSIZ];
+	char metrics_str[BUFSIZ];
+	int periodicity_metric;
+	long num_periods;
+	bool follow;
+	__s64 follow_interval;
+	char outliers_expr[BUFSIZ];
+	long num_outliers;
+	long outlier_context;
+	bool sync_correct;
+	__s64 sync_excursion;
+	bool exclude_sync_loss;
 };
 
+static const struct isochron_session_param session_params[] = {
+	{ "num-frames", SESSION_PARAM_LONG,
+	  offsetof(struct isochron_report, packet_count) },
+	{ "frame-size", SESSION_PARAM_LONG,
+	  offsetof(struct isochron_report, frame_size) },
+	{ "base-time", SESSION_PARAM_TIME,
+	  offsetof(struct isochron_report, base_time) },
+	{ "advance-time", SESSION_PARAM_TIME,
+	  offsetof(struct isochron_report, advance_time) },
+	{ "shift-time", SESSION_PARAM_TIME,
+	  offsetof(struct isochron_report, shift_time) },
+	{ "cycle-time", SESSION_PARAM_TIME,
+	  offsetof(struct isochron_report, cycle_time) },
+	{ "window-size", SESSION_PARAM_TIME,
+	  offsetof(struct isochron_report, window_size) },
+	{ "omit-sync", SESSION_PARAM_BOOL,
+	  offsetof(struct isochron_report, omit_sync) },
+	{ "ts", SESSION_PARAM_BOOL,
+	  offsetof(struct isochron_report, do_ts) },
+	{ "taprio", SESSION_PARAM_BOOL,
+	  offsetof(struct isochron_report, taprio) },
+	{ "txtime", SESSION_PARAM_BOOL,
+	  offsetof(struct isochron_report, txtime) },
+	{ "deadline", SESSION_PARAM_BOOL,
+	  offsetof(struct isochron_report, deadline) },
+};
+
+static __s64 prog_session_param_value(const struct isochron_report *prog,
+				      const struct isochron_session_param *param)
+{
+	const char *ptr = (const char *)prog + param->offset;
+
+	switch (param->type) {
+	case SESSION_PARAM_LONG:
+		return *(const long *)ptr;
+	case SESSION_PARAM_TIME:
+		return *(const __s64 *)ptr;
+	case SESSION_PARAM_BOOL:
+		return *(const bool *)ptr;
+	}
+
+	return 0;
+}
+
+/* The session filter is a comma-separated list of key=value pairs, all of
+ * which must match the parameters saved in the session header.
+ */
+static int prog_parse_session_filter(struct isochron_report *prog)
+{
+	char *str = prog->session_filter_str;
+	char *saveptr, *tok;
+	size_t i;
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		struct isochron_session_filter *filter;
+		char *value, *endptr;
+
+		if (prog->num_filters == ISOCHRON_REPORT_MAX_FILTERS) {
+			fprintf(stderr, "Too many session filters\n");
+			return -EINVAL;
+		}
+
+		value = strchr(tok, '=');
+		if (!value) {
+			fprintf(stderr, "Session filter \"%s\" is not of the form key=value\n",
+				tok);
+			return -EINVAL;
+		}
+
+		*value++ = 0;
+
+		filter = &prog->filters[prog->num_filters];
+		filter->param = NULL;
+
+		for (i = 0; i < ARRAY_SIZE(session_params); i++) {
+			if (!strcmp(tok, session_params[i].name)) {
+				filter->param = &session_params[i];
+				break;
+			}
+		}
+
+		if (!filter->param) {
+			fprintf(stderr, "Unknown session parameter \"%s\"\n",
+				tok);
+			return -EINVAL;
+		}
+
+		errno = 0;
+		filter->value = strtoll(value, &endptr, 0);
+		if (errno || !strlen(value) || *endptr) {
+			fprintf(stderr, "Invalid value \"%s\" for session parameter %s\n",
+				value, tok);
+			return -EINVAL;
+		}
+
+		prog->num_filters++;
+	}
+
+	return 0;
+}
+
+static int prog_cmp_percentiles(const void *a, const void *b)
+{
+	double pa = *(const double *)a, pb = *(const double *)b;
+
+	return (pa > pb) - (pa < pb);
+}
+
+static int prog_parse_percentiles(struct isochron_report *prog)
+{
+	char *saveptr, *tok, *endptr;
+	double p;
+
+	for (tok = strtok_r(prog->percentiles_str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (prog->num_percentiles == ISOCHRON_REPORT_MAX_PERCENTILES) {
+			fprintf(stderr, "Too many percentiles, maximum is %d\n",
+				ISOCHRON_REPORT_MAX_PERCENTILES);
+			return -EINVAL;
+		}
+
+		errno = 0;
+		p = strtod(tok, &endptr);
+		if (errno || endptr == tok || *endptr || p <= 0 || p > 100) {
+			fprintf(stderr, "Invalid percentile \"%s\"\n", tok);
+			return -EINVAL;
+		}
+
+		prog->percentiles[prog->num_percentiles++] = p;
+	}
+
+	qsort(prog->percentiles, prog->num_percentiles, sizeof(double),
+	      prog_cmp_percentiles);
+
+	return 0;
+}
+
+static bool prog_session_matches(const struct isochron_report *prog)
+{
+	int i;
+
+	for (i = 0; i < prog->num_filters; i++) {
+		const struct isochron_session_filter *filter = &prog->filters[i];
+
+		if (prog_session_param_value(prog, filter->param) != filter->value)
+			return false;
+	}
+
+	return true;
+}
+
+static void prog_print_session(const struct isochron_report *prog,
+			       long session)
+{
+	size_t i;
+
+	printf("Session %ld:", session);
+
+	for (i = 0; i < ARRAY_SIZE(session_params); i++)
+		printf(" %s=%lld", session_params[i].name,
+		       prog_session_param_value(prog, &session_params[i]));
+
+	printf("\n");
+}
+
+static int prog_parse_window(struct isochron_report *prog)
+{
+	char *saveptr, *tok, *value, *endptr;
+	int i, metric;
+
+	for (i = 0; i < __ISOCHRON_METRIC_MAX; i++)
+		prog->window_thresholds[i] = LLONG_MAX;
+
+	if (prog->window_packets && prog->window_time) {
+		fprintf(stderr,
+			"--window-packets and --window-time are mutually exclusive\n");
+		return -EINVAL;
+	}
+
+	if (prog->window_time < 0) {
+		fprintf(stderr, "Window time must be positive\n");
+		return -EINVAL;
+	}
+
+	if (!strlen(prog->window_thresholds_str))
+		return 0;
+
+	if (!prog->window_packets && !prog->window_time) {
+		fprintf(stderr,
+			"--window-thresholds requires --window-packets or --window-time\n");
+		return -EINVAL;
+	}
+
+	for (tok = strtok_r(prog->window_thresholds_str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		value = strchr(tok, '=');
+		if (!value) {
+			fprintf(stderr, "Window threshold \"%s\" is not of the form metric=value\n",
+				tok);
+			return -EINVAL;
+		}
+
+		*value++ = 0;
+
+		metric = isochron_metric_from_key(tok);
+		if (metric < 0) {
+			fprintf(stderr, "Unknown metric \"%s\"\n", tok);
+			return -EINVAL;
+		}
+
+		errno = 0;
+		prog->window_thresholds[metric] = strtoll(value, &endptr, 0);
+		if (errno || !strlen(value) || *endptr) {
+			fprintf(stderr, "Invalid threshold \"%s\" for metric %s\n",
+				value, tok);
+			return -EINVAL;
+		}
+	}
+
+	prog->have_window_thresholds = true;
+
+	return 0;
+}
+
+static int prog_parse_periodicity(struct isochron_report *prog)
+{
+	if (!strlen(prog->periodicity_str)) {
+		if (prog->num_periods) {
+			fprintf(stderr, "--num-periods requires --periodicity\n");
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	prog->periodicity_metric = isochron_metric_from_key(prog->periodicity_str);
+	if (prog->periodicity_metric < 0) {
+		fprintf(stderr, "Unknown metric \"%s\"\n",
+			prog->periodicity_str);
+		return -EINVAL;
+	}
+
+	if (!prog->num_periods)
+		prog->num_periods = ISOCHRON_REPORT_DEFAULT_NUM_PERIODS;
+
+	if (prog->num_periods < 1 ||
+	    prog->num_periods > ISOCHRON_REPORT_MAX_NUM_PERIODS) {
+		fprintf(stderr, "Number of periods must be between 1 and %d\n",
+			ISOCHRON_REPORT_MAX_NUM_PERIODS);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int prog_parse_outliers(struct isochron_report *prog)
+{
+	if (!strlen(prog->outliers_expr)) {
+		if (prog->num_outliers || prog->outlier_context >= 0) {
+			fprintf(stderr,
+				"--num-outliers and --outlier-context require --outliers\n");
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	if (!prog->num_outliers)
+		prog->num_outliers = ISOCHRON_REPORT_DEFAULT_NUM_OUTLIERS;
+
+	if (prog->num_outliers < 1 ||
+	    prog->num_outliers > ISOCHRON_REPORT_MAX_NUM_OUTLIERS) {
+		fprintf(stderr, "Number of outliers must be between 1 and %d\n",
+			ISOCHRON_REPORT_MAX_NUM_OUTLIERS);
+		return -EINVAL;
+	}
+
+	if (prog->outlier_context < 0)
+		prog->outlier_context = ISOCHRON_REPORT_DEFAULT_OUTLIER_CONTEXT;
+
+	if (prog->outlier_context > ISOCHRON_REPORT_MAX_OUTLIER_CONTEXT) {
+		fprintf(stderr, "Outlier context must be at most %d packets\n",
+			ISOCHRON_REPORT_MAX_OUTLIER_CONTEXT);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int prog_parse_follow(struct isochron_report *prog)
+{
+	if (!prog->follow) {
+		if (prog->follow_interval) {
+			fprintf(stderr, "--follow-interval requires --follow\n");
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	if (!prog->follow_interval)
+		prog->follow_interval = ISOCHRON_REPORT_DEFAULT_FOLLOW_INTERVAL;
+
+	if (prog->follow_interval < 0) {
+		fprintf(stderr, "Follow interval must be positive\n");
+		return -EINVAL;
+	}
+
+	if (!prog->summary && !prog->window_packets && !prog->window_time) {
+		fprintf(stderr,
+			"--follow requires --summary, --window-packets or --window-time\n");
+		return -EINVAL;
+	}
+
+	if (strlen(prog->printf_fmt) || strlen(prog->export_path) ||
+	    strlen(prog->periodicity_str) || strlen(prog->outliers_expr) ||
+	    strlen(prog->percentiles_str) ||
+	    strlen(prog->histogram_file) || strlen(prog->metrics_str) ||
+	    strlen(prog->session_filter_str) || prog->list_sessions ||
+	    prog->session >= 0 || prog->start || prog->stop ||
+	    prog->sync_correct || prog->sync_excursion ||
+	    prog->exclude_sync_loss) {
+		fprintf(stderr,
+			"--follow only supports --summary and windowed statistics\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int prog_parse_export_format(struct isochron_report *prog)
+{
+	if (!strlen(prog->export_path)) {
+		if (strlen(prog->export_format_str) ||
+		    strlen(prog->export_args)) {
+			fprintf(stderr,
+				"--export-format and --export-args require --export-path\n");
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+	if (!strcmp(prog->export_format_str, "npy")) {
+		prog->export_format = ISOCHRON_EXPORT_NPY;
+	} else if (!strcmp(prog->export_format_str, "arrow")) {
+		prog->export_format = ISOCHRON_EXPORT_ARROW;
+	} else {
+		fprintf(stderr,
+			"Unknown export format \"%s\", expected npy or arrow\n",
+			prog->export_format_str);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int prog_parse_args(int argc, char **argv, struct isochron_report *prog)
 {
 	bool help = false;
@@ -92,13 +516,221 @@ static int prog_parse_args(int argc, char **argv, struct isochron_report *prog)
 			.type = PROG_ARG_STRING,
 			.string = {
 				.buf = prog->printf_args,
+				.size = ISOCHRON_LOG_PRINTF_BUF_SIZE - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-i",
+			.long_opt = "--session",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->session,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-p",
+			.long_opt = "--session-filter",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->session_filter_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-l",
+			.long_opt = "--list-sessions",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->list_sessions,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-P",
+			.long_opt = "--percentiles",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->percentiles_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-A",
+			.long_opt = "--approximate",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->approximate,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-H",
+			.long_opt = "--histogram-file",
+			.type = PROG_ARG_FILEPATH,
+			.filepath = {
+				.buf = prog->histogram_file,
+				.size = PATH_MAX - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-E",
+			.long_opt = "--export-format",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->export_format_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-O",
+			.long_opt = "--export-path",
+			.type = PROG_ARG_FILEPATH,
+			.filepath = {
+				.buf = prog->export_path,
+				.size = PATH_MAX - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-V",
+			.long_opt = "--export-args",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->export_args,
 				.size = ISOCHRON_LOG_PRINTF_MAX_NUM_ARGS - 1,
 			},
 			.optional = true,
+		}, {
+			.short_opt = "-j",
+			.long_opt = "--num-threads",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->num_threads,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-w",
+			.long_opt = "--window-packets",
+			.type = PROG_ARG_UNSIGNED,
+			.unsigned_ptr = {
+				.ptr = &prog->window_packets,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-W",
+			.long_opt = "--window-time",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->window_time,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-T",
+			.long_opt = "--window-thresholds",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->window_thresholds_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-M",
+			.long_opt = "--metrics",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->metrics_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-o",
+			.long_opt = "--outliers",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->outliers_expr,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-n",
+			.long_opt = "--num-outliers",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->num_outliers,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-c",
+			.long_opt = "--outlier-context",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->outlier_context,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-L",
+			.long_opt = "--follow",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->follow,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-I",
+			.long_opt = "--follow-interval",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->follow_interval,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-y",
+			.long_opt = "--periodicity",
+			.type = PROG_ARG_STRING,
+			.string = {
+				.buf = prog->periodicity_str,
+				.size = BUFSIZ - 1,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-k",
+			.long_opt = "--num-periods",
+			.type = PROG_ARG_LONG,
+			.long_ptr = {
+				.ptr = &prog->num_periods,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-X",
+			.long_opt = "--sync-correct",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->sync_correct,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-x",
+			.long_opt = "--sync-excursion",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->sync_excursion,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-G",
+			.long_opt = "--exclude-sync-loss",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->exclude_sync_loss,
+			},
+			.optional = true,
 		},
 	};
 	int rc;
 
+	prog->session = -1;
+	prog->outlier_context = -1;
+
 	rc = prog_parse_np_args(argc, argv, args, ARRAY_SIZE(args));
 
 	/* Non-positional arguments left unconsumed */
@@ -120,12 +752,207 @@ static int prog_parse_args(int argc, char **argv, struct isochron_report *prog)
 	if (!strlen(prog->input_file))
 		sprintf(prog->input_file, "isochron.dat");
 
-	return 0;
+	if ((strlen(prog->percentiles_str) || strlen(prog->histogram_file) ||
+	     strlen(prog->metrics_str)) && !prog->summary) {
+		fprintf(stderr,
+			"--percentiles, --histogram-file and --metrics require --summary\n");
+		return -EINVAL;
+	}
+
+	if (!prog->num_threads)
+		prog->num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (prog->num_threads < 1) {
+		fprintf(stderr, "Number of threads must be positive\n");
+		return -EINVAL;
+	}
+
+	if (prog->sync_excursion < 0) {
+		fprintf(stderr, "Sync excursion threshold must be positive\n");
+		return -EINVAL;
+	}
+
+	rc = prog_parse_percentiles(prog);
+	if (rc)
+		return rc;
+
+	rc = prog_parse_export_format(prog);
+	if (rc)
+		return rc;
+
+	rc = prog_parse_window(prog);
+	if (rc)
+		return rc;
+
+	rc = prog_parse_periodicity(prog);
+	if (rc)
+		return rc;
+
+	rc = prog_parse_outliers(prog);
+	if (rc)
+		return rc;
+
+	rc = prog_parse_follow(prog);
+	if (rc)
+		return rc;
+
+	return prog_parse_session_filter(prog);
+}
+
+static int prog_report_session(struct isochron_report *prog, long session,
+			       bool container)
+{
+	unsigned long start = prog->start, stop = prog->stop;
+	int rc;
+
+	/* Filter and list the sessions by their header alone, the packet
+	 * logs are only read in for the sessions which are reported on.
+	 */
+	rc = isochron_log_load(prog->input_file, session, NULL, NULL, NULL,
+			       NULL, &prog->packet_count, &prog->frame_size,
+			       &prog->omit_sync, &prog->do_ts, &prog->taprio,
+			       &prog->txtime, &prog->deadline,
+			       &prog->base_time, &prog->advance_time,
+			       &prog->shift_time, &prog->cycle_time,
+			       &prog->window_size);
+	if (rc)
+		return rc;
+
+	if (!prog_session_matches(prog))
+		return 0;
+
+	if (prog->list_sessions) {
+		prog_print_session(prog, session);
+		return 0;
+	}
+
+	rc = isochron_log_load(prog->input_file, session, &prog->send_log,
+			       &prog->rcv_log, &prog->sync_log,
+			       &prog->annotation_log, &prog->packet_count,
+			       &prog->frame_size, &prog->omit_sync,
+			       &prog->do_ts, &prog->taprio, &prog->txtime,
+			       &prog->deadline, &prog->base_time,
+			       &prog->advance_time, &prog->shift_time,
+			       &prog->cycle_time, &prog->window_size);
+	if (rc)
+		return rc;
+
+	if (container)
+		printf("Session %ld:\n", session);
+
+	if (!start)
+		start = 1;
+	if (!stop)
+		stop = prog->packet_count;
+
+	/* The sync loss annotations were recorded with the system clock,
+	 * match them against the schedule before it is corrected
+	 */
+	rc = isochron_log_sync_loss(&prog->send_log, &prog->annotation_log,
+				    start, stop, prog->exclude_sync_loss);
+	if (rc)
+		goto out;
+
+	if (prog->sync_correct || prog->sync_excursion) {
+		rc = isochron_log_sync_correct(&prog->send_log,
+					       &prog->sync_log, start, stop,
+					       prog->sync_correct,
+					       prog->sync_excursion);
+		if (rc)
+			goto out;
+	}
+
+	if (strlen(prog->export_path)) {
+		rc = isochron_log_export(&prog->send_log, &prog->rcv_log,
+					 prog->export_format, prog->export_path,
+					 prog->export_args, start, stop,
+					 prog->base_time, prog->advance_time,
+					 prog->shift_time, prog->cycle_time,
+					 prog->window_size);
+		if (rc)
+			goto out;
+
+	}
+
+	if (prog->window_packets || prog->window_time) {
+		rc = isochron_print_windows(&prog->send_log, &prog->rcv_log,
+					    start, stop, prog->window_packets,
+					    prog->window_time,
+					    prog->have_window_thresholds ?
+					    prog->window_thresholds : NULL,
+					    prog->taprio, prog->txtime,
+					    prog->base_time,
+					    prog->advance_time,
+					    prog->shift_time,
+					    prog->cycle_time,
+					    prog->window_size);
+		if (rc)
+			goto out;
+	}
+
+	if (strlen(prog->periodicity_str)) {
+		rc = isochron_print_periodicity(&prog->send_log,
+						&prog->rcv_log, start, stop,
+						prog->periodicity_metric,
+						prog->num_periods,
+						prog->taprio, prog->txtime,
+						prog->base_time,
+						prog->advance_time,
+						prog->shift_time,
+						prog->cycle_time,
+						prog->window_size);
+		if (rc)
+			goto out;
+	}
+
+	if (strlen(prog->outliers_expr)) {
+		rc = isochron_print_outliers(&prog->send_log, &prog->rcv_log,
+					     start, stop, prog->outliers_expr,
+					     prog->num_outliers,
+					     prog->outlier_context,
+					     prog->base_time,
+					     prog->advance_time,
+					     prog->shift_time,
+					     prog->cycle_time,
+					     prog->window_size);
+		if (rc)
+			goto out;
+	}
+
+	/* Nothing else to report */
+	if ((strlen(prog->export_path) || prog->window_packets ||
+	     prog->window_time || strlen(prog->periodicity_str) ||
+	     strlen(prog->outliers_expr)) &&
+	    !strlen(prog->printf_fmt) && !prog->summary)
+		goto out;
+
+	rc = isochron_print_stats(&prog->send_log, &prog->rcv_log,
+				  prog->printf_fmt, prog->printf_args,
+				  start, stop, prog->summary,
+				  prog->percentiles, prog->num_percentiles,
+				  prog->approximate,
+				  strlen(prog->histogram_file) ?
+				  prog->histogram_file : NULL,
+				  prog->omit_sync, prog->taprio,
+				  prog->txtime, prog->base_time,
+				  prog->advance_time, prog->shift_time,
+				  prog->cycle_time, prog->window_size,
+				  prog->num_threads, prog->metrics_str);
+
+out:
+	isochron_log_teardown(&prog->send_log);
+	isochron_log_teardown(&prog->rcv_log);
+	isochron_log_teardown(&prog->sync_log);
+	isochron_log_teardown(&prog->annotation_log);
+
+	return rc;
 }
 
 int isochron_report_main(int argc, char *argv[])
 {
 	struct isochron_report prog = {0};
+	long num_sessions, session;
+	bool container;
 	int rc;
 
 	rc = prog_parse_args(argc, argv, &prog);
@@ -139,30 +966,34 @@ int isochron_report_main(int argc, char *argv[])
 	if (rc)
 		return rc;
 
-	rc = isochron_log_load(prog.input_file, &prog.send_log, &prog.rcv_log,
-			       &prog.packet_count, &prog.frame_size,
-			       &prog.omit_sync, &prog.do_ts, &prog.taprio,
-			       &prog.txtime, &prog.deadline, &prog.base_time,
-			       &prog.advance_time, &prog.shift_time,
-			       &prog.cycle_time, &prog.window_size);
+	if (prog.follow)
+		return isochron_log_follow(prog.input_file,
+					   prog.follow_interval, prog.summary,
+					   prog.window_packets,
+					   prog.window_time,
+					   prog.have_window_thresholds ?
+					   prog.window_thresholds : NULL);
+
+	rc = isochron_log_num_sessions(prog.input_file, &num_sessions,
+				       &container);
 	if (rc)
 		return rc;
 
-	if (!prog.start)
-		prog.start = 1;
-	if (!prog.stop)
-		prog.stop = prog.packet_count;
-
-	rc = isochron_print_stats(&prog.send_log, &prog.rcv_log,
-				  prog.printf_fmt, prog.printf_args,
-				  prog.start, prog.stop, prog.summary,
-				  prog.omit_sync, prog.taprio,
-				  prog.txtime, prog.base_time,
-				  prog.advance_time, prog.shift_time,
-				  prog.cycle_time, prog.window_size);
-
-	isochron_log_teardown(&prog.send_log);
-	isochron_log_teardown(&prog.rcv_log);
+	if (prog.session >= 0)
+		return prog_report_session(&prog, prog.session, container);
+
+	if (strlen(prog.export_path) && num_sessions > 1) {
+		fprintf(stderr,
+			"Exporting a log with %ld sessions requires --session\n",
+			num_sessions);
+		return -EINVAL;
+	}
+
+	for (session = 0; session < num_sessions; session++) {
+		rc = prog_report_session(&prog, session, container);
+		if (rc)
+			return rc;
+	}
 
 	return 0;
 }
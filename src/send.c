@@ -18,6 +18,7 @@
 /* For va_start and va_end */
 #include <stdarg.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <linux/un.h>
@@ -37,6 +38,11 @@
 #include <linux/net_tstamp.h>
 
 #define TIME_FMT_LEN	27 /* "[%s] " */
+/* Extra sync samples, for the time spent waiting for the base time and for
+ * the last TX timestamps. Older samples are overwritten past that.
+ */
+#define ISOCHRON_SYNC_LOG_SLACK		64
+#define ISOCHRON_SYNC_LOG_MAX_SAMPLES	(1 << 20)
 
 struct isochron_txtime_postmortem_priv {
 	struct isochron_send *prog;
@@ -188,6 +194,8 @@ static int prog_log_packet_no_tstamp(struct isochron_send *prog,
 	send_pkt->swts = 0;
 	send_pkt->hwts = 0;
 
+	__atomic_store_n(&prog->logged, index + 1, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
@@ -197,6 +205,28 @@ isochron_pkt_fully_timestamped(struct isochron_send_pkt_data *send_pkt)
 	return send_pkt->hwts && send_pkt->swts && send_pkt->sched_ts;
 }
 
+/* Timestamps may complete out of order, so only publish the length of the
+ * leading run of fully timestamped entries. Called from the TX timestamping
+ * thread, which is the only writer of the timestamp fields.
+ */
+static void prog_advance_ts_horizon(struct isochron_send *prog)
+{
+	__u32 logged = __atomic_load_n(&prog->logged, __ATOMIC_ACQUIRE);
+	__u32 horizon = __atomic_load_n(&prog->ts_horizon, __ATOMIC_RELAXED);
+	struct isochron_send_pkt_data *send_pkt;
+
+	while (horizon < logged) {
+		send_pkt = isochron_log_get_entry(&prog->log, sizeof(*send_pkt),
+						  horizon);
+		if (!isochron_pkt_fully_timestamped(send_pkt))
+			break;
+
+		horizon++;
+	}
+
+	__atomic_store_n(&prog->ts_horizon, horizon, __ATOMIC_RELEASE);
+}
+
 static int prog_validate_premature_tx(__u32 seqid, __s64 hwts, __s64 scheduled,
 				      bool deadline)
 {
@@ -340,8 +370,10 @@ static int prog_poll_txtstamps(struct isochron_send *prog, int timeout)
 			return rc;
 	}
 
-	if (isochron_pkt_fully_timestamped(send_pkt))
+	if (isochron_pkt_fully_timestamped(send_pkt)) {
 		prog->timestamped++;
+		prog_advance_ts_horizon(prog);
+	}
 
 	return len;
 }
@@ -381,6 +413,31 @@ static int do_work(struct isochron_send *prog, int iteration, __s64 scheduled,
 	return 0;
 }
 
+/* Return the index of the first log entry, starting from @start, which the
+ * sender thread or the TX timestamping thread have yet to fill in. The
+ * entries below the returned index are safe to read concurrently with the
+ * RT threads.
+ */
+__u32 isochron_send_log_horizon(struct isochron_send *prog, __u32 start)
+{
+	size_t num_entries = prog->log.size /
+			     sizeof(struct isochron_send_pkt_data);
+	__u32 horizon;
+
+	if (__atomic_load_n(&prog->send_tid_stopped, __ATOMIC_ACQUIRE) &&
+	    (!prog->do_ts ||
+	     __atomic_load_n(&prog->tx_tstamp_tid_stopped, __ATOMIC_ACQUIRE)))
+		return num_entries;
+
+	horizon = __atomic_load_n(&prog->logged, __ATOMIC_ACQUIRE);
+	if (prog->do_ts)
+		horizon = min(horizon,
+			      __atomic_load_n(&prog->ts_horizon,
+					      __ATOMIC_ACQUIRE));
+
+	return max(horizon, start);
+}
+
 static int isochron_missing_txts_dump(void *priv, void *pkt)
 {
 	struct isochron_send_pkt_data *send_pkt = pkt;
@@ -499,12 +556,20 @@ static int run_nanosleep(struct isochron_send *prog)
 	return 0;
 }
 
+/* The test state is derived from which threads are still running */
+static void prog_signal_state_change(struct isochron_send *prog)
+{
+	if (prog->state_event_fd >= 0)
+		eventfd_write(prog->state_event_fd, 1);
+}
+
 static void *prog_send_thread(void *arg)
 {
 	struct isochron_send *prog = arg;
 
 	prog->send_tid_rc = run_nanosleep(prog);
-	prog->send_tid_stopped = true;
+	__atomic_store_n(&prog->send_tid_stopped, true, __ATOMIC_RELEASE);
+	prog_signal_state_change(prog);
 
 	return &prog->send_tid_rc;
 }
@@ -522,11 +587,71 @@ static void *prog_tx_timestamp_thread(void *arg)
 	clock_nanosleep(prog->clkid, TIMER_ABSTIME, &wakeup_ts, NULL);
 
 	prog->tx_timestamp_tid_rc = wait_for_txtimestamps(prog);
-	prog->tx_tstamp_tid_stopped = true;
+	__atomic_store_n(&prog->tx_tstamp_tid_stopped, true, __ATOMIC_RELEASE);
+	prog_signal_state_change(prog);
 
 	return &prog->tx_timestamp_tid_rc;
 }
 
+/* Periodically measure the offset between the system clock and the PHC,
+ * so that software timestamps can be corrected after the fact.
+ */
+static int run_sync_sampler(struct isochron_send *prog)
+{
+	struct isochron_sync_sample sample;
+	struct timespec wakeup_ts;
+	__s64 offset, delay;
+	__s64 wakeup;
+	__u64 ts;
+	int rc;
+
+	rc = clock_gettime(CLOCK_MONOTONIC, &wakeup_ts);
+	if (rc < 0)
+		return -errno;
+
+	wakeup = timespec_to_ns(&wakeup_ts);
+
+	while (!signal_received && !prog->sync_sampler_tid_should_stop) {
+		rc = sysmon_get_offset(prog->sysmon, &offset, &ts, &delay);
+		if (!rc) {
+			sample.ts = __cpu_to_be64(utc_to_tai(ts, prog->utc_tai_offset));
+			sample.offset = __cpu_to_be64(utc_to_tai(offset,
+								 prog->utc_tai_offset));
+			sample.delay = __cpu_to_be64(delay);
+
+			isochron_log_sync_sample(&prog->sync_log,
+						 prog->sync_samples++,
+						 &sample);
+		}
+
+		wakeup += prog->sync_sample_interval;
+		wakeup_ts = ns_to_timespec(wakeup);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup_ts,
+				NULL);
+	}
+
+	return 0;
+}
+
+static void *prog_sync_sampler_thread(void *arg)
+{
+	struct isochron_send *prog = arg;
+
+	prog->sync_sampler_tid_rc = run_sync_sampler(prog);
+
+	return &prog->sync_sampler_tid_rc;
+}
+
+static void prog_sync_loss(void *priv, __s64 start, __s64 stop)
+{
+	struct isochron_send *prog = priv;
+
+	if (prog->annotation_log.size)
+		isochron_log_annotate(&prog->annotation_log,
+				      ISOCHRON_ANNOTATION_SYNC_LOSS,
+				      start, stop);
+}
+
 static int prog_init_syncmon(struct isochron_send *prog)
 {
 	struct syncmon_node *sn, *remote_sn;
@@ -572,6 +697,7 @@ static int prog_init_syncmon(struct isochron_send *prog)
 		return -ENOMEM;
 	}
 
+	syncmon_set_sync_loss_cb(syncmon, prog_sync_loss, prog);
 	syncmon_init(syncmon);
 	prog->syncmon = syncmon;
 
@@ -653,10 +779,124 @@ int isochron_prepare_receiver(struct isochron_send *prog, struct sk *mgmt_sock)
 
 static int prog_prepare_receiver(struct isochron_send *prog)
 {
+	int rc;
+
 	if (!prog->stats_srv.family)
 		return 0;
 
-	return isochron_prepare_receiver(prog, prog->mgmt_sock);
+	rc = isochron_prepare_receiver(prog, prog->mgmt_sock);
+	if (rc)
+		return rc;
+
+	/* With --mmap-output, the receiver log is already part of the mapping */
+	if (!prog->mmap_output) {
+		rc = isochron_log_init(&prog->rcv_log, prog->iterations *
+				       sizeof(struct isochron_rcv_pkt_data));
+		if (rc)
+			return rc;
+	}
+
+	/* Have the receiver log trickle in while the test is running */
+	rc = isochron_update_log_subscribe(prog->mgmt_sock,
+					   ISOCHRON_LOG_CHUNK_SIZE);
+	if (rc) {
+		if (!prog->mmap_output)
+			isochron_log_teardown(&prog->rcv_log);
+		return rc;
+	}
+
+	return 0;
+}
+
+static void prog_teardown_receiver(struct isochron_send *prog)
+{
+	if (!prog->stats_srv.family || prog->mmap_output)
+		return;
+
+	isochron_log_teardown(&prog->rcv_log);
+}
+
+static size_t prog_sync_log_size(struct isochron_send *prog)
+{
+	__u64 num_samples;
+
+	if (!prog->sync_sample_interval)
+		return 0;
+
+	num_samples = prog->iterations * prog->cycle_time /
+		      prog->sync_sample_interval + ISOCHRON_SYNC_LOG_SLACK;
+	if (num_samples > ISOCHRON_SYNC_LOG_MAX_SAMPLES)
+		num_samples = ISOCHRON_SYNC_LOG_MAX_SAMPLES;
+
+	return num_samples * sizeof(struct isochron_sync_sample);
+}
+
+static int prog_init_log(struct isochron_send *prog)
+{
+	int rc;
+
+	prog->sync_samples = 0;
+
+	if (!prog->mmap_output) {
+		rc = isochron_log_init(&prog->log, prog->iterations *
+				       sizeof(struct isochron_send_pkt_data));
+		if (rc)
+			return rc;
+
+		if (strlen(prog->output_file)) {
+			rc = isochron_log_init(&prog->annotation_log,
+					       ISOCHRON_ANNOTATION_LOG_SIZE);
+			if (rc)
+				goto out_log_teardown;
+		}
+
+		if (!prog->sync_sample_interval)
+			return 0;
+
+		rc = isochron_log_init(&prog->sync_log,
+				       prog_sync_log_size(prog));
+		if (rc)
+			goto out_annotation_log_teardown;
+
+		return 0;
+
+out_annotation_log_teardown:
+		isochron_log_teardown(&prog->annotation_log);
+		memset(&prog->annotation_log, 0, sizeof(prog->annotation_log));
+out_log_teardown:
+		isochron_log_teardown(&prog->log);
+		return rc;
+	}
+
+	return isochron_log_map_create(&prog->log_map, prog->output_file,
+				       &prog->log, &prog->rcv_log,
+				       &prog->sync_log, &prog->annotation_log,
+				       prog->iterations *
+				       sizeof(struct isochron_send_pkt_data),
+				       prog->iterations *
+				       sizeof(struct isochron_rcv_pkt_data),
+				       prog_sync_log_size(prog),
+				       ISOCHRON_ANNOTATION_LOG_SIZE,
+				       prog->iterations, prog->tx_len,
+				       prog->omit_sync, prog->do_ts,
+				       prog->taprio, prog->txtime,
+				       prog->deadline, prog->base_time,
+				       prog->advance_time, prog->shift_time,
+				       prog->cycle_time, prog->window_size);
+}
+
+static void prog_teardown_log(struct isochron_send *prog)
+{
+	if (prog->mmap_output) {
+		isochron_log_map_destroy(&prog->log_map);
+	} else {
+		isochron_log_teardown(&prog->log);
+		isochron_log_teardown(&prog->sync_log);
+		isochron_log_teardown(&prog->annotation_log);
+	}
+
+	memset(&prog->sync_log, 0, sizeof(prog->sync_log));
+	memset(&prog->annotation_log, 0, sizeof(prog->annotation_log));
 }
 
 int isochron_send_update_session_start_time(struct isochron_send *prog)
@@ -786,6 +1026,51 @@ err_destroy_attr:
 	return rc;
 }
 
+static int prog_sync_sampler_thread_create(struct isochron_send *prog)
+{
+	int rc;
+
+	if (!prog->sync_sample_interval)
+		return 0;
+
+	prog->sync_sampler_tid_should_stop = false;
+
+	/* Default attributes: the sampler must not compete with the
+	 * real-time sender thread.
+	 */
+	rc = pthread_create(&prog->sync_sampler_tid, NULL,
+			    prog_sync_sampler_thread, prog);
+	if (rc)
+		pr_err(-rc, "failed to create sync sampler pthread: %m\n");
+
+	return rc;
+}
+
+static void prog_sync_sampler_thread_destroy(struct isochron_send *prog)
+{
+	void *res;
+	int rc;
+
+	if (!prog->sync_sample_interval)
+		return;
+
+	prog->sync_sampler_tid_should_stop = true;
+
+	rc = pthread_join(prog->sync_sampler_tid, &res);
+	if (rc) {
+		pr_err(-rc, "failed to join with sync sampler thread: %m\n");
+		return;
+	}
+
+	rc = *((int *)res);
+	if (rc)
+		pr_err(rc, "sync sampler thread failed: %m\n");
+
+	rc = isochron_log_sync_finish(&prog->sync_log, prog->sync_samples);
+	if (rc)
+		pr_err(rc, "failed to order sync samples: %m\n");
+}
+
 static void prog_tx_timestamp_thread_destroy(struct isochron_send *prog)
 {
 	void *res;
@@ -809,28 +1094,40 @@ int isochron_send_start_threads(struct isochron_send *prog)
 {
 	int rc;
 
-	rc = prog_tx_timestamp_thread_create(prog);
+	rc = prog_sync_sampler_thread_create(prog);
 	if (rc)
 		return rc;
 
+	rc = prog_tx_timestamp_thread_create(prog);
+	if (rc)
+		goto err_sync_sampler;
+
 	rc = prog_send_thread_create(prog);
 	if (rc) {
 		prog_tx_timestamp_thread_destroy(prog);
-		return rc;
+		goto err_sync_sampler;
 	}
 
 	return 0;
+
+err_sync_sampler:
+	prog_sync_sampler_thread_destroy(prog);
+	return rc;
 }
 
 void isochron_send_stop_threads(struct isochron_send *prog)
 {
 	prog_send_thread_destroy(prog);
 	prog_tx_timestamp_thread_destroy(prog);
+	prog_sync_sampler_thread_destroy(prog);
 }
 
 void isochron_send_init_thread_state(struct isochron_send *prog)
 {
 	prog->timestamped = 0;
+	prog->logged = 0;
+	prog->ts_horizon = 0;
+	prog->rcv_log_rc = 0;
 	prog->send_tid_should_stop = false;
 	prog->send_tid_stopped = false;
 	prog->tx_tstamp_tid_stopped = false;
@@ -842,8 +1139,7 @@ static int prog_prepare_session(struct isochron_send *prog)
 
 	isochron_send_init_thread_state(prog);
 
-	rc = isochron_log_init(&prog->log, prog->iterations *
-			       sizeof(struct isochron_send_pkt_data));
+	rc = prog_init_log(prog);
 	if (rc)
 		return rc;
 
@@ -862,23 +1158,83 @@ static int prog_prepare_session(struct isochron_send *prog)
 	rc = isochron_send_update_session_start_time(prog);
 	if (rc) {
 		pr_err(rc, "Failed to update session start time: %m\n");
-		goto out_teardown_log;
+		goto out_teardown_receiver;
 	}
 
 	rc = isochron_send_start_threads(prog);
 	if (rc)
-		goto out_teardown_log;
+		goto out_teardown_receiver;
 
 	return 0;
 
+out_teardown_receiver:
+	prog_teardown_receiver(prog);
 out_teardown_log:
-	isochron_log_teardown(&prog->log);
+	prog_teardown_log(prog);
 	return rc;
 }
 
+/* Create the output file ahead of time, for @send_log and @rcv_log (and the
+ * annotations) to be filled in directly as they are collected. The file is
+ * marked as incomplete until isochron_log_map_complete().
+ */
+int isochron_send_map_log(struct isochron_send *prog,
+			  struct isochron_log_map *map,
+			  struct isochron_log *send_log,
+			  struct isochron_log *rcv_log)
+{
+	struct isochron_log sync_log;
+
+	return isochron_log_map_create(map, prog->output_file, send_log,
+				       rcv_log, &sync_log,
+				       &prog->annotation_log,
+				       prog->iterations *
+				       sizeof(struct isochron_send_pkt_data),
+				       prog->iterations *
+				       sizeof(struct isochron_rcv_pkt_data),
+				       0, ISOCHRON_ANNOTATION_LOG_SIZE,
+				       prog->iterations, prog->tx_len,
+				       prog->omit_sync, prog->do_ts,
+				       prog->taprio, prog->txtime,
+				       prog->deadline, prog->base_time,
+				       prog->advance_time, prog->shift_time,
+				       prog->cycle_time, prog->window_size);
+}
+
+/* Either overwrite the output file with a single-session log, or append
+ * the session to a multi-session container.
+ */
+int isochron_send_save_log(struct isochron_send *prog,
+			   const struct isochron_log *send_log,
+			   const struct isochron_log *rcv_log)
+{
+	if (prog->append_output)
+		return isochron_log_append(prog->output_file, send_log,
+					   rcv_log, &prog->sync_log,
+					   &prog->annotation_log,
+					   prog->iterations,
+					   prog->tx_len, prog->omit_sync,
+					   prog->do_ts, prog->taprio,
+					   prog->txtime, prog->deadline,
+					   prog->base_time,
+					   prog->advance_time,
+					   prog->shift_time,
+					   prog->cycle_time,
+					   prog->window_size);
+
+	return isochron_log_save(prog->output_file, send_log, rcv_log,
+				 &prog->sync_log, &prog->annotation_log,
+				 prog->iterations,
+				 prog->tx_len,
+				 prog->omit_sync, prog->do_ts, prog->taprio,
+				 prog->txtime, prog->deadline,
+				 prog->base_time, prog->advance_time,
+				 prog->shift_time, prog->cycle_time,
+				 prog->window_size);
+}
+
 static int prog_end_session(struct isochron_send *prog, bool save_log)
 {
-	struct isochron_log rcv_log;
 	int rc = 0;
 
 	isochron_send_stop_threads(prog);
@@ -889,27 +1245,30 @@ static int prog_end_session(struct isochron_send *prog, bool save_log)
 	if (!prog->stats_srv.family)
 		goto skip_collecting_rcv_log;
 
+	if (prog->rcv_log_rc) {
+		rc = prog->rcv_log_rc;
+		goto out_teardown_receiver;
+	}
+
 	printf("Collecting receiver stats\n");
 
-	rc = isochron_collect_rcv_log(prog->mgmt_sock, &rcv_log);
+	rc = isochron_collect_log_tail(prog->mgmt_sock, &prog->rcv_log,
+				       sizeof(struct isochron_rcv_pkt_data),
+				       ISOCHRON_LOG_TAIL_TIMEOUT);
 	if (rc) {
 		pr_err(rc, "Failed to collect receiver stats: %m\n");
-		return rc;
+		goto out_teardown_receiver;
 	}
 
-	if (save_log && strlen(prog->output_file)) {
-		rc = isochron_log_save(prog->output_file, &prog->log, &rcv_log,
-				       prog->iterations, prog->tx_len,
-				       prog->omit_sync, prog->do_ts,
-				       prog->taprio, prog->txtime,
-				       prog->deadline, prog->base_time,
-				       prog->advance_time, prog->shift_time,
-				       prog->cycle_time, prog->window_size);
-	}
+	if (save_log && prog->mmap_output)
+		rc = isochron_log_map_complete(&prog->log_map);
+	else if (save_log && strlen(prog->output_file))
+		rc = isochron_send_save_log(prog, &prog->log, &prog->rcv_log);
 
-	isochron_log_teardown(&rcv_log);
+out_teardown_receiver:
+	prog_teardown_receiver(prog);
 skip_collecting_rcv_log:
-	isochron_log_teardown(&prog->log);
+	prog_teardown_log(prog);
 
 	return rc;
 }
@@ -1325,6 +1684,7 @@ void isochron_send_prepare_default_args(struct isochron_send *prog)
 	prog->etype = ETH_P_ISOCHRON;
 	prog->data_port = ISOCHRON_DATA_PORT;
 	prog->stats_port = ISOCHRON_STATS_PORT;
+	prog->state_event_fd = -1;
 	sprintf(prog->uds_remote, "/var/run/ptp4l");
 }
 
@@ -1404,6 +1764,29 @@ int isochron_send_interpret_args(struct isochron_send *prog)
 		return -EINVAL;
 	}
 
+	if (prog->mmap_output && !prog->stats_srv.family) {
+		fprintf(stderr,
+			"--client is mandatory when --mmap-output is used\n");
+		return -EINVAL;
+	}
+
+	if (prog->sync_sample_interval < 0) {
+		fprintf(stderr, "Sync sample interval must be positive\n");
+		return -EINVAL;
+	}
+
+	if (prog->sync_sample_interval && prog->omit_sync) {
+		fprintf(stderr,
+			"--sync-sample-interval and --omit-sync are mutually exclusive\n");
+		return -EINVAL;
+	}
+
+	if (prog->mmap_output && prog->append_output) {
+		fprintf(stderr,
+			"--mmap-output and --append-output are mutually exclusive\n");
+		return -EINVAL;
+	}
+
 	if (prog->l4 && !prog->ip_destination.family) {
 		fprintf(stderr,
 			"--ip-destination is mandatory with --l4\n");
@@ -1419,6 +1802,15 @@ int isochron_send_interpret_args(struct isochron_send *prog)
 	if (!strlen(prog->output_file))
 		sprintf(prog->output_file, "isochron.dat");
 
+	/* The samples go to the output file, which has a default name but
+	 * is only written when the receiver log is collected
+	 */
+	if (prog->sync_sample_interval && !prog->stats_srv.family) {
+		fprintf(stderr,
+			"--client is mandatory when --sync-sample-interval is used\n");
+		return -EINVAL;
+	}
+
 	if (prog->sync_threshold < 0 && !prog->omit_sync) {
 		fprintf(stderr,
 			"--sync-threshold is mandatory unless --omit-sync is used\n");
@@ -1794,6 +2186,31 @@ int isochron_send_parse_args(int argc, char **argv, struct isochron_send *prog)
 				.size = PATH_MAX - 1,
 			},
 			.optional = true,
+		}, {
+			.short_opt = "-Z",
+			.long_opt = "--append-output",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->append_output,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-K",
+			.long_opt = "--mmap-output",
+			.type = PROG_ARG_BOOL,
+			.boolean_ptr = {
+			        .ptr = &prog->mmap_output,
+			},
+			.optional = true,
+		}, {
+			.short_opt = "-Y",
+			.long_opt = "--sync-sample-interval",
+			.type = PROG_ARG_TIME,
+			.time = {
+				.clkid = CLOCK_TAI,
+				.ns = &prog->sync_sample_interval,
+			},
+			.optional = true,
 		}, {
 			.short_opt = "-M",
 			.long_opt = "--cpu-mask",
@@ -1835,6 +2252,28 @@ int isochron_send_parse_args(int argc, char **argv, struct isochron_send *prog)
 static bool prog_stop_syncmon(void *priv)
 {
 	struct isochron_send *prog = priv;
+	bool complete;
+	int rc;
+
+	/* A failed chunk leaves the message stream in an unknown state, so
+	 * stop the test rather than keep collecting a log with holes in it.
+	 */
+	if (prog->stats_srv.family) {
+		rc = isochron_collect_log_chunk(prog->mgmt_sock, &prog->rcv_log,
+						sizeof(struct isochron_rcv_pkt_data),
+						&complete);
+		if (rc) {
+			pr_err(rc, "Failed to collect receiver log, stopping test: %m\n");
+			prog->rcv_log_rc = rc;
+			return true;
+		}
+	}
+
+	/* The RT threads only write to the page cache, flushing it to disk
+	 * is done from here.
+	 */
+	if (prog->mmap_output)
+		isochron_log_map_sync(&prog->log_map);
 
 	return prog->send_tid_stopped;
 }
@@ -19,6 +19,7 @@ struct isochron_send {
 	volatile bool send_tid_should_stop;
 	volatile bool send_tid_stopped;
 	volatile bool tx_tstamp_tid_stopped;
+	volatile bool sync_sampler_tid_should_stop;
 	unsigned char dest_mac[ETH_ALEN];
 	unsigned char src_mac[ETH_ALEN];
 	char if_name[IFNAMSIZ];
@@ -35,7 +36,19 @@ struct isochron_send {
 	struct sk_addr *sa;
 	struct ip_address stats_srv;
 	struct isochron_log log;
+	struct isochron_log rcv_log;
+	struct isochron_log sync_log;
+	struct isochron_log annotation_log;
+	unsigned long sync_samples;
+	__s64 sync_sample_interval;
 	unsigned long timestamped;
+	/* Number of leading log entries written by the send thread, and
+	 * fully timestamped by the TX timestamping thread, respectively.
+	 * Published with release semantics for isochron_send_log_horizon().
+	 */
+	__u32 logged;
+	__u32 ts_horizon;
+	int rcv_log_rc;
 	unsigned long iterations;
 	clockid_t clkid;
 	__s64 session_start;
@@ -78,10 +91,17 @@ struct isochron_send {
 	long sync_threshold;
 	long num_readings;
 	char output_file[PATH_MAX];
+	bool append_output;
+	bool mmap_output;
+	struct isochron_log_map log_map;
 	pthread_t send_tid;
 	pthread_t tx_timestamp_tid;
+	pthread_t sync_sampler_tid;
 	int send_tid_rc;
 	int tx_timestamp_tid_rc;
+	int sync_sampler_tid_rc;
+	/* eventfd written to by the threads when they stop, or -1 */
+	int state_event_fd;
 	unsigned long cpumask;
 	struct syncmon *syncmon;
 };
@@ -102,5 +122,13 @@ int isochron_send_start_threads(struct isochron_send *prog);
 void isochron_send_stop_threads(struct isochron_send *prog);
 int isochron_prepare_receiver(struct isochron_send *prog, struct sk *mgmt_sock);
 __s64 isochron_send_first_base_time(struct isochron_send *prog);
+__u32 isochron_send_log_horizon(struct isochron_send *prog, __u32 start);
+int isochron_send_save_log(struct isochron_send *prog,
+			   const struct isochron_log *send_log,
+			   const struct isochron_log *rcv_log);
+int isochron_send_map_log(struct isochron_send *prog,
+			  struct isochron_log_map *map,
+			  struct isochron_log *send_log,
+			  struct isochron_log *rcv_log);
 
 #endif
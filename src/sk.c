@@ -2,6 +2,7 @@
 /* Copyright 2022 NXP */
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/errqueue.h>
 #include <linux/ethtool.h>
 #include <linux/if_packet.h>
@@ -15,6 +16,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include "common.h"
 #include "sk.h"
@@ -35,11 +37,40 @@ struct sk_msg {
 	char *msg_control;
 };
 
+/* Size of the receive buffer of stream sockets, and amount of corked
+ * output which is coalesced before being handed to the kernel.
+ */
+#define SK_STREAM_BUFSIZ	65536
+
+struct sk_buf {
+	unsigned char *data;
+	/* Receive buffer and transmit queue only: first byte not yet
+	 * consumed
+	 */
+	size_t head;
+	size_t len;
+	size_t size;
+};
+
 struct sk {
 	int family;
 	int fd;
 	struct sk_addr *sa;
 	bool closed;
+	/* Output redirected by sk_capture_start() */
+	bool capturing;
+	struct sk_buf capture;
+	/* Output held back by sk_cork() */
+	int corked;
+	bool tcp_corked;
+	struct sk_buf tx;
+	/* Input read ahead by sk_recv() */
+	struct sk_buf rx;
+	/* Output of a non-blocking socket which the kernel did not take
+	 * yet, and how much of it is tolerated
+	 */
+	struct sk_buf txq;
+	size_t txq_limit;
 };
 
 static int __sk_bind_ipv4(int fd, const struct in_addr *a, int port)
@@ -224,6 +255,41 @@ static int sk_accept_ipv4(const struct sk *listen_sock, struct sk *sock,
 	return 0;
 }
 
+/* Management messages are written as a whole through sk_cork(), so Nagle's
+ * algorithm would only delay them waiting for the ACK of the previous one.
+ */
+static void sk_stream_init(struct sk *sock)
+{
+	int sockopt = 1;
+
+	if (setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &sockopt,
+		       sizeof(sockopt)) < 0)
+		perror("Failed to setsockopt(TCP_NODELAY)");
+}
+
+/* Make reads return -EAGAIN rather than wait for data, so that an event
+ * loop serving several peers cannot be stalled by one of them sending a
+ * partial message. Likewise, writes never wait for a peer which is slow to
+ * read: what the kernel does not take is queued, to be written out with
+ * sk_tx_drain() once the socket becomes writable. Once more than
+ * @txq_limit bytes are queued, the peer is given up on and writes fail.
+ */
+int sk_set_nonblock(struct sk *sock, size_t txq_limit)
+{
+	int flags;
+
+	flags = fcntl(sock->fd, F_GETFL);
+	if (flags < 0)
+		return -errno;
+
+	if (fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -errno;
+
+	sock->txq_limit = txq_limit;
+
+	return 0;
+}
+
 int sk_accept(const struct sk *listen_sock, struct sk **sock)
 {
 	char client_addr[INET6_ADDRSTRLEN];
@@ -245,6 +311,8 @@ int sk_accept(const struct sk *listen_sock, struct sk **sock)
 		return rc;
 	}
 
+	sk_stream_init(*sock);
+
 	printf("Accepted connection from %s\n", client_addr);
 
 	return 0;
@@ -304,6 +372,8 @@ int sk_connect_tcp(const struct ip_address *ip, int port, struct sk **sock)
 	(*sock)->fd = fd;
 	(*sock)->family = ip->family;
 
+	sk_stream_init(*sock);
+
 	return 0;
 
 err_close:
@@ -323,44 +393,437 @@ void sk_close(struct sk *sock)
 {
 	if (sock->sa)
 		sk_addr_destroy(sock->sa);
+	free(sock->capture.data);
+	free(sock->tx.data);
+	free(sock->rx.data);
+	free(sock->txq.data);
 	close(sock->fd);
 	free(sock);
 }
 
+/* Make room for @count more bytes at the end of @buf */
+static int sk_buf_reserve(struct sk_buf *buf, size_t count)
+{
+	size_t size = buf->size ? : BUFSIZ;
+	unsigned char *tmp;
+
+	while (size - buf->len < count)
+		size *= 2;
+
+	if (size == buf->size)
+		return 0;
+
+	tmp = realloc(buf->data, size);
+	if (!tmp)
+		return -ENOMEM;
+
+	buf->data = tmp;
+	buf->size = size;
+
+	return 0;
+}
+
+static int sk_buf_append(struct sk_buf *buf, const struct iovec *iov,
+			 int iovcnt)
+{
+	size_t count = 0;
+	int i, rc;
+
+	for (i = 0; i < iovcnt; i++)
+		count += iov[i].iov_len;
+
+	rc = sk_buf_reserve(buf, count);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf->data + buf->len, iov[i].iov_base, iov[i].iov_len);
+		buf->len += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+/* Wait for a non-blocking socket to become ready for @events, for the
+ * reads which must complete rather than return early.
+ */
+static int sk_wait(struct sk *sock, short events)
+{
+	struct pollfd pfd = {
+		.fd = sock->fd,
+		.events = events,
+	};
+
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			return -errno;
+
+	return 0;
+}
+
+/* Copy out up to @len bytes read ahead into the receive buffer */
+static size_t sk_rx_consume(struct sk *sock, void *buf, size_t len)
+{
+	struct sk_buf *rx = &sock->rx;
+	size_t count = min(len, rx->len - rx->head);
+
+	memcpy(buf, rx->data + rx->head, count);
+	rx->head += count;
+	if (rx->head == rx->len)
+		rx->head = rx->len = 0;
+
+	return count;
+}
+
+/* Read whatever the kernel has, up to the size of the receive buffer.
+ * Returns the number of bytes read, or a negative error code.
+ */
+static ssize_t sk_rx_fill(struct sk *sock, int flags)
+{
+	struct sk_buf *rx = &sock->rx;
+	ssize_t ret;
+
+	if (!rx->data) {
+		rx->data = malloc(SK_STREAM_BUFSIZ);
+		if (!rx->data)
+			return -ENOMEM;
+		rx->size = SK_STREAM_BUFSIZ;
+	}
+
+	ret = recv(sock->fd, rx->data, rx->size, flags);
+	if (ret <= 0) {
+		sock->closed = ret == 0;
+		return ret ? -errno : -ECONNRESET;
+	}
+
+	rx->len = ret;
+
+	return ret;
+}
+
+/* Receive exactly @len bytes. Small reads are served from a receive buffer
+ * which is refilled with as much as the kernel has, so that a message
+ * header and its payload usually cost a single system call. Reads larger
+ * than the buffer go straight to @buf.
+ */
 int sk_recv(struct sk *sock, void *buf, size_t len, int flags)
 {
-	size_t received = 0;
+	size_t received;
+	ssize_t ret;
+
+	received = sk_rx_consume(sock, buf, len);
+
+	while (received != len) {
+		if (len - received >= SK_STREAM_BUFSIZ) {
+			ret = recv(sock->fd, buf + received, len - received,
+				   flags);
+			if (ret < 0 && errno == EAGAIN &&
+			    !(flags & MSG_DONTWAIT)) {
+				ret = sk_wait(sock, POLLIN);
+				if (ret)
+					return ret;
+				continue;
+			}
+			if (ret <= 0) {
+				sock->closed = ret == 0;
+				return ret ? -errno : -ECONNRESET;
+			}
+			received += ret;
+			continue;
+		}
+
+		ret = sk_rx_fill(sock, flags);
+		if (ret == -EAGAIN && !(flags & MSG_DONTWAIT)) {
+			ret = sk_wait(sock, POLLIN);
+			if (ret)
+				return ret;
+			continue;
+		}
+		if (ret < 0)
+			return ret;
+
+		received += sk_rx_consume(sock, buf + received,
+					  len - received);
+	}
+
+	return 0;
+}
+
+/* Receive whatever is available, up to @len bytes, without blocking */
+int sk_recv_nowait(struct sk *sock, void *buf, size_t len, size_t *received)
+{
+	ssize_t ret;
+
+	*received = 0;
+
+	if (!sk_pending(sock)) {
+		if (len >= SK_STREAM_BUFSIZ) {
+			ret = recv(sock->fd, buf, len, MSG_DONTWAIT);
+			if (ret == 0) {
+				sock->closed = true;
+				return -ECONNRESET;
+			}
+			if (ret < 0)
+				ret = -errno;
+		} else {
+			ret = sk_rx_fill(sock, MSG_DONTWAIT);
+		}
+
+		if (ret == -EAGAIN || ret == -EWOULDBLOCK || ret == -EINTR)
+			return 0;
+		if (ret < 0)
+			return ret;
+
+		if (len >= SK_STREAM_BUFSIZ) {
+			*received = ret;
+			return 0;
+		}
+	}
+
+	*received = sk_rx_consume(sock, buf, len);
+
+	return 0;
+}
+
+/* Number of bytes already read from the kernel but not yet consumed. Poll
+ * and epoll cannot see these, so event loops must drain them first.
+ */
+size_t sk_pending(const struct sk *sock)
+{
+	return sock->rx.len - sock->rx.head;
+}
+
+/* Queue the output of a non-blocking socket which the kernel cannot take
+ * right away, behind what is already queued.
+ */
+static int sk_txq_append(struct sk *sock, const struct iovec *iov,
+			 int iovcnt)
+{
+	struct sk_buf *txq = &sock->txq;
+
+	if (txq->len - txq->head > sock->txq_limit) {
+		fprintf(stderr,
+			"Peer is not reading its %zu bytes of pending output, giving up on it\n",
+			txq->len - txq->head);
+		sock->closed = true;
+		return -ENOBUFS;
+	}
+
+	/* Reclaim the space of what was already written out */
+	if (txq->head) {
+		memmove(txq->data, txq->data + txq->head,
+			txq->len - txq->head);
+		txq->len -= txq->head;
+		txq->head = 0;
+	}
+
+	return sk_buf_append(txq, iov, iovcnt);
+}
+
+/* Number of bytes queued on a non-blocking socket. Event loops should wait
+ * for the socket to become writable while this is non-zero.
+ */
+size_t sk_tx_queued(const struct sk *sock)
+{
+	return sock->txq.len - sock->txq.head;
+}
+
+/* Write out as much of the queued output as the kernel takes */
+int sk_tx_drain(struct sk *sock)
+{
+	struct sk_buf *txq = &sock->txq;
 	ssize_t ret;
 
-	do {
-		ret = recv(sock->fd, buf + received, len - received, flags);
+	while (txq->head != txq->len) {
+		ret = send(sock->fd, txq->data + txq->head,
+			   txq->len - txq->head, 0);
+		if (ret < 0 && errno == EAGAIN)
+			return 0;
 		if (ret <= 0) {
 			sock->closed = ret == 0;
 			return ret ? -errno : -ECONNRESET;
 		}
-		received += ret;
-	} while (received != len);
+
+		txq->head += ret;
+	}
+
+	txq->head = txq->len = 0;
 
 	return 0;
 }
 
-int sk_send(struct sk *sock, const void *buf, size_t count)
+/* Write all of @iov with as few system calls as the kernel allows. On
+ * non-blocking sockets, what cannot be written right away is queued.
+ */
+static int sk_sendv_all(struct sk *sock, struct iovec *iov, int iovcnt,
+			int flags)
 {
-	size_t sent = 0;
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt,
+	};
 	ssize_t ret;
 
-	do {
-		ret = send(sock->fd, buf + sent, count - sent, 0);
+	/* Keep the order of the output */
+	if (sk_tx_queued(sock))
+		return sk_txq_append(sock, iov, iovcnt);
+
+	while (msg.msg_iovlen) {
+		ret = sendmsg(sock->fd, &msg, flags);
+		if (ret < 0 && errno == EAGAIN)
+			return sk_txq_append(sock, msg.msg_iov,
+					     msg.msg_iovlen);
 		if (ret <= 0) {
 			sock->closed = ret == 0;
 			return ret ? -errno : -ECONNRESET;
 		}
-		sent += ret;
-	} while (sent != count);
+
+		/* Skip over what was sent, on partial writes */
+		while (msg.msg_iovlen && (size_t)ret >= msg.msg_iov->iov_len) {
+			ret -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base += ret;
+			msg.msg_iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+static int sk_set_tcp_cork(struct sk *sock, bool on)
+{
+	int sockopt = on;
+
+	if (setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, &sockopt,
+		       sizeof(sockopt)) < 0)
+		return -errno;
+
+	sock->tcp_corked = on;
+
+	return 0;
+}
+
+/* Send the corked output followed by @iov in one go. With @more, the
+ * message is not complete yet, so TCP_CORK keeps the kernel from
+ * transmitting its partial tail segment. Otherwise the message is pushed
+ * out.
+ */
+static int sk_tx_flush(struct sk *sock, const struct iovec *iov, int iovcnt,
+		       bool more)
+{
+	struct iovec v[SK_IOV_MAX + 1];
+	int rc, n = 0, i;
+
+	if (sock->tx.len) {
+		v[n].iov_base = sock->tx.data;
+		v[n].iov_len = sock->tx.len;
+		n++;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		if (iov[i].iov_len)
+			v[n++] = iov[i];
+
+	if (more && !sock->tcp_corked) {
+		rc = sk_set_tcp_cork(sock, true);
+		if (rc)
+			return rc;
+	}
+
+	rc = n ? sk_sendv_all(sock, v, n, 0) : 0;
+	sock->tx.len = 0;
+	if (rc)
+		return rc;
+
+	if (!more && sock->tcp_corked)
+		return sk_set_tcp_cork(sock, false);
 
 	return 0;
 }
 
+/* Write @iovcnt buffers, at most SK_IOV_MAX, as one contiguous stream
+ * of data.
+ */
+int sk_sendv(struct sk *sock, const struct iovec *iov, int iovcnt)
+{
+	size_t count = 0;
+	int i;
+
+	if (iovcnt > SK_IOV_MAX)
+		return -EINVAL;
+
+	if (sock->capturing)
+		return sk_buf_append(&sock->capture, iov, iovcnt);
+
+	if (!sock->corked)
+		return sk_tx_flush(sock, iov, iovcnt, false);
+
+	for (i = 0; i < iovcnt; i++)
+		count += iov[i].iov_len;
+
+	/* Bulk data is not worth copying, hand it to the kernel together
+	 * with what was coalesced so far.
+	 */
+	if (sock->tx.len + count > SK_STREAM_BUFSIZ)
+		return sk_tx_flush(sock, iov, iovcnt, true);
+
+	return sk_buf_append(&sock->tx, iov, iovcnt);
+}
+
+int sk_send(struct sk *sock, const void *buf, size_t count)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = count,
+	};
+
+	return sk_sendv(sock, &iov, 1);
+}
+
+/* Until the matching sk_uncork(), coalesce the output of sk_send() and
+ * sk_sendv() so that a message built piecewise leaves in one system call.
+ * Calls may nest.
+ */
+void sk_cork(struct sk *sock)
+{
+	sock->corked++;
+}
+
+/* Returns the error of sending the coalesced output, if any */
+int sk_uncork(struct sk *sock)
+{
+	if (--sock->corked)
+		return 0;
+
+	if (!sock->tx.len && !sock->tcp_corked)
+		return 0;
+
+	return sk_tx_flush(sock, NULL, 0, false);
+}
+
+/* Until sk_capture_stop(), accumulate the data passed to sk_send() in a
+ * buffer instead of sending it, so that it can be post-processed.
+ */
+void sk_capture_start(struct sk *sock)
+{
+	sock->capturing = true;
+	sock->capture.len = 0;
+}
+
+/* Returns the data captured since sk_capture_start(). The buffer remains
+ * owned by the socket, and is valid until the next capture.
+ */
+void *sk_capture_stop(struct sk *sock, size_t *len)
+{
+	sock->capturing = false;
+	*len = sock->capture.len;
+
+	return sock->capture.data;
+}
+
 int sk_fd(const struct sk *sock)
 {
 	return sock->fd;
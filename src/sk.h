@@ -4,8 +4,12 @@
 #define _ISOCHRON_SK_H
 
 #include <stdbool.h>
+#include <sys/uio.h>
 #include "argparser.h"
 
+/* Maximum number of buffers passed to sk_sendv() */
+#define SK_IOV_MAX	8
+
 struct isochron_timestamp {
 	struct timespec hw;
 	struct timespec sw;
@@ -38,10 +42,20 @@ struct sk_msg;
 int sk_listen_tcp(const struct ip_address *ip, int port, int backlog,
 		  struct sk **listen_sock);
 int sk_accept(const struct sk *listen_sock, struct sk **sock);
+int sk_set_nonblock(struct sk *sock, size_t txq_limit);
 int sk_connect_tcp(const struct ip_address *ip, int port, struct sk **sock);
 int sk_recv(struct sk *sock, void *buf, size_t len, int flags);
+int sk_recv_nowait(struct sk *sock, void *buf, size_t len, size_t *received);
 int sk_send(struct sk *sock, const void *buf, size_t count);
+int sk_sendv(struct sk *sock, const struct iovec *iov, int iovcnt);
+void sk_cork(struct sk *sock);
+int sk_uncork(struct sk *sock);
+size_t sk_pending(const struct sk *sock);
+size_t sk_tx_queued(const struct sk *sock);
+int sk_tx_drain(struct sk *sock);
 bool sk_closed(const struct sk *sock);
+void sk_capture_start(struct sk *sock);
+void *sk_capture_stop(struct sk *sock, size_t *len);
 
 /* Connection-less */
 int sk_udp(const struct ip_address *dest, int port, struct sk **sock);
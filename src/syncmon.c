@@ -19,6 +19,7 @@
 #define NUM_SYNC_CHECKS	 3
 
 struct syncmon_node {
+	struct syncmon *syncmon;
 	bool remote;
 	union {
 		/* remote */
@@ -44,6 +45,8 @@ struct syncmon_node {
 	bool ptpmon_sync_done;
 	bool sysmon_sync_done;
 	bool transient_port_state;
+	/* Pushed nodes have no offsets until their first sample */
+	bool sync_valid;
 	struct clock_identity gm_clkid;
 	enum port_link_state link_state;
 	enum port_state port_state;
@@ -58,6 +61,12 @@ struct syncmon {
 	__s64 monitor_interval;
 	__s64 initial_interval;
 	bool same_gm;
+	bool last_check_ok;
+	/* Remote node state is pushed rather than queried */
+	syncmon_wait_fn_t *wait;
+	void *wait_priv;
+	syncmon_sync_loss_fn_t *sync_loss_cb;
+	void *sync_loss_priv;
 	LIST_HEAD(nodes_head, syncmon_node) nodes;
 };
 
@@ -101,11 +110,27 @@ static int syncmon_node_query_link_state_local(struct syncmon_node *node,
 	return 0;
 }
 
+void syncmon_push_link_state(struct syncmon_node *node,
+			     enum port_link_state link_state)
+{
+	if (node->link_state == link_state)
+		return;
+
+	node->link_state = link_state;
+	if (node->link_state == PORT_LINK_STATE_RUNNING)
+		printf("Link state of node %s is running\n", node->name);
+	if (node->link_state == PORT_LINK_STATE_DOWN)
+		printf("Link state of node %s is down\n", node->name);
+}
+
 static int syncmon_node_update_link_state(struct syncmon_node *node)
 {
 	enum port_link_state link_state;
 	int rc;
 
+	if (node->remote && node->syncmon->wait)
+		return 0;
+
 	if (node->remote)
 		rc = syncmon_node_query_link_state_remote(node, &link_state);
 	else
@@ -113,14 +138,7 @@ static int syncmon_node_update_link_state(struct syncmon_node *node)
 	if (rc)
 		return rc;
 
-	if (node->link_state == link_state)
-		return 0;
-
-	node->link_state = link_state;
-	if (node->link_state == PORT_LINK_STATE_RUNNING)
-		printf("Link state of node %s is running\n", node->name);
-	if (node->link_state == PORT_LINK_STATE_DOWN)
-		printf("Link state of node %s is down\n", node->name);
+	syncmon_push_link_state(node, link_state);
 
 	return 0;
 }
@@ -132,8 +150,6 @@ static int syncmon_node_query_sync_local(struct syncmon_node *node,
 					 struct clock_identity *gm_clkid)
 {
 	struct time_properties_ds time_properties_ds;
-	struct parent_data_set parent_ds;
-	struct current_ds current_ds;
 	__s64 sysmon_delay;
 	__u64 sysmon_ts;
 	int rc;
@@ -145,17 +161,15 @@ static int syncmon_node_query_sync_local(struct syncmon_node *node,
 		return rc;
 	}
 
-	rc = ptpmon_query_clock_mid(node->ptpmon, MID_PARENT_DATA_SET,
-				    &parent_ds, sizeof(parent_ds));
+	rc = ptpmon_get_gm_identity(node->ptpmon, gm_clkid);
 	if (rc) {
 		pr_err(rc, "ptpmon failed to query grandmaster clock id: %m\n");
 		return rc;
 	}
 
-	rc = ptpmon_query_clock_mid(node->ptpmon, MID_CURRENT_DATA_SET,
-				    &current_ds, sizeof(current_ds));
+	rc = ptpmon_get_master_offset(node->ptpmon, ptpmon_offset);
 	if (rc) {
-		pr_err(rc, "ptpmon failed to query CURRENT_DATA_SET: %m\n");
+		pr_err(rc, "ptpmon failed to query master offset: %m\n");
 		return rc;
 	}
 
@@ -174,9 +188,7 @@ static int syncmon_node_query_sync_local(struct syncmon_node *node,
 		return rc;
 	}
 
-	*ptpmon_offset = master_offset_from_current_ds(&current_ds);
 	*utc_offset = __be16_to_cpu(time_properties_ds.current_utc_offset);
-	*gm_clkid = parent_ds.grandmaster_identity;
 
 	return 0;
 }
@@ -241,51 +253,81 @@ static void syncmon_compare_node_grandmasters(struct syncmon *syncmon)
 	}
 }
 
-static int syncmon_node_update_sync(struct syncmon *syncmon,
-				    struct syncmon_node *node)
+/* A failed sample counts as out of sync */
+void syncmon_push_sync(struct syncmon_node *node, int rc,
+		       __s64 sysmon_offset, __s64 ptpmon_offset,
+		       int utc_offset)
 {
-	struct clock_identity gm_clkid;
-	enum port_state port_state;
-	int utc_offset;
-	int rc;
+	node->sync_valid = !rc;
+	if (rc) {
+		node->ptpmon_sync_done = false;
+		node->sysmon_sync_done = false;
+		return;
+	}
 
-	if (node->remote)
-		rc = syncmon_node_query_sync_remote(node, &node->sysmon_offset,
-						    &node->ptpmon_offset,
-						    &utc_offset, &port_state,
-						    &gm_clkid);
-	else
-		rc = syncmon_node_query_sync_local(node, &node->sysmon_offset,
-						   &node->ptpmon_offset,
-						   &utc_offset, &port_state,
-						   &gm_clkid);
-	if (rc)
-		return rc;
+	node->ptpmon_offset = ptpmon_offset;
+	node->sysmon_offset = sysmon_offset + NSEC_PER_SEC * utc_offset;
 
-	node->sysmon_offset += NSEC_PER_SEC * utc_offset;
+	node->ptpmon_sync_done = !!(llabs(node->ptpmon_offset) <= node->sync_threshold);
+	node->sysmon_sync_done = !!(llabs(node->sysmon_offset) <= node->sync_threshold);
+}
 
+void syncmon_push_port_state(struct syncmon_node *node,
+			     enum port_state port_state)
+{
 	node->transient_port_state = port_state != PS_MASTER &&
 				     port_state != PS_SLAVE;
 
-	node->ptpmon_sync_done = !!(llabs(node->ptpmon_offset) <= node->sync_threshold);
-	node->sysmon_sync_done = !!(llabs(node->sysmon_offset) <= node->sync_threshold);
-
 	if (port_state != node->port_state) {
 		printf("Node %s port changed state to %s\n",
 		       node->name, port_state_to_string(port_state));
 		node->port_state = port_state;
 	}
+}
 
-	if (!clockid_eq(&gm_clkid, &node->gm_clkid)) {
-		char gm[CLOCKID_BUFSIZE];
+void syncmon_push_gm(struct syncmon_node *node,
+		     const struct clock_identity *gm_clkid)
+{
+	char gm[CLOCKID_BUFSIZE];
 
-		clockid_to_string(&gm_clkid, gm);
+	if (clockid_eq(gm_clkid, &node->gm_clkid))
+		return;
 
-		printf("Node %s changed GM to %s\n", node->name, gm);
-		node->gm_clkid = gm_clkid;
-		node->gm_warned = false;
-		syncmon_compare_node_grandmasters(syncmon);
-	}
+	clockid_to_string(gm_clkid, gm);
+
+	printf("Node %s changed GM to %s\n", node->name, gm);
+	node->gm_clkid = *gm_clkid;
+	node->gm_warned = false;
+	syncmon_compare_node_grandmasters(node->syncmon);
+}
+
+static int syncmon_node_update_sync(struct syncmon_node *node)
+{
+	__s64 sysmon_offset, ptpmon_offset;
+	struct clock_identity gm_clkid;
+	enum port_state port_state;
+	int utc_offset;
+	int rc;
+
+	if (node->remote && node->syncmon->wait)
+		return node->sync_valid ? 0 : -EAGAIN;
+
+	if (node->remote)
+		rc = syncmon_node_query_sync_remote(node, &sysmon_offset,
+						    &ptpmon_offset,
+						    &utc_offset, &port_state,
+						    &gm_clkid);
+	else
+		rc = syncmon_node_query_sync_local(node, &sysmon_offset,
+						   &ptpmon_offset,
+						   &utc_offset, &port_state,
+						   &gm_clkid);
+	if (rc)
+		return rc;
+
+	syncmon_push_sync(node, 0, sysmon_offset, ptpmon_offset, utc_offset);
+	syncmon_push_port_state(node, port_state);
+	syncmon_push_gm(node, &gm_clkid);
 
 	return 0;
 }
@@ -295,7 +337,18 @@ static void syncmon_next(struct syncmon *syncmon, __s64 interval)
 	__s64 next = timespec_to_ns(&syncmon->ts) + interval;
 
 	syncmon->ts = ns_to_timespec(next);
-	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &syncmon->ts, NULL);
+
+	if (!syncmon->wait) {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &syncmon->ts,
+				NULL);
+		return;
+	}
+
+	/* Pushed state changes are acted upon right away, so the next
+	 * interval starts from when the wait ended
+	 */
+	syncmon->wait(syncmon->wait_priv, &syncmon->ts);
+	clock_gettime(CLOCK_MONOTONIC, &syncmon->ts);
 }
 
 static bool syncmon_all_nodes_within_3x_threshold(struct syncmon *syncmon)
@@ -359,6 +412,8 @@ static bool syncmon_sync_ok(struct syncmon *syncmon)
 	struct syncmon_node *node;
 	int rc;
 
+	syncmon->last_check_ok = false;
+
 	LIST_FOREACH(node, &syncmon->nodes, list) {
 		rc = syncmon_node_update_link_state(node);
 		if (rc)
@@ -370,7 +425,7 @@ static bool syncmon_sync_ok(struct syncmon *syncmon)
 		if (!node->collect_sync_stats)
 			continue;
 
-		rc = syncmon_node_update_sync(syncmon, node);
+		rc = syncmon_node_update_sync(node);
 		if (rc)
 			return false;
 
@@ -395,8 +450,11 @@ static bool syncmon_sync_ok(struct syncmon *syncmon)
 			syncmon_print_sync_stats_single(node);
 	}
 
-	return !any_link_down && !any_port_transient_state &&
-	       syncmon->same_gm && all_ptpmon_sync_done && all_sysmon_sync_done;
+	syncmon->last_check_ok = !any_link_down && !any_port_transient_state &&
+				 syncmon->same_gm && all_ptpmon_sync_done &&
+				 all_sysmon_sync_done;
+
+	return syncmon->last_check_ok;
 }
 
 static void syncmon_init_num_checks(struct syncmon *syncmon)
@@ -453,6 +511,37 @@ static void syncmon_init_monitor_interval(struct syncmon *syncmon)
 		syncmon->monitor_interval = NSEC_PER_SEC;
 }
 
+__s64 syncmon_get_monitor_interval(const struct syncmon *syncmon)
+{
+	return syncmon->monitor_interval;
+}
+
+void syncmon_set_push(struct syncmon *syncmon, syncmon_wait_fn_t *wait,
+		      void *priv)
+{
+	syncmon->wait = wait;
+	syncmon->wait_priv = priv;
+}
+
+/* Single sync check, for when the nodes are expected to still be in sync */
+bool syncmon_check(struct syncmon *syncmon)
+{
+	return syncmon_sync_ok(syncmon);
+}
+
+/* Whether the nodes were in sync as of the last check */
+bool syncmon_last_check_ok(const struct syncmon *syncmon)
+{
+	return syncmon->last_check_ok;
+}
+
+void syncmon_set_sync_loss_cb(struct syncmon *syncmon,
+			      syncmon_sync_loss_fn_t *cb, void *priv)
+{
+	syncmon->sync_loss_cb = cb;
+	syncmon->sync_loss_priv = priv;
+}
+
 void syncmon_init(struct syncmon *syncmon)
 {
 	syncmon_init_num_checks(syncmon);
@@ -487,11 +576,64 @@ int syncmon_wait_until_ok(struct syncmon *syncmon)
 	return 0;
 }
 
+static __s64 syncmon_tai_now(void)
+{
+	struct timespec now_ts;
+
+	clock_gettime(CLOCK_TAI, &now_ts);
+
+	return timespec_to_ns(&now_ts);
+}
+
+/* Sync may have been lost at any time after the last good check, and is
+ * considered regained at the first good check afterwards.
+ */
+static bool syncmon_monitor_sync_loss(struct syncmon *syncmon,
+				      syncmon_stop_fn_t stop, void *priv)
+{
+	__s64 last_ok, now;
+	bool lost = false;
+
+	syncmon_init_ts(syncmon);
+	last_ok = syncmon_tai_now();
+
+	while (!stop(priv)) {
+		if (signal_received)
+			return false;
+
+		if (syncmon_sync_ok(syncmon)) {
+			now = syncmon_tai_now();
+			if (lost) {
+				fprintf(stderr,
+					"Sync regained, annotating the log\n");
+				syncmon->sync_loss_cb(syncmon->sync_loss_priv,
+						      last_ok, now);
+				lost = false;
+			}
+			last_ok = now;
+		} else if (!lost) {
+			fprintf(stderr, "Sync lost during the test\n");
+			lost = true;
+		}
+
+		syncmon_next(syncmon, syncmon->monitor_interval);
+	}
+
+	if (lost)
+		syncmon->sync_loss_cb(syncmon->sync_loss_priv, last_ok,
+				      syncmon_tai_now());
+
+	return true;
+}
+
 bool syncmon_monitor(struct syncmon *syncmon, syncmon_stop_fn_t stop,
 		     void *priv)
 {
 	int sync_checks_to_go = syncmon->num_checks;
 
+	if (syncmon->sync_loss_cb)
+		return syncmon_monitor_sync_loss(syncmon, stop, priv);
+
 	syncmon_init_ts(syncmon);
 
 	while (!stop(priv)) {
@@ -524,6 +666,7 @@ syncmon_add_local_sender_no_sync(struct syncmon *syncmon, const char *name,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->role = ISOCHRON_ROLE_SEND;
 	node->name = name;
 	node->rtnl = rtnl;
@@ -550,6 +693,7 @@ struct syncmon_node *syncmon_add_local_sender(struct syncmon *syncmon,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->role = ISOCHRON_ROLE_SEND;
 	node->name = name;
 	node->rtnl = rtnl;
@@ -576,6 +720,7 @@ syncmon_add_remote_sender_no_sync(struct syncmon *syncmon, const char *name,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->remote = true;
 	node->role = ISOCHRON_ROLE_SEND;
 	node->name = name;
@@ -600,6 +745,7 @@ struct syncmon_node *syncmon_add_remote_sender(struct syncmon *syncmon,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->remote = true;
 	node->role = ISOCHRON_ROLE_SEND;
 	node->name = name;
@@ -624,6 +770,7 @@ syncmon_add_remote_receiver_no_sync(struct syncmon *syncmon, const char *name,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->remote = true;
 	node->role = ISOCHRON_ROLE_RCV;
 	node->name = name;
@@ -647,6 +794,7 @@ struct syncmon_node *syncmon_add_remote_receiver(struct syncmon *syncmon,
 	if (!node)
 		return NULL;
 
+	node->syncmon = syncmon;
 	node->remote = true;
 	node->role = ISOCHRON_ROLE_RCV;
 	node->name = name;
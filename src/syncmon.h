@@ -7,7 +7,9 @@
 #include <linux/types.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <time.h>
 
+#include "management.h"
 #include "ptpmon.h"
 #include "sk.h"
 #include "sysmon.h"
@@ -16,12 +18,41 @@ struct syncmon;
 struct syncmon_node;
 
 typedef bool syncmon_stop_fn_t(void *priv);
+/* Wait until the absolute CLOCK_MONOTONIC @deadline, or less if a pushed
+ * state change needs attention
+ */
+typedef void syncmon_wait_fn_t(void *priv, const struct timespec *deadline);
+/* Sync was not OK between the CLOCK_TAI times @start and @stop */
+typedef void syncmon_sync_loss_fn_t(void *priv, __s64 start, __s64 stop);
 
 struct syncmon *syncmon_create(void);
 void syncmon_destroy(struct syncmon *syncmon);
 void syncmon_init(struct syncmon *syncmon);
 int syncmon_wait_until_ok(struct syncmon *syncmon);
 bool syncmon_monitor(struct syncmon *syncmon, syncmon_stop_fn_t stop, void *priv);
+bool syncmon_check(struct syncmon *syncmon);
+bool syncmon_last_check_ok(const struct syncmon *syncmon);
+__s64 syncmon_get_monitor_interval(const struct syncmon *syncmon);
+
+/* Instead of being queried, remote nodes have their state pushed through
+ * the syncmon_push_*() functions while @wait runs.
+ */
+void syncmon_set_push(struct syncmon *syncmon, syncmon_wait_fn_t *wait,
+		      void *priv);
+/* Instead of stopping the test, sync loss is reported through @cb and the
+ * monitoring continues.
+ */
+void syncmon_set_sync_loss_cb(struct syncmon *syncmon,
+			      syncmon_sync_loss_fn_t *cb, void *priv);
+void syncmon_push_sync(struct syncmon_node *node, int rc,
+		       __s64 sysmon_offset, __s64 ptpmon_offset,
+		       int utc_offset);
+void syncmon_push_port_state(struct syncmon_node *node,
+			     enum port_state port_state);
+void syncmon_push_gm(struct syncmon_node *node,
+		     const struct clock_identity *gm_clkid);
+void syncmon_push_link_state(struct syncmon_node *node,
+			     enum port_link_state link_state);
 
 struct syncmon_node *
 syncmon_add_local_sender_no_sync(struct syncmon *syncmon, const char *name,